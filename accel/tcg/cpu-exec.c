@@ -687,6 +687,10 @@ int cpu_exec(CPUState *cpu)
     /* replay_interrupt may need current_cpu */
     current_cpu = cpu;
 
+    if (qemu_etrace_mask(ETRACE_F_MEM_INLINE)) {
+        etrace_mem_cpu_init(&qemu_etracer, cpu);
+    }
+
     if (cpu_handle_halt(cpu)) {
         return EXCP_HALTED;
     }
@@ -724,7 +728,7 @@ int cpu_exec(CPUState *cpu)
         }
 
         if (qemu_etrace_mask(ETRACE_F_EXEC)
-            && qemu_etracer.exec_start_valid) {
+            && etrace_exec_start_valid(&qemu_etracer, cpu->cpu_index)) {
             target_ulong cs_base, pc;
             uint32_t flags;
 
@@ -771,8 +775,6 @@ int cpu_exec(CPUState *cpu)
                                      cpu->cpu_index, pc);
             }
 
-            qemu_etracer.exec_start_valid = false;
-
             /* Try to align the host and virtual clocks
                if the guest is in advance */
             align_clocks(&sc, cpu);
@@ -706,6 +706,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
      * vaddr we add back in io_readx()/io_writex()/get_page_addr_code().
      */
     env->iotlb[mmu_idx][index].addr = iotlb - vaddr_page;
+    env->iotlb[mmu_idx][index].paddr = paddr_page;
     env->iotlb[mmu_idx][index].attrs = attrs;
 
     /* Now calculate the new entry */
@@ -755,6 +756,26 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
                             prot, mmu_idx, size);
 }
 
+hwaddr tlb_vaddr_to_paddr(CPUArchState *env, target_ulong addr, int mmu_idx)
+{
+    target_ulong page = addr & TARGET_PAGE_MASK;
+    CPUIOTLBEntry *io = NULL;
+    size_t vidx;
+
+    if (tlb_hit_page_anyprot(tlb_entry(env, mmu_idx, addr), page)) {
+        io = &env->iotlb[mmu_idx][tlb_index(env, mmu_idx, addr)];
+    } else {
+        for (vidx = 0; vidx < CPU_VTLB_SIZE; vidx++) {
+            if (tlb_hit_page_anyprot(&env->tlb_v_table[mmu_idx][vidx], page)) {
+                io = &env->iotlb_v[mmu_idx][vidx];
+                break;
+            }
+        }
+    }
+
+    return io ? io->paddr | (addr & ~TARGET_PAGE_MASK) : -1;
+}
+
 static inline ram_addr_t qemu_ram_addr_from_host_nofail(void *ptr)
 {
     ram_addr_t ram_addr;
@@ -767,13 +788,29 @@ static inline ram_addr_t qemu_ram_addr_from_host_nofail(void *ptr)
     return ram_addr;
 }
 
+/*
+ * True if the access to @addr in progress is also being logged inline,
+ * in which case TCG has started its memlog entry. Accesses from helpers
+ * and from TBs without instrumentation have no such entry.
+ */
+static bool etrace_mem_logged_inline(CPUState *cpu, target_ulong addr)
+{
+    struct etrace_mem_log *log;
+
+    if (!cpu->etrace_mem) {
+        return false;
+    }
+    log = (struct etrace_mem_log *) cpu->etrace_mem_ptr;
+    return (log->info & ETRACE_MEMLOG_INFO_PENDING) && log->vaddr == addr;
+}
+
 static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
                          int mmu_idx,
                          target_ulong addr, uintptr_t retaddr,
                          bool recheck, MMUAccessType access_type, int size)
 {
     CPUState *cpu = ENV_GET_CPU(env);
-    hwaddr mr_offset;
+    hwaddr mr_offset, physaddr;
     MemoryRegionSection *section;
     MemoryRegion *mr;
     uint64_t val;
@@ -830,16 +867,16 @@ static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
                                         &val, size, iotlbentry->attrs);
     }
 
-    if (qemu_etrace_mask(ETRACE_F_MEM)) {
-        etrace_mem_access(&qemu_etracer, 0, 0,
-                          addr, size, MEM_READ, val);
+    physaddr = mr_offset + section->offset_within_address_space -
+               section->offset_within_region;
+
+    if (qemu_etrace_mask(ETRACE_F_MEM)
+        && !etrace_mem_logged_inline(cpu, addr)) {
+        etrace_mem_access(&qemu_etracer, cpu->cpu_index, addr,
+                          physaddr, size, MEM_READ, val);
     }
 
     if (r != MEMTX_OK) {
-        hwaddr physaddr = mr_offset +
-            section->offset_within_address_space -
-            section->offset_within_region;
-
         cpu_transaction_failed(cpu, physaddr, addr, size, access_type,
                                mmu_idx, iotlbentry->attrs, r, retaddr);
     }
@@ -857,7 +894,7 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
                       uintptr_t retaddr, bool recheck, int size)
 {
     CPUState *cpu = ENV_GET_CPU(env);
-    hwaddr mr_offset;
+    hwaddr mr_offset, physaddr;
     MemoryRegionSection *section;
     MemoryRegion *mr;
     bool locked = false;
@@ -912,16 +949,16 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
                                          val, size, iotlbentry->attrs);
     }
 
-    if (qemu_etrace_mask(ETRACE_F_MEM)) {
-        etrace_mem_access(&qemu_etracer, 0, 0,
-                          addr, size, MEM_WRITE, val);
+    physaddr = mr_offset + section->offset_within_address_space -
+               section->offset_within_region;
+
+    if (qemu_etrace_mask(ETRACE_F_MEM)
+        && !etrace_mem_logged_inline(cpu, addr)) {
+        etrace_mem_access(&qemu_etracer, cpu->cpu_index, addr,
+                          physaddr, size, MEM_WRITE, val);
     }
 
     if (r != MEMTX_OK) {
-        hwaddr physaddr = mr_offset +
-            section->offset_within_address_space -
-            section->offset_within_region;
-
         cpu_transaction_failed(cpu, physaddr, addr, size, MMU_DATA_STORE,
                                mmu_idx, iotlbentry->attrs, r, retaddr);
     }
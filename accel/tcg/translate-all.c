@@ -1712,6 +1712,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
     tcg_ctx->tb_cflags = cflags;
+    tcg_ctx->etrace_mem = (cflags & CF_ETRACE_MEM)
+                          && etrace_mem_in_range(&qemu_etracer, pc);
+    tcg_ctx->etrace_mem_nr = 0;
 
 #ifdef CONFIG_PROFILER
     /* includes aborted translations because of exceptions */
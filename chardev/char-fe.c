@@ -135,6 +135,18 @@ int qemu_chr_fe_get_msgfds(CharBackend *be, int *fds, int len)
         CHARDEV_GET_CLASS(s)->get_msgfds(s, fds, len) : -1;
 }
 
+int qemu_chr_fe_get_fd(CharBackend *be)
+{
+    Chardev *s = be->chr;
+
+    if (!s) {
+        return -1;
+    }
+
+    return CHARDEV_GET_CLASS(s)->get_fd ?
+        CHARDEV_GET_CLASS(s)->get_fd(s) : -1;
+}
+
 int qemu_chr_fe_set_msgfds(CharBackend *be, int *fds, int num)
 {
     Chardev *s = be->chr;
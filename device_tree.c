@@ -21,6 +21,7 @@
 #include "qemu/error-report.h"
 #include "qemu/option.h"
 #include "qemu/bswap.h"
+#include "qemu/cutils.h"
 #include "sysemu/device_tree.h"
 #include "sysemu/sysemu.h"
 #include "hw/loader.h"
@@ -223,11 +224,238 @@ void *load_device_tree_from_sysfs(void)
 
 #endif /* CONFIG_LINUX */
 
+/*
+ * Node index.
+ *
+ * Machine construction looks nodes up by path and phandle many times per
+ * node, and fdt_path_offset() / fdt_get_path() / fdt_node_offset_by_phandle()
+ * all walk the blob from the start. Build an index of all nodes on first use
+ * and serve lookups from hash tables instead.
+ *
+ * Nodes are stored in blob order. Property writes through qemu_fdt_setprop*
+ * that resize the structure block shift the offsets of the following nodes,
+ * structural changes (new or nop'ed nodes) drop the index. Lookups revalidate
+ * against the blob so that changes made behind our back cause a rebuild.
+ */
+typedef struct FDTIndexNode {
+    int offset;
+    int parent;
+    int depth;
+    uint32_t phandle;
+    char *path;
+} FDTIndexNode;
+
+typedef struct FDTIndex {
+    void *fdt;
+    uint32_t off_dt_struct;
+    uint32_t size_dt_struct;
+    FDTIndexNode *nodes;
+    int num_nodes;
+    GHashTable *by_path;
+    GHashTable *by_phandle;
+} FDTIndex;
+
+static FDTIndex fdt_index;
+
+static void fdt_index_drop(void)
+{
+    int i;
+
+    if (!fdt_index.fdt) {
+        return;
+    }
+    g_hash_table_destroy(fdt_index.by_path);
+    g_hash_table_destroy(fdt_index.by_phandle);
+    for (i = 0; i < fdt_index.num_nodes; i++) {
+        g_free(fdt_index.nodes[i].path);
+    }
+    g_free(fdt_index.nodes);
+    memset(&fdt_index, 0, sizeof(fdt_index));
+}
+
+static void fdt_index_build(void *fdt)
+{
+    FDTIndex *idx = &fdt_index;
+    int *stack = NULL;
+    int alloc = 0, stack_size = 0;
+    int offset = 0, depth = 0;
+    int i;
+
+    fdt_index_drop();
+    if (fdt_check_header(fdt)) {
+        return;
+    }
+
+    idx->fdt = fdt;
+    idx->off_dt_struct = fdt_off_dt_struct(fdt);
+    idx->size_dt_struct = fdt_size_dt_struct(fdt);
+    idx->by_path = g_hash_table_new(g_str_hash, g_str_equal);
+    idx->by_phandle = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    while (offset >= 0 && (depth > 0 || !idx->num_nodes)) {
+        FDTIndexNode *node;
+        const char *name;
+        int parent;
+
+        if (idx->num_nodes == alloc) {
+            alloc = alloc ? alloc * 2 : 64;
+            idx->nodes = g_renew(FDTIndexNode, idx->nodes, alloc);
+        }
+        if (depth >= stack_size) {
+            stack_size = depth + 16;
+            stack = g_renew(int, stack, stack_size);
+        }
+        name = fdt_get_name(fdt, offset, NULL);
+        if (!name) {
+            break;
+        }
+        parent = depth ? stack[depth - 1] : -1;
+        stack[depth] = idx->num_nodes;
+
+        node = &idx->nodes[idx->num_nodes];
+        node->offset = offset;
+        node->parent = parent;
+        node->depth = depth;
+        node->phandle = fdt_get_phandle(fdt, offset);
+        if (parent < 0) {
+            node->path = g_strdup("/");
+        } else if (parent == 0) {
+            node->path = g_strconcat("/", name, NULL);
+        } else {
+            node->path = g_strconcat(idx->nodes[parent].path, "/", name, NULL);
+        }
+        idx->num_nodes++;
+
+        offset = fdt_next_node(fdt, offset, &depth);
+    }
+    g_free(stack);
+
+    /* The array is final, hash the nodes.  */
+    for (i = 0; i < idx->num_nodes; i++) {
+        FDTIndexNode *node = &idx->nodes[i];
+
+        g_hash_table_insert(idx->by_path, node->path, GINT_TO_POINTER(i + 1));
+        if (node->phandle) {
+            g_hash_table_insert(idx->by_phandle,
+                                GUINT_TO_POINTER(node->phandle),
+                                GINT_TO_POINTER(i + 1));
+        }
+    }
+}
+
+static FDTIndex *fdt_index_get(void *fdt)
+{
+    if (fdt_index.fdt != fdt
+        || fdt_index.off_dt_struct != fdt_off_dt_struct(fdt)
+        || fdt_index.size_dt_struct != fdt_size_dt_struct(fdt)) {
+        fdt_index_build(fdt);
+    }
+    return fdt_index.fdt ? &fdt_index : NULL;
+}
+
+/* Check that an indexed node still is what the blob has at its offset.  */
+static bool fdt_index_node_valid(void *fdt, FDTIndexNode *node)
+{
+    const char *name = fdt_get_name(fdt, node->offset, NULL);
+    const char *base = strrchr(node->path, '/') + 1;
+
+    return name && !strcmp(name, base);
+}
+
+/* Returns the index of the node at node_path or -1.  */
+static int fdt_index_find(void *fdt, const char *node_path)
+{
+    int retry;
+
+    for (retry = 0; retry < 2; retry++) {
+        FDTIndex *idx = fdt_index_get(fdt);
+        int i;
+
+        if (!idx) {
+            return -1;
+        }
+        i = GPOINTER_TO_INT(g_hash_table_lookup(idx->by_path, node_path)) - 1;
+        if (i < 0 || fdt_index_node_valid(fdt, &idx->nodes[i])) {
+            return i;
+        }
+        fdt_index_drop();
+    }
+    return -1;
+}
+
+static int fdt_index_find_offset(void *fdt, int offset)
+{
+    FDTIndex *idx = fdt_index_get(fdt);
+    int lo = 0, hi;
+
+    if (!idx) {
+        return -1;
+    }
+    hi = idx->num_nodes;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (idx->nodes[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < idx->num_nodes && idx->nodes[lo].offset == offset ? lo : -1;
+}
+
+/* Account for a property write to the node at offset.  */
+static void fdt_index_note_setprop(void *fdt, int offset, const char *property)
+{
+    FDTIndex *idx = &fdt_index;
+    int delta, i;
+
+    if (idx->fdt != fdt) {
+        return;
+    }
+    if (!strcmp(property, "phandle") || !strcmp(property, "linux,phandle")) {
+        fdt_index_drop();
+        return;
+    }
+
+    delta = fdt_size_dt_struct(fdt) - idx->size_dt_struct;
+    if (delta) {
+        for (i = 0; i < idx->num_nodes; i++) {
+            if (idx->nodes[i].offset > offset) {
+                idx->nodes[i].offset += delta;
+            }
+        }
+        idx->size_dt_struct = fdt_size_dt_struct(fdt);
+    }
+}
+
+static int fdt_index_get_path(void *fdt, int offset, char *buf, int buflen)
+{
+    int i = fdt_index_find_offset(fdt, offset);
+
+    if (i >= 0 && fdt_index_node_valid(fdt, &fdt_index.nodes[i])) {
+        if (strlen(fdt_index.nodes[i].path) >= buflen) {
+            return -FDT_ERR_NOSPACE;
+        }
+        strcpy(buf, fdt_index.nodes[i].path);
+        return 0;
+    }
+    return fdt_get_path(fdt, offset, buf, buflen);
+}
+
+int qemu_fdt_node_offset(void *fdt, const char *node_path)
+{
+    int i = fdt_index_find(fdt, node_path);
+
+    /* Not a canonical path (e.g an alias), let libfdt resolve it.  */
+    return i >= 0 ? fdt_index.nodes[i].offset : fdt_path_offset(fdt, node_path);
+}
+
 static int findnode_nofail(void *fdt, const char *node_path)
 {
     int offset;
 
-    offset = fdt_path_offset(fdt, node_path);
+    offset = qemu_fdt_node_offset(fdt, node_path);
     if (offset < 0) {
         error_report("%s Couldn't find node %s: %s", __func__, node_path,
                      fdt_strerror(offset));
@@ -349,14 +577,16 @@ char **qemu_fdt_node_path(void *fdt, const char *name, char *compat,
 int qemu_fdt_setprop(void *fdt, const char *node_path,
                      const char *property, const void *val, int size)
 {
+    int offset = findnode_nofail(fdt, node_path);
     int r;
 
-    r = fdt_setprop(fdt, findnode_nofail(fdt, node_path), property, val, size);
+    r = fdt_setprop(fdt, offset, property, val, size);
     if (r < 0) {
         error_report("%s: Couldn't set %s/%s: %s", __func__, node_path,
                      property, fdt_strerror(r));
         exit(1);
     }
+    fdt_index_note_setprop(fdt, offset, property);
 
     return r;
 }
@@ -364,14 +594,16 @@ int qemu_fdt_setprop(void *fdt, const char *node_path,
 int qemu_fdt_setprop_cell(void *fdt, const char *node_path,
                           const char *property, uint32_t val)
 {
+    int offset = findnode_nofail(fdt, node_path);
     int r;
 
-    r = fdt_setprop_cell(fdt, findnode_nofail(fdt, node_path), property, val);
+    r = fdt_setprop_cell(fdt, offset, property, val);
     if (r < 0) {
         error_report("%s: Couldn't set %s/%s = %#08x: %s", __func__,
                      node_path, property, val, fdt_strerror(r));
         exit(1);
     }
+    fdt_index_note_setprop(fdt, offset, property);
 
     return r;
 }
@@ -386,14 +618,16 @@ int qemu_fdt_setprop_u64(void *fdt, const char *node_path,
 int qemu_fdt_setprop_string(void *fdt, const char *node_path,
                             const char *property, const char *string)
 {
+    int offset = findnode_nofail(fdt, node_path);
     int r;
 
-    r = fdt_setprop_string(fdt, findnode_nofail(fdt, node_path), property, string);
+    r = fdt_setprop_string(fdt, offset, property, string);
     if (r < 0) {
         error_report("%s: Couldn't set %s/%s = %s: %s", __func__,
                      node_path, property, string, fdt_strerror(r));
         exit(1);
     }
+    fdt_index_note_setprop(fdt, offset, property);
 
     return r;
 }
@@ -567,6 +801,7 @@ int qemu_fdt_nop_node(void *fdt, const char *node_path)
     int r;
 
     r = fdt_nop_node(fdt, findnode_nofail(fdt, node_path));
+    fdt_index_drop();
     if (r < 0) {
         error_report("%s: Couldn't nop node %s: %s", __func__, node_path,
                      fdt_strerror(r));
@@ -596,6 +831,7 @@ int qemu_fdt_add_subnode(void *fdt, const char *name)
     }
 
     retval = fdt_add_subnode(fdt, parent, basename);
+    fdt_index_drop();
     if (retval < 0) {
         error_report("FDT: Failed to create subnode %s: %s", name,
                      fdt_strerror(retval));
@@ -608,18 +844,29 @@ int qemu_fdt_add_subnode(void *fdt, const char *name)
 
 char *qemu_fdt_get_node_name(void *fdt, const char *node_path)
 {
-    const char *ret = fdt_get_name(fdt, fdt_path_offset(fdt, node_path), NULL);
+    int i = fdt_index_find(fdt, node_path);
+    const char *ret;
+
+    if (i >= 0) {
+        return strdup(strrchr(fdt_index.nodes[i].path, '/') + 1);
+    }
+    ret = fdt_get_name(fdt, fdt_path_offset(fdt, node_path), NULL);
     return ret ? strdup(ret) : NULL;
 }
 
 int qemu_fdt_get_node_depth(void *fdt, const char *node_path)
 {
+    int i = fdt_index_find(fdt, node_path);
+
+    if (i >= 0) {
+        return fdt_index.nodes[i].depth;
+    }
     return fdt_node_depth(fdt, fdt_path_offset(fdt, node_path));
 }
 
 int qemu_fdt_num_props(void *fdt, const char *node_path)
 {
-    int offset = fdt_path_offset(fdt, node_path);
+    int offset = qemu_fdt_node_offset(fdt, node_path);
     int ret = 0;
 
     for (offset = fdt_first_property_offset(fdt, offset);
@@ -634,7 +881,7 @@ QEMUDevtreeProp *qemu_fdt_get_props(void *fdt, const char *node_path)
 {
     QEMUDevtreeProp *ret = g_new0(QEMUDevtreeProp,
                                   qemu_fdt_num_props(fdt, node_path) + 1);
-    int offset = fdt_path_offset(fdt, node_path);
+    int offset = qemu_fdt_node_offset(fdt, node_path);
     int i = 0;
 
     for (offset = fdt_first_property_offset(fdt, offset);
@@ -653,13 +900,36 @@ QEMUDevtreeProp *qemu_fdt_get_props(void *fdt, const char *node_path)
 
 static void qemu_fdt_children_info(void *fdt, const char *node_path,
         int depth, int *num, char **returned_paths) {
-    int offset = fdt_path_offset(fdt, node_path);
-    int root_depth = fdt_node_depth(fdt, offset);
-    int cur_depth = root_depth;
+    int i = fdt_index_find(fdt, node_path);
+    int offset, root_depth, cur_depth;
 
     if (num) {
         *num = 0;
     }
+    if (i >= 0) {
+        /* Descendants directly follow their ancestor in the index.  */
+        FDTIndexNode *nodes = fdt_index.nodes;
+
+        root_depth = nodes[i].depth;
+        for (i++; i < fdt_index.num_nodes && nodes[i].depth > root_depth;
+             i++) {
+            if (nodes[i].depth <= root_depth + depth || depth == 0) {
+                if (returned_paths) {
+                    returned_paths[*num] = g_malloc0(DT_PATH_LENGTH);
+                    pstrcpy(returned_paths[*num], DT_PATH_LENGTH,
+                            nodes[i].path);
+                }
+                if (num) {
+                    (*num)++;
+                }
+            }
+        }
+        return;
+    }
+
+    offset = fdt_path_offset(fdt, node_path);
+    root_depth = fdt_node_depth(fdt, offset);
+    cur_depth = root_depth;
     for (;;) {
         offset = fdt_next_node(fdt, offset, &cur_depth);
         if (cur_depth <= root_depth) {
@@ -699,7 +969,7 @@ int qemu_fdt_node_by_compatible(void *fdt, char *node_path,
 {
     int offset = fdt_node_offset_by_compatible(fdt, 0, compats);
     return offset > 0 ?
-        fdt_get_path(fdt, offset, node_path, DT_PATH_LENGTH) : 1;
+        fdt_index_get_path(fdt, offset, node_path, DT_PATH_LENGTH) : 1;
 }
 
 int qemu_fdt_get_node_by_name(void *fdt, char *node_path,
@@ -721,7 +991,7 @@ int qemu_fdt_get_node_by_name(void *fdt, char *node_path,
         }
     } while (offset > 0);
     return offset > 0 ?
-        fdt_get_path(fdt, offset, node_path, DT_PATH_LENGTH) : 1;
+        fdt_index_get_path(fdt, offset, node_path, DT_PATH_LENGTH) : 1;
 }
 
 int qemu_fdt_get_n_nodes_by_name(void *fdt, char ***array,
@@ -745,7 +1015,7 @@ int qemu_fdt_get_n_nodes_by_name(void *fdt, char ***array,
 
         at = memchr(name, '@', strlen(name));
         if (!strncmp(name, cmpname, at ? at - name : strlen(name))) {
-            if (fdt_get_path(fdt, offset, node_p, DT_PATH_LENGTH) >= 0) {
+            if (fdt_index_get_path(fdt, offset, node_p, DT_PATH_LENGTH) >= 0) {
                 if (node_path == NULL) {
                     node_path = (char **) g_new(char *, 1);
                 } else {
@@ -769,12 +1039,12 @@ char *qemu_fdt_get_child_by_name(void *fdt, char *parent_path,
     int namelen = strlen(cmpname);
     char child_path[DT_PATH_LENGTH];
 
-    parent_offset = fdt_path_offset(fdt, parent_path);
+    parent_offset = qemu_fdt_node_offset(fdt, parent_path);
 
     if (parent_offset > 0) {
         offset = fdt_subnode_offset_namelen(fdt, parent_offset,
                                             cmpname, namelen);
-        if (fdt_get_path(fdt, offset, child_path, DT_PATH_LENGTH) == 0) {
+        if (fdt_index_get_path(fdt, offset, child_path, DT_PATH_LENGTH) == 0) {
             return g_strdup(child_path);
         }
     }
@@ -784,14 +1054,38 @@ char *qemu_fdt_get_child_by_name(void *fdt, char *parent_path,
 
 int qemu_fdt_get_node_by_phandle(void *fdt, char *node_path, int phandle)
 {
-    return fdt_get_path(fdt, fdt_node_offset_by_phandle(fdt, phandle),
-                            node_path, DT_PATH_LENGTH);
+    FDTIndex *idx = fdt_index_get(fdt);
+
+    if (idx) {
+        int i = GPOINTER_TO_INT(g_hash_table_lookup(idx->by_phandle,
+                                                    GUINT_TO_POINTER(phandle)));
+
+        if (i && fdt_index_node_valid(fdt, &idx->nodes[i - 1])) {
+            pstrcpy(node_path, DT_PATH_LENGTH, idx->nodes[i - 1].path);
+            return 0;
+        }
+    }
+    return fdt_index_get_path(fdt, fdt_node_offset_by_phandle(fdt, phandle),
+                              node_path, DT_PATH_LENGTH);
 }
 
 int qemu_fdt_getparent(void *fdt, char *node_path, const char *current)
 {
-    int offset = fdt_path_offset(fdt, current);
-    int parent_offset = fdt_supernode_atdepth_offset(fdt, offset,
+    int i = fdt_index_find(fdt, current);
+    int offset, parent_offset;
+
+    if (i >= 0) {
+        int parent = fdt_index.nodes[i].parent;
+
+        if (parent < 0) {
+            return 1;
+        }
+        pstrcpy(node_path, DT_PATH_LENGTH, fdt_index.nodes[parent].path);
+        return 0;
+    }
+
+    offset = fdt_path_offset(fdt, current);
+    parent_offset = fdt_supernode_atdepth_offset(fdt, offset,
         fdt_node_depth(fdt, offset) - 1, NULL);
 
     return parent_offset >= 0 ?
@@ -20,6 +20,7 @@
 #include "qemu/osdep.h"
 
 #include <unistd.h>
+#include <zlib.h>
 #ifndef _WIN32
 #include <sys/socket.h>
 #include "qemu/sockets.h"
@@ -33,6 +34,10 @@
 #include "exec/address-spaces.h"
 #include "cpu.h"
 #include "exec/exec-all.h"
+#include "exec/helper-proto.h"
+#include "qemu/range.h"
+#include "qemu/cutils.h"
+#include "qapi/error.h"
 
 /* Still under development.  */
 #define ETRACE_VERSION_MAJOR 0
@@ -47,6 +52,8 @@ enum {
     TYPE_BARRIER = 6,
     TYPE_OLD_EVENT_U64 = 7,
     TYPE_EVENT_U64 = 8,
+    TYPE_CHUNK = 9,
+    TYPE_INDEX = 10,
     TYPE_INFO = 0x4554,
 };
 
@@ -58,6 +65,7 @@ struct etrace_hdr {
 
 enum etrace_info_flags {
     ETRACE_INFO_F_TB_CHAINING   = (1 << 0),
+    ETRACE_INFO_F_CHUNKED       = (1 << 1),
 };
 
 struct etrace_info_data {
@@ -102,6 +110,45 @@ struct etrace_tb {
     uint32_t host_code_len;
 } QEMU_PACKED;
 
+enum etrace_chunk_compression {
+    ETRACE_CHUNK_ZLIB = 1,
+};
+
+/*
+ * A chunk of records from a single unit, compressed as a whole.
+ * The compressed data follows and makes up the rest of the record.
+ */
+struct etrace_chunk {
+    uint64_t start_time;
+    uint64_t end_time;
+    uint32_t raw_len;
+    uint8_t compression;
+    uint8_t padd[3];
+} QEMU_PACKED;
+
+/*
+ * The index is the last record in a chunked trace. It is made of one
+ * entry per chunk followed by a trailer, so that readers can locate it
+ * from the end of the file.
+ */
+struct etrace_index_entry {
+    uint64_t start_time;
+    uint64_t end_time;
+    /* File offset of the chunk record header.  */
+    uint64_t offset;
+    uint16_t unit_id;
+    uint8_t padd[6];
+} QEMU_PACKED;
+
+#define ETRACE_INDEX_MAGIC 0x58495445 /* "ETIX" */
+
+struct etrace_index_trailer {
+    /* File offset of the index record header.  */
+    uint64_t offset;
+    uint32_t nr_entries;
+    uint32_t magic;
+} QEMU_PACKED;
+
 struct etrace_event_u64 {
     uint32_t flags;
     uint16_t unit_id;
@@ -115,6 +162,8 @@ struct etrace_event_u64 {
 
 const char *qemu_arg_etrace;
 const char *qemu_arg_etrace_flags;
+const char *qemu_arg_etrace_mem_pc;
+const char *qemu_arg_etrace_mem_masters;
 struct etracer qemu_etracer = {0};
 bool qemu_etrace_enabled;
 
@@ -133,7 +182,11 @@ struct {
     { "mem", ETRACE_F_MEM },
     { "cpu", ETRACE_F_CPU },
     { "gpio", ETRACE_F_GPIO },
-    { "all", ~0 },
+    { "mem-inline", ETRACE_F_MEM_INLINE },
+    { "all", ETRACE_F_ALL },
+    { "async", ETRACE_F_ASYNC },
+    { "drop", ETRACE_F_ASYNC | ETRACE_F_ASYNC_DROP },
+    { "chunked", ETRACE_F_CHUNKED },
     { NULL, 0 },
 };
 
@@ -179,7 +232,7 @@ static uint64_t qemu_etrace_opts2flags(const char *opts)
     return flags;
 }
 
-static void etrace_write(struct etracer *t, const void *buf, size_t len)
+static void etrace_fwrite(struct etracer *t, const void *buf, size_t len)
 {
     size_t r;
 
@@ -195,7 +248,180 @@ static void etrace_write(struct etracer *t, const void *buf, size_t len)
     assert(r == len);
 }
 
-static void etrace_write_header(struct etracer *t, uint16_t type,
+/* Returns the buffer currently owned by the producer, if any.  */
+static struct etrace_async_buf *etrace_async_cur(struct etracer *t)
+{
+    struct etrace_async *a = &t->async;
+
+    if (a->head - atomic_mb_read(&a->tail) == ETRACE_ASYNC_NR_BUFS) {
+        return NULL;
+    }
+    return &a->bufs[a->head % ETRACE_ASYNC_NR_BUFS];
+}
+
+/* Hand the current buffer over to the writer thread.  */
+static void etrace_async_submit(struct etracer *t)
+{
+    struct etrace_async *a = &t->async;
+    struct etrace_async_buf *b = etrace_async_cur(t);
+
+    if (!b || !b->len) {
+        return;
+    }
+    atomic_mb_set(&a->head, a->head + 1);
+    qemu_sem_post(&a->filled);
+}
+
+/*
+ * Get a buffer to fill, waiting for the writer thread if the ring is full.
+ * If the drop policy is active and can_drop is set, returns NULL instead
+ * of waiting.
+ */
+static struct etrace_async_buf *etrace_async_get(struct etracer *t,
+                                                 bool can_drop)
+{
+    struct etrace_async *a = &t->async;
+    struct etrace_async_buf *b;
+
+    while (!(b = etrace_async_cur(t))) {
+        if (a->drop && can_drop) {
+            return NULL;
+        }
+        qemu_event_reset(&a->drained);
+        if (etrace_async_cur(t)) {
+            continue;
+        }
+        qemu_event_wait(&a->drained);
+    }
+    return b;
+}
+
+/*
+ * Reserve room for a record of len bytes. Records are kept within a
+ * single buffer unless they are larger than a buffer. Returns false
+ * if the record is to be dropped.
+ */
+static bool etrace_async_reserve(struct etracer *t, size_t len)
+{
+    struct etrace_async *a = &t->async;
+    struct etrace_async_buf *b = etrace_async_cur(t);
+
+    if (b && b->len && b->len + len > ETRACE_ASYNC_BUF_SIZE) {
+        etrace_async_submit(t);
+    }
+
+    b = etrace_async_get(t, true);
+    if (!b) {
+        a->dropping = true;
+        a->dropped_records++;
+        a->dropped_bytes += len;
+        return false;
+    }
+    a->dropping = false;
+    return true;
+}
+
+static void etrace_async_write(struct etracer *t, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len) {
+        struct etrace_async_buf *b = etrace_async_get(t, false);
+        size_t copylen = MIN(len, ETRACE_ASYNC_BUF_SIZE - b->len);
+
+        memcpy(b->data + b->len, p, copylen);
+        b->len += copylen;
+        p += copylen;
+        len -= copylen;
+
+        if (b->len == ETRACE_ASYNC_BUF_SIZE) {
+            etrace_async_submit(t);
+        }
+    }
+}
+
+static void *etrace_async_thread(void *opaque)
+{
+    struct etracer *t = opaque;
+    struct etrace_async *a = &t->async;
+
+    while (true) {
+        struct etrace_async_buf *b;
+        unsigned int tail = a->tail;
+
+        qemu_sem_wait(&a->filled);
+        if (tail == atomic_mb_read(&a->head)) {
+            if (atomic_mb_read(&a->quit)) {
+                break;
+            }
+            continue;
+        }
+
+        b = &a->bufs[tail % ETRACE_ASYNC_NR_BUFS];
+        etrace_fwrite(t, b->data, b->len);
+        b->len = 0;
+        atomic_mb_set(&a->tail, tail + 1);
+        qemu_event_set(&a->drained);
+    }
+    fflush(t->fp);
+    return NULL;
+}
+
+static void etrace_async_init(struct etracer *t)
+{
+    struct etrace_async *a = &t->async;
+    unsigned int i;
+
+    for (i = 0; i < ETRACE_ASYNC_NR_BUFS; i++) {
+        a->bufs[i].data = g_malloc(ETRACE_ASYNC_BUF_SIZE);
+        a->bufs[i].len = 0;
+    }
+    a->drop = t->flags & ETRACE_F_ASYNC_DROP;
+    qemu_sem_init(&a->filled, 0);
+    qemu_event_init(&a->drained, false);
+    qemu_thread_create(&a->thread, "etrace-writer", etrace_async_thread,
+                       t, QEMU_THREAD_JOINABLE);
+    a->enabled = true;
+}
+
+static void etrace_async_close(struct etracer *t)
+{
+    struct etrace_async *a = &t->async;
+    unsigned int i;
+
+    etrace_async_submit(t);
+    atomic_mb_set(&a->quit, true);
+    qemu_sem_post(&a->filled);
+    qemu_thread_join(&a->thread);
+    a->enabled = false;
+
+    if (a->dropped_records) {
+        fprintf(stderr, "etrace: dropped %" PRIu64 " records (%" PRIu64
+                " bytes)\n", a->dropped_records, a->dropped_bytes);
+    }
+
+    for (i = 0; i < ETRACE_ASYNC_NR_BUFS; i++) {
+        g_free(a->bufs[i].data);
+    }
+    qemu_sem_destroy(&a->filled);
+    qemu_event_destroy(&a->drained);
+}
+
+static void etrace_write(struct etracer *t, const void *buf, size_t len)
+{
+    if (t->async.enabled) {
+        if (t->async.dropping) {
+            return;
+        }
+        etrace_async_write(t, buf, len);
+    } else {
+        etrace_fwrite(t, buf, len);
+    }
+    t->offset += len;
+}
+
+/* Returns false if the record is dropped.  */
+static bool etrace_write_header(struct etracer *t, uint16_t type,
                                 uint16_t unit_id, uint32_t len)
 {
     struct etrace_hdr hdr = {
@@ -203,7 +429,12 @@ static void etrace_write_header(struct etracer *t, uint16_t type,
         .unit_id = unit_id,
         .len = len
     };
+
+    if (t->async.enabled && !etrace_async_reserve(t, sizeof hdr + len)) {
+        return false;
+    }
     etrace_write(t, &hdr, sizeof hdr);
+    return true;
 }
 
 #define UNIX_PREFIX "unix:"
@@ -274,11 +505,18 @@ bool etrace_init(struct etracer *t, const char *filename,
     struct etrace_arch arch;
 
     memset(t, 0, sizeof *t);
+    qemu_mutex_init(&t->lock);
+    t->units_high = g_hash_table_new(NULL, NULL);
     t->fp = etrace_open(filename);
     if (!t->fp) {
         return false;
     }
 
+    t->flags = qemu_etrace_opts2flags(opts);
+    if (t->flags & ETRACE_F_ASYNC) {
+        etrace_async_init(t);
+    }
+
     memset(&id, 0, sizeof id);
     id.version.major = ETRACE_VERSION_MAJOR;
     id.version.minor = ETRACE_VERSION_MINOR;
@@ -286,6 +524,11 @@ bool etrace_init(struct etracer *t, const char *filename,
     if (qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
         id.attr |= ETRACE_INFO_F_TB_CHAINING;
     }
+    if (t->flags & ETRACE_F_CHUNKED) {
+        id.attr |= ETRACE_INFO_F_CHUNKED;
+        t->index = g_array_new(false, false,
+                               sizeof(struct etrace_index_entry));
+    }
     etrace_write_header(t, TYPE_INFO, 0, sizeof id);
     etrace_write(t, &id, sizeof id);
 
@@ -298,33 +541,348 @@ bool etrace_init(struct etracer *t, const char *filename,
 #endif
     etrace_write_header(t, TYPE_ARCH, 0, sizeof arch);
     etrace_write(t, &arch, sizeof arch);
-
-    t->flags = qemu_etrace_opts2flags(opts);
     return true;
 }
 
-static void etrace_flush_exec_cache(struct etracer *t)
+/* Called with t->lock held.  */
+static struct etrace_unit *etrace_unit_new(struct etracer *t,
+                                           unsigned int unit_id)
+{
+    struct etrace_unit *u = g_new0(struct etrace_unit, 1);
+
+    qemu_mutex_init(&u->lock);
+    u->exec_cache.unit_id = unit_id;
+    u->rec.size = ETRACE_UNIT_BUF_SIZE;
+    u->rec.data = g_malloc(u->rec.size);
+    u->next = t->unit_list;
+    atomic_store_release(&t->unit_list, u);
+    t->nr_units++;
+    return u;
+}
+
+static struct etrace_unit *etrace_unit_get(struct etracer *t,
+                                           unsigned int unit_id)
+{
+    struct etrace_unit *u;
+
+    if (likely(unit_id < ETRACE_MAX_UNITS)) {
+        u = atomic_load_acquire(&t->units[unit_id]);
+        if (likely(u)) {
+            return u;
+        }
+    }
+
+    qemu_mutex_lock(&t->lock);
+    if (unit_id < ETRACE_MAX_UNITS) {
+        u = t->units[unit_id];
+        if (!u) {
+            u = etrace_unit_new(t, unit_id);
+            atomic_store_release(&t->units[unit_id], u);
+        }
+    } else {
+        u = g_hash_table_lookup(t->units_high, GUINT_TO_POINTER(unit_id));
+        if (!u) {
+            u = etrace_unit_new(t, unit_id);
+            g_hash_table_insert(t->units_high, GUINT_TO_POINTER(unit_id), u);
+        }
+    }
+    qemu_mutex_unlock(&t->lock);
+    return u;
+}
+
+static struct etrace_unit *etrace_unit_lock(struct etracer *t,
+                                            unsigned int unit_id)
+{
+    struct etrace_unit *u = etrace_unit_get(t, unit_id);
+
+    qemu_mutex_lock(&u->lock);
+    return u;
+}
+
+static void etrace_unit_unlock(struct etrace_unit *u)
+{
+    qemu_mutex_unlock(&u->lock);
+}
+
+/* Called with both t->lock and u->lock held.  */
+static void etrace_unit_write_chunk(struct etracer *t, struct etrace_unit *u)
 {
-    size_t size64 = t->exec_cache.pos * sizeof t->exec_cache.t64[0];
-    size_t size32 = t->exec_cache.pos * sizeof t->exec_cache.t32[0];
+    if (!u->rec.len) {
+        return;
+    }
+
+    if (!t->async.enabled || etrace_async_reserve(t, u->rec.len)) {
+        etrace_write(t, u->rec.data, u->rec.len);
+    }
+    etrace_write_header(t, TYPE_BARRIER, u->exec_cache.unit_id, 0);
+    u->rec.len = 0;
+}
+
+/*
+ * Compress the pending records of u. Done without holding t->lock so
+ * that units compress in parallel.
+ *
+ * Called with u->lock held.
+ */
+static void etrace_unit_compress(struct etracer *t, struct etrace_unit *u)
+{
+    uLongf zlen;
+    int r;
+
+    zlen = compressBound(u->rec.len);
+    if (zlen > u->rec.zsize) {
+        u->rec.zsize = zlen;
+        u->rec.zdata = g_realloc(u->rec.zdata, u->rec.zsize);
+    }
+
+    r = compress2(u->rec.zdata, &zlen, u->rec.data, u->rec.len,
+                  Z_BEST_SPEED);
+    /* Can only fail on bad buffer sizes or OOM.  */
+    assert(r == Z_OK);
+    u->rec.zlen = zlen;
+}
+
+/* Called with both t->lock and u->lock held.  */
+static void etrace_unit_write_zchunk(struct etracer *t, struct etrace_unit *u)
+{
+    struct etrace_index_entry ie;
+    struct etrace_chunk chunk;
+    uint64_t offset = t->offset;
+
+    memset(&chunk, 0, sizeof chunk);
+    chunk.start_time = u->rec.first_time;
+    chunk.end_time = u->rec.last_time;
+    chunk.raw_len = u->rec.len;
+    chunk.compression = ETRACE_CHUNK_ZLIB;
+
+    if (!etrace_write_header(t, TYPE_CHUNK, u->exec_cache.unit_id,
+                             sizeof chunk + u->rec.zlen)) {
+        return;
+    }
+    etrace_write(t, &chunk, sizeof chunk);
+    etrace_write(t, u->rec.zdata, u->rec.zlen);
+
+    memset(&ie, 0, sizeof ie);
+    ie.start_time = chunk.start_time;
+    ie.end_time = chunk.end_time;
+    ie.offset = offset;
+    ie.unit_id = u->exec_cache.unit_id;
+    g_array_append_val(t->index, ie);
+}
+
+/* Called with u->lock held.  */
+static void etrace_unit_merge_chunked(struct etracer *t, struct etrace_unit *u)
+{
+    if (!u->rec.len) {
+        return;
+    }
+
+    etrace_unit_compress(t, u);
+    qemu_mutex_lock(&t->lock);
+    etrace_unit_write_zchunk(t, u);
+    qemu_mutex_unlock(&t->lock);
+    u->rec.len = 0;
+}
+
+/*
+ * Merge the pending records of u into the output.
+ *
+ * Other units holding records older than the newest record of u are
+ * merged along with it, oldest chunk first, so that the output stays
+ * roughly ordered in time. Units that are busy are skipped, they will
+ * merge themselves.
+ *
+ * Called with u->lock held.
+ */
+static void etrace_unit_merge(struct etracer *t, struct etrace_unit *u)
+{
+    struct etrace_unit **pending;
+    struct etrace_unit *o;
+    unsigned int nr = 0;
+    unsigned int i, j;
+
+    if (t->flags & ETRACE_F_CHUNKED) {
+        /* Chunks carry their time range and are indexed, readers merge.  */
+        etrace_unit_merge_chunked(t, u);
+        return;
+    }
+
+    qemu_mutex_lock(&t->lock);
+    pending = g_new(struct etrace_unit *, t->nr_units);
+    for (o = t->unit_list; o; o = o->next) {
+        if (o == u || !atomic_read(&o->rec.len)) {
+            continue;
+        }
+        if (qemu_mutex_trylock(&o->lock)) {
+            continue;
+        }
+        if (o->rec.len && o->rec.first_time <= u->rec.last_time) {
+            pending[nr++] = o;
+        } else {
+            qemu_mutex_unlock(&o->lock);
+        }
+    }
+    pending[nr++] = u;
+
+    /* Insertion sort on the time of the first record, nr is small.  */
+    for (i = 1; i < nr; i++) {
+        struct etrace_unit *x = pending[i];
+
+        for (j = i; j > 0 && pending[j - 1]->rec.first_time > x->rec.first_time;
+             j--) {
+            pending[j] = pending[j - 1];
+        }
+        pending[j] = x;
+    }
+
+    for (i = 0; i < nr; i++) {
+        etrace_unit_write_chunk(t, pending[i]);
+        if (pending[i] != u) {
+            qemu_mutex_unlock(&pending[i]->lock);
+        }
+    }
+    qemu_mutex_unlock(&t->lock);
+    g_free(pending);
+}
+
+/*
+ * Reserve room for a record in the unit buffer and fill in its header.
+ * Returns a pointer to the record payload.
+ *
+ * Called with u->lock held.
+ */
+static void *etrace_unit_reserve(struct etracer *t, struct etrace_unit *u,
+                                 uint16_t type, uint16_t unit_id,
+                                 uint32_t len, uint64_t time)
+{
+    size_t total = sizeof(struct etrace_hdr) + len;
+    struct etrace_hdr *hdr;
+
+    if (u->rec.len && u->rec.len + total > u->rec.size) {
+        etrace_unit_merge(t, u);
+    }
+    if (total > u->rec.size) {
+        u->rec.size = total;
+        u->rec.data = g_realloc(u->rec.data, u->rec.size);
+    }
+
+    if (!u->rec.len) {
+        u->rec.first_time = time;
+        u->rec.last_time = time;
+    } else {
+        u->rec.first_time = MIN(u->rec.first_time, time);
+        u->rec.last_time = MAX(u->rec.last_time, time);
+    }
+
+    hdr = (struct etrace_hdr *) (u->rec.data + u->rec.len);
+    hdr->type = type;
+    hdr->unit_id = unit_id;
+    hdr->len = len;
+    u->rec.len += total;
+    return hdr + 1;
+}
+
+static uint64_t etrace_time(void)
+{
+#if defined(CONFIG_USER_ONLY)
+    return 0;
+#else
+    return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);;
+#endif
+}
+
+static void etrace_flush_exec_cache(struct etracer *t, struct etrace_unit *u);
+
+/*
+ * Guest physical address of a logged access, taken from the vCPU's TLB.
+ * 0 when the translation has been evicted or the log is drained from
+ * another thread, which can't safely look at the TLB.
+ */
+static uint64_t etrace_memlog_paddr(CPUState *cpu, uint64_t vaddr,
+                                    unsigned int mmu_idx)
+{
+#if defined(CONFIG_USER_ONLY)
+    return 0;
+#else
+    hwaddr paddr;
+
+    if (mmu_idx >= NB_MMU_MODES || !qemu_cpu_is_self(cpu)) {
+        return 0;
+    }
+    paddr = tlb_vaddr_to_paddr(cpu->env_ptr, vaddr, mmu_idx);
+    return paddr == -1 ? 0 : paddr;
+#endif
+}
+
+/*
+ * Turn the inline memory access log of the unit's vCPU into TYPE_MEM
+ * records. The log is only drained when it fills up or another record
+ * needs to go after it, so accesses are stamped with the drain time.
+ *
+ * Called with u->lock held.
+ */
+static void etrace_unit_drain_memlog(struct etracer *t, struct etrace_unit *u)
+{
+    struct etrace_mem_log *log, *end;
+    struct etrace_mem mem;
+    uint64_t time;
+
+    if (!u->cpu) {
+        return;
+    }
+
+    end = (struct etrace_mem_log *) u->cpu->etrace_mem_ptr;
+    if (end == u->memlog) {
+        return;
+    }
+
+    etrace_flush_exec_cache(t, u);
+    time = etrace_time();
+    memset(&mem, 0, sizeof mem);
+    for (log = u->memlog; log < end; log++) {
+        unsigned int mmu_idx = (log->info >> ETRACE_MEMLOG_INFO_MMU_IDX_SHIFT)
+                               & ETRACE_MEMLOG_INFO_MMU_IDX_MASK;
+
+        mem.time = time;
+        mem.vaddr = log->vaddr;
+        mem.paddr = etrace_memlog_paddr(u->cpu, log->vaddr, mmu_idx);
+        mem.value = log->value;
+        mem.size = log->info & ETRACE_MEMLOG_INFO_SIZE_MASK;
+        mem.attr = (log->info >> ETRACE_MEMLOG_INFO_ATTR_SHIFT)
+                   & ETRACE_MEMLOG_INFO_ATTR_MASK;
+        memcpy(etrace_unit_reserve(t, u, TYPE_MEM, u->cpu->cpu_index,
+                                   sizeof mem, time),
+               &mem, sizeof mem);
+    }
+    u->cpu->etrace_mem_ptr = (uintptr_t) u->memlog;
+}
+
+static void etrace_flush_exec_cache(struct etracer *t, struct etrace_unit *u)
+{
+    size_t size64 = u->exec_cache.pos * sizeof u->exec_cache.t64[0];
+    size_t size32 = u->exec_cache.pos * sizeof u->exec_cache.t32[0];
     size_t size = t->arch_bits == 32 ? size32 : size64;
     struct etrace_exec ex;
+    uint8_t *p;
 
     if (!size) {
         return;
     }
 
-    ex.start_time = t->exec_cache.start_time;
+    ex.start_time = u->exec_cache.start_time;
 
-    etrace_write_header(t, TYPE_EXEC, t->exec_cache.unit_id, size + sizeof ex);
-    etrace_write(t, &ex, sizeof ex);
-    etrace_write(t, &t->exec_cache.t64[0], size);
-    t->exec_cache.pos = 0;
-    memset(&t->exec_cache.t64[0], 0, sizeof t->exec_cache.t64);
+    p = etrace_unit_reserve(t, u, TYPE_EXEC, u->exec_cache.unit_id,
+                            size + sizeof ex, ex.start_time);
+    memcpy(p, &ex, sizeof ex);
+    memcpy(p + sizeof ex, &u->exec_cache.t64[0], size);
+    u->exec_cache.pos = 0;
+    /* Only the used part of the cache can be dirty.  */
+    memset(&u->exec_cache.t64[0], 0, size);
 
     /* A barrier indicates that the other side can assume order across the
        the barrier.  */
-    etrace_write_header(t, TYPE_BARRIER, t->exec_cache.unit_id, 0);
+    etrace_unit_reserve(t, u, TYPE_BARRIER, u->exec_cache.unit_id, 0,
+                        ex.start_time);
 }
 
 #define PROXIMITY_MASK (~0xfff)
@@ -362,21 +920,23 @@ static bool qualify_merge(uint64_t start, uint64_t end,
 /* Exec cache accessors. To avoid duplicating src code we use the cpp.  */
 #define XC_ACCESSOR(field)                                                \
 static inline void execache_set_ ## field(struct etracer *t,              \
+                                          struct etrace_unit *u,          \
                                           unsigned int pos, uint64_t v)   \
 {                                                                         \
     if (t->arch_bits == 32) {                                             \
-        t->exec_cache.t32[pos].field = v;                                 \
+        u->exec_cache.t32[pos].field = v;                                 \
     } else {                                                              \
-        t->exec_cache.t64[pos].field = v;                                 \
+        u->exec_cache.t64[pos].field = v;                                 \
     }                                                                     \
 }                                                                         \
 static inline uint64_t execache_get_ ## field(struct etracer *t,          \
+                                              struct etrace_unit *u,      \
                                               unsigned int pos)           \
 {                                                                         \
     if (t->arch_bits == 32) {                                             \
-        return t->exec_cache.t32[pos].field;                              \
+        return u->exec_cache.t32[pos].field;                              \
     } else {                                                              \
-        return t->exec_cache.t64[pos].field;                              \
+        return u->exec_cache.t64[pos].field;                              \
     }                                                                     \
 }
 
@@ -384,62 +944,69 @@ XC_ACCESSOR(start)
 XC_ACCESSOR(end)
 XC_ACCESSOR(duration)
 
-/*
- * dump an execution record.
- *
- * unit_id idenfies the master, e.g CPU #0 or #1 etc.
- *
- */
-void etrace_dump_exec(struct etracer *t, unsigned int unit_id,
-                      uint64_t start, uint64_t end,
-                      uint64_t start_time, uint32_t duration)
+/* Called with u->lock held.  */
+static void etrace_unit_dump_exec(struct etracer *t, struct etrace_unit *u,
+                                  uint64_t start, uint64_t end,
+                                  uint64_t start_time, uint32_t duration)
 {
     unsigned int pos;
 
-    if (unit_id != t->exec_cache.unit_id) {
-        etrace_flush_exec_cache(t);
-        t->exec_cache.unit_id = unit_id;
-    }
-
-    pos = t->exec_cache.pos;
+    pos = u->exec_cache.pos;
     if (pos == 0) {
-        t->exec_cache.start_time = start_time;
+        u->exec_cache.start_time = start_time;
     }
 
     assert(t->arch_bits == 32 || t->arch_bits == 64);
     if (pos &&
-        qualify_merge(execache_get_start(t, pos), execache_get_end(t, pos),
+        qualify_merge(execache_get_start(t, u, pos),
+                      execache_get_end(t, u, pos),
                       start, end)) {
         /* Reuse the old entry.  */
         pos -= 1;
-        execache_set_duration(t, pos, execache_get_duration(t, pos) + duration);
+        execache_set_duration(t, u, pos,
+                              execache_get_duration(t, u, pos) + duration);
     } else {
         /* Advance.  */
-        t->exec_cache.pos += 1;
-        execache_set_start(t, pos, start);
-        execache_set_duration(t, pos, duration);
+        u->exec_cache.pos += 1;
+        execache_set_start(t, u, pos, start);
+        execache_set_duration(t, u, pos, duration);
     }
 
-    execache_set_end(t, pos, end);
+    execache_set_end(t, u, pos, end);
     if (!qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
-        assert(execache_get_start(t, pos) <= execache_get_end(t, pos));
+        assert(execache_get_start(t, u, pos) <= execache_get_end(t, u, pos));
     }
 
-    if (t->exec_cache.pos == EXEC_CACHE_SIZE) {
-        etrace_flush_exec_cache(t);
+    if (u->exec_cache.pos == EXEC_CACHE_SIZE) {
+        etrace_flush_exec_cache(t, u);
     }
 }
 
+/*
+ * dump an execution record.
+ *
+ * unit_id idenfies the master, e.g CPU #0 or #1 etc.
+ *
+ */
+void etrace_dump_exec(struct etracer *t, unsigned int unit_id,
+                      uint64_t start, uint64_t end,
+                      uint64_t start_time, uint32_t duration)
+{
+    struct etrace_unit *u = etrace_unit_lock(t, unit_id);
+
+    etrace_unit_dump_exec(t, u, start, end, start_time, duration);
+    etrace_unit_unlock(u);
+}
+
 static void etrace_dump_guestmem(struct etracer *t, AddressSpace *as,
+                                 void *dst,
                                  uint64_t guest_vaddr, uint64_t guest_paddr,
                                  size_t guest_len)
 {
 #if defined(CONFIG_USER_ONLY)
     /* Currently, user mode address are directly addressable.  */
-    etrace_write(t, (void *) (uintptr_t) guest_vaddr, guest_len);
+    memcpy(dst, (void *) (uintptr_t) guest_vaddr, guest_len);
 #else
-    unsigned char buf[8 * 1024];
-
     /* Once we have per-master address-space support, we can assert()
        as not beeing NULL. But for now, provide this fallback.  */
     if (as == NULL) {
@@ -448,13 +1015,8 @@ static void etrace_dump_guestmem(struct etracer *t, AddressSpace *as,
 
     /* TODO: We know that tb guest mem is mapped in at this time, so we could
        dig out the host ram pointer and directly write from it.  */
-    while (guest_len) {
-        unsigned int copylen = guest_len > sizeof buf ? sizeof buf : guest_len;
-
-        address_space_rw(as, guest_paddr, MEMTXATTRS_UNSPECIFIED, buf, copylen, 0);
-        etrace_write(t, buf, copylen);
-        guest_len -= copylen;
-    }
+    address_space_rw(as, guest_paddr, MEMTXATTRS_UNSPECIFIED, dst,
+                     guest_len, 0);
 #endif
 }
 
@@ -472,7 +1034,9 @@ void etrace_dump_tb(struct etracer *t, AddressSpace *as, uint16_t unit_id,
                     size_t guest_len,
                     void *host_buf, size_t host_len)
 {
+    struct etrace_unit *u = etrace_unit_lock(t, unit_id);
     struct etrace_tb tb;
+    uint8_t *p;
     size_t size;
 
     tb.vaddr = guest_vaddr;
@@ -482,83 +1046,201 @@ void etrace_dump_tb(struct etracer *t, AddressSpace *as, uint16_t unit_id,
     tb.host_code_len = host_len;
 
     size = sizeof tb + guest_len + host_len;
-    /* Write headers.  */
-    etrace_write_header(t, TYPE_TB, unit_id, size);
-    etrace_write(t, &tb, sizeof tb);
+    p = etrace_unit_reserve(t, u, TYPE_TB, unit_id, size, etrace_time());
+    memcpy(p, &tb, sizeof tb);
+    p += sizeof tb;
     /* Guest code.  */
-    etrace_dump_guestmem(t, as, guest_vaddr, guest_paddr, guest_len);
+    etrace_dump_guestmem(t, as, p, guest_vaddr, guest_paddr, guest_len);
+    p += guest_len;
     /* Host/native code.  */
-    etrace_write(t, host_buf, host_len);
-}
-
-static uint64_t etrace_time(void)
-{
-#if defined(CONFIG_USER_ONLY)
-    return 0;
-#else
-    return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);;
-#endif
+    memcpy(p, host_buf, host_len);
+    etrace_unit_unlock(u);
 }
 
 void etrace_mem_access(struct etracer *t, uint16_t unit_id,
                        uint64_t guest_vaddr, uint64_t guest_paddr,
                        size_t size, uint64_t attr, uint64_t val)
 {
+    struct etrace_unit *u = etrace_unit_lock(t, unit_id);
     struct etrace_mem mem;
 
-    etrace_flush_exec_cache(t);
+    etrace_unit_drain_memlog(t, u);
+    etrace_flush_exec_cache(t, u);
     mem.time = etrace_time();
     mem.vaddr = guest_vaddr;
     mem.paddr = guest_paddr;
     mem.attr = attr;
     mem.size = size;
     mem.value = val;
+    memset(mem.padd, 0, sizeof mem.padd);
+
+    memcpy(etrace_unit_reserve(t, u, TYPE_MEM, unit_id, sizeof mem, mem.time),
+           &mem, sizeof mem);
+    etrace_unit_unlock(u);
+}
+
+void etrace_set_mem_filter(struct etracer *t, const char *pc_ranges,
+                           const char *masters, Error **errp)
+{
+    Error *err = NULL;
+
+    if (pc_ranges) {
+        t->mem_pc_ranges = g_array_new(false, false, sizeof(Range));
+        qemu_parse_addr_ranges(t->mem_pc_ranges, pc_ranges, &err);
+        if (err) {
+            error_propagate(errp, err);
+            return;
+        }
+    }
+
+    if (masters) {
+        gchar **ids = g_strsplit(masters, ",", 0);
+        unsigned int i;
+
+        for (i = 0; ids[i]; i++) {
+            uint64_t id;
+
+            if (qemu_strtou64(ids[i], NULL, 0, &id) || id >= 64) {
+                error_setg(errp, "Invalid etrace master id %s", ids[i]);
+                break;
+            }
+            t->mem_masters |= 1ULL << id;
+        }
+        g_strfreev(ids);
+    }
+}
+
+/* Returns true if memory accesses by code at pc should be logged.  */
+bool etrace_mem_in_range(struct etracer *t, uint64_t pc)
+{
+    unsigned int i;
+
+    if (!t->mem_pc_ranges) {
+        return true;
+    }
+
+    for (i = 0; i < t->mem_pc_ranges->len; i++) {
+        Range *range = &g_array_index(t->mem_pc_ranges, Range, i);
+
+        if (range_contains(range, pc)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Set up inline memory access logging for a vCPU. Called by the vCPU
+ * itself before running guest code. Translations made from then on
+ * carry CF_ETRACE_MEM.
+ */
+void etrace_mem_cpu_init(struct etracer *t, CPUState *cpu)
+{
+    struct etrace_unit *u;
+
+    if (cpu->etrace_mem) {
+        return;
+    }
+    if (t->mem_masters && (cpu->cpu_index >= 64
+                           || !(t->mem_masters & (1ULL << cpu->cpu_index)))) {
+        return;
+    }
+
+    u = etrace_unit_lock(t, cpu->cpu_index);
+    if (!u->memlog) {
+        /* Plus the slot an access past the TB budget starts in.  */
+        u->memlog = g_new0(struct etrace_mem_log,
+                           ETRACE_MEMLOG_SIZE + ETRACE_MEMLOG_TB_MAX + 1);
+        u->cpu = cpu;
+        cpu->etrace_mem_ptr = (uintptr_t) u->memlog;
+        cpu->etrace_mem_limit = (uintptr_t) (u->memlog + ETRACE_MEMLOG_SIZE);
+        cpu->etrace_mem = true;
+    }
+    etrace_unit_unlock(u);
+}
+
+void HELPER(etrace_mem_drain)(CPUArchState *env)
+{
+    CPUState *cpu = ENV_GET_CPU(env);
+    struct etrace_unit *u = etrace_unit_lock(&qemu_etracer, cpu->cpu_index);
+
+    etrace_unit_drain_memlog(&qemu_etracer, u);
+    etrace_unit_unlock(u);
+}
+
+void HELPER(etrace_mem)(CPUArchState *env, uint64_t vaddr, uint64_t val,
+                        uint32_t info)
+{
+    CPUState *cpu = ENV_GET_CPU(env);
+    struct etrace_mem_log *log = (struct etrace_mem_log *) cpu->etrace_mem_ptr;
+    unsigned int mmu_idx = (info >> ETRACE_MEMLOG_INFO_MMU_IDX_SHIFT)
+                           & ETRACE_MEMLOG_INFO_MMU_IDX_MASK;
+
+    /* Drop the entry TCG started for the access, it's recorded here.  */
+    log->info = 0;
+    etrace_mem_access(&qemu_etracer, cpu->cpu_index, vaddr,
+                      etrace_memlog_paddr(cpu, vaddr, mmu_idx),
+                      info & ETRACE_MEMLOG_INFO_SIZE_MASK,
+                      (info >> ETRACE_MEMLOG_INFO_ATTR_SHIFT)
+                      & ETRACE_MEMLOG_INFO_ATTR_MASK, val);
+}
 
-    /* Write headers.  */
-    etrace_write_header(t, TYPE_MEM, unit_id, sizeof mem);
-    etrace_write(t, &mem, sizeof mem);
+bool etrace_exec_start_valid(struct etracer *t, unsigned int unit_id)
+{
+    return etrace_unit_get(t, unit_id)->exec_start_valid;
 }
 
 void etrace_dump_exec_start(struct etracer *t,
                             unsigned int unit_id,
                             uint64_t start)
 {
-    assert(!t->exec_start_valid);
-    t->exec_start = start;
-    t->exec_start_time = etrace_time();
-    t->exec_start_valid = true;
+    struct etrace_unit *u = etrace_unit_get(t, unit_id);
+
+    assert(!u->exec_start_valid);
+    u->exec_start = start;
+    u->exec_start_time = etrace_time();
+    u->exec_start_valid = true;
 }
 
 void etrace_dump_exec_end(struct etracer *t,
                           unsigned int unit_id,
                           uint64_t end)
 {
+    struct etrace_unit *u = etrace_unit_lock(t, unit_id);
     int64_t tdiff;
-    if (!t->exec_start_valid) {
-        printf("exec_start not valid! %" PRIx64 " %" PRIx64 "\n", t->exec_start, end);
+
+    if (!u->exec_start_valid) {
+        printf("exec_start not valid! %" PRIx64 " %" PRIx64 "\n", u->exec_start, end);
     }
-    tdiff = etrace_time() - t->exec_start_time;
+    tdiff = etrace_time() - u->exec_start_time;
     if (tdiff < 0) {
         printf("tdiff=%" PRId64 "\n", tdiff);
         fflush(NULL);
     }
     assert(tdiff >= 0);
-    assert(t->exec_start_valid);
-    t->exec_start_valid = false;
-    etrace_dump_exec(t, unit_id, t->exec_start, end, t->exec_start_time, tdiff);
+    assert(u->exec_start_valid);
+    u->exec_start_valid = false;
+    etrace_unit_dump_exec(t, u, u->exec_start, end,
+                          u->exec_start_time, tdiff);
+    etrace_unit_unlock(u);
 }
 
 void etrace_note_write(struct etracer *t, unsigned int unit_id,
                        void *buf, size_t len)
 {
+    struct etrace_unit *u = etrace_unit_lock(t, unit_id);
     struct etrace_note nt;
+    uint8_t *p;
 
-    etrace_flush_exec_cache(t);
+    etrace_unit_drain_memlog(t, u);
+    etrace_flush_exec_cache(t, u);
 
     nt.time = etrace_time();
-    etrace_write_header(t, TYPE_NOTE, unit_id, sizeof nt + len);
-    etrace_write(t, &nt, sizeof nt);
-    etrace_write(t, buf, len);
+    p = etrace_unit_reserve(t, u, TYPE_NOTE, unit_id, sizeof nt + len,
+                            nt.time);
+    memcpy(p, &nt, sizeof nt);
+    memcpy(p + sizeof nt, buf, len);
+    etrace_unit_unlock(u);
 }
 
 int etrace_note_fprintf(FILE *fp,
@@ -584,14 +1266,18 @@ void etrace_event_u64(struct etracer *t, uint16_t unit_id,
                       const char *event_name,
                       uint64_t val, uint64_t prev_val)
 {
+    struct etrace_unit *u = etrace_unit_lock(t, unit_id);
     struct etrace_event_u64 event;
     size_t dev_len, event_len;
+    uint8_t *p;
 
-    etrace_flush_exec_cache(t);
+    etrace_unit_drain_memlog(t, u);
+    etrace_flush_exec_cache(t, u);
 
     dev_len = strlen(dev_name) + 1;
     event_len = strlen(event_name) + 1;
 
+    memset(&event, 0, sizeof event);
     event.time = etrace_time();
     event.flags = flags;
     event.unit_id = unit_id;
@@ -599,17 +1285,54 @@ void etrace_event_u64(struct etracer *t, uint16_t unit_id,
     event.event_name_len = event_len;
     event.val = val;
     event.prev_val = prev_val;
-    etrace_write_header(t, TYPE_EVENT_U64, unit_id,
-                        sizeof event + dev_len + event_len);
-    etrace_write(t, &event, sizeof event);
-    etrace_write(t, dev_name, dev_len);
-    etrace_write(t, event_name, event_len);
+    p = etrace_unit_reserve(t, u, TYPE_EVENT_U64, unit_id,
+                            sizeof event + dev_len + event_len, event.time);
+    memcpy(p, &event, sizeof event);
+    p += sizeof event;
+    memcpy(p, dev_name, dev_len);
+    p += dev_len;
+    memcpy(p, event_name, event_len);
+    etrace_unit_unlock(u);
+}
+
+static void etrace_write_index(struct etracer *t)
+{
+    struct etrace_index_trailer tr;
+    size_t size = t->index->len * sizeof(struct etrace_index_entry);
+
+    memset(&tr, 0, sizeof tr);
+    tr.offset = t->offset;
+    tr.nr_entries = t->index->len;
+    tr.magic = ETRACE_INDEX_MAGIC;
+
+    etrace_write_header(t, TYPE_INDEX, 0, size + sizeof tr);
+    etrace_write(t, t->index->data, size);
+    etrace_write(t, &tr, sizeof tr);
 }
 
 void etrace_close(struct etracer *t)
 {
+    struct etrace_unit *u;
+
     if (t->fp) {
-        etrace_flush_exec_cache(t);
+        for (u = atomic_load_acquire(&t->unit_list); u; u = u->next) {
+            qemu_mutex_lock(&u->lock);
+            etrace_unit_drain_memlog(t, u);
+            etrace_flush_exec_cache(t, u);
+            etrace_unit_merge(t, u);
+            qemu_mutex_unlock(&u->lock);
+        }
+        if (t->index) {
+            /* Never drop the index.  */
+            t->async.drop = false;
+            etrace_write_index(t);
+            g_array_free(t->index, true);
+            t->index = NULL;
+        }
+        if (t->async.enabled) {
+            etrace_async_close(t);
+        }
         fclose(t->fp);
+        t->fp = NULL;
     }
 }
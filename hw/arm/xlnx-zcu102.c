@@ -24,6 +24,7 @@
 #include "qemu/error-report.h"
 #include "qemu/log.h"
 #include "sysemu/qtest.h"
+#include "hw/remote-port-gpio.h"
 
 typedef struct XlnxZCU102 {
     MachineState parent_obj;
@@ -33,6 +34,7 @@ typedef struct XlnxZCU102 {
 
     bool secure;
     bool virt;
+    bool remote_ipi;
 } XlnxZCU102;
 
 #define TYPE_ZCU102_MACHINE   MACHINE_TYPE_NAME("xlnx-zcu102")
@@ -69,6 +71,20 @@ static void zcu102_set_virt(Object *obj, bool value, Error **errp)
     s->virt = value;
 }
 
+static bool zcu102_get_remote_ipi(Object *obj, Error **errp)
+{
+    XlnxZCU102 *s = ZCU102_MACHINE(obj);
+
+    return s->remote_ipi;
+}
+
+static void zcu102_set_remote_ipi(Object *obj, bool value, Error **errp)
+{
+    XlnxZCU102 *s = ZCU102_MACHINE(obj);
+
+    s->remote_ipi = value;
+}
+
 static void xlnx_zcu102_init(MachineState *machine)
 {
     XlnxZCU102 *s = ZCU102_MACHINE(machine);
@@ -104,6 +120,18 @@ static void xlnx_zcu102_init(MachineState *machine)
 
     object_property_set_bool(OBJECT(&s->soc), true, "realized", &error_fatal);
 
+    /* Connect the APU IPI channel to an xlnx-zynqmp-pmu machine.  */
+    if (s->remote_ipi) {
+        DeviceState *bridge = rp_gpio_create(OBJECT(machine), "remote-ipi",
+                                             XLNX_ZYNQMP_IPI_NUM_GPIOS,
+                                             &error_fatal);
+
+        for (i = XLNX_ZYNQMP_IPI_PMU_0; i <= XLNX_ZYNQMP_IPI_PMU_3; i++) {
+            xlnx_zynqmp_ipi_connect_gpio(&s->soc.ipi, XLNX_ZYNQMP_IPI_APU, i,
+                                         bridge);
+        }
+    }
+
     /* Create and plug in the SD cards */
     for (i = 0; i < XLNX_ZYNQMP_NUM_SDHCI; i++) {
         BusState *bus;
@@ -202,6 +230,15 @@ static void xlnx_zcu102_machine_instance_init(Object *obj)
                                     "guest CPU which implements the ARM "
                                     "Virtualization Extensions",
                                     NULL);
+
+    s->remote_ipi = false;
+    object_property_add_bool(obj, "remote-ipi", zcu102_get_remote_ipi,
+                             zcu102_set_remote_ipi, NULL);
+    object_property_set_description(obj, "remote-ipi",
+                                    "Set on to connect the APU IPI channel "
+                                    "to an xlnx-zynqmp-pmu machine through "
+                                    "remote-port (needs -machine-path)",
+                                    NULL);
 }
 
 static void xlnx_zcu102_machine_class_init(ObjectClass *oc, void *data)
@@ -24,14 +24,24 @@
 #include "qapi/error.h"
 #include "hw/sysbus.h"
 #include "sysemu/sysemu.h"
+#include "exec/memory.h"
+#include "qemu/bswap.h"
+#include "qemu/log.h"
 
 #define MBLAZE_MBOX_BYTES 4096
 #define MBLAZE_MBOX_ADDR_MASK 0x3FF
+/* Granularity of delta transfers */
+#define MBLAZE_MBOX_DELTA_CHUNK 64
+/* Largest delta message, every chunk in its own record plus terminator */
+#define MBLAZE_MBOX_DELTA_MAX \
+    (MBLAZE_MBOX_BYTES + (MBLAZE_MBOX_BYTES / MBLAZE_MBOX_DELTA_CHUNK + 1) * 4)
+/* Default number of host messages buffered */
+#define MBLAZE_MBOX_RX_DEPTH 8
 #define TYPE_BIAMP_MBMBOX "biamp.mblaze-mbox"
 #define BIAMP_MBMBOX(obj) OBJECT_CHECK(BiampMbMbox, (obj), TYPE_BIAMP_MBMBOX)
 
 
-typedef enum {EVENT_READY, WRITE_BUFFER} mblaze_opcode;
+typedef enum {EVENT_READY, WRITE_BUFFER, WRITE_DELTA} mblaze_opcode;
 
 typedef struct BiampMbMbox{
     SysBusDevice busdev;
@@ -44,8 +54,25 @@ typedef struct BiampMbMbox{
 
     /* Mailbox buffer */
     uint32_t * mailboxBuffer;
-    uint32_t mailboxIndex;
 
+    /* Map the buffer as RAM rather than trapping every read */
+    bool directRam;
+    /* The guest wrote to the buffer since the last message */
+    bool guestDirty;
+    /* Send only the chunks that changed since the last message */
+    bool delta;
+    /* Buffer contents as last seen by the host */
+    uint8_t *shadow;
+    bool shadowValid;
+
+    /* Host messages not yet delivered */
+    uint32_t rxDepth;
+    uint8_t *rxBuf;
+    uint32_t rxSize;
+    uint32_t rxLen;
+    /* A host write is waiting for the guest to reply */
+    bool handshake;
+    bool busy;
 
 } BiampMbMbox;
 
@@ -66,6 +93,7 @@ static void mailbox_write(void *opaque, hwaddr addr,
     uint32_t val32 = (uint32_t)val64;
 
     p->mailboxBuffer[(addr >> 2) & MBLAZE_MBOX_ADDR_MASK] = val32;
+    p->guestDirty = true;
 }
 
 static const MemoryRegionOps mailbox_mem_ops = {
@@ -78,58 +106,275 @@ static const MemoryRegionOps mailbox_mem_ops = {
     },
 };
 
-/* GPIO callback function */
-static void message_ready_irq(void *opaque, int irq, int level){
+/* Guest stores to the buffer in direct-ram mode. Reads are served from RAM,
+ * so the buffer holds the bytes in guest memory order.
+ */
+static uint64_t mailbox_ram_read(void *opaque, hwaddr addr,
+                                 unsigned int size)
+{
     BiampMbMbox *p = opaque;
-    const uint8_t * mailboxBuffer8 = (uint8_t *)(p->mailboxBuffer);
-    if(level){
-        qemu_chr_fe_write(&(p->chr_fifo), mailboxBuffer8, MBLAZE_MBOX_BYTES);
+    const uint8_t *ptr = (uint8_t *)p->mailboxBuffer + addr;
+
+    /* Only used while the region is out of ROMD mode */
+    switch (size) {
+    case 1:
+        return ldub_p(ptr);
+    case 2:
+        return lduw_le_p(ptr);
+    case 4:
+        return ldl_le_p(ptr);
+    default:
+        g_assert_not_reached();
     }
 }
 
-/* Called when host writes to the character pipe
- * First byte is an op code, either EVENT_READY(0) or WRITE_BUFFER(1).
- * When EVENT_READY, the eventRdyIrq interrupt is raised.
- * When WRITE_BUFFER, the next MBLAZE_MBOX_BYTES are written to the mailbox buffer,
- * followed by the responseRdyIrq once all the bytes are recieved/written.
- */
-static void host_to_mbox(void *opaque, const uint8_t *buf, int size){
+static void mailbox_ram_write(void *opaque, hwaddr addr,
+                              uint64_t val64, unsigned int size)
+{
     BiampMbMbox *p = opaque;
-    int i;
-
-
-    for(i = 0; i < size; i++){
-        if(p->mailboxIndex == 0){
-            switch((mblaze_opcode)buf[i]){
-            case(EVENT_READY):
-                qemu_irq_raise(p->eventRdyIrq);
-                break;
-            case(WRITE_BUFFER):
-                p->mailboxIndex = 1;
-                break;
-            default:
-                break;
-            }
+    uint8_t *ptr = (uint8_t *)p->mailboxBuffer + addr;
+
+    switch (size) {
+    case 1:
+        stb_p(ptr, val64);
+        break;
+    case 2:
+        stw_le_p(ptr, val64);
+        break;
+    case 4:
+        stl_le_p(ptr, val64);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    p->guestDirty = true;
+}
+
+static const MemoryRegionOps mailbox_ram_ops = {
+    .read = mailbox_ram_read,
+    .write = mailbox_ram_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .valid = {
+        .min_access_size = 1,
+        .max_access_size = 4,
+    },
+};
+
+/* Length of the records of a WRITE_DELTA message at buf, 0 if incomplete
+ * and -1 if malformed.
+ */
+static int mailbox_delta_len(const uint8_t *buf, uint32_t avail)
+{
+    uint32_t pos = 0;
+
+    for (;;) {
+        uint16_t off, len;
+
+        if (avail - pos < 4) {
+            return 0;
+        }
+        off = lduw_le_p(buf + pos);
+        len = lduw_le_p(buf + pos + 2);
+        pos += 4;
+        if (!len) {
+            return pos;
+        }
+        if (off + len > MBLAZE_MBOX_BYTES) {
+            return -1;
         }
-        else{
-            ((uint8_t*)(p->mailboxBuffer))[p->mailboxIndex - 1] = buf[i];
-            if(p->mailboxIndex < MBLAZE_MBOX_BYTES){
-                p->mailboxIndex++;
+        if (avail - pos < len) {
+            return 0;
+        }
+        pos += len;
+    }
+}
+
+static void mailbox_delta_apply(BiampMbMbox *p, const uint8_t *buf)
+{
+    uint8_t *mailboxBuffer8 = (uint8_t *)p->mailboxBuffer;
+    uint16_t off, len;
+
+    while ((len = lduw_le_p(buf + 2))) {
+        off = lduw_le_p(buf);
+        memcpy(mailboxBuffer8 + off, buf + 4, len);
+        memcpy(p->shadow + off, buf + 4, len);
+        buf += 4 + len;
+    }
+}
+
+/* Deliver the complete host messages at the head of the receive buffer.
+ * With handshake set, writes to the mailbox wait until the guest has
+ * replied to the previous one, everything behind them waits as well to
+ * keep ordering.
+ */
+static void mailbox_rx_process(BiampMbMbox *p)
+{
+    uint8_t *mailboxBuffer8 = (uint8_t *)p->mailboxBuffer;
+    uint32_t pos = 0;
+
+    while (pos < p->rxLen) {
+        const uint8_t *msg = p->rxBuf + pos;
+        uint32_t avail = p->rxLen - pos - 1;
+        int len = 0;
+
+        switch ((mblaze_opcode)msg[0]) {
+        case EVENT_READY:
+            qemu_irq_raise(p->eventRdyIrq);
+            break;
+        case WRITE_BUFFER:
+            if (p->busy || avail < MBLAZE_MBOX_BYTES) {
+                goto out;
+            }
+            len = MBLAZE_MBOX_BYTES;
+            memcpy(mailboxBuffer8, msg + 1, len);
+            memcpy(p->shadow, msg + 1, len);
+            p->busy = p->handshake;
+            qemu_irq_raise(p->responseRdyIrq);
+            break;
+        case WRITE_DELTA:
+            len = mailbox_delta_len(msg + 1, avail);
+            if (len < 0) {
+                qemu_log_mask(LOG_GUEST_ERROR, "%s: bad delta message, "
+                              "flushing host input\n", TYPE_BIAMP_MBMBOX);
+                pos = p->rxLen;
+                goto out;
             }
-            else{
-                p->mailboxIndex = 0;
-                qemu_irq_raise(p->responseRdyIrq);
+            if (!len && pos == 0 && p->rxLen == p->rxSize) {
+                /* Incomplete although it fills the whole buffer */
+                qemu_log_mask(LOG_GUEST_ERROR, "%s: host message larger than "
+                              "the receive buffer, flushing host input\n",
+                              TYPE_BIAMP_MBMBOX);
+                pos = p->rxLen;
+                goto out;
             }
+            if (p->busy || !len) {
+                goto out;
+            }
+            mailbox_delta_apply(p, msg + 1);
+            p->busy = p->handshake;
+            qemu_irq_raise(p->responseRdyIrq);
+            break;
+        default:
+            /* Ignore unknown op codes */
+            break;
         }
+        pos += 1 + len;
+    }
+
+out:
+    if (pos) {
+        p->rxLen -= pos;
+        memmove(p->rxBuf, p->rxBuf + pos, p->rxLen);
+        qemu_chr_fe_accept_input(&(p->chr_fifo));
     }
 }
 
+/* Called when host writes to the character pipe
+ * Messages start with an op code:
+ * EVENT_READY(0) raises the eventRdyIrq interrupt.
+ * WRITE_BUFFER(1) is followed by MBLAZE_MBOX_BYTES bytes written to the
+ * mailbox buffer, then the responseRdyIrq is raised.
+ * WRITE_DELTA(2) is followed by delta records (see mailbox_send_delta)
+ * written to the mailbox buffer, then the responseRdyIrq is raised.
+ * Up to rx-depth messages are buffered, mb_can_rx() throttles the host
+ * beyond that.
+ */
+static void host_to_mbox(void *opaque, const uint8_t *buf, int size){
+    BiampMbMbox *p = opaque;
+
+    assert(size <= p->rxSize - p->rxLen);
+    memcpy(p->rxBuf + p->rxLen, buf, size);
+    p->rxLen += size;
+    mailbox_rx_process(p);
+}
+
 static int mb_can_rx(void *opaque){
-    return true;
+    BiampMbMbox *p = opaque;
+
+    return p->rxSize - p->rxLen;
+}
+
+/* Delta transfers.
+ * With the delta property set, a message is sent as a list of records, each
+ * a little-endian 16-bit byte offset and length followed by the data, and is
+ * terminated by a record with a length of 0. Only the chunks that differ
+ * from what the host last saw are sent, the whole buffer after the host
+ * (re)connects.
+ */
+static void mailbox_send_delta(BiampMbMbox *p)
+{
+    const uint8_t *buf = (uint8_t *)p->mailboxBuffer;
+    uint8_t *frame = g_malloc(MBLAZE_MBOX_DELTA_MAX);
+    unsigned int pos = 0, start, end;
+
+    for (start = 0; start < MBLAZE_MBOX_BYTES; start = end) {
+        end = start + MBLAZE_MBOX_DELTA_CHUNK;
+        if (p->shadowValid && !memcmp(buf + start, p->shadow + start,
+                                      MBLAZE_MBOX_DELTA_CHUNK)) {
+            continue;
+        }
+        /* Coalesce runs of changed chunks into one record */
+        while (end < MBLAZE_MBOX_BYTES &&
+               (!p->shadowValid || memcmp(buf + end, p->shadow + end,
+                                          MBLAZE_MBOX_DELTA_CHUNK))) {
+            end += MBLAZE_MBOX_DELTA_CHUNK;
+        }
+        stw_le_p(frame + pos, start);
+        stw_le_p(frame + pos + 2, end - start);
+        memcpy(frame + pos + 4, buf + start, end - start);
+        memcpy(p->shadow + start, buf + start, end - start);
+        pos += 4 + end - start;
+    }
+    stw_le_p(frame + pos, 0);
+    stw_le_p(frame + pos + 2, 0);
+    pos += 4;
+    p->shadowValid = true;
+
+    qemu_chr_fe_write_all(&(p->chr_fifo), frame, pos);
+    g_free(frame);
+}
+
+/* GPIO callback function */
+static void message_ready_irq(void *opaque, int irq, int level){
+    BiampMbMbox *p = opaque;
+    const uint8_t * mailboxBuffer8 = (uint8_t *)(p->mailboxBuffer);
+    bool dirty;
+
+    if(!level){
+        return;
+    }
+
+    /* The guest is done with the previous host write */
+    if (p->busy) {
+        p->busy = false;
+        mailbox_rx_process(p);
+    }
+
+    /* Guest stores since the last message, host writes don't count */
+    dirty = p->guestDirty;
+    p->guestDirty = false;
+
+    if (!p->delta) {
+        qemu_chr_fe_write_all(&(p->chr_fifo), mailboxBuffer8,
+                              MBLAZE_MBOX_BYTES);
+    } else if (!dirty && p->shadowValid) {
+        uint8_t end[4] = { 0 };
+
+        qemu_chr_fe_write_all(&(p->chr_fifo), end, sizeof(end));
+    } else {
+        mailbox_send_delta(p);
+    }
 }
 
 static void chr_fifo_event(void *opaque, int event){
     BiampMbMbox *p = opaque;
+
+    if (event == CHR_EVENT_OPENED) {
+        /* A new host knows nothing, resend everything */
+        p->shadowValid = false;
+        p->rxLen = 0;
+        p->busy = false;
+    }
     qemu_chr_fe_accept_input(&(p->chr_fifo));  
 }
 
@@ -138,13 +383,28 @@ static int biamp_mblaze_mbox_init(SysBusDevice *dev)
 
     BiampMbMbox *p = BIAMP_MBMBOX(dev);
     
-    /* Initialize the mailbox buffer */
-    p->mailboxBuffer = g_malloc0(MBLAZE_MBOX_BYTES);
-
     /* Set up memory regions */
-    memory_region_init_io(&p->mmbox, OBJECT(p), &mailbox_mem_ops, p,
-                          "biamp-mblze-mailbox-mem", MBLAZE_MBOX_BYTES);
+    if (p->directRam) {
+        /* Guest reads stay in the TCG fast path, stores go through
+         * mailbox_ram_write() so we know whether the guest touched the
+         * buffer between messages.
+         */
+        memory_region_init_rom_device_nomigrate(&p->mmbox, OBJECT(p),
+                                                &mailbox_ram_ops, p,
+                                                "biamp-mblze-mailbox-mem",
+                                                MBLAZE_MBOX_BYTES,
+                                                &error_fatal);
+        p->mailboxBuffer = memory_region_get_ram_ptr(&p->mmbox);
+        memset(p->mailboxBuffer, 0, MBLAZE_MBOX_BYTES);
+    } else {
+        p->mailboxBuffer = g_malloc0(MBLAZE_MBOX_BYTES);
+        memory_region_init_io(&p->mmbox, OBJECT(p), &mailbox_mem_ops, p,
+                              "biamp-mblze-mailbox-mem", MBLAZE_MBOX_BYTES);
+    }
     sysbus_init_mmio(dev, &p->mmbox);
+    p->shadow = g_malloc0(MBLAZE_MBOX_BYTES);
+    p->rxSize = MAX(p->rxDepth, 1) * (1 + MBLAZE_MBOX_DELTA_MAX);
+    p->rxBuf = g_malloc(p->rxSize);
 
     /* Initialize the IRQs */
     sysbus_init_irq(SYS_BUS_DEVICE(dev), &p->eventRdyIrq);
@@ -152,7 +412,7 @@ static int biamp_mblaze_mbox_init(SysBusDevice *dev)
     qdev_init_gpio_in(DEVICE(dev), message_ready_irq, 1); 
 
     /* Initialize the chardev front ends */
-    p->mailboxIndex = 0;
+    p->rxLen = 0;
     if (qemu_chr_fe_init(&(p->chr_fifo), qemu_chr_find("mbmbx") , &error_abort) == false) {
 		}
     qemu_chr_fe_set_handlers(&(p->chr_fifo), mb_can_rx, host_to_mbox, chr_fifo_event, NULL, p, NULL, true);
@@ -162,6 +422,10 @@ static int biamp_mblaze_mbox_init(SysBusDevice *dev)
 
 static Property biamp_mbmbox_properties[] = {
     DEFINE_PROP_CHR("chardev0", BiampMbMbox, chr_fifo),
+    DEFINE_PROP_BOOL("direct-ram", BiampMbMbox, directRam, false),
+    DEFINE_PROP_BOOL("delta", BiampMbMbox, delta, false),
+    DEFINE_PROP_UINT32("rx-depth", BiampMbMbox, rxDepth, MBLAZE_MBOX_RX_DEPTH),
+    DEFINE_PROP_BOOL("handshake", BiampMbMbox, handshake, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -163,36 +163,17 @@ void fdt_init_yield(FDTMachineInfo *fdti)
 
 void fdt_init_set_opaque(FDTMachineInfo *fdti, char *node_path, void *opaque)
 {
-    FDTDevOpaque *dp;
-    for (dp = fdti->dev_opaques;
-        dp->node_path && strcmp(dp->node_path, node_path);
-        dp++);
-    if (!dp->node_path) {
-        dp->node_path = strdup(node_path);
-    }
-    dp->opaque = opaque;
+    g_hash_table_insert(fdti->dev_opaques, g_strdup(node_path), opaque);
 }
 
 int fdt_init_has_opaque(FDTMachineInfo *fdti, char *node_path)
 {
-    FDTDevOpaque *dp;
-    for (dp = fdti->dev_opaques; dp->node_path; dp++) {
-        if (!strcmp(dp->node_path, node_path)) {
-            return 1;
-         }
-    }
-    return 0;
+    return g_hash_table_contains(fdti->dev_opaques, node_path);
 }
 
 void *fdt_init_get_opaque(FDTMachineInfo *fdti, char *node_path)
 {
-    FDTDevOpaque *dp;
-    for (dp = fdti->dev_opaques; dp->node_path; dp++) {
-        if (!strcmp(dp->node_path, node_path)) {
-            return dp->opaque;
-        }
-    }
-    return NULL;
+    return g_hash_table_lookup(fdti->dev_opaques, node_path);
 }
 
 FDTMachineInfo *fdt_init_new_fdti(void *fdt)
@@ -201,17 +182,17 @@ FDTMachineInfo *fdt_init_new_fdti(void *fdt)
     fdti->fdt = fdt;
     fdti->cq = g_malloc0(sizeof(*(fdti->cq)));
     qemu_co_queue_init(fdti->cq);
-    fdti->dev_opaques = g_malloc0(sizeof(*(fdti->dev_opaques)) *
-        (fdt_get_num_nodes(fdt) + 1));
+    fdti->dev_opaques = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                              g_free, NULL);
     return fdti;
 }
 
 void fdt_init_destroy_fdti(FDTMachineInfo *fdti)
 {
-    FDTDevOpaque *dp;
-    for (dp = fdti->dev_opaques; dp->node_path; dp++) {
-        g_free(dp->node_path);
+    g_hash_table_destroy(fdti->dev_opaques);
+    if (fdti->plan) {
+        g_string_free(fdti->plan, true);
     }
-    g_free(fdti->dev_opaques);
+    g_free(fdti->plan_file);
     g_free(fdti);
 }
@@ -38,6 +38,7 @@
 #include "sysemu/blockdev.h"
 #include "chardev/char.h"
 #include "qemu/log.h"
+#include "qemu/error-report.h"
 #include "qemu/config-file.h"
 #include "qemu/option.h"
 #include "qom/cpu.h"
@@ -175,6 +176,173 @@ static void fdt_init_all_irqs(FDTMachineInfo *fdti)
     }
 }
 
+struct FDTInitNodeArgs {
+    char *node_path;
+    char *parent_path;
+    FDTMachineInfo *fdti;
+    /* Binding recorded in the machine plan, 0 to discover it.  */
+    char plan_kind;
+    char *plan_arg;
+};
+
+static void fdt_init_node(void *args);
+
+/*
+ * Machine plans.
+ *
+ * Discovering how to build a machine from a DTB means trying every binding
+ * of every node and resolving dependencies between nodes by yielding until
+ * they have been created. Both only depend on the DTB and on the device
+ * models built into QEMU, so the outcome is recorded as a plan: the order
+ * in which nodes completed and the binding that was used for each. With
+ * -machine fdt-plan-cache=DIR the plan is saved to DIR, keyed by a hash of
+ * the DTB and of the QEMU build, and replayed on the next launch of the
+ * same build with the same DTB. Should a recorded binding fail, the node
+ * falls back to discovery and the plan is refreshed.
+ *
+ * Plan files are text, one node per line: kind, node path and argument,
+ * separated by tabs.
+ */
+#define FDT_PLAN_MAGIC "# fdt-plan 1"
+
+enum {
+    FDT_PLAN_NONE = 'N',    /* No binding */
+    FDT_PLAN_INST = 'I',    /* Instance binding */
+    FDT_PLAN_COMPAT = 'C',  /* Compat table binding, arg is the key */
+    FDT_PLAN_QDEV = 'Q',    /* QOM type, arg is the compat */
+    FDT_PLAN_INVALID = 'X', /* Unsupported, compatible is invalidated */
+};
+
+static void fdt_plan_record(FDTMachineInfo *fdti, char kind,
+                            const char *node_path, const char *arg)
+{
+    if (!fdti->plan) {
+        return;
+    }
+    g_string_append_printf(fdti->plan, "%c\t%s\t%s\n", kind, node_path,
+                           arg ? arg : "");
+}
+
+/*
+ * Identify the QEMU build. The version stays the same across rebuilds
+ * that add or change device models, and a plan recorded by another build
+ * would replay its unbound and invalidated nodes without probing them
+ * again. Hash the identity of the executable instead, a rebuild replaces
+ * it. Returns false if it cannot be found.
+ */
+static bool fdt_plan_hash_build(GChecksum *sum)
+{
+    struct stat st;
+    uint64_t id[4];
+
+    if (stat("/proc/self/exe", &st) < 0) {
+        return false;
+    }
+    id[0] = st.st_dev;
+    id[1] = st.st_ino;
+    id[2] = st.st_size;
+    id[3] = st.st_mtime;
+    g_checksum_update(sum, (const guchar *)id, sizeof(id));
+    return true;
+}
+
+static void fdt_plan_init(FDTMachineInfo *fdti)
+{
+    const char *dir = qemu_opt_get(qemu_get_machine_opts(), "fdt-plan-cache");
+    GChecksum *sum;
+
+    if (!dir) {
+        return;
+    }
+
+    sum = g_checksum_new(G_CHECKSUM_SHA256);
+    if (!fdt_plan_hash_build(sum)) {
+        warn_report("FDT: cannot identify the QEMU executable, "
+                    "machine plans are not cached");
+        g_checksum_free(sum);
+        return;
+    }
+    g_checksum_update(sum, (const guchar *)QEMU_VERSION,
+                      strlen(QEMU_VERSION));
+    g_checksum_update(sum, fdti->fdt, fdt_totalsize(fdti->fdt));
+    fdti->plan_file = g_strdup_printf("%s/%s.plan", dir,
+                                      g_checksum_get_string(sum));
+    g_checksum_free(sum);
+
+    fdti->plan = g_string_new(FDT_PLAN_MAGIC "\n");
+}
+
+/* Start all nodes of a cached plan. Returns false if there is none.  */
+static bool fdt_plan_replay(FDTMachineInfo *fdti)
+{
+    char *contents;
+    char **lines;
+    int i;
+
+    if (!fdti->plan_file
+        || !g_file_get_contents(fdti->plan_file, &contents, NULL, NULL)) {
+        return false;
+    }
+    lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+
+    if (g_strcmp0(lines[0], FDT_PLAN_MAGIC)) {
+        goto bad;
+    }
+    /* Validate everything before creating anything.  */
+    for (i = 1; lines[i] && *lines[i]; i++) {
+        char **f = g_strsplit(lines[i], "\t", 3);
+        bool ok = g_strv_length(f) == 3 && strlen(f[0]) == 1
+                  && strchr("NICQX", f[0][0])
+                  && qemu_fdt_node_offset(fdti->fdt, f[1]) >= 0;
+
+        g_strfreev(f);
+        if (!ok) {
+            goto bad;
+        }
+    }
+
+    DB_PRINT(0, "FDT: replaying machine plan %s\n", fdti->plan_file);
+    fdti->plan_replay = true;
+    for (i = 1; lines[i] && *lines[i]; i++) {
+        char **f = g_strsplit(lines[i], "\t", 3);
+        struct FDTInitNodeArgs *init_args = g_malloc0(sizeof(*init_args));
+
+        init_args->node_path = g_strdup(f[1]);
+        init_args->fdti = fdti;
+        init_args->plan_kind = f[0][0];
+        init_args->plan_arg = g_strdup(f[2]);
+        g_strfreev(f);
+        fdti->plan_pending++;
+        qemu_coroutine_enter(qemu_coroutine_create(fdt_init_node, init_args));
+    }
+    g_strfreev(lines);
+    return true;
+
+bad:
+    warn_report("FDT: ignoring malformed machine plan %s", fdti->plan_file);
+    g_strfreev(lines);
+    return false;
+}
+
+static void fdt_plan_save(FDTMachineInfo *fdti)
+{
+    GError *err = NULL;
+
+    if (!fdti->plan || (fdti->plan_replay && !fdti->plan_stale)) {
+        return;
+    }
+    /* Nodes still waiting on dependencies, don't cache a broken machine.  */
+    if (fdti->plan_pending) {
+        return;
+    }
+    if (!g_file_set_contents(fdti->plan_file, fdti->plan->str,
+                             fdti->plan->len, &err)) {
+        warn_report("FDT: cannot save machine plan: %s", err->message);
+        g_error_free(err);
+    }
+}
+
 FDTMachineInfo *fdt_generic_create_machine(void *fdt, qemu_irq *cpu_irq)
 {
     char node_path[DT_PATH_LENGTH];
@@ -185,6 +353,9 @@ FDTMachineInfo *fdt_generic_create_machine(void *fdt, qemu_irq *cpu_irq)
 
     fdt_serial_ports = 0;
 
+    /* Hash the DTB before nodes get invalidated.  */
+    fdt_plan_init(fdti);
+
     /* bind any force bound instances */
     fdt_force_bind_all(fdti);
 
@@ -192,11 +363,14 @@ FDTMachineInfo *fdt_generic_create_machine(void *fdt, qemu_irq *cpu_irq)
     if (!qemu_fdt_get_root_node(fdt, node_path)) {
         memory_region_transaction_begin();
         fdt_init_set_opaque(fdti, node_path, NULL);
-        simple_bus_fdt_init(node_path, fdti);
+        if (!fdt_plan_replay(fdti)) {
+            simple_bus_fdt_init(node_path, fdti);
+        }
         while (qemu_co_enter_next(fdti->cq, NULL));
         bdrv_drain_all();
         fdt_init_all_irqs(fdti);
         memory_region_transaction_commit();
+        fdt_plan_save(fdti);
     } else {
         fprintf(stderr, "FDT: ERROR: cannot get root node from device tree %s\n"
             , node_path);
@@ -215,22 +389,48 @@ FDTMachineInfo *fdt_generic_create_machine(void *fdt, qemu_irq *cpu_irq)
     return fdti;
 }
 
-struct FDTInitNodeArgs {
-    char *node_path;
-    char *parent_path;
-    FDTMachineInfo *fdti;
-};
-
 static int fdt_init_qdev(char *node_path, FDTMachineInfo *fdti, char *compat);
 
+/* Bind a node the way a machine plan says. Returns false on failure.  */
+static bool fdt_init_node_planned(char *node_path, FDTMachineInfo *fdti,
+                                  char kind, char *arg)
+{
+    char *node_name;
+    bool ok;
+
+    switch (kind) {
+    case FDT_PLAN_NONE:
+        return true;
+    case FDT_PLAN_INST:
+        node_name = qemu_fdt_get_node_name(fdti->fdt, node_path);
+        ok = node_name && !fdt_init_inst_bind(node_path, fdti, node_name);
+        free(node_name);
+        return ok;
+    case FDT_PLAN_COMPAT:
+        return !fdt_init_compat(node_path, fdti, arg);
+    case FDT_PLAN_QDEV:
+        return !fdt_init_qdev(node_path, fdti, arg);
+    case FDT_PLAN_INVALID:
+        qemu_fdt_setprop_string(fdti->fdt, node_path, "compatible",
+                                "invalidated");
+        return true;
+    }
+    return false;
+}
+
 static void fdt_init_node(void *args)
 {
     struct FDTInitNodeArgs *a = args;
     char *node_path = a->node_path;
     FDTMachineInfo *fdti = a->fdti;
+    char plan_kind = a->plan_kind;
+    char *plan_arg = a->plan_arg;
     g_free(a);
 
-    simple_bus_fdt_init(node_path, fdti);
+    /* A plan lists every node, don't discover children.  */
+    if (!fdti->plan_replay) {
+        simple_bus_fdt_init(node_path, fdti);
+    }
 
     char *all_compats = NULL, *compat, *node_name, *next_compat;
     char *device_type = NULL;
@@ -238,6 +438,14 @@ static void fdt_init_node(void *args)
 
     DB_PRINT_NP(1, "enter\n");
 
+    if (plan_kind) {
+        if (fdt_init_node_planned(node_path, fdti, plan_kind, plan_arg)) {
+            goto exit;
+        }
+        DB_PRINT_NP(0, "FDT: stale machine plan entry, rediscovering\n");
+        fdti->plan_stale = true;
+    }
+
     /* try instance binding first */
     node_name = qemu_fdt_get_node_name(fdti->fdt, node_path);
     DB_PRINT_NP(1, "node with name: %s\n", node_name ? node_name : "(none)");
@@ -246,6 +454,7 @@ static void fdt_init_node(void *args)
     }
     if (!fdt_init_inst_bind(node_path, fdti, node_name)) {
         DB_PRINT_NP(0, "instance bind successful\n");
+        plan_kind = FDT_PLAN_INST;
         goto exit;
     }
 
@@ -259,10 +468,16 @@ static void fdt_init_node(void *args)
     for (compat = all_compats; compat && compat_len; compat = next_compat+1) {
         char *compat_prefixed = g_strdup_printf("compatible:%s", compat);
         if (!fdt_init_compat(node_path, fdti, compat_prefixed)) {
+            plan_kind = FDT_PLAN_COMPAT;
+            g_free(plan_arg);
+            plan_arg = compat_prefixed;
             goto exit;
         }
         g_free(compat_prefixed);
         if (!fdt_init_qdev(node_path, fdti, compat)) {
+            plan_kind = FDT_PLAN_QDEV;
+            g_free(plan_arg);
+            plan_arg = g_strdup(compat);
             goto exit;
         }
         next_compat = memchr(compat, '\0', DT_PATH_LENGTH);
@@ -276,6 +491,9 @@ static void fdt_init_node(void *args)
                                    "device_type", NULL, false, NULL);
     device_type = g_strdup_printf("device_type:%s", device_type);
     if (!fdt_init_compat(node_path, fdti, device_type)) {
+        plan_kind = FDT_PLAN_COMPAT;
+        g_free(plan_arg);
+        plan_arg = g_strdup(device_type);
         goto exit;
     }
 
@@ -284,15 +502,22 @@ static void fdt_init_node(void *args)
      * try with device_type.
      */
     if (!fdt_init_qdev(node_path, fdti, device_type)) {
+        plan_kind = FDT_PLAN_QDEV;
+        g_free(plan_arg);
+        plan_arg = g_strdup(device_type);
         goto exit;
     }
 
+    plan_kind = FDT_PLAN_NONE;
+    g_free(plan_arg);
+    plan_arg = NULL;
     if (!all_compats) {
         goto exit;
     }
     DB_PRINT_NP(0, "FDT: Unsupported peripheral invalidated - "
                 "compatibilities %s\n", all_compats);
     qemu_fdt_setprop_string(fdti->fdt, node_path, "compatible", "invalidated");
+    plan_kind = FDT_PLAN_INVALID;
 exit:
 
     DB_PRINT_NP(1, "exit\n");
@@ -300,6 +525,9 @@ exit:
     if (!fdt_init_has_opaque(fdti, node_path)) {
         fdt_init_set_opaque(fdti, node_path, NULL);
     }
+    fdt_plan_record(fdti, plan_kind, node_path, plan_arg);
+    fdti->plan_pending--;
+    g_free(plan_arg);
     g_free(node_path);
     g_free(all_compats);
     g_free(device_type);
@@ -318,6 +546,7 @@ static int simple_bus_fdt_init(char *node_path, FDTMachineInfo *fdti)
         struct FDTInitNodeArgs *init_args = g_malloc0(sizeof(*init_args));
         init_args->node_path = children[i];
         init_args->fdti = fdti;
+        fdti->plan_pending++;
         qemu_coroutine_enter(qemu_coroutine_create(fdt_init_node, init_args));
     }
 
@@ -1316,8 +1545,9 @@ exit_reg_parse:
     if (object_dynamic_cast(dev, TYPE_SYS_BUS_DEVICE)) {
         {
             int len;
-            fdt_get_property(fdti->fdt, fdt_path_offset(fdti->fdt, node_path),
-                            "interrupt-controller", &len);
+            fdt_get_property(fdti->fdt,
+                             qemu_fdt_node_offset(fdti->fdt, node_path),
+                             "interrupt-controller", &len);
             is_intc = len >= 0;
             DB_PRINT_NP(is_intc ? 0 : 1, "is interrupt controller: %c\n",
                         is_intc ? 'y' : 'n');
@@ -1332,7 +1562,8 @@ exit_reg_parse:
             qemu_irq *irqs = fdt_get_irq_info(fdti, node_path, i, irq_info,
                                               &map_mode);
             /* INTCs inferr their top level, if no IRQ connection specified */
-            fdt_get_property(fdti->fdt, fdt_path_offset(fdti->fdt, node_path),
+            fdt_get_property(fdti->fdt,
+                             qemu_fdt_node_offset(fdti->fdt, node_path),
                              "interrupts-extended", &len);
             if (!irqs && is_intc && i == 0 && len <= 0) {
                 FDTGenericIntc *id = (FDTGenericIntc *)object_dynamic_cast(
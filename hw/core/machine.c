@@ -176,6 +176,22 @@ static void machine_set_hw_dtb(Object *obj, const char *value, Error **errp)
     ms->hw_dtb = g_strdup(value);
 }
 
+static char *machine_get_fdt_plan_cache(Object *obj, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    return g_strdup(ms->fdt_plan_cache);
+}
+
+static void machine_set_fdt_plan_cache(Object *obj, const char *value,
+                                       Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    g_free(ms->fdt_plan_cache);
+    ms->fdt_plan_cache = g_strdup(value);
+}
+
 static char *machine_get_dumpdtb(Object *obj, Error **errp)
 {
     MachineState *ms = MACHINE(obj);
@@ -694,6 +710,13 @@ static void machine_initfn(Object *obj)
     object_property_set_description(obj, "hw-dtb",
                                     "A device tree used to describe the hardware to QEMU.",
                                     NULL);
+    object_property_add_str(obj, "fdt-plan-cache",
+                            machine_get_fdt_plan_cache,
+                            machine_set_fdt_plan_cache, NULL);
+    object_property_set_description(obj, "fdt-plan-cache",
+                                    "Directory caching FDT machine plans "
+                                    "keyed by hardware DTB and QEMU build",
+                                    NULL);
     object_property_add_bool(obj, "linux",
                              machine_get_linux, machine_set_linux, NULL);
     object_property_set_description(obj, "linux",
@@ -715,6 +738,7 @@ static void machine_finalize(Object *obj)
     g_free(ms->kernel_cmdline);
     g_free(ms->dtb);
     g_free(ms->dumpdtb);
+    g_free(ms->fdt_plan_cache);
     g_free(ms->dt_compatible);
     g_free(ms->firmware);
     g_free(ms->device_memory);
@@ -20,6 +20,7 @@
 #include "hw/remote-port-proto.h"
 #include "hw/remote-port-device.h"
 #include "hw/remote-port-gpio.h"
+#include "hw/remote-port.h"
 
 #define CACHE_INVALID -1
 
@@ -63,6 +64,12 @@ static void rp_gpio_realize(DeviceState *dev, Error **errp)
     RemotePortGPIO *s = REMOTE_PORT_GPIO(dev);
     unsigned int i;
 
+    if (s->num_gpios > MAX_GPIOS) {
+        error_setg(errp, "num-gpios %u above the maximum of %u",
+                   s->num_gpios, MAX_GPIOS);
+        return;
+    }
+
     s->gpio_out = g_new0(qemu_irq, s->num_gpios);
     qdev_init_gpio_out(dev, s->gpio_out, s->num_gpios);
     qdev_init_gpio_in(dev, rp_gpio_handler, s->num_gpios);
@@ -134,6 +141,39 @@ static const TypeInfo rp_info = {
     },
 };
 
+DeviceState *rp_gpio_create(Object *parent, const char *name,
+                            uint32_t num_gpios, Error **errp)
+{
+    DeviceState *rp = DEVICE(object_new(TYPE_REMOTE_PORT));
+    DeviceState *dev = qdev_create(NULL, TYPE_REMOTE_PORT_GPIO);
+    char *gpio_name = g_strdup_printf("%s-gpio", name);
+    Error *err = NULL;
+
+    object_property_add_child(parent, name, OBJECT(rp), &error_abort);
+    object_unref(OBJECT(rp));
+    object_property_add_child(parent, gpio_name, OBJECT(dev), &error_abort);
+    g_free(gpio_name);
+
+    qdev_prop_set_uint32(dev, "num-gpios", num_gpios);
+    rp_device_attach(OBJECT(rp), OBJECT(dev), 0, 0, &err);
+    if (err) {
+        goto fail;
+    }
+    object_property_set_bool(OBJECT(dev), true, "realized", &err);
+    if (err) {
+        goto fail;
+    }
+    object_property_set_bool(OBJECT(rp), true, "realized", &err);
+    if (err) {
+        goto fail;
+    }
+    return dev;
+
+fail:
+    error_propagate(errp, err);
+    return NULL;
+}
+
 static void rp_register_types(void)
 {
     type_register_static(&rp_info);
@@ -47,6 +47,7 @@ typedef struct RemotePortMap {
     RemotePortMemoryMaster *parent;
     MemoryRegion iomem;
     uint64_t offset;
+    bool posted;
 } RemotePortMap;
 
 struct RemotePortMemoryMaster {
@@ -60,39 +61,36 @@ struct RemotePortMemoryMaster {
     uint32_t rp_dev;
     bool relative;
     uint32_t max_access_size;
+    /* Bit N set means writes to map N are posted.  */
+    uint32_t posted_writes;
     struct RemotePort *rp;
     struct rp_peer_state *peer;
 };
 
 #define RP_MAX_ACCESS_SIZE 128
 
-static void rp_io_access(MemoryTransaction *tr)
+static void rp_io_access_one(MemoryTransaction *tr)
 {
     uint64_t addr = tr->addr;
     RemotePortMap *map = tr->opaque;
     RemotePortMemoryMaster *s = map->parent;
     int64_t rclk;
     RemotePortDynPkt rsp;
-    struct  {
-        struct rp_pkt_busaccess_ext_base pkt;
-        uint8_t reserved[RP_MAX_ACCESS_SIZE];
-    } pay;
-    uint8_t *data = rp_busaccess_tx_dataptr(s->peer, &pay.pkt);
+    struct rp_pkt_busaccess_ext_base pkt;
+    uint8_t val[8];
+    /* Larger payloads are sent straight from the callers buffer.  */
+    uint8_t *data = tr->size <= 8 ? val : tr->data.p8;
     struct rp_encode_busaccess_in in = {0};
+    struct iovec iov[2];
     int i;
-    int len;
 
     DB_PRINT_L(0, "addr: %" HWADDR_PRIx " data: %" PRIx64 "\n",
                addr, tr->data.u64);
 
-    if (tr->rw) {
+    if (tr->rw && tr->size <= 8) {
         /* Data up to 8 bytes is passed as values.  */
-        if (tr->size <= 8) {
-            for (i = 0; i < tr->size; i++) {
-                data[i] = tr->data.u64 >> (i * 8);
-            }
-        } else {
-            memcpy(data, tr->data.p8, tr->size);
+        for (i = 0; i < tr->size; i++) {
+            data[i] = tr->data.u64 >> (i * 8);
         }
     }
 
@@ -107,31 +105,55 @@ static void rp_io_access(MemoryTransaction *tr)
     in.attr |= tr->attr.secure ? RP_BUS_ATTR_SECURE : 0;
     in.size = tr->size;
     in.stream_width = tr->size;
-    len = rp_encode_busaccess(s->peer, &pay.pkt, &in);
-    len += tr->rw ? tr->size : 0;
+    iov[0].iov_base = &pkt;
+    iov[0].iov_len = rp_encode_busaccess(s->peer, &pkt, &in);
+    iov[1].iov_base = data;
+    iov[1].iov_len = tr->size;
 
     rp_rsp_mutex_lock(s->rp);
-    rp_write(s->rp, (void *) &pay, len);
+    if (tr->rw && map->posted) {
+        /* Posted write, don't wait for the response. Failures are
+           reported when it's retired.  */
+        rp_tag_alloc(s->rp, in.id, true);
+        rp_writev(s->rp, iov, 2);
+        /* Still keep up with the latest time we've heard from the peer.  */
+        rclk = rp_posted_clk(s->rp);
+        rp_rsp_mutex_unlock(s->rp);
+        rp_sync_vmclock(s->rp, in.clk, rclk);
+        DB_PRINT_L(1, "posted\n");
+        return;
+    }
 
-    rsp = rp_wait_resp(s->rp);
+    /* Reads and non-posted writes must not bypass posted writes.  */
+    rp_drain_posted(s->rp);
+    rp_tag_alloc(s->rp, in.id, false);
+    rp_writev(s->rp, iov, tr->rw ? 2 : 1);
 
-    /* We dont support out of order answers yet.  */
-    assert(rsp.pkt->hdr.id == be32_to_cpu(pay.pkt.hdr.id));
+    rsp = rp_wait_resp_tag(s->rp, in.id);
 
     if (!tr->rw) {
         data = rp_busaccess_rx_dataptr(s->peer, &rsp.pkt->busaccess_ext_base);
         /* Data up to 8 bytes is return as values.  */
         if (tr->size <= 8) {
             for (i = 0; i < tr->size; i++) {
-                tr->data.u64 |= data[i] << (i * 8);
+                tr->data.u64 |= (uint64_t)data[i] << (i * 8);
             }
         } else {
             memcpy(tr->data.p8, data, tr->size);
         }
     }
 
+    if (rsp.pkt->busaccess.attributes & RP_BUS_RESP_MASK) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "remote-port-memory-master: %s at 0x%" PRIx64
+                      " failed, response %" PRIu64 "\n",
+                      tr->rw ? "write" : "read", addr,
+                      (rsp.pkt->busaccess.attributes & RP_BUS_RESP_MASK)
+                      >> RP_BUS_RESP_SHIFT);
+    }
+
     rclk = rsp.pkt->busaccess.timestamp;
-    rp_dpkt_invalidate(&rsp);
+    rp_tag_free(s->rp, in.id);
     rp_rsp_mutex_unlock(s->rp);
     rp_sync_vmclock(s->rp, in.clk, rclk);
     /* Reads are sync-points, roll the sync timer.  */
@@ -140,6 +162,29 @@ static void rp_io_access(MemoryTransaction *tr)
     DB_PRINT_L(1, "\n");
 }
 
+static void rp_io_access(MemoryTransaction *tr)
+{
+    RemotePortMap *map = tr->opaque;
+    RemotePortMemoryMaster *s = map->parent;
+    MemoryTransaction sub = *tr;
+    unsigned int i;
+
+    if (tr->size <= RP_MAX_ACCESS_SIZE || s->peer->caps.busaccess_burst) {
+        rp_io_access_one(tr);
+        return;
+    }
+
+    /* The peer can't take bursts, split them up. The memory core only
+       issues power of 2 sizes so the pieces are all the same size.  */
+    assert(QEMU_IS_ALIGNED(tr->size, RP_MAX_ACCESS_SIZE));
+    sub.size = RP_MAX_ACCESS_SIZE;
+    for (i = 0; i < tr->size; i += RP_MAX_ACCESS_SIZE) {
+        sub.addr = tr->addr + i;
+        sub.data.p8 = tr->data.p8 + i;
+        rp_io_access_one(&sub);
+    }
+}
+
 static const MemoryRegionOps rp_ops_template = {
     .access = rp_io_access,
     .valid.max_access_size = RP_MAX_ACCESS_SIZE,
@@ -151,11 +196,12 @@ static void rp_memory_master_realize(DeviceState *dev, Error **errp)
 {
     RemotePortMemoryMaster *s = REMOTE_PORT_MEMORY_MASTER(dev);
 
-    /* Sanity check max access size.  */
-    if (s->max_access_size > RP_MAX_ACCESS_SIZE) {
+    /* Sanity check max access size. Accesses above RP_MAX_ACCESS_SIZE
+       are split if the peer doesn't support bursts.  */
+    if (s->max_access_size > RP_MAX_BURST_SIZE) {
         error_setg(errp, "%s: max-access-size %d too large! MAX is %d",
                    TYPE_REMOTE_PORT_MEMORY_MASTER, s->max_access_size,
-                   RP_MAX_ACCESS_SIZE);
+                   RP_MAX_BURST_SIZE);
         return;
     }
 
@@ -201,6 +247,7 @@ static bool rp_parse_reg(FDTGenericMMap *obj, FDTGenericRegPropInfo reg,
                               &s->mmaps[i], name, reg.s[i]);
         sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmaps[i].iomem);
         s->mmaps[i].parent = s;
+        s->mmaps[i].posted = i < 32 && (s->posted_writes & (1U << i));
         g_free(name);
     }
 
@@ -212,6 +259,8 @@ static Property rp_properties[] = {
     DEFINE_PROP_BOOL("relative", RemotePortMemoryMaster, relative, false),
     DEFINE_PROP_UINT32("max-access-size", RemotePortMemoryMaster,
                        max_access_size, RP_MAX_ACCESS_SIZE),
+    DEFINE_PROP_UINT32("posted-writes", RemotePortMemoryMaster,
+                       posted_writes, 0),
     DEFINE_PROP_END_OF_LIST()
 };
 
@@ -52,20 +52,55 @@ static void process_data_slow(RemotePortMemorySlave *s,
     }
 }
 
+/*
+ * Map the whole access if it hits RAM. Other regions go through
+ * dma_memory_rw so that they see our attributes, bounce buffers don't.
+ */
+static void *rp_map(RemotePortMemorySlave *s, uint64_t addr, uint32_t len,
+                    bool is_write)
+{
+    MemoryRegion *mr;
+    hwaddr xlat;
+    hwaddr plen = len;
+    bool direct;
+    void *p;
+
+    rcu_read_lock();
+    mr = address_space_translate(s->as, addr, &xlat, &plen, is_write,
+                                 s->attr);
+    direct = memory_access_is_direct(mr, is_write) && plen >= len;
+    rcu_read_unlock();
+    if (!direct) {
+        return NULL;
+    }
+
+    plen = len;
+    p = address_space_map(s->as, addr, &plen, is_write, s->attr);
+    if (p && plen < len) {
+        address_space_unmap(s->as, p, plen, is_write, 0);
+        p = NULL;
+    }
+    return p;
+}
+
 static void rp_cmd_rw(RemotePortMemorySlave *s, struct rp_pkt *pkt,
                       DMADirection dir)
 {
     size_t pktlen = sizeof(struct rp_pkt_busaccess_ext_base);
     struct rp_encode_busaccess_in in = {0};
+    bool is_write = dir == DMA_DIRECTION_FROM_DEVICE;
+    uint32_t len = pkt->busaccess.len;
     size_t enclen;
     int64_t delay;
     uint8_t *data = NULL;
     uint8_t *byte_en;
+    void *map = NULL;
+    uint64_t resp = RP_RESP_OK;
 
     byte_en = rp_busaccess_byte_en_ptr(s->peer, &pkt->busaccess_ext_base);
 
     if (dir == DMA_DIRECTION_TO_DEVICE) {
-        pktlen += pkt->busaccess.len;
+        pktlen += len;
     } else {
         data = rp_busaccess_rx_dataptr(s->peer, &pkt->busaccess_ext_base);
     }
@@ -74,8 +109,20 @@ static void rp_cmd_rw(RemotePortMemorySlave *s, struct rp_pkt *pkt,
     assert(pkt->busaccess.stream_width == pkt->busaccess.len);
     assert(!(pkt->hdr.flags & RP_PKT_FLAGS_response));
 
+    s->attr.secure = !!(pkt->busaccess.attributes & RP_BUS_ATTR_SECURE);
+    s->attr.master_id = pkt->busaccess.master_id;
+
+    if (!byte_en) {
+        map = rp_map(s, pkt->busaccess.addr, len, is_write);
+    }
+
+    if (map && !is_write) {
+        /* Read responses are sent straight from guest memory.  */
+        data = map;
+        pktlen -= len;
+    }
     rp_dpkt_alloc(&s->rsp, pktlen);
-    if (dir == DMA_DIRECTION_TO_DEVICE) {
+    if (dir == DMA_DIRECTION_TO_DEVICE && !map) {
         data = rp_busaccess_tx_dataptr(s->peer,
                                        &s->rsp.pkt->busaccess_ext_base);
     }
@@ -84,14 +131,16 @@ static void rp_cmd_rw(RemotePortMemorySlave *s, struct rp_pkt *pkt,
         qemu_hexdump((const char *)data, stderr, ": write: ",
                      pkt->busaccess.len);
     }
-    s->attr.secure = !!(pkt->busaccess.attributes & RP_BUS_ATTR_SECURE);
-    s->attr.master_id = pkt->busaccess.master_id;
 
     if (byte_en) {
         process_data_slow(s, pkt, dir, data, byte_en);
-    } else {
-        dma_memory_rw_attr(s->as, pkt->busaccess.addr, data,
-                           pkt->busaccess.len, dir, s->attr);
+    } else if (map) {
+        if (is_write) {
+            memcpy(map, data, len);
+        }
+    } else if (dma_memory_rw_attr(s->as, pkt->busaccess.addr, data,
+                                  pkt->busaccess.len, dir, s->attr)) {
+        resp = RP_RESP_BUS_GENERIC_ERROR;
     }
     if (dir == DMA_DIRECTION_TO_DEVICE && REMOTE_PORT_DEBUG_LEVEL > 0) {
         DB_PRINT_L(0, "address: %" PRIx64 "\n", pkt->busaccess.addr);
@@ -105,11 +154,26 @@ static void rp_cmd_rw(RemotePortMemorySlave *s, struct rp_pkt *pkt,
 
     rp_encode_busaccess_in_rsp_init(&in, pkt);
     in.clk = pkt->busaccess.timestamp + delay;
+    in.attr |= resp << RP_BUS_RESP_SHIFT;
     enclen = rp_encode_busaccess(s->peer, &s->rsp.pkt->busaccess_ext_base,
                                  &in);
-    assert(enclen <= pktlen);
 
-    rp_write(s->rp, (void *)s->rsp.pkt, enclen);
+    if (map && !is_write) {
+        struct iovec iov[] = {
+            { .iov_base = s->rsp.pkt, .iov_len = enclen - len },
+            { .iov_base = map, .iov_len = len },
+        };
+
+        assert(iov[0].iov_len <= pktlen);
+        rp_writev(s->rp, iov, ARRAY_SIZE(iov));
+    } else {
+        assert(enclen <= pktlen);
+        rp_write(s->rp, (void *)s->rsp.pkt, enclen);
+    }
+
+    if (map) {
+        address_space_unmap(s->as, map, len, is_write, len);
+    }
 }
 
 static void rp_memory_slave_realize(DeviceState *dev, Error **errp)
@@ -87,6 +87,7 @@ static const char *rp_cmd_names[RP_CMD_max + 1] = {
     [RP_CMD_write] = "write",
     [RP_CMD_interrupt] = "interrupt",
     [RP_CMD_sync] = "sync",
+    [RP_CMD_shm_setup] = "shm_setup",
 };
 
 const char *rp_cmd_to_string(enum rp_cmd cmd)
@@ -188,6 +189,11 @@ int rp_decode_payload(struct rp_pkt *pkt)
         pkt->sync.timestamp = be64toh(pkt->interrupt.timestamp);
         used += pkt->hdr.len;
         break;
+    case RP_CMD_shm_setup:
+        assert(pkt->hdr.len >= sizeof pkt->shm_setup - sizeof pkt->hdr);
+        pkt->shm_setup.size = be64toh(pkt->shm_setup.size);
+        used += pkt->hdr.len;
+        break;
     default:
         break;
     }
@@ -388,6 +394,77 @@ size_t rp_encode_sync_resp(uint32_t id, uint32_t dev,
     return rp_encode_sync_common(id, dev, pkt, clk, RP_PKT_FLAGS_response);
 }
 
+size_t rp_encode_shm_setup(uint32_t id, uint32_t dev,
+                           struct rp_pkt_shm_setup *pkt,
+                           uint64_t size, uint32_t flags)
+{
+    rp_encode_hdr(&pkt->hdr, RP_CMD_shm_setup, id, dev,
+                  sizeof *pkt - sizeof pkt->hdr, flags);
+    pkt->size = htobe64(size);
+    return sizeof *pkt;
+}
+
+bool rp_shm_ring_init(struct rp_shm_ring *ring, size_t region_size)
+{
+    size_t size = 1;
+
+    if (region_size <= sizeof *ring) {
+        return false;
+    }
+
+    /* Largest power of 2 that fits.  */
+    while (size * 2 <= region_size - sizeof *ring && size * 2 <= UINT32_MAX) {
+        size *= 2;
+    }
+
+    memset(ring, 0, sizeof *ring);
+    ring->size = size;
+    ring->magic = RP_SHM_RING_MAGIC;
+    return true;
+}
+
+/*
+ * The peer can write to every field of the ring, so the counters are read
+ * once and checked against the size we cached at setup time.
+ */
+ssize_t rp_shm_ring_write(struct rp_shm_ring *ring, uint32_t size,
+                          const void *buf, size_t len)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t mask = size - 1;
+    size_t first;
+
+    if (head - tail > size) {
+        return -1;
+    }
+    len = MIN(len, size - (head - tail));
+    first = MIN(len, size - (head & mask));
+    memcpy(ring->data + (head & mask), buf, first);
+    memcpy(ring->data, (const uint8_t *) buf + first, len - first);
+    __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+    return len;
+}
+
+ssize_t rp_shm_ring_read(struct rp_shm_ring *ring, uint32_t size,
+                         void *buf, size_t len)
+{
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t mask = size - 1;
+    size_t first;
+
+    if (head - tail > size) {
+        return -1;
+    }
+    len = MIN(len, head - tail);
+    first = MIN(len, size - (tail & mask));
+    memcpy(buf, ring->data + (tail & mask), first);
+    memcpy((uint8_t *) buf + first, ring->data, len - first);
+    __atomic_store_n(&ring->tail, tail + len, __ATOMIC_RELEASE);
+    return len;
+}
+
 void rp_process_caps(struct rp_peer_state *peer,
                      void *caps, size_t caps_len)
 {
@@ -407,6 +484,12 @@ void rp_process_caps(struct rp_peer_state *peer,
         case CAP_BUSACCESS_EXT_BYTE_EN:
             peer->caps.busaccess_ext_byte_en = true;
             break;
+        case CAP_SHM_RING:
+            peer->caps.shm_ring = true;
+            break;
+        case CAP_BUSACCESS_BURST:
+            peer->caps.busaccess_burst = true;
+            break;
         }
     }
 }
@@ -16,14 +16,21 @@
 #include "hw/ptimer.h"
 #include "qemu/sockets.h"
 #include "qemu/thread.h"
+#include "qemu/atomic.h"
 #include "qemu/log.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
+#include "qapi/visitor.h"
 #include "qemu/error-report.h"
 #include "qom/cpu.h"
 
 #ifndef _WIN32
 #include <sys/mman.h>
 #endif
+#ifdef CONFIG_EVENTFD
+#include <poll.h>
+#include "qemu/memfd.h"
+#endif
 
 #include "hw/fdt_generic_util.h"
 #include "hw/remote-port-proto.h"
@@ -49,6 +56,9 @@
 #define REMOTE_PORT_CLASS(klass)    \
      OBJECT_CLASS_CHECK(RemotePortClass, (klass), TYPE_REMOTE_PORT)
 
+/* Nr of packets per quantum above which the adaptive quantum shrinks.  */
+#define RP_SYNC_BUSY 4
+
 static bool time_warp_enable = true;
 
 bool rp_time_warp_enable(bool en)
@@ -71,7 +81,8 @@ static void rp_pkt_dump(const char *prefix, const char *buf, size_t len)
 
 uint32_t rp_new_id(RemotePort *s)
 {
-    return s->current_id++;
+    /* Ids are used to match tagged responses, they must be unique.  */
+    return atomic_fetch_inc(&s->current_id);
 }
 
 void rp_rsp_mutex_lock(RemotePort *s)
@@ -113,12 +124,174 @@ static void rp_fatal_error(RemotePort *s, const char *reason)
     exit(EXIT_FAILURE);
 }
 
+#ifdef CONFIG_EVENTFD
+/* Largest ring we map on behalf of the peer.  */
+#define RP_SHM_MAX_SIZE (256 * MiB)
+
+/*
+ * Release our receive ring and its doorbells, whatever state the offer
+ * got to. Called from the protocol thread.
+ */
+static void rp_shm_teardown_rx(RemotePort *s)
+{
+    s->shm.rx_active = false;
+    if (s->shm.rx_notifiers) {
+        event_notifier_cleanup(&s->shm.rx_data);
+        event_notifier_cleanup(&s->shm.rx_space);
+        s->shm.rx_notifiers = false;
+    }
+    if (s->shm.rx) {
+        qemu_memfd_free(s->shm.rx, s->shm.size, s->shm.rx_fd);
+        s->shm.rx = NULL;
+    }
+}
+
+/* Same for the peer's ring, switching writers back to the socket.  */
+static void rp_shm_teardown_tx(RemotePort *s)
+{
+    qemu_mutex_lock(&s->write_mutex);
+    s->shm.tx_active = false;
+    qemu_mutex_unlock(&s->write_mutex);
+
+    if (s->shm.tx_notifiers) {
+        event_notifier_cleanup(&s->shm.tx_data);
+        event_notifier_cleanup(&s->shm.tx_space);
+        s->shm.tx_notifiers = false;
+    }
+    if (s->shm.tx) {
+        munmap(s->shm.tx, s->shm.tx_size);
+        s->shm.tx = NULL;
+    }
+}
+
+static void rp_shm_teardown(RemotePort *s)
+{
+    rp_shm_teardown_rx(s);
+    rp_shm_teardown_tx(s);
+}
+
+/*
+ * Sleep on a doorbell. The peer never rings it if it dies, so watch the
+ * socket too, it is hung up when the peer goes away. Nothing else is
+ * read from the socket once the ring is in use.
+ * Returns false if the peer is gone.
+ */
+static bool rp_shm_wait(RemotePort *s, EventNotifier *e)
+{
+    struct pollfd pfd[2] = {
+        {
+            .fd = event_notifier_get_fd(e),
+            .events = POLLIN,
+        },
+        {
+            .fd = qemu_chr_fe_get_fd(&s->chr),
+#ifdef POLLRDHUP
+            .events = POLLRDHUP,
+#endif
+        },
+    };
+
+    if (pfd[1].fd < 0) {
+        return false;
+    }
+    while (poll(pfd, ARRAY_SIZE(pfd), -1) < 0 && errno == EINTR) {
+        continue;
+    }
+    if (pfd[1].revents) {
+        return false;
+    }
+    event_notifier_test_and_clear(e);
+    return true;
+}
+
+/*
+ * The waiting flags and the ring counters are ordered with full barriers
+ * on both sides, so either the sleeper sees the new data/space or the
+ * other side sees the flag and rings the doorbell.
+ */
+static void rp_shm_send(RemotePort *s, const void *buf, size_t count)
+{
+    struct rp_shm_ring *ring = s->shm.tx;
+    uint32_t size = s->shm.tx_ring_size;
+    const uint8_t *p = buf;
+    ssize_t n;
+
+    while (count) {
+        n = rp_shm_ring_write(ring, size, p, count);
+        if (!n) {
+            /* Ring is full, sleep until the peer makes room.  */
+            atomic_set(&ring->producer_waiting, 1);
+            smp_mb();
+            n = rp_shm_ring_write(ring, size, p, count);
+            if (!n && !rp_shm_wait(s, &s->shm.tx_space)) {
+                /* write_mutex is held, leave the rings to exit.  */
+                rp_fatal_error(s, "Disconnected");
+            }
+            atomic_set(&ring->producer_waiting, 0);
+        }
+        if (n < 0) {
+            rp_fatal_error(s, "Bad shm ring");
+        }
+        p += n;
+        count -= n;
+
+        smp_mb();
+        if (n && atomic_read(&ring->consumer_waiting)) {
+            event_notifier_set(&s->shm.tx_data);
+        }
+    }
+}
+
+static void rp_shm_recv(RemotePort *s, void *buf, size_t count)
+{
+    struct rp_shm_ring *ring = s->shm.rx;
+    uint32_t size = s->shm.rx_ring_size;
+    uint8_t *p = buf;
+    ssize_t n;
+
+    while (count) {
+        n = rp_shm_ring_read(ring, size, p, count);
+        if (!n) {
+            atomic_set(&ring->consumer_waiting, 1);
+            smp_mb();
+            n = rp_shm_ring_read(ring, size, p, count);
+            if (!n && !rp_shm_wait(s, &s->shm.rx_data)) {
+                rp_shm_teardown(s);
+                rp_fatal_error(s, "Disconnected");
+            }
+            atomic_set(&ring->consumer_waiting, 0);
+        }
+        if (n < 0) {
+            rp_shm_teardown(s);
+            rp_fatal_error(s, "Bad shm ring");
+        }
+        p += n;
+        count -= n;
+
+        smp_mb();
+        if (n && atomic_read(&ring->producer_waiting)) {
+            event_notifier_set(&s->shm.rx_space);
+        }
+    }
+}
+#endif
+
 static ssize_t rp_recv(RemotePort *s, void *buf, size_t count)
 {
     ssize_t r;
 
+#ifdef CONFIG_EVENTFD
+    if (s->shm.rx_active) {
+        rp_shm_recv(s, buf, count);
+        return count;
+    }
+#endif
+
     r = qemu_chr_fe_read_all(&s->chr, buf, count);
     if (r <= 0) {
+#ifdef CONFIG_EVENTFD
+        rp_shm_teardown(s);
+#endif
         rp_fatal_error(s, "Disconnected");
     }
     if (r != count) {
@@ -130,13 +303,18 @@ static ssize_t rp_recv(RemotePort *s, void *buf, size_t count)
     return r;
 }
 
-ssize_t rp_write(RemotePort *s, const void *buf, size_t count)
+/* Called with write_mutex held.  */
+static ssize_t rp_write_locked(RemotePort *s, const void *buf, size_t count)
 {
     ssize_t r;
 
-    qemu_mutex_lock(&s->write_mutex);
+#ifdef CONFIG_EVENTFD
+    if (s->shm.tx_active) {
+        rp_shm_send(s, buf, count);
+        return count;
+    }
+#endif
     r = qemu_chr_fe_write(&s->chr, buf, count);
-    qemu_mutex_unlock(&s->write_mutex);
     if (r <= 0) {
         error_report("%s: Disconnected r=%zd buf=%p count=%zd\n",
                      s->prefix, r, buf, count);
@@ -145,10 +323,34 @@ ssize_t rp_write(RemotePort *s, const void *buf, size_t count)
     return r;
 }
 
+ssize_t rp_write(RemotePort *s, const void *buf, size_t count)
+{
+    ssize_t r;
+
+    qemu_mutex_lock(&s->write_mutex);
+    r = rp_write_locked(s, buf, count);
+    qemu_mutex_unlock(&s->write_mutex);
+    return r;
+}
+
+ssize_t rp_writev(RemotePort *s, const struct iovec *iov, int iovcnt)
+{
+    ssize_t r = 0;
+    int i;
+
+    qemu_mutex_lock(&s->write_mutex);
+    for (i = 0; i < iovcnt; i++) {
+        r += rp_write_locked(s, iov[i].iov_base, iov[i].iov_len);
+    }
+    qemu_mutex_unlock(&s->write_mutex);
+    return r;
+}
+
 /* Warp time if cpus are idle. diff is max time in ns to warp.  */
 static int64_t rp_time_warp(RemotePort *s, int64_t diff)
 {
-    int64_t future = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + diff;
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int64_t future = start + diff;
     int64_t clk;
 
     if (!time_warp_enable) {
@@ -166,6 +368,7 @@ static int64_t rp_time_warp(RemotePort *s, int64_t diff)
         }
     } while (clk < future);
 
+    atomic_add(&s->sync.stats.warp_ns, clk - start);
     return future - clk;
 }
 
@@ -194,6 +397,113 @@ RemotePortDynPkt rp_wait_resp(RemotePort *s)
     return s->rspqueue;
 }
 
+static int rp_tag_find(RemotePort *s, uint32_t id)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(s->tags); i++) {
+        if (s->tags[i].state != RP_TAG_FREE && s->tags[i].id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void rp_tag_alloc(RemotePort *s, uint32_t id, bool posted)
+{
+    int i;
+
+    while (1) {
+        for (i = 0; i < ARRAY_SIZE(s->tags); i++) {
+            if (s->tags[i].state == RP_TAG_FREE) {
+                s->tags[i].id = id;
+                s->tags[i].state = posted ? RP_TAG_POSTED : RP_TAG_PENDING;
+                s->posted += posted;
+                return;
+            }
+        }
+        /* All tags in flight, wait for one to complete.  */
+        rp_event_read(s);
+        qemu_cond_wait(&s->progress_cond, &s->rsp_mutex);
+    }
+}
+
+RemotePortDynPkt rp_wait_resp_tag(RemotePort *s, uint32_t id)
+{
+    int i = rp_tag_find(s, id);
+
+    assert(i >= 0 && s->tags[i].state != RP_TAG_POSTED);
+    while (s->tags[i].state != RP_TAG_DONE) {
+        rp_event_read(s);
+        qemu_cond_wait(&s->progress_cond, &s->rsp_mutex);
+    }
+    return s->tags[i].rsp;
+}
+
+void rp_tag_free(RemotePort *s, uint32_t id)
+{
+    int i = rp_tag_find(s, id);
+
+    assert(i >= 0 && s->tags[i].state == RP_TAG_DONE);
+    rp_dpkt_invalidate(&s->tags[i].rsp);
+    s->tags[i].state = RP_TAG_FREE;
+    /* Someone may be waiting for a free tag.  */
+    qemu_cond_broadcast(&s->progress_cond);
+}
+
+void rp_drain_posted(RemotePort *s)
+{
+    while (s->posted) {
+        rp_event_read(s);
+        qemu_cond_wait(&s->progress_cond, &s->rsp_mutex);
+    }
+}
+
+int64_t rp_posted_clk(RemotePort *s)
+{
+    return s->posted_clk;
+}
+
+/* Route a response to its tag. Called with rsp_mutex held.  */
+static bool rp_tag_complete(RemotePort *s, RemotePortDynPkt *dpkt)
+{
+    int i = rp_tag_find(s, dpkt->pkt->hdr.id);
+
+    if (i < 0) {
+        return false;
+    }
+
+    switch (s->tags[i].state) {
+    case RP_TAG_POSTED:
+        /* Nobody is waiting for the data, report failures and retire.  */
+        if (dpkt->pkt->busaccess.attributes & RP_BUS_RESP_MASK) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: posted write to 0x%" PRIx64 " failed, "
+                          "response %" PRIu64 "\n", s->prefix,
+                          dpkt->pkt->busaccess.addr,
+                          (dpkt->pkt->busaccess.attributes & RP_BUS_RESP_MASK)
+                          >> RP_BUS_RESP_SHIFT);
+            atomic_inc(&s->posted_errors);
+        }
+        s->posted_clk = MAX(s->posted_clk,
+                            (int64_t) dpkt->pkt->busaccess.timestamp);
+        s->tags[i].state = RP_TAG_FREE;
+        assert(s->posted);
+        s->posted--;
+        break;
+    case RP_TAG_PENDING:
+        rp_dpkt_swap(&s->tags[i].rsp, dpkt);
+        s->tags[i].state = RP_TAG_DONE;
+        break;
+    default:
+        error_report("%s: duplicate response for id %u\n",
+                     s->prefix, dpkt->pkt->hdr.id);
+        rp_fatal_error(s, "Bad response");
+    }
+    qemu_cond_broadcast(&s->progress_cond);
+    return true;
+}
+
 void rp_sync_vmclock(RemotePort *s, int64_t lclk, int64_t rclk)
 {
     int64_t diff;
@@ -218,6 +528,156 @@ void rp_sync_vmclock(RemotePort *s, int64_t lclk, int64_t rclk)
     }
 }
 
+#ifdef CONFIG_EVENTFD
+/* Allocate our receive ring and offer it to the peer.  */
+static void rp_shm_offer(RemotePort *s)
+{
+    struct rp_pkt_shm_setup pkt;
+    Error *err = NULL;
+    int fds[3];
+    size_t len;
+    ssize_t r;
+
+    /* A hello means a new peer, which knows nothing of earlier rings.  */
+    rp_shm_teardown(s);
+
+    s->shm.rx = qemu_memfd_alloc("remote-port", s->shm.size, 0,
+                                 &s->shm.rx_fd, &err);
+    if (!s->shm.rx) {
+        error_report_err(err);
+        return;
+    }
+    rp_shm_ring_init(s->shm.rx, s->shm.size);
+    s->shm.rx_ring_size = s->shm.rx->size;
+
+    if (event_notifier_init(&s->shm.rx_data, 0) < 0) {
+        goto fail;
+    }
+    if (event_notifier_init(&s->shm.rx_space, 0) < 0) {
+        event_notifier_cleanup(&s->shm.rx_data);
+        goto fail;
+    }
+    s->shm.rx_notifiers = true;
+
+    fds[0] = s->shm.rx_fd;
+    fds[1] = event_notifier_get_fd(&s->shm.rx_data);
+    fds[2] = event_notifier_get_fd(&s->shm.rx_space);
+    len = rp_encode_shm_setup(rp_new_id(s), 0, &pkt, s->shm.size, 0);
+
+    qemu_mutex_lock(&s->write_mutex);
+    if (qemu_chr_fe_set_msgfds(&s->chr, fds, ARRAY_SIZE(fds)) < 0) {
+        qemu_mutex_unlock(&s->write_mutex);
+        warn_report("%s: shm transport needs a UNIX socket chardev",
+                    s->prefix);
+        rp_shm_teardown_rx(s);
+        return;
+    }
+    r = qemu_chr_fe_write(&s->chr, (void *) &pkt, len);
+    qemu_mutex_unlock(&s->write_mutex);
+    if (r <= 0) {
+        rp_fatal_error(s, "Bad write");
+    }
+    return;
+
+fail:
+    error_report("%s: Unable to create shm doorbells", s->prefix);
+    rp_shm_teardown_rx(s);
+}
+
+static void rp_cmd_shm_setup(RemotePort *s, struct rp_pkt *pkt)
+{
+    struct rp_pkt_shm_setup rsp;
+    struct rp_shm_ring *ring;
+    uint64_t size = pkt->shm_setup.size;
+    uint32_t ring_size;
+    struct stat st;
+    int fds[3];
+    size_t len;
+    ssize_t r;
+    int i;
+
+    if (pkt->hdr.flags & RP_PKT_FLAGS_response) {
+        /* The peer has switched, the rest comes through the ring.  */
+        if (!s->shm.rx) {
+            error_report("%s: shm setup response without an offer",
+                         s->prefix);
+            return;
+        }
+        s->shm.rx_active = true;
+        return;
+    }
+
+    /* The peer is offering a new ring, drop the one it gave us before.  */
+    rp_shm_teardown_tx(s);
+
+    memset(fds, -1, sizeof fds);
+    qemu_chr_fe_get_msgfds(&s->chr, fds, ARRAY_SIZE(fds));
+    if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0) {
+        error_report("%s: shm setup without file descriptors", s->prefix);
+        goto fail;
+    }
+
+    if (fstat(fds[0], &st) < 0) {
+        error_report("%s: Unable to stat shm ring: %s", s->prefix,
+                     strerror(errno));
+        goto fail;
+    }
+    if (size < sizeof *ring || size > RP_SHM_MAX_SIZE || size > st.st_size) {
+        error_report("%s: Bad shm ring size %" PRIu64, s->prefix, size);
+        goto fail;
+    }
+
+    ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    if (ring == MAP_FAILED) {
+        error_report("%s: Unable to map shm ring: %s", s->prefix,
+                     strerror(errno));
+        goto fail;
+    }
+    s->shm.tx = ring;
+    s->shm.tx_size = size;
+    /* Read the size once, the peer can still change it.  */
+    ring_size = atomic_read(&ring->size);
+    if (ring->magic != RP_SHM_RING_MAGIC || !is_power_of_2(ring_size)
+        || ring_size > size - sizeof *ring) {
+        error_report("%s: Bad shm ring", s->prefix);
+        goto fail;
+    }
+    s->shm.tx_ring_size = ring_size;
+    close(fds[0]);
+
+    /* The doorbells own their fds from here on.  */
+    event_notifier_init_fd(&s->shm.tx_data, fds[1]);
+    event_notifier_init_fd(&s->shm.tx_space, fds[2]);
+    s->shm.tx_notifiers = true;
+
+    /* Ack on the socket and switch over, atomically wrt other writers.  */
+    len = rp_encode_shm_setup(pkt->hdr.id, pkt->hdr.dev, &rsp, size,
+                              RP_PKT_FLAGS_response);
+    qemu_mutex_lock(&s->write_mutex);
+    r = qemu_chr_fe_write(&s->chr, (void *) &rsp, len);
+    s->shm.tx_active = true;
+    qemu_mutex_unlock(&s->write_mutex);
+    if (r <= 0) {
+        rp_fatal_error(s, "Bad write");
+    }
+    return;
+
+fail:
+    /* Keep using the socket.  */
+    for (i = 0; i < ARRAY_SIZE(fds); i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    rp_shm_teardown_tx(s);
+}
+#else
+static void rp_cmd_shm_setup(RemotePort *s, struct rp_pkt *pkt)
+{
+    /* We never advertise CAP_SHM_RING, ignore it.  */
+}
+#endif
+
 static void rp_cmd_hello(RemotePort *s, struct rp_pkt *pkt)
 {
     s->peer.version = pkt->hello.version;
@@ -233,6 +693,12 @@ static void rp_cmd_hello(RemotePort *s, struct rp_pkt *pkt)
 
         rp_process_caps(&s->peer, caps, pkt->hello.caps.len);
     }
+
+#ifdef CONFIG_EVENTFD
+    if (s->shm.enable && s->peer.caps.shm_ring) {
+        rp_shm_offer(s);
+    }
+#endif
 }
 
 static void rp_cmd_sync(RemotePort *s, struct rp_pkt *pkt)
@@ -243,6 +709,8 @@ static void rp_cmd_sync(RemotePort *s, struct rp_pkt *pkt)
 
     assert(!(pkt->hdr.flags & RP_PKT_FLAGS_response));
 
+    atomic_inc(&s->sync.stats.peer_syncs);
+
     /* If cpus are idle. warp.  */
     clk = rp_normalized_vmclk(s);
     diff = pkt->sync.timestamp - clk;
@@ -281,16 +749,24 @@ static void rp_say_hello(RemotePort *s)
     uint32_t caps[] = {
         CAP_BUSACCESS_EXT_BASE,
         CAP_BUSACCESS_EXT_BYTE_EN,
+        CAP_BUSACCESS_BURST,
+        CAP_SHM_RING,
     };
+    unsigned int nr_caps = ARRAY_SIZE(caps);
     size_t len;
 
+    if (!s->shm.enable) {
+        /* CAP_SHM_RING is last.  */
+        nr_caps--;
+    }
+
     len = rp_encode_hello_caps(s->current_id++, 0, &pkt, RP_VERSION_MAJOR,
                                RP_VERSION_MINOR,
-                               caps, caps, sizeof caps / sizeof caps[0]);
+                               caps, caps, nr_caps);
     rp_write(s, (void *) &pkt, len);
 
-    if (sizeof caps) {
-        rp_write(s, caps, sizeof caps);
+    if (nr_caps) {
+        rp_write(s, caps, nr_caps * sizeof caps[0]);
     }
 }
 
@@ -315,11 +791,27 @@ static void syncresp_timer_hit(void *opaque)
     rp_leave_iothread(s);
 }
 
+static void rp_sync_adapt(RemotePort *s)
+{
+    unsigned int activity = atomic_xchg(&s->sync.activity, 0);
+
+    if (!s->sync.adaptive) {
+        return;
+    }
+
+    if (activity == 0) {
+        s->sync.quantum = MIN(s->sync.quantum * 2, s->sync.quantum_max);
+    } else if (activity > RP_SYNC_BUSY) {
+        s->sync.quantum = MAX(s->sync.quantum / 2, s->sync.quantum_min);
+    }
+}
+
 static void sync_timer_hit(void *opaque)
 {
     RemotePort *s = REMOTE_PORT(opaque);
     int64_t clk;
     int64_t rclk;
+    int64_t stall;
     RemotePortDynPkt rsp;
 
     clk = rp_normalized_vmclk(s);
@@ -334,6 +826,7 @@ static void sync_timer_hit(void *opaque)
 
     /* Sync.  */
     s->sync.need_sync = false;
+    stall = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     qemu_mutex_lock(&s->rsp_mutex);
     /* Send the sync.  */
     rp_say_sync(s, clk);
@@ -343,8 +836,12 @@ static void sync_timer_hit(void *opaque)
     rclk = rsp.pkt->sync.timestamp;
     rp_dpkt_invalidate(&rsp);
     qemu_mutex_unlock(&s->rsp_mutex);
+    atomic_inc(&s->sync.stats.syncs);
+    atomic_add(&s->sync.stats.stall_ns,
+               qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - stall);
 
     rp_sync_vmclock(s, clk, rclk);
+    rp_sync_adapt(s);
     rp_restart_sync_timer(s);
 }
 
@@ -518,6 +1015,7 @@ static bool rp_pt_cmd_sync(RemotePort *s, struct rp_pkt *pkt)
 
     if (!use_icount || diff < s->sync.quantum) {
         /* We are still OK.  */
+        atomic_inc(&s->sync.stats.peer_syncs);
         rp_write(s, (void *) &rsp, enclen);
         return true;
     }
@@ -538,10 +1036,22 @@ static void rp_pt_process_pkt(RemotePort *s, RemotePortDynPkt *dpkt)
         return;
     }
 
+    if (pkt->hdr.cmd == RP_CMD_shm_setup) {
+        rp_cmd_shm_setup(s, pkt);
+        return;
+    }
+
+    if (pkt->hdr.cmd != RP_CMD_sync) {
+        /* Feeds the adaptive sync quantum.  */
+        atomic_inc(&s->sync.activity);
+    }
+
     if (pkt->hdr.flags & RP_PKT_FLAGS_response) {
         qemu_mutex_lock(&s->rsp_mutex);
-        rp_dpkt_swap(&s->rspqueue, dpkt);
-        qemu_cond_signal(&s->progress_cond);
+        if (!rp_tag_complete(s, dpkt)) {
+            rp_dpkt_swap(&s->rspqueue, dpkt);
+            qemu_cond_broadcast(&s->progress_cond);
+        }
         qemu_mutex_unlock(&s->rsp_mutex);
         return;
     }
@@ -592,6 +1102,10 @@ static void *rp_protocol_thread(void *arg)
     /* Make sure we have a decent bufsize to start with.  */
     rp_dpkt_alloc(&s->rsp, sizeof s->rsp.pkt->busaccess + 1024);
     rp_dpkt_alloc(&s->rspqueue, sizeof s->rspqueue.pkt->busaccess + 1024);
+    for (i = 0; i < ARRAY_SIZE(s->tags); i++) {
+        rp_dpkt_alloc(&s->tags[i].rsp,
+                      sizeof s->tags[i].rsp.pkt->busaccess + 1024);
+    }
     for (i = 0; i < ARRAY_SIZE(s->rx_queue.pkt); i++) {
         rp_dpkt_alloc(&s->rx_queue.pkt[i],
                       sizeof s->rx_queue.pkt[i].pkt->busaccess + 1024);
@@ -625,6 +1139,21 @@ static void rp_realize(DeviceState *dev, Error **errp)
 
     s->peer.clk_base = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
 
+    if (s->shm.enable) {
+#ifdef CONFIG_EVENTFD
+        if (s->shm.size <= sizeof(struct rp_shm_ring)
+            || s->shm.size > RP_SHM_MAX_SIZE) {
+            error_setg(errp, "%s: shm-size %u out of range", s->prefix,
+                       s->shm.size);
+            return;
+        }
+#else
+        warn_report("%s: shm transport not supported on this host",
+                    s->prefix);
+        s->shm.enable = false;
+#endif
+    }
+
     qemu_mutex_init(&s->write_mutex);
     qemu_mutex_init(&s->rsp_mutex);
     qemu_cond_init(&s->progress_cond);
@@ -746,6 +1275,15 @@ static void rp_realize(DeviceState *dev, Error **errp)
        After config negotiation with the peer, sync.quantum value might
        change.  */
     s->sync.quantum = s->peer.local_cfg.quantum;
+    if (s->sync.adaptive) {
+        if (s->sync.quantum_min > s->sync.quantum_max) {
+            error_setg(errp, "%s: sync-quantum-min is above sync-quantum-max",
+                       s->prefix);
+            return;
+        }
+        s->sync.quantum = MAX(s->sync.quantum, s->sync.quantum_min);
+        s->sync.quantum = MIN(s->sync.quantum, s->sync.quantum_max);
+    }
 
     s->sync.bh = qemu_bh_new(sync_timer_hit, s);
     s->sync.bh_resp = qemu_bh_new(syncresp_timer_hit, s);
@@ -779,9 +1317,25 @@ static Property rp_properties[] = {
     DEFINE_PROP_BOOL("sync", RemotePort, do_sync, false),
     DEFINE_PROP_UINT64("sync-quantum", RemotePort, peer.local_cfg.quantum,
                        1000000),
+    DEFINE_PROP_BOOL("sync-adaptive", RemotePort, sync.adaptive, false),
+    DEFINE_PROP_UINT64("sync-quantum-min", RemotePort, sync.quantum_min,
+                       10000),
+    DEFINE_PROP_UINT64("sync-quantum-max", RemotePort, sync.quantum_max,
+                       100000000),
+    DEFINE_PROP_BOOL("shm", RemotePort, shm.enable, false),
+    DEFINE_PROP_UINT32("shm-size", RemotePort, shm.size, 1 * 1024 * 1024),
     DEFINE_PROP_END_OF_LIST(),
 };
 
+/* Sync state is updated from several threads, read it atomically.  */
+static void rp_get_stat(Object *obj, Visitor *v, const char *name,
+                        void *opaque, Error **errp)
+{
+    uint64_t value = atomic_read__nocheck((uint64_t *) opaque);
+
+    visit_type_uint64(v, name, &value, errp);
+}
+
 static void rp_init(Object *obj)
 {
     RemotePort *s = REMOTE_PORT(obj);
@@ -799,6 +1353,20 @@ static void rp_init(Object *obj)
                              &error_abort);
         g_free(name);
     }
+
+    /* Sync statistics, readable with qom-get.  */
+    object_property_add(obj, "sync-quantum-current", "uint64", rp_get_stat,
+                        NULL, NULL, &s->sync.quantum, &error_abort);
+    object_property_add(obj, "sync-count", "uint64", rp_get_stat,
+                        NULL, NULL, &s->sync.stats.syncs, &error_abort);
+    object_property_add(obj, "sync-peer-count", "uint64", rp_get_stat,
+                        NULL, NULL, &s->sync.stats.peer_syncs, &error_abort);
+    object_property_add(obj, "sync-stall-ns", "uint64", rp_get_stat,
+                        NULL, NULL, &s->sync.stats.stall_ns, &error_abort);
+    object_property_add(obj, "sync-warp-ns", "uint64", rp_get_stat,
+                        NULL, NULL, &s->sync.stats.warp_ns, &error_abort);
+    object_property_add(obj, "posted-errors", "uint64", rp_get_stat,
+                        NULL, NULL, &s->posted_errors, &error_abort);
 }
 
 struct rp_peer_state *rp_get_peer(RemotePort *s)
@@ -1,5 +1,6 @@
 #include "qemu/osdep.h"
 #include "hw/stream.h"
+#include "qemu/iov.h"
 
 size_t
 stream_push(StreamSlave *sink, uint8_t *buf, size_t len, uint32_t attr)
@@ -9,6 +10,30 @@ stream_push(StreamSlave *sink, uint8_t *buf, size_t len, uint32_t attr)
     return k->push(sink, buf, len, attr);
 }
 
+size_t
+stream_pushv(StreamSlave *sink, const struct iovec *iov, int iovcnt,
+             uint32_t attr)
+{
+    StreamSlaveClass *k =  STREAM_SLAVE_GET_CLASS(sink);
+    size_t len, ret;
+    uint8_t *buf;
+
+    if (k->pushv) {
+        return k->pushv(sink, iov, iovcnt, attr);
+    }
+    if (iovcnt == 1) {
+        return k->push(sink, iov[0].iov_base, iov[0].iov_len, attr);
+    }
+
+    /* Gather for slaves that only take linear buffers.  */
+    len = iov_size(iov, iovcnt);
+    buf = g_malloc(len);
+    iov_to_buf(iov, iovcnt, 0, buf, len);
+    ret = k->push(sink, buf, len, attr);
+    g_free(buf);
+    return ret;
+}
+
 bool
 stream_can_push(StreamSlave *sink, StreamCanPushNotifyFn notify,
                 void *notify_opaque)
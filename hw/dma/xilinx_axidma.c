@@ -32,6 +32,7 @@
 
 #include "sysemu/dma.h"
 #include "hw/stream.h"
+#include "qemu/iov.h"
 
 #define D(x)
 
@@ -59,6 +60,11 @@
 #define CONTROL_PAYLOAD_WORDS 5
 #define CONTROL_PAYLOAD_SIZE (CONTROL_PAYLOAD_WORDS * (sizeof(uint32_t)))
 
+/* Descriptors are fetched and written back through a mapped window of the
+ * ring. Descriptors are 64 byte aligned, so this covers 8 of them.
+ */
+#define SDESC_WINDOW_SIZE 512
+
 typedef struct XilinxAXIDMA XilinxAXIDMA;
 typedef struct XilinxAXIDMAStreamSlave XilinxAXIDMAStreamSlave;
 
@@ -108,7 +114,6 @@ struct Stream {
     int nr;
 
     struct SDesc desc;
-    int pos;
     unsigned int complete_cnt;
     uint32_t regs[R_MAX];
     uint8_t app[20];
@@ -117,7 +122,18 @@ struct Stream {
     AddressSpace *data_as;
     AddressSpace *sg_as;
 
-    unsigned char txbuf[16 * 1024];
+    /* Mapped window of the descriptor ring */
+    struct {
+        uint8_t *buf;
+        hwaddr addr;
+        bool dirty;
+    } sg_win;
+
+    /* Fragments of the frame being transmitted */
+    struct iovec *tx_iov;
+    bool *tx_mapped;
+    int tx_iovcnt;
+    int tx_iovalloc;
 };
 
 struct XilinxAXIDMAStreamSlave {
@@ -173,10 +189,72 @@ static inline int stream_idle(struct Stream *s)
     return !!(s->regs[R_DMASR] & DMASR_IDLE);
 }
 
+/* Add a payload fragment, mapping guest memory when it is RAM.  */
+static void stream_tx_add(struct Stream *s, hwaddr addr, unsigned int len)
+{
+    void *p;
+
+    if (!len) {
+        return;
+    }
+    if (s->tx_iovcnt == s->tx_iovalloc) {
+        s->tx_iovalloc = MAX(s->tx_iovalloc * 2, 16);
+        s->tx_iov = g_renew(struct iovec, s->tx_iov, s->tx_iovalloc);
+        s->tx_mapped = g_renew(bool, s->tx_mapped, s->tx_iovalloc);
+    }
+
+    p = dma_memory_map_direct(s->data_as, addr, len, DMA_DIRECTION_TO_DEVICE);
+    s->tx_mapped[s->tx_iovcnt] = p != NULL;
+    if (!p) {
+        p = g_malloc(len);
+        dma_memory_read(s->data_as, addr, p, len);
+    }
+    s->tx_iov[s->tx_iovcnt].iov_base = p;
+    s->tx_iov[s->tx_iovcnt].iov_len = len;
+    s->tx_iovcnt++;
+}
+
+static void stream_tx_release(struct Stream *s)
+{
+    int i;
+
+    for (i = 0; i < s->tx_iovcnt; i++) {
+        if (s->tx_mapped[i]) {
+            dma_memory_unmap(s->data_as, s->tx_iov[i].iov_base,
+                             s->tx_iov[i].iov_len, DMA_DIRECTION_TO_DEVICE,
+                             s->tx_iov[i].iov_len);
+        } else {
+            g_free(s->tx_iov[i].iov_base);
+        }
+    }
+    s->tx_iovcnt = 0;
+}
+
+/* The frame continues once the guest queues more descriptors. Don't keep
+ * guest memory mapped meanwhile, it may get remapped.
+ */
+static void stream_tx_detach(struct Stream *s)
+{
+    int i;
+
+    for (i = 0; i < s->tx_iovcnt; i++) {
+        if (s->tx_mapped[i]) {
+            void *p = g_memdup(s->tx_iov[i].iov_base, s->tx_iov[i].iov_len);
+
+            dma_memory_unmap(s->data_as, s->tx_iov[i].iov_base,
+                             s->tx_iov[i].iov_len, DMA_DIRECTION_TO_DEVICE,
+                             s->tx_iov[i].iov_len);
+            s->tx_iov[i].iov_base = p;
+            s->tx_mapped[i] = false;
+        }
+    }
+}
+
 static void stream_reset(struct Stream *s)
 {
     s->regs[R_DMASR] = DMASR_HALTED;  /* starts up halted.  */
     s->regs[R_DMACR] = 1 << 16; /* Starts with one in compl threshold.  */
+    stream_tx_release(s);
 }
 
 /* Map an offset addr into a channel index.  */
@@ -189,11 +267,42 @@ static inline int streamid_from_addr(hwaddr addr)
     return sid;
 }
 
+static void stream_desc_flush(struct Stream *s)
+{
+    if (s->sg_win.buf) {
+        dma_memory_unmap(s->sg_as, s->sg_win.buf, SDESC_WINDOW_SIZE,
+                         DMA_DIRECTION_FROM_DEVICE,
+                         s->sg_win.dirty ? SDESC_WINDOW_SIZE : 0);
+        s->sg_win.buf = NULL;
+        s->sg_win.dirty = false;
+    }
+}
+
+/* Host pointer to the descriptor at addr, NULL if it isn't in RAM.  */
+static uint8_t *stream_desc_ptr(struct Stream *s, hwaddr addr)
+{
+    if (s->sg_win.buf && addr >= s->sg_win.addr &&
+        addr - s->sg_win.addr <= SDESC_WINDOW_SIZE - sizeof(struct SDesc)) {
+        return s->sg_win.buf + (addr - s->sg_win.addr);
+    }
+
+    stream_desc_flush(s);
+    s->sg_win.buf = dma_memory_map_direct(s->sg_as, addr, SDESC_WINDOW_SIZE,
+                                          DMA_DIRECTION_FROM_DEVICE);
+    s->sg_win.addr = addr;
+    return s->sg_win.buf;
+}
+
 static void stream_desc_load(struct Stream *s, hwaddr addr)
 {
     struct SDesc *d = &s->desc;
+    uint8_t *p = stream_desc_ptr(s, addr);
 
-    dma_memory_read(s->sg_as, addr, d, sizeof *d);
+    if (p) {
+        memcpy(d, p, sizeof *d);
+    } else {
+        dma_memory_read(s->sg_as, addr, d, sizeof *d);
+    }
 
     /* Convert from LE into host endianness.  */
     d->buffer_address = le64_to_cpu(d->buffer_address);
@@ -205,13 +314,34 @@ static void stream_desc_load(struct Stream *s, hwaddr addr)
 static void stream_desc_store(struct Stream *s, hwaddr addr)
 {
     struct SDesc *d = &s->desc;
+    uint8_t *p;
 
     /* Convert from host endianness into LE.  */
     d->buffer_address = cpu_to_le64(d->buffer_address);
     d->nxtdesc = cpu_to_le64(d->nxtdesc);
     d->control = cpu_to_le32(d->control);
     d->status = cpu_to_le32(d->status);
-    dma_memory_write(s->sg_as, addr, d, sizeof *d);
+    p = stream_desc_ptr(s, addr);
+    if (p) {
+        memcpy(p, d, sizeof *d);
+        s->sg_win.dirty = true;
+    } else {
+        dma_memory_write(s->sg_as, addr, d, sizeof *d);
+    }
+}
+
+/* Only the status word changes on transmit.  */
+static void stream_desc_store_status(struct Stream *s, hwaddr addr)
+{
+    uint8_t *p = stream_desc_ptr(s, addr);
+    hwaddr off = offsetof(struct SDesc, status);
+
+    if (p) {
+        stl_le_p(p + off, s->desc.status);
+        s->sg_win.dirty = true;
+    } else {
+        stl_le_dma(s->sg_as, addr + off, s->desc.status);
+    }
 }
 
 static void stream_update_irq(struct Stream *s)
@@ -281,30 +411,24 @@ static void stream_process_mem2s(struct Stream *s, StreamSlave *tx_data_dev,
         }
 
         if (stream_desc_sof(&s->desc)) {
-            s->pos = 0;
+            stream_tx_release(s);
             stream_push(tx_control_dev, s->desc.app, sizeof(s->desc.app),
                         STREAM_ATTR_EOP);
         }
 
         txlen = s->desc.control & SDESC_CTRL_LEN_MASK;
-        if ((txlen + s->pos) > sizeof s->txbuf) {
-            hw_error("%s: too small internal txbuf! %d\n", __func__,
-                     txlen + s->pos);
-        }
-
-        dma_memory_read(s->data_as, s->desc.buffer_address,
-                        s->txbuf + s->pos, txlen);
-        s->pos += txlen;
+        stream_tx_add(s, s->desc.buffer_address, txlen);
 
         if (stream_desc_eof(&s->desc)) {
-            stream_push(tx_data_dev, s->txbuf, s->pos, STREAM_ATTR_EOP);
-            s->pos = 0;
+            stream_pushv(tx_data_dev, s->tx_iov, s->tx_iovcnt,
+                         STREAM_ATTR_EOP);
+            stream_tx_release(s);
             stream_complete(s);
         }
 
         /* Update the descriptor.  */
         s->desc.status = txlen | SDESC_STATUS_COMPLETE;
-        stream_desc_store(s, s->regs[R_CURDESC]);
+        stream_desc_store_status(s, s->regs[R_CURDESC]);
 
         /* Advance.  */
         prev_d = s->regs[R_CURDESC];
@@ -314,6 +438,9 @@ static void stream_process_mem2s(struct Stream *s, StreamSlave *tx_data_dev,
             break;
         }
     }
+
+    stream_tx_detach(s);
+    stream_desc_flush(s);
 }
 
 static size_t stream_process_s2mem(struct Stream *s, unsigned char *buf,
@@ -367,6 +494,7 @@ static size_t stream_process_s2mem(struct Stream *s, unsigned char *buf,
         }
     }
 
+    stream_desc_flush(s);
     return pos;
 }
 
@@ -31,11 +31,19 @@
 #include "qemu/bitops.h"
 #include "qemu/log.h"
 #include "qapi/error.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
 
 #ifndef XLNX_ZDMA_ERR_DEBUG
 #define XLNX_ZDMA_ERR_DEBUG 0
 #endif
 
+/* Largest number of bytes moved per run of the channel, before giving
+   the main loop (and with bandwidth modelling, virtual time) a chance
+   to advance.  */
+#define ZDMA_SLICE_BYTES (1 * MiB)
+#define ZDMA_SLICE_BYTES_THROTTLED (4 * KiB)
+
 REG32(ZDMA_ERR_CTRL, 0x0)
     FIELD(ZDMA_ERR_CTRL, APB_ERR_RES, 0, 1)
 REG32(ZDMA_CH_ISR, 0x100)
@@ -370,6 +378,7 @@ static void zdma_write_dst(XlnxZDMA *s, uint8_t *buf, uint32_t len)
 {
     uint32_t dst_size, dlen;
     bool dst_intr, dst_type;
+    void *dst;
     unsigned int ptype = ARRAY_FIELD_EX32(s->regs, ZDMA_CH_CTRL0, POINT_TYPE);
     unsigned int rw_mode = ARRAY_FIELD_EX32(s->regs, ZDMA_CH_CTRL0, MODE);
     unsigned int burst_type = ARRAY_FIELD_EX32(s->regs, ZDMA_CH_DATA_ATTR,
@@ -412,8 +421,20 @@ static void zdma_write_dst(XlnxZDMA *s, uint8_t *buf, uint32_t len)
             }
         }
 
-        address_space_rw(s->dma_as, s->dsc_dst.addr, s->attr, buf, dlen,
-                         true);
+        dst = NULL;
+        if (burst_type == AXI_BURST_INCR && dlen > sizeof(s->buf)) {
+            dst = dma_memory_map_direct(s->dma_as, s->dsc_dst.addr, dlen,
+                                        DMA_DIRECTION_FROM_DEVICE);
+        }
+        if (dst) {
+            /* src may be mapped as well and overlap.  */
+            memmove(dst, buf, dlen);
+            dma_memory_unmap(s->dma_as, dst, dlen,
+                             DMA_DIRECTION_FROM_DEVICE, dlen);
+        } else {
+            address_space_rw(s->dma_as, s->dsc_dst.addr, s->attr, buf, dlen,
+                             true);
+        }
         if (burst_type == AXI_BURST_INCR) {
             s->dsc_dst.addr += dlen;
         }
@@ -433,10 +454,13 @@ static void zdma_write_dst(XlnxZDMA *s, uint8_t *buf, uint32_t len)
     }
 }
 
-static void zdma_process_descr(XlnxZDMA *s)
+/* Move at most @budget bytes of the current src descriptor, and complete
+   it once it is exhausted. Returns the number of bytes moved.  */
+static uint64_t zdma_process_descr(XlnxZDMA *s, uint64_t budget)
 {
-    uint64_t src_addr;
+    uint64_t src_addr, done = 0;
     uint32_t src_size, len;
+    uint8_t *buf;
     unsigned int src_cmd;
     bool src_intr, src_type;
     unsigned int ptype = ARRAY_FIELD_EX32(s->regs, ZDMA_CH_CTRL0, POINT_TYPE);
@@ -476,33 +500,60 @@ static void zdma_process_descr(XlnxZDMA *s)
         memcpy(s->buf, &s->regs[R_ZDMA_CH_WR_ONLY_WORD0], s->cfg.bus_width / 8);
     }
 
-    while (src_size) {
-        len = src_size > ARRAY_SIZE(s->buf) ? ARRAY_SIZE(s->buf) : src_size;
+    while (src_size && done < budget && !s->error) {
+        len = MIN(src_size, budget - done);
         if (burst_type == AXI_BURST_FIXED) {
             if (len > (s->cfg.bus_width / 8)) {
                 len = s->cfg.bus_width / 8;
             }
         }
 
+        buf = s->buf;
         if (rw_mode == RW_MODE_WO) {
             if (len > s->cfg.bus_width / 8) {
                 len = s->cfg.bus_width / 8;
             }
         } else {
-            address_space_rw(s->dma_as, src_addr, s->attr, s->buf, len,
-                             false);
+            /* Large copies from RAM skip the bounce through s->buf.  */
+            if (rw_mode == RW_MODE_RW && burst_type == AXI_BURST_INCR &&
+                len > sizeof(s->buf)) {
+                buf = dma_memory_map_direct(s->dma_as, src_addr, len,
+                                            DMA_DIRECTION_TO_DEVICE);
+            }
+            if (!buf) {
+                buf = s->buf;
+            }
+            if (buf == s->buf) {
+                len = MIN(len, sizeof(s->buf));
+                address_space_rw(s->dma_as, src_addr, s->attr, s->buf, len,
+                                 false);
+            }
             if (burst_type == AXI_BURST_INCR) {
                 src_addr += len;
             }
         }
 
         if (rw_mode != RW_MODE_RO) {
-            zdma_write_dst(s, s->buf, len);
+            zdma_write_dst(s, buf, len);
+        }
+        if (buf != s->buf) {
+            dma_memory_unmap(s->dma_as, buf, len,
+                             DMA_DIRECTION_TO_DEVICE, len);
         }
 
         s->regs[R_ZDMA_CH_TOTAL_BYTE] += len;
         src_size -= len;
+        done += len;
+    }
+
+    /* Write back to buffered descriptor.  */
+    s->dsc_src.addr = src_addr;
+    s->dsc_src.words[2] = FIELD_DP32(s->dsc_src.words[2],
+                                     ZDMA_CH_SRC_DSCR_WORD2, SIZE, src_size);
+    if (src_size) {
+        return done;
     }
+    s->src_busy = false;
 
     ARRAY_FIELD_DP32(s->regs, ZDMA_CH_ISR, DMA_DONE, true);
 
@@ -514,32 +565,103 @@ static void zdma_process_descr(XlnxZDMA *s)
     if (ptype == PT_REG || src_cmd == CMD_STOP) {
         ARRAY_FIELD_DP32(s->regs, ZDMA_CH_CTRL2, EN, 0);
         zdma_set_state(s, DISABLED);
-        return;
+        return done;
     }
 
     if (src_cmd == CMD_HALT) {
         zdma_set_state(s, PAUSED);
         ARRAY_FIELD_DP32(s->regs, ZDMA_CH_ISR, DMA_PAUSE, 1);
         zdma_ch_imr_update_irq(s);
-        return;
+        return done;
     }
 
     zdma_update_descr_addr(s, src_type, R_ZDMA_CH_SRC_CUR_DSCR_LSB);
+    return done;
 }
 
-static void zdma_run(XlnxZDMA *s)
+static uint64_t zdma_run(XlnxZDMA *s, uint64_t budget)
 {
-    while (s->state == ENABLED && !s->error) {
-        zdma_load_src_descriptor(s);
-
+    uint64_t done = 0;
+
+    while (s->state == ENABLED && !s->error && done < budget) {
+        if (!s->src_busy) {
+            zdma_load_src_descriptor(s);
+            if (s->error) {
+                zdma_set_state(s, DISABLED);
+                break;
+            }
+            s->src_busy = true;
+        }
+        done += zdma_process_descr(s, budget - done);
         if (s->error) {
+            /* Abandon the descriptor, a restart begins from the start.  */
+            s->src_busy = false;
             zdma_set_state(s, DISABLED);
-        } else {
-            zdma_process_descr(s);
         }
     }
 
     zdma_ch_imr_update_irq(s);
+    return done;
+}
+
+static bool zdma_running(XlnxZDMA *s)
+{
+    return s->state == ENABLED && !s->error;
+}
+
+static void zdma_bh(void *opaque)
+{
+    XlnxZDMA *s = XLNX_ZDMA(opaque);
+
+    zdma_run(s, ZDMA_SLICE_BYTES);
+    if (zdma_running(s)) {
+        qemu_bh_schedule(s->bh);
+    }
+}
+
+/* With bandwidth modelling the channel may only move the bytes it has
+   earned since bw_time, and sleeps on the virtual clock for the rest.  */
+static void zdma_timer(void *opaque)
+{
+    XlnxZDMA *s = XLNX_ZDMA(opaque);
+    uint64_t bpns = s->cfg.bytes_per_ns;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    uint64_t budget = 0;
+    uint64_t done;
+
+    if (now > s->bw_time) {
+        budget = MIN((now - s->bw_time) * bpns, ZDMA_SLICE_BYTES_THROTTLED);
+    }
+    done = zdma_run(s, budget);
+    s->bw_time += DIV_ROUND_UP(done, bpns);
+    if (zdma_running(s)) {
+        timer_mod(s->timer,
+                  s->bw_time + DIV_ROUND_UP(ZDMA_SLICE_BYTES_THROTTLED, bpns));
+    }
+}
+
+/* Start the channel or let it continue. Data is moved asynchronously so
+   that the vCPU is not held up by large transfers.  */
+static void zdma_kick(XlnxZDMA *s)
+{
+    int64_t now;
+
+    zdma_ch_imr_update_irq(s);
+    if (!zdma_running(s)) {
+        return;
+    }
+
+    if (!s->cfg.bytes_per_ns) {
+        qemu_bh_schedule(s->bh);
+        return;
+    }
+
+    if (!timer_pending(s->timer)) {
+        now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        s->bw_time = now;
+        timer_mod(s->timer, now + DIV_ROUND_UP(ZDMA_SLICE_BYTES_THROTTLED,
+                                               s->cfg.bytes_per_ns));
+    }
 }
 
 static void zdma_update_descr_addr_from_start(XlnxZDMA *s)
@@ -574,6 +696,7 @@ static void zdma_ch_ctrlx_postw(RegisterInfo *reg, uint64_t val64)
             zdma_set_state(s, ENABLED);
         } else if (s->state == DISABLED) {
             zdma_update_descr_addr_from_start(s);
+            s->src_busy = false;
             zdma_set_state(s, ENABLED);
         }
     } else {
@@ -584,7 +707,7 @@ static void zdma_ch_ctrlx_postw(RegisterInfo *reg, uint64_t val64)
         }
     }
 
-    zdma_run(s);
+    zdma_kick(s);
 }
 
 static RegisterAccessInfo zdma_regs_info[] = {
@@ -698,6 +821,12 @@ static void zdma_reset(DeviceState *dev)
         register_reset(&s->regs_info[i]);
     }
 
+    qemu_bh_cancel(s->bh);
+    timer_del(s->timer);
+    s->state = DISABLED;
+    s->error = false;
+    s->src_busy = false;
+
     zdma_ch_imr_update_irq(s);
 }
 
@@ -772,6 +901,9 @@ static void zdma_realize(DeviceState *dev, Error **errp)
         s->dma_as = &address_space_memory;
     }
     s->attr = MEMTXATTRS_UNSPECIFIED;
+
+    s->bh = qemu_bh_new(zdma_bh, s);
+    s->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, zdma_timer, s);
 }
 
 static void zdma_init(Object *obj)
@@ -791,22 +923,34 @@ static void zdma_init(Object *obj)
                              &error_abort);
 }
 
+static int zdma_post_load(void *opaque, int version_id)
+{
+    XlnxZDMA *s = XLNX_ZDMA(opaque);
+
+    zdma_kick(s);
+    return 0;
+}
+
 static const VMStateDescription vmstate_zdma = {
     .name = TYPE_XLNX_ZDMA,
-    .version_id = 1,
+    .version_id = 2,
     .minimum_version_id = 1,
     .minimum_version_id_old = 1,
+    .post_load = zdma_post_load,
     .fields = (VMStateField[]) {
         VMSTATE_UINT32_ARRAY(regs, XlnxZDMA, ZDMA_R_MAX),
         VMSTATE_UINT32(state, XlnxZDMA),
         VMSTATE_UINT32_ARRAY(dsc_src.words, XlnxZDMA, 4),
         VMSTATE_UINT32_ARRAY(dsc_dst.words, XlnxZDMA, 4),
+        VMSTATE_BOOL_V(src_busy, XlnxZDMA, 2),
         VMSTATE_END_OF_LIST(),
     }
 };
 
 static Property zdma_props[] = {
     DEFINE_PROP_UINT32("bus-width", XlnxZDMA, cfg.bus_width, 64),
+    /* Modelled throughput, 0 moves data as fast as the host can.  */
+    DEFINE_PROP_UINT32("bytes-per-ns", XlnxZDMA, cfg.bytes_per_ns, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -369,6 +369,47 @@ static const TypeInfo xlnx_zynqmp_ipi_info = {
     .instance_init = xlnx_zynqmp_ipi_init,
 };
 
+static void xlnx_zynqmp_ipi_connect_out(XlnxZynqMPIPI *s, int peer_agent,
+                                        qemu_irq trig, qemu_irq obs)
+{
+    char *obs_name = g_strdup_printf("OBS_%s", index_array_names[peer_agent]);
+
+    qdev_connect_gpio_out_named(DEVICE(s), index_array_names[peer_agent], 0,
+                                trig);
+    qdev_connect_gpio_out_named(DEVICE(s), obs_name, 0, obs);
+    g_free(obs_name);
+}
+
+void xlnx_zynqmp_ipi_connect(XlnxZynqMPIPI *a, int a_agent,
+                             XlnxZynqMPIPI *b, int b_agent)
+{
+    DeviceState *da = DEVICE(a);
+    DeviceState *db = DEVICE(b);
+
+    assert(a_agent != b_agent);
+    xlnx_zynqmp_ipi_connect_out(a, b_agent,
+        qdev_get_gpio_in_named(db, "IPI_INPUTS", index_array[a_agent]),
+        qdev_get_gpio_in_named(db, "OBS_INPUTS", index_array[a_agent]));
+    xlnx_zynqmp_ipi_connect_out(b, a_agent,
+        qdev_get_gpio_in_named(da, "IPI_INPUTS", index_array[b_agent]),
+        qdev_get_gpio_in_named(da, "OBS_INPUTS", index_array[b_agent]));
+}
+
+void xlnx_zynqmp_ipi_connect_gpio(XlnxZynqMPIPI *s, int agent,
+                                  int peer_agent, DeviceState *bridge)
+{
+    DeviceState *dev = DEVICE(s);
+
+    assert(agent != peer_agent);
+    xlnx_zynqmp_ipi_connect_out(s, peer_agent,
+        qdev_get_gpio_in(bridge, XLNX_ZYNQMP_IPI_GPIO_TRIG(agent, peer_agent)),
+        qdev_get_gpio_in(bridge, XLNX_ZYNQMP_IPI_GPIO_OBS(agent, peer_agent)));
+    qdev_connect_gpio_out(bridge, XLNX_ZYNQMP_IPI_GPIO_TRIG(peer_agent, agent),
+        qdev_get_gpio_in_named(dev, "IPI_INPUTS", index_array[peer_agent]));
+    qdev_connect_gpio_out(bridge, XLNX_ZYNQMP_IPI_GPIO_OBS(peer_agent, agent),
+        qdev_get_gpio_in_named(dev, "OBS_INPUTS", index_array[peer_agent]));
+}
+
 static void xlnx_zynqmp_ipi_register_types(void)
 {
     type_register_static(&xlnx_zynqmp_ipi_info);
@@ -26,6 +26,7 @@
 
 #include "hw/intc/xlnx-zynqmp-ipi.h"
 #include "hw/intc/xlnx-pmu-iomod-intc.h"
+#include "hw/remote-port-gpio.h"
 
 /* Define the PMU device */
 
@@ -138,15 +139,41 @@ type_init(xlnx_zynqmp_pmu_soc_register_types)
 
 /* Define the PMU Machine */
 
+typedef struct XlnxZynqMPPMUMachine {
+    MachineState parent_obj;
+
+    bool remote_ipi;
+} XlnxZynqMPPMUMachine;
+
+#define TYPE_XLNX_ZYNQMP_PMU_MACHINE MACHINE_TYPE_NAME("xlnx-zynqmp-pmu")
+#define XLNX_ZYNQMP_PMU_MACHINE(obj) \
+    OBJECT_CHECK(XlnxZynqMPPMUMachine, (obj), TYPE_XLNX_ZYNQMP_PMU_MACHINE)
+
+static bool xlnx_zynqmp_pmu_get_remote_ipi(Object *obj, Error **errp)
+{
+    XlnxZynqMPPMUMachine *s = XLNX_ZYNQMP_PMU_MACHINE(obj);
+
+    return s->remote_ipi;
+}
+
+static void xlnx_zynqmp_pmu_set_remote_ipi(Object *obj, bool value,
+                                           Error **errp)
+{
+    XlnxZynqMPPMUMachine *s = XLNX_ZYNQMP_PMU_MACHINE(obj);
+
+    s->remote_ipi = value;
+}
+
 static void xlnx_zynqmp_pmu_init(MachineState *machine)
 {
+    XlnxZynqMPPMUMachine *s = XLNX_ZYNQMP_PMU_MACHINE(machine);
     XlnxZynqMPPMUSoCState *pmu = g_new0(XlnxZynqMPPMUSoCState, 1);
     MemoryRegion *address_space_mem = get_system_memory();
     MemoryRegion *pmu_rom = g_new(MemoryRegion, 1);
     MemoryRegion *pmu_ram = g_new(MemoryRegion, 1);
     XlnxZynqMPIPI *ipi[XLNX_ZYNQMP_PMU_NUM_IPIS];
     qemu_irq irq[32];
-    int i;
+    int i, j;
 
     /* Create the ROM */
     memory_region_init_rom(pmu_rom, NULL, "xlnx-zynqmp-pmu.rom",
@@ -184,6 +211,30 @@ static void xlnx_zynqmp_pmu_init(MachineState *machine)
         sysbus_connect_irq(SYS_BUS_DEVICE(ipi[i]), 0, irq[ipi_irq[i]]);
     }
 
+    /* The PMU channels signal each other directly.  */
+    for (i = 0; i < XLNX_ZYNQMP_PMU_NUM_IPIS; i++) {
+        for (j = i + 1; j < XLNX_ZYNQMP_PMU_NUM_IPIS; j++) {
+            xlnx_zynqmp_ipi_connect(ipi[i], XLNX_ZYNQMP_IPI_PMU_0 + i,
+                                    ipi[j], XLNX_ZYNQMP_IPI_PMU_0 + j);
+        }
+    }
+
+    /*
+     * The APU runs in another QEMU. Only the IPI lines cross over, as
+     * posted interrupts, so the register accesses on either side stay
+     * local. The xlnx-zcu102 machine has the other end.
+     */
+    if (s->remote_ipi) {
+        DeviceState *bridge = rp_gpio_create(OBJECT(machine), "remote-ipi",
+                                             XLNX_ZYNQMP_IPI_NUM_GPIOS,
+                                             &error_fatal);
+
+        for (i = 0; i < XLNX_ZYNQMP_PMU_NUM_IPIS; i++) {
+            xlnx_zynqmp_ipi_connect_gpio(ipi[i], XLNX_ZYNQMP_IPI_PMU_0 + i,
+                                         XLNX_ZYNQMP_IPI_APU, bridge);
+        }
+    }
+
     /* Load the kernel */
     microblaze_load_kernel(&pmu->cpu, XLNX_ZYNQMP_PMU_RAM_ADDR,
                            machine->ram_size,
@@ -195,11 +246,41 @@ static void xlnx_zynqmp_pmu_init(MachineState *machine)
                            0);
 }
 
-static void xlnx_zynqmp_pmu_machine_init(MachineClass *mc)
+static void xlnx_zynqmp_pmu_machine_instance_init(Object *obj)
+{
+    XlnxZynqMPPMUMachine *s = XLNX_ZYNQMP_PMU_MACHINE(obj);
+
+    s->remote_ipi = false;
+    object_property_add_bool(obj, "remote-ipi",
+                             xlnx_zynqmp_pmu_get_remote_ipi,
+                             xlnx_zynqmp_pmu_set_remote_ipi, NULL);
+    object_property_set_description(obj, "remote-ipi",
+                                    "Set on to connect the IPI channels to "
+                                    "an xlnx-zcu102 machine through "
+                                    "remote-port (needs -machine-path)",
+                                    NULL);
+}
+
+static void xlnx_zynqmp_pmu_machine_class_init(ObjectClass *oc, void *data)
 {
+    MachineClass *mc = MACHINE_CLASS(oc);
+
     mc->desc = "Xilinx ZynqMP PMU machine";
     mc->init = xlnx_zynqmp_pmu_init;
 }
 
-DEFINE_MACHINE("xlnx-zynqmp-pmu", xlnx_zynqmp_pmu_machine_init)
+static const TypeInfo xlnx_zynqmp_pmu_machine_typeinfo = {
+    .name       = TYPE_XLNX_ZYNQMP_PMU_MACHINE,
+    .parent     = TYPE_MACHINE,
+    .class_init = xlnx_zynqmp_pmu_machine_class_init,
+    .instance_init = xlnx_zynqmp_pmu_machine_instance_init,
+    .instance_size = sizeof(XlnxZynqMPPMUMachine),
+};
+
+static void xlnx_zynqmp_pmu_machine_register_types(void)
+{
+    type_register_static(&xlnx_zynqmp_pmu_machine_typeinfo);
+}
+
+type_init(xlnx_zynqmp_pmu_machine_register_types)
 
@@ -26,6 +26,7 @@
 #include "qemu/osdep.h"
 #include "hw/sysbus.h"
 #include "qemu/log.h"
+#include "qemu/gf2x.h"
 #include "hw/misc/ipcores-rsa5-4k.h"
 
 #include <gcrypt.h>
@@ -39,6 +40,7 @@
     } while (0)
 
 #define MAX_LEN 4224
+#define MAX_LIMBS (MAX_LEN / 64)
 
 static const char *err2str[] = {
     [RSA_NO_ERROR]      = "No error",
@@ -128,6 +130,58 @@ static void load_mpi(gcry_mpi_t d, struct reg *s, unsigned int len)
     }
 }
 
+/* Debug code to dump a binary polynomial.  */
+static void show_limbs(const char *prefix, const uint64_t *a)
+{
+    int i = MAX_LIMBS - 1;
+
+    while (i > 0 && !a[i]) {
+        i--;
+    }
+    printf("%s: ", prefix);
+    for (; i >= 0; i--) {
+        printf("%16.16" PRIx64, a[i]);
+    }
+    printf("\n");
+}
+
+/* Load from reg into a binary polynomial.  */
+static void load_limbs(uint64_t *d, struct reg *s, unsigned int len)
+{
+    unsigned int i;
+
+    /* We assume lengths are 32bit aligned.  */
+    assert((len & 3) == 0);
+    len /= 4;
+    if (len > MAX_LIMBS * 2) {
+        qemu_log_mask(LOG_GUEST_ERROR, "RSA: %u digits, only %u supported\n",
+                      len, MAX_LIMBS * 2);
+        len = MAX_LIMBS * 2;
+    }
+
+    memset(d, 0, MAX_LIMBS * sizeof(*d));
+    for (i = 0; i < len; i++) {
+        d[i / 2] |= (uint64_t)s->u32[i] << (32 * (i % 2));
+    }
+}
+
+/* Store a binary polynomial into reg, starting from its 32-bit digit
+   @from.  */
+static void store_limbs(struct reg *d, const uint64_t *s, unsigned int from,
+                        unsigned int len)
+{
+    unsigned int i, digit;
+
+    assert((len & 3) == 0);
+    len /= 4;
+
+    for (i = 0; i < len; i++) {
+        digit = from + i;
+        d->u32[i] = digit < MAX_LIMBS * 2 ?
+                    s[digit / 2] >> (32 * (digit % 2)) : 0;
+    }
+}
+
 /* Store from MPI into reg.  */
 static void store_mpi(struct reg *d, gcry_mpi_t s, unsigned int len)
 {
@@ -210,144 +264,45 @@ static void mpi_to_unsigned(gcry_mpi_t a, unsigned int bytelen)
     }
 }
 
-static void bin_xor(unsigned int bitlen,
-                    gcry_mpi_t r, gcry_mpi_t a, gcry_mpi_t b)
-{
-    gcry_mpi_t res;
-    int i;
-
-    res = gcry_mpi_new(bitlen);
-    gcry_mpi_set_ui(res, 0);
-    for (i = 0; i < bitlen; i++) {
-        bool bit_a;
-        bool bit_b;
-
-        bit_a = gcry_mpi_test_bit(a, i);
-        bit_b = gcry_mpi_test_bit(b, i);
-        if (bit_a ^ bit_b) {
-            gcry_mpi_set_bit(res, i);
-        }
-    }
-
-    gcry_mpi_set(r, res);
-    gcry_mpi_release(res);
-}
-
-static void gf_reduce(unsigned int bitlen,
-                      gcry_mpi_t r, gcry_mpi_t a, gcry_mpi_t m2)
-{
-    gcry_mpi_t res;
-    int s_bit = bitlen - 1;
-
-    res = gcry_mpi_new(bitlen);
-
-    if (gcry_mpi_test_bit(a, s_bit)) {
-        bin_xor(bitlen, res, a, m2);
-    }
-
-    gcry_mpi_set(r, res);
-    gcry_mpi_release(res);
-}
-
-static void gf_lshift(unsigned int bitlen,
-                      gcry_mpi_t r, gcry_mpi_t a, gcry_mpi_t m2,
-                      unsigned int nr)
-{
-    gcry_mpi_t res;
-
-    res = gcry_mpi_new(bitlen);
-
-    gcry_mpi_set(res, a);
-    while (nr--) {
-        gcry_mpi_lshift(res, res, 1);
-        gf_reduce(bitlen, res, res, m2);
-    }
-
-    gcry_mpi_set(r, res);
-    gcry_mpi_release(res);
-}
-
-static void gf_mul(unsigned int bitlen,
-                   gcry_mpi_t r, gcry_mpi_t a, gcry_mpi_t b, gcry_mpi_t m2)
-{
-    gcry_mpi_t res, tmp;
-    unsigned int nr_bits = gcry_mpi_get_nbits(a);
-    unsigned int i;
-
-    res = gcry_mpi_new(bitlen);
-    tmp = gcry_mpi_new(bitlen);
-    gcry_mpi_set_ui(res, 0);
-    gcry_mpi_set(tmp, b);
-
-    for (i = 0; i < nr_bits; i++) {
-        if (gcry_mpi_test_bit(a, i)) {
-            bin_xor(bitlen, res, res, tmp);
-        }
-        gf_lshift(bitlen, tmp, tmp, m2, 1);
-    }
-
-    gcry_mpi_set(r, res);
-    gcry_mpi_release(res);
-    gcry_mpi_release(tmp);
-}
-
 int rsa_do_bin_mont(IPCoresRSA *s,
                     unsigned int a_addr, unsigned int b_addr,
                     unsigned int r_addr, unsigned int m2_addr,
                     unsigned int digits)
 {
-    gcry_mpi_t a, b, c, m2, r, q, tmp;
+    uint64_t a[MAX_LIMBS], b[MAX_LIMBS], c[MAX_LIMBS], m2[MAX_LIMBS];
+    uint64_t q[MAX_LIMBS], tmp[MAX_LIMBS];
     unsigned int bytelen;
     unsigned int i;
     int ret = RSA_NO_ERROR;
 
     bytelen = (digits + 1) * 4;
 
-    a = gcry_mpi_new(bytelen * 8);
-    b = gcry_mpi_new(bytelen * 8);
-    c = gcry_mpi_new(bytelen * 8);
-    m2 = gcry_mpi_new(bytelen * 8);
-    r = gcry_mpi_new(bytelen * 8);
-    q = gcry_mpi_new(bytelen * 8);
-    tmp = gcry_mpi_new(bytelen * 8);
-
-    load_mpi(a, (struct reg *) &s->mem.words[a_addr], bytelen);
-    load_mpi(b, (struct reg *) &s->mem.words[b_addr], bytelen);
-    load_mpi(m2, (struct reg *) &s->mem.words[m2_addr], bytelen);
+    load_limbs(a, (struct reg *) &s->mem.words[a_addr], bytelen);
+    load_limbs(b, (struct reg *) &s->mem.words[b_addr], bytelen);
+    load_limbs(m2, (struct reg *) &s->mem.words[m2_addr], bytelen);
 
-    D(show_mpi("a", a));
-    D(show_mpi("b", b));
-    D(show_mpi("m2", m2));
+    D(show_limbs("a", a));
+    D(show_limbs("b", b));
+    D(show_limbs("m2", m2));
 
-    gf_mul(MAX_LEN, c, a, b, m2);
-    D(show_mpi("c", c));
-    gf_lshift(MAX_LEN, c, c, m2, 32);
-    for (i = 0; i < digits + 1; i++) {
-        gcry_mpi_set_ui(tmp, 1);
-        gcry_mpi_lshift(tmp, tmp, 32);
+    gf2x_mulmod(c, a, b, m2, MAX_LIMBS);
+    D(show_limbs("c", c));
+    gf2x_lshift_reduce(c, c, m2, 32, MAX_LIMBS);
 
-        gcry_mpi_rshift(q, c, i * 32);
-        gcry_mpi_mod(q, q, tmp);
+    /* tmp is m2 * x^(32 * i).  */
+    memcpy(tmp, m2, sizeof(tmp));
+    for (i = 0; i < MIN(digits + 1, MAX_LIMBS * 2); i++) {
+        memset(q, 0, sizeof(q));
+        q[0] = (c[i / 2] >> (32 * (i % 2))) & 0xffffffff;
 
-        gf_lshift(MAX_LEN, tmp, m2, m2, i * 32);
-        gf_mul(MAX_LEN, tmp, q, tmp, m2);
-        bin_xor(MAX_LEN, c, c, tmp);
+        gf2x_mulmod(q, q, tmp, m2, MAX_LIMBS);
+        gf2x_xor(c, c, q, MAX_LIMBS);
+        gf2x_lshift_reduce(tmp, tmp, m2, 32, MAX_LIMBS);
     }
 
-    gcry_mpi_rshift(c, c, (digits + 1) * 32);
-    gcry_mpi_set(r, c);
-
-    D(show_mpi("Result", r));
-
-    store_mpi((struct reg *) &s->mem.words[r_addr], r, bytelen);
+    D(show_limbs("Result", c));
 
-    gcry_mpi_release(a);
-    gcry_mpi_release(b);
-    gcry_mpi_release(c);
-    gcry_mpi_release(m2);
-    gcry_mpi_release(r);
-    gcry_mpi_release(q);
-    gcry_mpi_release(tmp);
+    store_limbs((struct reg *) &s->mem.words[r_addr], c, digits + 1, bytelen);
     return ret;
 }
 
@@ -356,63 +311,33 @@ int rsa_do_gf_mod(IPCoresRSA *s,
                   unsigned int r_addr, unsigned int m2_addr,
                   unsigned int digits)
 {
-    gcry_mpi_t a, b, m2, r, bit, tmp;
+    uint64_t b[MAX_LIMBS], r[MAX_LIMBS], tmp[MAX_LIMBS];
     unsigned int bytelen;
     int ret = RSA_NO_ERROR;
-    int ab;
-    int bb = 0;
+    int rb, bb;
 
     bytelen = (digits + 1) * 4;
 
-    a = gcry_mpi_new(bytelen * 8);
-    b = gcry_mpi_new(bytelen * 8);
-    m2 = gcry_mpi_new(bytelen * 8);
-    r = gcry_mpi_new(bytelen * 8);
-    bit = gcry_mpi_new(bytelen * 8);
-    tmp = gcry_mpi_new(bytelen * 8);
+    load_limbs(r, (struct reg *) &s->mem.words[a_addr], bytelen);
+    load_limbs(b, (struct reg *) &s->mem.words[b_addr], bytelen);
 
-    load_mpi(a, (struct reg *) &s->mem.words[a_addr], bytelen);
-    load_mpi(b, (struct reg *) &s->mem.words[b_addr], bytelen);
-    load_mpi(m2, (struct reg *) &s->mem.words[m2_addr], bytelen);
+    D(show_limbs("a", r));
+    D(show_limbs("b", b));
 
-    D(show_mpi("a", a));
-    D(show_mpi("b", b));
-
-    gcry_mpi_set(r, a);
-    if (gcry_mpi_cmp(a, b) <= 0) {
-        goto done;
-    }
-
-    gcry_mpi_set(tmp, b);
-    gcry_mpi_set_ui(bit, 1);
-
-    for (ab = 0; gcry_mpi_cmp(bit, r) < 0; ab++) {
-        if (gcry_mpi_cmp(bit, tmp) < 0) {
-            bb = ab;
-        }
-        gcry_mpi_lshift(bit, bit, 1);
-    }
-    ab--;
-    gcry_mpi_rshift(bit, bit, 1);
-    assert(ab >= bb);
-    gcry_mpi_lshift(tmp, tmp, ab - bb);
-
-    for (; ab >= bb; ab--) {
-        if (gcry_mpi_test_bit(a, ab)) {
-            bin_xor(MAX_LEN, r, r, tmp);
+    /* Polynomial long division, cancelling the top bit of the remainder
+       until it drops below the degree of b.  */
+    bb = gf2x_degree(b, MAX_LIMBS);
+    if (bb >= 0) {
+        for (rb = gf2x_degree(r, MAX_LIMBS); rb >= bb;
+             rb = gf2x_degree(r, MAX_LIMBS)) {
+            gf2x_lshift(tmp, b, rb - bb, MAX_LIMBS);
+            gf2x_xor(r, r, tmp, MAX_LIMBS);
         }
-        gcry_mpi_rshift(bit, bit, 1);
-        gcry_mpi_rshift(tmp, tmp, 1);
     }
 
-done:
-    D(show_mpi("Result", r));
-
-    store_mpi((struct reg *) &s->mem.words[r_addr], r, bytelen);
+    D(show_limbs("Result", r));
 
-    gcry_mpi_release(a);
-    gcry_mpi_release(b);
-    gcry_mpi_release(r);
+    store_limbs((struct reg *) &s->mem.words[r_addr], r, 0, bytelen);
     return ret;
 }
 
@@ -421,29 +346,21 @@ int rsa_do_xor(IPCoresRSA *s,
                unsigned int r_addr, unsigned int m2_addr,
                unsigned int digits)
 {
-    gcry_mpi_t a, b, r;
+    uint64_t a[MAX_LIMBS], b[MAX_LIMBS], r[MAX_LIMBS];
     unsigned int bytelen;
     int ret = RSA_NO_ERROR;
 
     bytelen = (digits + 1) * 4;
 
-    a = gcry_mpi_new(bytelen * 8);
-    b = gcry_mpi_new(bytelen * 8);
-    r = gcry_mpi_new(bytelen * 8);
-
-    load_mpi(a, (struct reg *) &s->mem.words[a_addr], bytelen);
-    load_mpi(b, (struct reg *) &s->mem.words[b_addr], bytelen);
-
-    D(show_mpi("a", a));
-    D(show_mpi("b", b));
+    load_limbs(a, (struct reg *) &s->mem.words[a_addr], bytelen);
+    load_limbs(b, (struct reg *) &s->mem.words[b_addr], bytelen);
 
-    bin_xor(bytelen * 8, r, a, b);
-    D(show_mpi("Result", r));
-    store_mpi((struct reg *) &s->mem.words[r_addr], r, bytelen);
+    D(show_limbs("a", a));
+    D(show_limbs("b", b));
 
-    gcry_mpi_release(a);
-    gcry_mpi_release(b);
-    gcry_mpi_release(r);
+    gf2x_xor(r, a, b, MAX_LIMBS);
+    D(show_limbs("Result", r));
+    store_limbs((struct reg *) &s->mem.words[r_addr], r, 0, bytelen);
     return ret;
 }
 
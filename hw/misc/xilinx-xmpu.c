@@ -321,6 +321,44 @@ typedef struct XMPUMaster {
     } err;
 } XMPUMaster;
 
+typedef struct XMPURegion {
+    uint64_t start;
+    uint64_t end;
+    uint64_t size;
+    union {
+        uint32_t u32;
+        struct {
+            uint16_t mask;
+            uint16_t id;
+        };
+    } master;
+    struct {
+        bool nschecktype;
+        bool regionns;
+        bool wrallowed;
+        bool rdallowed;
+        bool enable;
+    } config;
+} XMPURegion;
+
+/* A piece of the address space, and the region that decides for it.  */
+typedef struct XMPUInterval {
+    uint64_t start;
+    uint64_t end;
+    unsigned int region;
+} XMPUInterval;
+
+/* The enabled regions that share a master ID and mask, flattened into
+ * sorted, non-overlapping intervals. Where regions overlap the highest
+ * numbered one wins, as in hardware.
+ */
+typedef struct XMPURegionGroup {
+    uint16_t mask;
+    uint16_t id;
+    unsigned int nr_intervals;
+    XMPUInterval intervals[NR_XMPU_REGIONS * 2];
+} XMPURegionGroup;
+
 struct XMPU {
     SysBusDevice parent_obj;
     MemoryRegion iomem;
@@ -348,27 +386,12 @@ struct XMPU {
     const char *prefix;
     bool enabled;
     qemu_irq enabled_signal;
-};
 
-typedef struct XMPURegion {
-    uint64_t start;
-    uint64_t end;
-    uint64_t size;
-    union {
-        uint32_t u32;
-        struct {
-            uint16_t mask;
-            uint16_t id;
-        };
-    } master;
-    struct {
-        bool nschecktype;
-        bool regionns;
-        bool wrallowed;
-        bool rdallowed;
-        bool enable;
-    } config;
-} XMPURegion;
+    /* Decoded regions, rebuilt by xmpu_flush() when the setup changes.  */
+    XMPURegion regions[NR_XMPU_REGIONS];
+    XMPURegionGroup groups[NR_XMPU_REGIONS];
+    unsigned int nr_groups;
+};
 
 static void xmpu_decode_region(XMPU *s, XMPURegion *xr, unsigned int region)
 {
@@ -392,6 +415,152 @@ static void xmpu_decode_region(XMPU *s, XMPURegion *xr, unsigned int region)
     xr->config.nschecktype = DEP_F_EX32(config, R00_CONFIG, NSCHECKTYPE);
 }
 
+static int xmpu_cmp_u64(const void *a, const void *b)
+{
+    uint64_t va = *(const uint64_t *)a;
+    uint64_t vb = *(const uint64_t *)b;
+
+    return va < vb ? -1 : va > vb;
+}
+
+static void xmpu_build_group(XMPU *s, XMPURegionGroup *g)
+{
+    uint64_t points[NR_XMPU_REGIONS * 2];
+    unsigned int nr_points = 0;
+    unsigned int i;
+    int r;
+
+    for (i = 0; i < NR_XMPU_REGIONS; i++) {
+        XMPURegion *xr = &s->regions[i];
+
+        if (xr->config.enable && xr->master.mask == g->mask &&
+            (xr->master.mask & xr->master.id) == g->id) {
+            points[nr_points++] = xr->start;
+            points[nr_points++] = xr->end;
+        }
+    }
+    qsort(points, nr_points, sizeof(points[0]), xmpu_cmp_u64);
+
+    g->nr_intervals = 0;
+    for (i = 0; i + 1 < nr_points; i++) {
+        XMPUInterval *prev;
+
+        if (points[i] == points[i + 1]) {
+            continue;
+        }
+
+        /* Find the region that decides for [points[i], points[i + 1]).  */
+        for (r = NR_XMPU_REGIONS - 1; r >= 0; r--) {
+            XMPURegion *xr = &s->regions[r];
+
+            if (xr->config.enable && xr->master.mask == g->mask &&
+                (xr->master.mask & xr->master.id) == g->id &&
+                points[i] >= xr->start && points[i] < xr->end) {
+                break;
+            }
+        }
+        if (r < 0) {
+            continue;
+        }
+
+        prev = g->nr_intervals ? &g->intervals[g->nr_intervals - 1] : NULL;
+        if (prev && prev->region == r && prev->end == points[i]) {
+            prev->end = points[i + 1];
+        } else {
+            g->intervals[g->nr_intervals++] = (XMPUInterval) {
+                .start = points[i],
+                .end = points[i + 1],
+                .region = r,
+            };
+        }
+    }
+}
+
+/* Decode all regions and check them once, instead of on every access.  */
+static void xmpu_decode_regions(XMPU *s)
+{
+    unsigned int i, j;
+
+    s->nr_groups = 0;
+    for (i = 0; i < NR_XMPU_REGIONS; i++) {
+        XMPURegion *xr = &s->regions[i];
+
+        xmpu_decode_region(s, xr, i);
+        if (!xr->config.enable) {
+            continue;
+        }
+
+        if (xr->start & s->addr_mask) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: Bad region start address %" PRIx64 "\n",
+                          s->prefix, xr->start);
+        }
+
+        if (xr->end & s->addr_mask) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: Bad region end address %" PRIx64 "\n",
+                           s->prefix, xr->end);
+        }
+
+        if (xr->start < s->cfg.base) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: Too low region start address %" PRIx64 "\n",
+                           s->prefix, xr->end);
+        }
+
+        xr->start &= ~s->addr_mask;
+        xr->end &= ~s->addr_mask;
+
+        for (j = 0; j < s->nr_groups; j++) {
+            if (s->groups[j].mask == xr->master.mask &&
+                s->groups[j].id == (xr->master.mask & xr->master.id)) {
+                break;
+            }
+        }
+        if (j == s->nr_groups) {
+            s->groups[j].mask = xr->master.mask;
+            s->groups[j].id = xr->master.mask & xr->master.id;
+            s->nr_groups++;
+        }
+    }
+
+    for (i = 0; i < s->nr_groups; i++) {
+        xmpu_build_group(s, &s->groups[i]);
+    }
+}
+
+/* Return the highest numbered enabled region that matches, or NULL.  */
+static XMPURegion *xmpu_lookup_region(XMPU *s, uint64_t addr,
+                                      uint64_t master_id)
+{
+    int best = -1;
+    unsigned int i;
+
+    for (i = 0; i < s->nr_groups; i++) {
+        XMPURegionGroup *g = &s->groups[i];
+        unsigned int lo = 0, hi = g->nr_intervals;
+
+        if (g->id != (g->mask & master_id)) {
+            continue;
+        }
+
+        while (lo < hi) {
+            unsigned int mid = (lo + hi) / 2;
+            XMPUInterval *iv = &g->intervals[mid];
+
+            if (addr < iv->start) {
+                hi = mid;
+            } else if (addr >= iv->end) {
+                lo = mid + 1;
+            } else {
+                best = MAX(best, (int)iv->region);
+                break;
+            }
+        }
+    }
+    return best < 0 ? NULL : &s->regions[best];
+}
+
 static void isr_update_irq(XMPU *s)
 {
     bool pending = s->regs[R_ISR] & ~s->regs[R_IMR];
@@ -429,18 +598,8 @@ static void xmpu_update_enabled(XMPU *s)
     bool regions_enabled = false;
     bool default_wr = DEP_AF_EX32(s->regs, CTRL, DEFWRALLOWED);
     bool default_rd = DEP_AF_EX32(s->regs, CTRL, DEFRDALLOWED);
-    int i;
 
-    /* Lookup if this address fits a region.  */
-    for (i = NR_XMPU_REGIONS - 1; i >= 0; i--) {
-        XMPURegion xr;
-        xmpu_decode_region(s, &xr, i);
-        if (!xr.config.enable) {
-            continue;
-        }
-        regions_enabled = true;
-        break;
-    }
+    regions_enabled = s->nr_groups > 0;
 
     s->enabled = true;
     if (!regions_enabled && default_wr && default_rd) {
@@ -452,6 +611,7 @@ static void xmpu_flush(XMPU *s)
 {
     unsigned int i;
 
+    xmpu_decode_regions(s);
     xmpu_update_enabled(s);
     qemu_set_irq(s->enabled_signal, s->enabled);
 
@@ -826,7 +986,7 @@ static IOMMUTLBEntry xmpu_master_translate(XMPUMaster *xm, hwaddr addr,
                                            bool *sec_vio)
 {
     XMPU *s = xm->parent;
-    XMPURegion xr;
+    XMPURegion *xr;
     IOMMUTLBEntry ret = {
         .iova = addr,
         .translated_addr = addr,
@@ -843,8 +1003,6 @@ static IOMMUTLBEntry xmpu_master_translate(XMPUMaster *xm, hwaddr addr,
     bool default_rd = DEP_AF_EX32(s->regs, CTRL, DEFRDALLOWED);
     bool sec = attr->secure;
     bool sec_access_check;
-    unsigned int nr_matched = 0;
-    int i;
 
     /* No security violation by default.  */
     *sec_vio = false;
@@ -858,72 +1016,34 @@ static IOMMUTLBEntry xmpu_master_translate(XMPUMaster *xm, hwaddr addr,
     /* Convert to an absolute address to simplify the compare logic.  */
     addr += s->cfg.base;
 
-    /* Lookup if this address fits a region.  */
-    for (i = NR_XMPU_REGIONS - 1; i >= 0; i--) {
-        bool id_match;
-        bool match;
-
-        xmpu_decode_region(s, &xr, i);
-        if (!xr.config.enable) {
-            continue;
-        }
-
-        if (xr.start & s->addr_mask) {
-            qemu_log_mask(LOG_GUEST_ERROR,
-                          "%s: Bad region start address %" PRIx64 "\n",
-                          s->prefix, xr.start);
-        }
-
-        if (xr.end & s->addr_mask) {
-            qemu_log_mask(LOG_GUEST_ERROR,
-                          "%s: Bad region end address %" PRIx64 "\n",
-                           s->prefix, xr.end);
-        }
-
-        if (xr.start < s->cfg.base) {
-            qemu_log_mask(LOG_GUEST_ERROR,
-                          "%s: Too low region start address %" PRIx64 "\n",
-                           s->prefix, xr.end);
+    xr = xmpu_lookup_region(s, addr, attr->master_id);
+    if (xr) {
+        /* Determine if this region is accessible by the transactions
+         * security domain.
+         */
+        if (xr->config.nschecktype) {
+            /* In strict mode, secure accesses are not allowed to
+             * non-secure regions (and vice-versa).
+             */
+            sec_access_check = (sec != xr->config.regionns);
+        } else {
+            /* In relaxed mode secure accesses can access any region
+             * while non-secure can only access non-secure areas.
+             */
+            sec_access_check = (sec || xr->config.regionns);
         }
 
-        xr.start &= ~s->addr_mask;
-        xr.end &= ~s->addr_mask;
-
-        id_match = (xr.master.mask & xr.master.id) ==
-                       (xr.master.mask & attr->master_id);
-        match = id_match && (addr >= xr.start && addr < xr.end);
-        if (match) {
-            nr_matched++;
-            /* Determine if this region is accessible by the transactions
-             * security domain.
-             */
-            if (xr.config.nschecktype) {
-                /* In strict mode, secure accesses are not allowed to
-                 * non-secure regions (and vice-versa).
-                 */
-                sec_access_check = (sec != xr.config.regionns);
-            } else {
-                /* In relaxed mode secure accesses can access any region
-                 * while non-secure can only access non-secure areas.
-                 */
-                sec_access_check = (sec || xr.config.regionns);
+        if (sec_access_check) {
+            if (xr->config.rdallowed) {
+                ret.perm |= IOMMU_RO;
             }
-
-            if (sec_access_check) {
-                if (xr.config.rdallowed) {
-                    ret.perm |= IOMMU_RO;
-                }
-                if (xr.config.wrallowed) {
-                    ret.perm |= IOMMU_WO;
-                }
-            } else {
-                *sec_vio = true;
+            if (xr->config.wrallowed) {
+                ret.perm |= IOMMU_WO;
             }
-            break;
+        } else {
+            *sec_vio = true;
         }
-    }
-
-    if (nr_matched == 0) {
+    } else {
         if (default_rd) {
             ret.perm |= IOMMU_RO;
         }
@@ -937,8 +1057,8 @@ static IOMMUTLBEntry xmpu_master_translate(XMPUMaster *xm, hwaddr addr,
         ret.target_as = &xm->down.none.as;
     }
 #if 0
-    qemu_log("%s: nr_matched=%d AS=%p addr=%lx - > %lx (%lx) perm=%x\n",
-           __func__, nr_matched, ret.target_as, ret.iova,
+    qemu_log("%s: region=%d AS=%p addr=%lx - > %lx (%lx) perm=%x\n",
+           __func__, xr ? (int)(xr - s->regions) : -1, ret.target_as, ret.iova,
           ret.translated_addr, (addr | ret.addr_mask) - addr + 1, ret.perm);
 #endif
     return ret;
@@ -1182,11 +1302,20 @@ static Property xmpu_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
+static int xmpu_post_load(void *opaque, int version_id)
+{
+    XMPU *s = XILINX_XMPU(opaque);
+
+    xmpu_flush(s);
+    return 0;
+}
+
 static const VMStateDescription vmstate_xmpu = {
     .name = TYPE_XILINX_XMPU,
     .version_id = 1,
     .minimum_version_id = 1,
     .minimum_version_id_old = 1,
+    .post_load = xmpu_post_load,
     .fields = (VMStateField[]) {
         VMSTATE_UINT32_ARRAY(regs, XMPU, R_MAX),
         VMSTATE_END_OF_LIST(),
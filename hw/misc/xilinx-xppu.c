@@ -238,6 +238,26 @@ typedef struct XPPUAperture {
     uint32_t ram_base;
 } XPPUAperture;
 
+/* A decoded MASTER_IDxx register.  */
+typedef struct XPPUMid {
+    uint32_t mid;
+    uint32_t mask;
+    bool readonly;
+    bool parity_ok;
+} XPPUMid;
+
+/* The MID entries that share a mask, sorted by masked ID. Entries with
+ * the same masked ID share a slot, as a bitmap of entry numbers.
+ */
+typedef struct XPPUMidGroup {
+    uint32_t mask;
+    unsigned int nr_ids;
+    struct {
+        uint32_t mid;
+        uint32_t entries;
+    } ids[NR_MID_ENTRIES];
+} XPPUMidGroup;
+
 struct XPPU {
     SysBusDevice parent_obj;
     MemoryRegion iomem;
@@ -252,6 +272,11 @@ struct XPPU {
 
     uint32_t regs[R_MAX];
     DepRegisterInfo regs_info[R_MAX];
+
+    /* Decoded MID entries, rebuilt when CTRL or a MASTER_IDxx changes.  */
+    XPPUMid mids[NR_MID_ENTRIES];
+    XPPUMidGroup mid_groups[NR_MID_ENTRIES];
+    unsigned int nr_mid_groups;
 };
 
 static bool parity32(uint32_t v)
@@ -347,6 +372,76 @@ static bool check_apl_parity(XPPU *s, uint32_t val32)
     return ok;
 }
 
+static void xppu_decode_mids(XPPU *s)
+{
+    unsigned int i, j, k;
+
+    s->nr_mid_groups = 0;
+    for (i = 0; i < NR_MID_ENTRIES; i++) {
+        uint32_t val32 = s->regs[R_MASTER_ID00 + i];
+        XPPUMid *m = &s->mids[i];
+        XPPUMidGroup *g;
+
+        m->mask = DEP_F_EX32(val32, MASTER_ID00, MIDM);
+        m->mid = DEP_F_EX32(val32, MASTER_ID00, MID) & m->mask;
+        m->readonly = DEP_F_EX32(val32, MASTER_ID00, MIDR);
+        m->parity_ok = check_mid_parity(s, val32);
+
+        for (j = 0; j < s->nr_mid_groups; j++) {
+            if (s->mid_groups[j].mask == m->mask) {
+                break;
+            }
+        }
+        g = &s->mid_groups[j];
+        if (j == s->nr_mid_groups) {
+            g->mask = m->mask;
+            g->nr_ids = 0;
+            s->nr_mid_groups++;
+        }
+
+        /* Insert in order, or add to an existing slot.  */
+        for (k = 0; k < g->nr_ids && g->ids[k].mid < m->mid; k++) {
+            /* Nothing.  */
+        }
+        if (k < g->nr_ids && g->ids[k].mid == m->mid) {
+            g->ids[k].entries |= 1U << i;
+            continue;
+        }
+        memmove(&g->ids[k + 1], &g->ids[k],
+                (g->nr_ids - k) * sizeof(g->ids[0]));
+        g->ids[k].mid = m->mid;
+        g->ids[k].entries = 1U << i;
+        g->nr_ids++;
+    }
+}
+
+/* Bitmap of the MID entries whose masked ID matches @master_id.  */
+static uint32_t xppu_match_mids(XPPU *s, uint64_t master_id)
+{
+    uint32_t entries = 0;
+    unsigned int i;
+
+    for (i = 0; i < s->nr_mid_groups; i++) {
+        XPPUMidGroup *g = &s->mid_groups[i];
+        uint32_t mid = master_id & g->mask;
+        unsigned int lo = 0, hi = g->nr_ids;
+
+        while (lo < hi) {
+            unsigned int n = (lo + hi) / 2;
+
+            if (mid < g->ids[n].mid) {
+                hi = n;
+            } else if (mid > g->ids[n].mid) {
+                lo = n + 1;
+            } else {
+                entries |= g->ids[n].entries;
+                break;
+            }
+        }
+    }
+    return entries;
+}
+
 static void isr_update_irq(XPPU *s)
 {
     bool pending = s->regs[R_ISR] & ~s->regs[R_IMR];
@@ -394,6 +489,7 @@ static void ctrl_postw(DepRegisterInfo *reg, uint64_t val64)
     XPPU *s = XILINX_XPPU(reg->opaque);
     update_mrs(s);
     check_mid_parities(s);
+    xppu_decode_mids(s);
     isr_update_irq(s);
 }
 
@@ -401,6 +497,7 @@ static void mid_postw(DepRegisterInfo *reg, uint64_t val64)
 {
     XPPU *s = XILINX_XPPU(reg->opaque);
     check_mid_parity(s, val64);
+    xppu_decode_mids(s);
     isr_update_irq(s);
 }
 
@@ -488,54 +585,70 @@ static DepRegisterAccessInfo xppu_regs_info[] = {
         .reset = 0x83c30080,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID05",  .decode.addr = A_MASTER_ID05,
         .reset = 0x3c30081,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID06",  .decode.addr = A_MASTER_ID06,
         .reset = 0x3c30082,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID07",  .decode.addr = A_MASTER_ID07,
         .reset = 0x83c30083,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID08",  .decode.addr = A_MASTER_ID08,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID09",  .decode.addr = A_MASTER_ID09,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID10",  .decode.addr = A_MASTER_ID10,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID11",  .decode.addr = A_MASTER_ID11,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID12",  .decode.addr = A_MASTER_ID12,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID13",  .decode.addr = A_MASTER_ID13,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID14",  .decode.addr = A_MASTER_ID14,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID15",  .decode.addr = A_MASTER_ID15,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID16",  .decode.addr = A_MASTER_ID16,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID17",  .decode.addr = A_MASTER_ID17,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID18",  .decode.addr = A_MASTER_ID18,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "MASTER_ID19",  .decode.addr = A_MASTER_ID19,
         .rsvd = 0x3c00fc00,
         .ro = 0x3c00fc00,
+        .post_write = mid_postw,
     },{ .name = "RAM_ADJ",  .decode.addr = A_RAM_ADJ,
         .reset = 0xb0b,
         .rsvd = 0xffffc0c0,
@@ -552,13 +665,13 @@ static void xppu_reset(DeviceState *dev)
         dep_register_reset(&s->regs_info[i]);
     }
     update_mrs(s);
+    xppu_decode_mids(s);
     isr_update_irq(s);
 }
 
 static bool xppu_ap_check(XPPU *s, MemoryTransaction *tr, uint32_t apl)
 {
-    unsigned int i;
-    bool mid_match = false;
+    uint32_t entries;
     bool tz = extract32(apl, 27, 1);
     bool ok;
 
@@ -567,33 +680,25 @@ static bool xppu_ap_check(XPPU *s, MemoryTransaction *tr, uint32_t apl)
         return false;
     }
 
-    /* Check MIDs.  */
-    for (i = 0; i < NR_MID_ENTRIES; i++) {
-        uint32_t val32, mid, mask;
-        bool readonly;
-
-        if (!extract32(apl, i, 1)) {
-            continue;
-        }
-
-        val32 = s->regs[R_MASTER_ID00 + i];
-        mid = DEP_F_EX32(val32, MASTER_ID00, MID);
-        readonly = DEP_F_EX32(val32, MASTER_ID00, MIDR);
-        mask = DEP_F_EX32(val32, MASTER_ID00, MIDM);
-
-        if ((mid & mask) != (tr->attr.master_id & mask)) {
-            continue;
-        }
+    /* Check MIDs, the enabled entries that match in order.  */
+    entries = apl & xppu_match_mids(s, tr->attr.master_id) &
+              MAKE_64BIT_MASK(0, NR_MID_ENTRIES);
+    if (!entries) {
+        /* Set if MID checks don't make it past masking and compare.  */
+        DEP_AF_DP32(s->regs, ISR, MID_MISS, true);
+        return false;
+    }
 
-        mid_match = true;
+    for (; entries; entries &= entries - 1) {
+        XPPUMid *m = &s->mids[ctz32(entries)];
 
         /* Check MID parity.  */
-        if (check_mid_parity(s, val32) == false) {
+        if (!m->parity_ok) {
             DEP_AF_DP32(s->regs, ISR, MID_PARITY, true);
             continue;
         }
 
-        if (readonly && tr->rw) {
+        if (m->readonly && tr->rw) {
             DEP_AF_DP32(s->regs, ISR, MID_RO, true);
             continue;
         }
@@ -603,15 +708,9 @@ static bool xppu_ap_check(XPPU *s, MemoryTransaction *tr, uint32_t apl)
             continue;
         }
 
-        break;
-    }
-
-    if (!mid_match) {
-        /* Set if MID checks don't make it past masking and compare.  */
-        DEP_AF_DP32(s->regs, ISR, MID_MISS, true);
+        return true;
     }
-
-    return i < NR_MID_ENTRIES;
+    return false;
 }
 
 static void xppu_ap_access(MemoryTransaction *tr)
@@ -882,11 +981,20 @@ static bool xppu_parse_reg(FDTGenericMMap *obj, FDTGenericRegPropInfo reg,
     return parent_fmc ? parent_fmc->parse_reg(obj, reg, errp) : false;
 }
 
+static int xppu_post_load(void *opaque, int version_id)
+{
+    XPPU *s = XILINX_XPPU(opaque);
+
+    xppu_decode_mids(s);
+    return 0;
+}
+
 static const VMStateDescription vmstate_xppu = {
     .name = TYPE_XILINX_XPPU,
     .version_id = 1,
     .minimum_version_id = 1,
     .minimum_version_id_old = 1,
+    .post_load = xppu_post_load,
     .fields = (VMStateField[]) {
         VMSTATE_UINT32_ARRAY(regs, XPPU, R_MAX),
         VMSTATE_END_OF_LIST(),
@@ -31,6 +31,8 @@
 #include "sysemu/dma.h"
 #include "net/checksum.h"
 #include "exec/address-spaces.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
 
 #ifdef CADENCE_GEM_ERR_DEBUG
 #define DB_PRINT(...) do { \
@@ -59,6 +61,7 @@
 #define GEM_TXPAUSE       (0x0000003C/4) /* TX Pause Time reg */
 #define GEM_TXPARTIALSF   (0x00000040/4) /* TX Partial Store and Forward */
 #define GEM_RXPARTIALSF   (0x00000044/4) /* RX Partial Store and Forward */
+#define GEM_JUMBO_MAX_LEN (0x00000048/4) /* Max Jumbo Frame Size */
 #define GEM_HASHLO        (0x00000080/4) /* Hash Low address reg */
 #define GEM_HASHHI        (0x00000084/4) /* Hash High address reg */
 #define GEM_SPADDR1LO     (0x00000088/4) /* Specific addr 1 low reg */
@@ -212,6 +215,7 @@
 #define GEM_NWCFG_MCAST_HASH   0x00000040 /* accept multicast if hash match */
 #define GEM_NWCFG_BCAST_REJ    0x00000020 /* Reject broadcast packets */
 #define GEM_NWCFG_PROMISC      0x00000010 /* Accept all packets */
+#define GEM_NWCFG_JUMBO_FRAME  0x00000008 /* Jumbo Frames enable */
 
 #define GEM_DMACFG_ADDR_64B    (1U << 30)
 #define GEM_DMACFG_TX_BD_EXT   (1U << 29)
@@ -311,6 +315,12 @@
 
 #define GEM_MODID_VALUE 0x00020118
 
+/* Largest frame accepted when jumbo frames are disabled */
+#define GEM_MAX_FRAME_LEN 1536
+
+/* Bytes of a descriptor ring mapped at a time */
+#define GEM_DESC_CACHE_SIZE 512
+
 static inline uint64_t tx_desc_get_buffer(CadenceGEMState *s, uint32_t *desc)
 {
     uint64_t ret = desc[0];
@@ -462,6 +472,7 @@ static void gem_init_register_masks(CadenceGEMState *s)
     s->regs_ro[GEM_ISR]      = 0xFFFFFFFF;
     s->regs_ro[GEM_IMR]      = 0xFFFFFFFF;
     s->regs_ro[GEM_MODID]    = 0xFFFFFFFF;
+    s->regs_ro[GEM_JUMBO_MAX_LEN] = 0xFFFFC000;
 
     /* Mask of register bits which are clear on read */
     memset(&s->regs_rtc[0], 0, sizeof(s->regs_rtc));
@@ -837,6 +848,83 @@ static int get_queue_from_screen(CadenceGEMState *s, uint8_t *rxbuf_ptr,
     return 0;
 }
 
+static unsigned gem_get_max_frame_len(CadenceGEMState *s)
+{
+    if (s->regs[GEM_NWCFG] & GEM_NWCFG_JUMBO_FRAME) {
+        return s->regs[GEM_JUMBO_MAX_LEN];
+    }
+    return GEM_MAX_FRAME_LEN;
+}
+
+static void gem_desc_cache_flush(CadenceGEMState *s, CadenceGEMDescCache *c)
+{
+    if (c->buf) {
+        dma_memory_unmap(&s->dma_as, c->buf, GEM_DESC_CACHE_SIZE,
+                         DMA_DIRECTION_FROM_DEVICE,
+                         c->dirty ? GEM_DESC_CACHE_SIZE : 0);
+        c->buf = NULL;
+        c->dirty = false;
+    }
+}
+
+/* Release the descriptor windows. Called before returning to the guest,
+ * mappings are not kept while the memory map may change.
+ */
+static void gem_desc_cache_flush_all(CadenceGEMState *s)
+{
+    int i;
+
+    for (i = 0; i < MAX_PRIORITY_QUEUES; i++) {
+        gem_desc_cache_flush(s, &s->rx_desc_cache[i]);
+        gem_desc_cache_flush(s, &s->tx_desc_cache[i]);
+    }
+}
+
+/* Host pointer to @len bytes of descriptor at @addr, NULL if the ring
+ * isn't directly accessible RAM.
+ */
+static uint8_t *gem_desc_ptr(CadenceGEMState *s, CadenceGEMDescCache *c,
+                             hwaddr addr, unsigned len)
+{
+    if (c->buf && addr >= c->addr &&
+        addr - c->addr <= GEM_DESC_CACHE_SIZE - len) {
+        return c->buf + (addr - c->addr);
+    }
+
+    gem_desc_cache_flush(s, c);
+    c->buf = dma_memory_map_direct(&s->dma_as, addr, GEM_DESC_CACHE_SIZE,
+                                   DMA_DIRECTION_FROM_DEVICE);
+    c->addr = addr;
+    return c->buf;
+}
+
+static void gem_desc_read(CadenceGEMState *s, CadenceGEMDescCache *c,
+                          hwaddr addr, uint32_t *desc, unsigned len)
+{
+    uint8_t *p = gem_desc_ptr(s, c, addr, len);
+
+    if (p) {
+        memcpy(desc, p, len);
+    } else {
+        address_space_read(&s->dma_as, addr, MEMTXATTRS_UNSPECIFIED,
+                           (uint8_t *)desc, len);
+    }
+}
+
+static void gem_desc_write(CadenceGEMState *s, CadenceGEMDescCache *c,
+                           hwaddr addr, uint32_t *desc, unsigned len)
+{
+    uint8_t *p = gem_desc_ptr(s, c, addr, len);
+
+    if (p) {
+        memcpy(p, desc, len);
+        c->dirty = true;
+    } else {
+        address_space_write(&s->dma_as, addr, MEMTXATTRS_UNSPECIFIED,
+                            (uint8_t *)desc, len);
+    }
+}
+
 static hwaddr gem_get_desc_addr(CadenceGEMState *s, bool tx, int q)
 {
     hwaddr desc_addr = 0;
@@ -866,9 +954,8 @@ static void gem_get_rx_desc(CadenceGEMState *s, int q)
     DB_PRINT("read descriptor 0x%" HWADDR_PRIx "\n", desc_addr);
 
     /* read current descriptor */
-    address_space_read(&s->dma_as, desc_addr, MEMTXATTRS_UNSPECIFIED,
-                       (uint8_t *)s->rx_desc[q],
-                       sizeof(uint32_t) * gem_get_desc_len(s, true));
+    gem_desc_read(s, &s->rx_desc_cache[q], desc_addr, s->rx_desc[q],
+                  sizeof(uint32_t) * gem_get_desc_len(s, true));
 
     /* Descriptor owned by software ? */
     if (rx_desc_get_ownership(s->rx_desc[q]) == 1) {
@@ -880,17 +967,89 @@ static void gem_get_rx_desc(CadenceGEMState *s, int q)
     }
 }
 
+/*
+ * gem_dma_write_iov:
+ * Copy @len bytes at @offset into @iov to guest memory at @addr.
+ */
+static void gem_dma_write_iov(CadenceGEMState *s, hwaddr addr,
+                              const struct iovec *iov, int iovcnt,
+                              size_t offset, size_t len)
+{
+    void *p = dma_memory_map_direct(&s->dma_as, addr, len,
+                                    DMA_DIRECTION_FROM_DEVICE);
+    int i;
+
+    if (p) {
+        iov_to_buf(iov, iovcnt, offset, p, len);
+        dma_memory_unmap(&s->dma_as, p, len, DMA_DIRECTION_FROM_DEVICE, len);
+        return;
+    }
+
+    for (i = 0; i < iovcnt && len; i++) {
+        size_t n;
+
+        if (offset >= iov[i].iov_len) {
+            offset -= iov[i].iov_len;
+            continue;
+        }
+        n = MIN(len, iov[i].iov_len - offset);
+        address_space_write(&s->dma_as, addr, MEMTXATTRS_UNSPECIFIED,
+                            (uint8_t *)iov[i].iov_base + offset, n);
+        addr += n;
+        len -= n;
+        offset = 0;
+    }
+}
+
+/*
+ * gem_rx_has_room:
+ * Check that queue @q has free descriptors for all @count buffers of a
+ * frame, starting with the current one. Nothing is modified, so a frame
+ * that does not fit can be dropped before the guest sees any of it.
+ */
+static bool gem_rx_has_room(CadenceGEMState *s, int q, unsigned count)
+{
+    unsigned desc_len = sizeof(uint32_t) * gem_get_desc_len(s, true);
+    hwaddr desc_hi = gem_get_rx_desc_addr(s, q) - s->rx_desc_addr[q];
+    uint32_t addr = s->rx_desc_addr[q];
+    uint32_t desc[DESC_MAX_NUM_WORDS];
+
+    memcpy(desc, s->rx_desc[q], sizeof(desc));
+    while (1) {
+        if (rx_desc_get_ownership(desc) == 1) {
+            return false;
+        }
+        if (--count == 0) {
+            return true;
+        }
+        if (rx_desc_get_wrap(desc)) {
+            addr = s->regs[GEM_RXQBASE];
+        } else {
+            addr += 4 * gem_get_desc_len(s, true);
+        }
+        /* The ring is smaller than the frame.  */
+        if (addr == s->rx_desc_addr[q]) {
+            return false;
+        }
+        gem_desc_read(s, &s->rx_desc_cache[q], desc_hi | addr, desc,
+                      desc_len);
+    }
+}
+
 /*
  * gem_receive:
  * Fit a packet handed to us by QEMU into the receive descriptor ring.
  */
 static ssize_t gem_receive(NetClientState *nc, const uint8_t *buf, size_t size)
 {
+    static const uint8_t zeroes[60];
     CadenceGEMState *s;
     unsigned   rxbufsize, bytes_to_copy;
     unsigned   rxbuf_offset;
-    uint8_t    rxbuf[2048];
-    uint8_t   *rxbuf_ptr;
+    struct iovec iov[3];
+    int iovcnt;
+    size_t copied = 0;
+    uint32_t crc_val;
     bool first_desc = true;
     int maf;
     int q = 0;
@@ -918,6 +1077,12 @@ static ssize_t gem_receive(NetClientState *nc, const uint8_t *buf, size_t size)
         }
     }
 
+    /* Frames larger than the configured maximum are dropped */
+    if (size > gem_get_max_frame_len(s)) {
+        DB_PRINT("frame of %zd bytes too large\n", size);
+        return -1;
+    }
+
     /*
      * Determine configured receive buffer offset (probably 0)
      */
@@ -929,7 +1094,6 @@ static ssize_t gem_receive(NetClientState *nc, const uint8_t *buf, size_t size)
      */
     rxbufsize = ((s->regs[GEM_DMACFG] & GEM_DMACFG_RBUFSZ_M) >>
                  GEM_DMACFG_RBUFSZ_S) * GEM_DMACFG_RBUFSZ_MUL;
-    bytes_to_copy = size;
 
     /* Hardware allows a zero value here but warns against it. To avoid QEMU
      * indefinite loops we enforce a minimum value here
@@ -938,62 +1102,88 @@ static ssize_t gem_receive(NetClientState *nc, const uint8_t *buf, size_t size)
         rxbufsize = GEM_DMACFG_RBUFSZ_MUL;
     }
 
+    /* The frame is copied straight from the net layer's buffer, padding
+     * and FCS are appended as separate fragments.
+     */
+    iov[0].iov_base = (void *)buf;
+    iov[0].iov_len = size;
+    iovcnt = 1;
+
     /* Pad to minimum length. Assume FCS field is stripped, logic
      * below will increment it to the real minimum of 64 when
      * not FCS stripping
      */
     if (size < 60) {
+        iov[iovcnt].iov_base = (void *)zeroes;
+        iov[iovcnt].iov_len = 60 - size;
+        iovcnt++;
         size = 60;
     }
 
     /* Strip of FCS field ? (usually yes) */
-    if (s->regs[GEM_NWCFG] & GEM_NWCFG_STRIP_FCS) {
-        rxbuf_ptr = (void *)buf;
-    } else {
-        unsigned crc_val;
-
-        if (size > sizeof(rxbuf) - sizeof(crc_val)) {
-            size = sizeof(rxbuf) - sizeof(crc_val);
-        }
-        bytes_to_copy = size;
+    if (!(s->regs[GEM_NWCFG] & GEM_NWCFG_STRIP_FCS)) {
         /* The application wants the FCS field, which QEMU does not provide.
          * We must try and calculate one.
          */
-
-        memcpy(rxbuf, buf, size);
-        memset(rxbuf + size, 0, sizeof(rxbuf) - size);
-        rxbuf_ptr = rxbuf;
-        crc_val = cpu_to_le32(crc32(0, rxbuf, MAX(size, 60)));
-        memcpy(rxbuf + size, &crc_val, sizeof(crc_val));
-
-        bytes_to_copy += 4;
-        size += 4;
+        crc_val = crc32(0, buf, iov[0].iov_len);
+        crc_val = crc32(crc_val, zeroes, size - iov[0].iov_len);
+        crc_val = cpu_to_le32(crc_val);
+
+        iov[iovcnt].iov_base = &crc_val;
+        iov[iovcnt].iov_len = sizeof(crc_val);
+        iovcnt++;
+        size += sizeof(crc_val);
     }
+    bytes_to_copy = size;
 
     DB_PRINT("config bufsize: %d packet size: %ld\n", rxbufsize, size);
 
     /* Find which queue we are targeting */
-    q = get_queue_from_screen(s, rxbuf_ptr, rxbufsize);
+    q = get_queue_from_screen(s, (uint8_t *)buf, rxbufsize);
+
+    /* Like the hardware, drop the frame when its queue has no buffers
+     * rather than stall the other queues behind it. Check for the whole
+     * frame, so the guest never gets a partial one without EOF.
+     */
+    if (!gem_rx_has_room(s, q, DIV_ROUND_UP(size, rxbufsize))) {
+        DB_PRINT("queue %d has no buffers, dropping frame\n", q);
+        s->regs[GEM_RXRSCERRCNT]++;
+        s->regs[GEM_RXSTATUS] |= GEM_RXSTATUS_NOBUF;
+        s->regs[GEM_ISR] |= GEM_INT_RXUSED & ~(s->regs[GEM_IMR]);
+        gem_update_int_status(s);
+        return size;
+    }
 
     while (bytes_to_copy) {
         hwaddr desc_addr;
+        unsigned chunk = MIN(bytes_to_copy, rxbufsize);
+
+        /* The buffers were checked above, only a guest racing with us
+         * can take one back midway. Drop the rest of the frame.
+         */
+        if (rx_desc_get_ownership(s->rx_desc[q]) == 1) {
+            qemu_log_mask(LOG_GUEST_ERROR, "cadence_gem: RX descriptor "
+                          "reclaimed in the middle of a frame\n");
+            gem_desc_cache_flush_all(s);
+            return size;
+        }
 
         /* Do nothing if receive is not enabled. */
         if (!gem_can_receive(nc)) {
             assert(!first_desc);
+            gem_desc_cache_flush_all(s);
             return -1;
         }
 
-        DB_PRINT("copy %d bytes to 0x%x\n", MIN(bytes_to_copy, rxbufsize),
+        DB_PRINT("copy %d bytes to 0x%x\n", chunk,
                 rx_desc_get_buffer(s->rx_desc[q]));
 
         /* Copy packet data to emulated DMA buffer */
-        address_space_write(&s->dma_as, rx_desc_get_buffer(s, s->rx_desc[q]) +
-                                                                  rxbuf_offset,
-                            MEMTXATTRS_UNSPECIFIED, rxbuf_ptr,
-                            MIN(bytes_to_copy, rxbufsize));
-        rxbuf_ptr += MIN(bytes_to_copy, rxbufsize);
-        bytes_to_copy -= MIN(bytes_to_copy, rxbufsize);
+        gem_dma_write_iov(s, rx_desc_get_buffer(s, s->rx_desc[q]) +
+                                                              rxbuf_offset,
+                          iov, iovcnt, copied, chunk);
+        copied += chunk;
+        bytes_to_copy -= chunk;
 
         /* Update the descriptor.  */
         if (first_desc) {
@@ -1026,10 +1216,8 @@ static ssize_t gem_receive(NetClientState *nc, const uint8_t *buf, size_t size)
 
         /* Descriptor write-back.  */
         desc_addr = gem_get_rx_desc_addr(s, q);
-        address_space_write(&s->dma_as, desc_addr,
-                            MEMTXATTRS_UNSPECIFIED,
-                            (uint8_t *)s->rx_desc[q],
-                            sizeof(uint32_t) * gem_get_desc_len(s, true));
+        gem_desc_write(s, &s->rx_desc_cache[q], desc_addr, s->rx_desc[q],
+                       sizeof(uint32_t) * gem_get_desc_len(s, true));
 
         /* Next descriptor */
         if (rx_desc_get_wrap(s->rx_desc[q])) {
@@ -1042,6 +1230,7 @@ static ssize_t gem_receive(NetClientState *nc, const uint8_t *buf, size_t size)
 
         gem_get_rx_desc(s, q);
     }
+    gem_desc_cache_flush_all(s);
 
     /* Count it */
     gem_receive_updatestats(s, buf, size);
@@ -1101,158 +1290,272 @@ static void gem_transmit_updatestats(CadenceGEMState *s, const uint8_t *packet,
     }
 }
 
+/* Add a fragment of the frame being sent, mapping it when it is RAM.  */
+static void gem_tx_add(CadenceGEMState *s, hwaddr addr, unsigned len)
+{
+    void *p;
+
+    if (s->tx_iovcnt == s->tx_iovalloc) {
+        s->tx_iovalloc = MAX(s->tx_iovalloc * 2, 16);
+        s->tx_iov = g_renew(struct iovec, s->tx_iov, s->tx_iovalloc);
+        s->tx_mapped = g_renew(bool, s->tx_mapped, s->tx_iovalloc);
+    }
+
+    p = dma_memory_map_direct(&s->dma_as, addr, len, DMA_DIRECTION_TO_DEVICE);
+    s->tx_mapped[s->tx_iovcnt] = p != NULL;
+    if (!p) {
+        p = g_malloc(len);
+        address_space_read(&s->dma_as, addr, MEMTXATTRS_UNSPECIFIED, p, len);
+    }
+    s->tx_iov[s->tx_iovcnt].iov_base = p;
+    s->tx_iov[s->tx_iovcnt].iov_len = len;
+    s->tx_iovcnt++;
+}
+
+static void gem_tx_release(CadenceGEMState *s)
+{
+    int i;
+
+    for (i = 0; i < s->tx_iovcnt; i++) {
+        if (s->tx_mapped[i]) {
+            dma_memory_unmap(&s->dma_as, s->tx_iov[i].iov_base,
+                             s->tx_iov[i].iov_len, DMA_DIRECTION_TO_DEVICE,
+                             s->tx_iov[i].iov_len);
+        } else {
+            g_free(s->tx_iov[i].iov_base);
+        }
+    }
+    s->tx_iovcnt = 0;
+}
+
+static void gem_transmit(CadenceGEMState *s);
+
+/* Priority queues share the backend queues round robin */
+static NetClientState *gem_get_tx_nc(CadenceGEMState *s, int q)
+{
+    return qemu_get_subqueue(s->nic, q % MAX(s->conf.peers.queues, 1));
+}
+
+/* The backend has drained a frame it queued, carry on with the rings.  */
+static void gem_tx_sent(NetClientState *nc, ssize_t len)
+{
+    CadenceGEMState *s = qemu_get_nic_opaque(nc);
+    int q;
+
+    for (q = 0; q < s->num_priority_queues; q++) {
+        if (gem_get_tx_nc(s, q) == nc) {
+            s->txq[q].stalled = false;
+        }
+    }
+    gem_transmit(s);
+}
+
 /*
- * gem_transmit:
- * Fish packets out of the descriptor ring and feed them to QEMU
+ * gem_send_packet:
+ * Hand the gathered fragments to QEMU. Returns false if the backend queued
+ * the frame and transmission must wait for gem_tx_sent().
  */
-static void gem_transmit(CadenceGEMState *s)
+static bool gem_send_packet(CadenceGEMState *s, int q, unsigned total_bytes)
 {
+    NetClientState *nc = gem_get_tx_nc(s, q);
+    bool loop = s->phy_loop || (s->regs[GEM_NWCTRL] & GEM_NWCTRL_LOCALLOOP);
+    uint8_t hdr[6];
+
+    /* Update MAC statistics */
+    iov_to_buf(s->tx_iov, s->tx_iovcnt, 0, hdr, sizeof(hdr));
+    gem_transmit_updatestats(s, hdr, total_bytes);
+
+    /* Checksum offload writes into the frame and loopback needs it linear,
+     * these take a copy. Everything else goes out from guest memory.
+     */
+    if (loop || (s->regs[GEM_DMACFG] & GEM_DMACFG_TXCSUM_OFFL)) {
+        uint8_t *packet = g_malloc(total_bytes);
+
+        iov_to_buf(s->tx_iov, s->tx_iovcnt, 0, packet, total_bytes);
+
+        /* Is checksum offload enabled? */
+        if (s->regs[GEM_DMACFG] & GEM_DMACFG_TXCSUM_OFFL) {
+            net_checksum_calculate(packet, total_bytes);
+        }
+
+        /* Send the packet somewhere */
+        if (loop) {
+            gem_receive(nc, packet, total_bytes);
+        } else {
+            qemu_send_packet(nc, packet, total_bytes);
+        }
+        g_free(packet);
+        return true;
+    }
+
+    /* A queued frame has been copied by the net layer, so the fragments
+     * can be released either way.
+     */
+    return qemu_sendv_packet_async(nc, s->tx_iov, s->tx_iovcnt,
+                                   gem_tx_sent) != 0;
+}
+
+/*
+ * gem_transmit_queue:
+ * Fish packets out of the descriptor ring of priority queue @q and feed
+ * them to QEMU
+ */
+static void gem_transmit_queue(CadenceGEMState *s, int q)
+{
+    CadenceGEMDescCache *cache = &s->tx_desc_cache[q];
     uint32_t desc[DESC_MAX_NUM_WORDS];
     hwaddr packet_desc_addr;
-    uint8_t     tx_packet[2048];
-    uint8_t     *p;
+    unsigned    desc_len = sizeof(uint32_t) * gem_get_desc_len(s, false);
     unsigned    total_bytes;
-    int q = 0;
 
     /* Do nothing if transmit is not enabled. */
     if (!(s->regs[GEM_NWCTRL] & GEM_NWCTRL_TXENA)) {
         return;
     }
 
-    DB_PRINT("\n");
+    /* Wait for the backend to take the last frame */
+    if (s->txq[q].stalled) {
+        return;
+    }
+
+    DB_PRINT("queue %d\n", q);
 
     /* The packet we will hand off to QEMU.
-     * Packets scattered across multiple descriptors are gathered to this
-     * one contiguous buffer first.
+     * Packets scattered across multiple descriptors are collected
+     * as an iovec over the guest buffers.
      */
-    p = tx_packet;
     total_bytes = 0;
 
-    for (q = s->num_priority_queues - 1; q >= 0; q--) {
-        /* read current descriptor */
-        packet_desc_addr = gem_get_tx_desc_addr(s, q);
+    /* read current descriptor */
+    packet_desc_addr = gem_get_tx_desc_addr(s, q);
 
-        DB_PRINT("read descriptor 0x%" HWADDR_PRIx "\n", packet_desc_addr);
-        address_space_read(&s->dma_as, packet_desc_addr,
-                           MEMTXATTRS_UNSPECIFIED, (uint8_t *)desc,
-                           sizeof(uint32_t) * gem_get_desc_len(s, false));
-        /* Handle all descriptors owned by hardware */
-        while (tx_desc_get_used(desc) == 0) {
-
-            /* Do nothing if transmit is not enabled. */
-            if (!(s->regs[GEM_NWCTRL] & GEM_NWCTRL_TXENA)) {
-                return;
-            }
-            print_gem_tx_desc(desc, q);
+    DB_PRINT("read descriptor 0x%" HWADDR_PRIx "\n", packet_desc_addr);
+    gem_desc_read(s, cache, packet_desc_addr, desc, desc_len);
+    /* Handle all descriptors owned by hardware */
+    while (tx_desc_get_used(desc) == 0) {
+
+        /* Do nothing if transmit is not enabled. */
+        if (!(s->regs[GEM_NWCTRL] & GEM_NWCTRL_TXENA)) {
+            return;
+        }
+        print_gem_tx_desc(desc, q);
+
+        /* The real hardware would eat this (and possibly crash).
+         * For QEMU let's lend a helping hand.
+         */
+        if ((tx_desc_get_buffer(s, desc) == 0) ||
+            (tx_desc_get_length(desc) == 0)) {
+            DB_PRINT("Invalid TX descriptor @ 0x%x\n",
+                     (unsigned)packet_desc_addr);
+            break;
+        }
+
+        if (total_bytes + tx_desc_get_length(desc) >
+            gem_get_max_frame_len(s)) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "cadence_gem: TX frame @ 0x%" HWADDR_PRIx
+                          " exceeds the maximum frame length %u\n",
+                          packet_desc_addr, gem_get_max_frame_len(s));
+            break;
+        }
 
-            /* The real hardware would eat this (and possibly crash).
-             * For QEMU let's lend a helping hand.
+        /* Collect this fragment of the packet from "dma memory" */
+        gem_tx_add(s, tx_desc_get_buffer(s, desc),
+                   tx_desc_get_length(desc));
+        total_bytes += tx_desc_get_length(desc);
+
+        /* Last descriptor for this packet; hand the whole thing off */
+        if (tx_desc_get_last(desc)) {
+            uint32_t desc_first[DESC_MAX_NUM_WORDS];
+            hwaddr desc_addr = gem_get_tx_desc_addr(s, q);
+            bool sent;
+
+            /* Modify the 1st descriptor of this packet to be owned by
+             * the processor.
              */
-            if ((tx_desc_get_buffer(s, desc) == 0) ||
-                (tx_desc_get_length(desc) == 0)) {
-                DB_PRINT("Invalid TX descriptor @ 0x%x\n",
-                         (unsigned)packet_desc_addr);
-                break;
+            gem_desc_read(s, cache, desc_addr, desc_first, desc_len);
+            tx_desc_set_used(desc_first);
+            gem_desc_write(s, cache, desc_addr, desc_first, desc_len);
+            /* Advance the hardware current descriptor past this packet */
+            if (tx_desc_get_wrap(desc)) {
+                s->tx_desc_addr[q] = s->regs[GEM_TXQBASE];
+            } else {
+                s->tx_desc_addr[q] = packet_desc_addr + desc_len;
             }
+            DB_PRINT("TX descriptor next: 0x%08x\n", s->tx_desc_addr[q]);
 
-            if (tx_desc_get_length(desc) > sizeof(tx_packet) -
-                                               (p - tx_packet)) {
-                DB_PRINT("TX descriptor @ 0x%x too large: size 0x%x space " \
-                         "0x%x\n", (unsigned)packet_desc_addr,
-                         (unsigned)tx_desc_get_length(desc),
-                         sizeof(tx_packet) - (p - tx_packet));
-                break;
-            }
+            s->regs[GEM_TXSTATUS] |= GEM_TXSTATUS_TXCMPL;
+            s->regs[GEM_ISR] |= GEM_INT_TXCMPL & ~(s->regs[GEM_IMR]);
 
-            /* Gather this fragment of the packet from "dma memory" to our
-             * contig buffer.
-             */
-            address_space_read(&s->dma_as, tx_desc_get_buffer(s, desc),
-                               MEMTXATTRS_UNSPECIFIED,
-                               p, tx_desc_get_length(desc));
-            p += tx_desc_get_length(desc);
-            total_bytes += tx_desc_get_length(desc);
-
-            /* Last descriptor for this packet; hand the whole thing off */
-            if (tx_desc_get_last(desc)) {
-                uint32_t desc_first[DESC_MAX_NUM_WORDS];
-                hwaddr desc_addr = gem_get_tx_desc_addr(s, q);
-
-                /* Modify the 1st descriptor of this packet to be owned by
-                 * the processor.
-                 */
-                address_space_read(&s->dma_as, desc_addr,
-                                   MEMTXATTRS_UNSPECIFIED,
-                                   (uint8_t *)desc_first,
-                                   sizeof(desc_first));
-                tx_desc_set_used(desc_first);
-                address_space_write(&s->dma_as, desc_addr,
-                                  MEMTXATTRS_UNSPECIFIED,
-                                  (uint8_t *)desc_first,
-                                   sizeof(desc_first));
-                /* Advance the hardware current descriptor past this packet */
-                if (tx_desc_get_wrap(desc)) {
-                    s->tx_desc_addr[q] = s->regs[GEM_TXQBASE];
-                } else {
-                    s->tx_desc_addr[q] = packet_desc_addr +
-                                         4 * gem_get_desc_len(s, false);
-                }
-                DB_PRINT("TX descriptor next: 0x%08x\n", s->tx_desc_addr[q]);
-
-                s->regs[GEM_TXSTATUS] |= GEM_TXSTATUS_TXCMPL;
-                s->regs[GEM_ISR] |= GEM_INT_TXCMPL & ~(s->regs[GEM_IMR]);
-
-                /* Update queue interrupt status */
-                if (s->num_priority_queues > 1) {
-                    s->regs[GEM_INT_Q1_STATUS + q] |=
-                            GEM_INT_TXCMPL & ~(s->regs[GEM_INT_Q1_MASK + q]);
-                }
-
-                /* Handle interrupt consequences */
-                gem_update_int_status(s);
-
-                /* Is checksum offload enabled? */
-                if (s->regs[GEM_DMACFG] & GEM_DMACFG_TXCSUM_OFFL) {
-                    net_checksum_calculate(tx_packet, total_bytes);
-                }
-
-                /* Update MAC statistics */
-                gem_transmit_updatestats(s, tx_packet, total_bytes);
-
-                /* Send the packet somewhere */
-                if (s->phy_loop || (s->regs[GEM_NWCTRL] &
-                                    GEM_NWCTRL_LOCALLOOP)) {
-                    gem_receive(qemu_get_queue(s->nic), tx_packet,
-                                total_bytes);
-                } else {
-                    qemu_send_packet(qemu_get_queue(s->nic), tx_packet,
-                                     total_bytes);
-                }
-
-                /* Prepare for next packet */
-                p = tx_packet;
-                total_bytes = 0;
+            /* Update queue interrupt status */
+            if (s->num_priority_queues > 1) {
+                s->regs[GEM_INT_Q1_STATUS + q] |=
+                        GEM_INT_TXCMPL & ~(s->regs[GEM_INT_Q1_MASK + q]);
             }
 
-            /* read next descriptor */
-            if (tx_desc_get_wrap(desc)) {
-                tx_desc_set_last(desc);
-                packet_desc_addr = s->regs[GEM_TXQBASE];
-            } else {
-                packet_desc_addr += 4 * gem_get_desc_len(s, false);
+            /* Handle interrupt consequences */
+            gem_update_int_status(s);
+
+            sent = gem_send_packet(s, q, total_bytes);
+
+            /* Prepare for next packet */
+            gem_tx_release(s);
+            total_bytes = 0;
+
+            if (!sent) {
+                s->txq[q].stalled = true;
+                return;
             }
-            DB_PRINT("read descriptor 0x%" HWADDR_PRIx "\n", packet_desc_addr);
-            address_space_read(&s->dma_as, packet_desc_addr,
-                              MEMTXATTRS_UNSPECIFIED, (uint8_t *)desc,
-                              sizeof(uint32_t) * gem_get_desc_len(s, false));
         }
 
-        if (tx_desc_get_used(desc)) {
-            s->regs[GEM_TXSTATUS] |= GEM_TXSTATUS_USED;
-            s->regs[GEM_ISR] |= GEM_INT_TXUSED & ~(s->regs[GEM_IMR]);
-            gem_update_int_status(s);
+        /* read next descriptor */
+        if (tx_desc_get_wrap(desc)) {
+            tx_desc_set_last(desc);
+            packet_desc_addr = s->regs[GEM_TXQBASE];
+        } else {
+            packet_desc_addr += desc_len;
         }
+        DB_PRINT("read descriptor 0x%" HWADDR_PRIx "\n", packet_desc_addr);
+        gem_desc_read(s, cache, packet_desc_addr, desc, desc_len);
     }
+
+    if (tx_desc_get_used(desc)) {
+        s->regs[GEM_TXSTATUS] |= GEM_TXSTATUS_USED;
+        s->regs[GEM_ISR] |= GEM_INT_TXUSED & ~(s->regs[GEM_IMR]);
+        gem_update_int_status(s);
+    }
+}
+
+static void gem_tx_bh(void *opaque)
+{
+    CadenceGEMTxQueue *txq = opaque;
+    CadenceGEMState *s = txq->gem;
+
+    qemu_mutex_lock_iothread();
+    gem_transmit_queue(s, txq->id);
+    gem_tx_release(s);
+    gem_desc_cache_flush_all(s);
+    qemu_mutex_unlock_iothread();
+}
+
+/*
+ * gem_transmit:
+ * Process the rings from the highest priority queue down, or hand them
+ * to the IOThread
+ */
+static void gem_transmit(CadenceGEMState *s)
+{
+    int q;
+
+    for (q = s->num_priority_queues - 1; q >= 0; q--) {
+        if (s->iothread) {
+            qemu_bh_schedule(s->txq[q].bh);
+        } else {
+            gem_transmit_queue(s, q);
+            gem_tx_release(s);
+        }
+    }
+    gem_desc_cache_flush_all(s);
 }
 
 static void gem_phy_reset(CadenceGEMState *s)
@@ -1298,6 +1601,7 @@ static void gem_reset(DeviceState *d)
     s->regs[GEM_TXPAUSE] = 0x0000ffff;
     s->regs[GEM_TXPARTIALSF] = 0x000003ff;
     s->regs[GEM_RXPARTIALSF] = 0x000003ff;
+    s->regs[GEM_JUMBO_MAX_LEN] = s->jumbo_max_len;
     s->regs[GEM_MODID] = s->revision;
     s->regs[GEM_DESCONF] = 0x02500111;
     s->regs[GEM_DESCONF2] = 0x2ab13fff;
@@ -1317,6 +1621,9 @@ static void gem_reset(DeviceState *d)
     for (i = 0; i < 4; i++) {
         s->sar_active[i] = false;
     }
+    for (i = 0; i < MAX_PRIORITY_QUEUES; i++) {
+        s->txq[i].stalled = false;
+    }
 
     if (s->mdio) {
         phy_update_link(s);
@@ -1470,6 +1777,7 @@ static void gem_write(void *opaque, hwaddr offset, uint64_t val,
             for (i = 0; i < s->num_priority_queues; ++i) {
                 gem_get_rx_desc(s, i);
             }
+            gem_desc_cache_flush_all(s);
         }
         if (val & GEM_NWCTRL_TXSTART) {
             gem_transmit(s);
@@ -1481,7 +1789,9 @@ static void gem_write(void *opaque, hwaddr offset, uint64_t val,
             }
         }
         if (gem_can_receive(qemu_get_queue(s->nic))) {
-            qemu_flush_queued_packets(qemu_get_queue(s->nic));
+            for (i = 0; i < MAX(s->conf.peers.queues, 1); i++) {
+                qemu_flush_queued_packets(qemu_get_subqueue(s->nic, i));
+            }
         }
         break;
 
@@ -1595,10 +1905,21 @@ static void gem_realize(DeviceState *dev, Error **errp)
         error_setg(errp, "Invalid num-type2-screeners value: %" PRIx8,
                    s->num_type2_screeners);
         return;
+    } else if (s->jumbo_max_len > DESC_1_LENGTH) {
+        error_setg(errp, "Invalid jumbo-max-len value: %" PRIu16,
+                   s->jumbo_max_len);
+        return;
     }
 
     for (i = 0; i < s->num_priority_queues; ++i) {
         sysbus_init_irq(SYS_BUS_DEVICE(dev), &s->irq[i]);
+
+        s->txq[i].gem = s;
+        s->txq[i].id = i;
+        if (s->iothread) {
+            s->txq[i].bh = aio_bh_new(iothread_get_aio_context(s->iothread),
+                                      gem_tx_bh, &s->txq[i]);
+        }
     }
 
     if (!s->attr) {
@@ -1667,6 +1988,10 @@ static Property gem_properties[] = {
                       num_type1_screeners, 4),
     DEFINE_PROP_UINT8("num-type2-screeners", CadenceGEMState,
                       num_type2_screeners, 4),
+    DEFINE_PROP_UINT16("jumbo-max-len", CadenceGEMState,
+                       jumbo_max_len, 10240),
+    DEFINE_PROP_LINK("iothread", CadenceGEMState, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -20,13 +20,13 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/log.h"
 #include "hw/sysbus.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/dma.h"
+#include "exec/address-spaces.h"
 #include "net/net.h"
 
-#define FIFO_RAM_BYTES 2048
-#define LENGTH_FIFO_WORDS 16
-
 #define TYPE_LABX_ETHERNET "labx.ethernet"
 #define LABX_ETHERNET(obj) \
     OBJECT_CHECK(LabXEthernet, (obj), TYPE_LABX_ETHERNET)
@@ -45,28 +45,37 @@ typedef struct LabXEthernet {
 
     /* Device Configuration */
     uint32_t baseAddress;
+    uint32_t fifoBytes;
+    uint32_t lengthFifoDepth;
+    bool     dmaMode;
 
     /* Values set by drivers */
     uint32_t hostRegs[0x10];
     uint32_t fifoRegs[0x10];
 
     /* Tx buffers */
-    uint32_t *txBuffer;
-    uint32_t  txPushIndex;
+    uint8_t  *txBuffer;
     uint32_t  txPopIndex;
+    uint32_t  txUsed;
 
     uint32_t *txLengthBuffer;
-    uint32_t  txLengthPushIndex;
     uint32_t  txLengthPopIndex;
+    uint32_t  txLengthUsed;
 
     /* Rx buffers */
-    uint32_t *rxBuffer;
-    uint32_t  rxPushIndex;
+    uint8_t  *rxBuffer;
     uint32_t  rxPopIndex;
+    uint32_t  rxUsed;
 
     uint32_t *rxLengthBuffer;
-    uint32_t  rxLengthPushIndex;
     uint32_t  rxLengthPopIndex;
+    uint32_t  rxLengthUsed;
+
+    /* Bytes needed by the packet held back by the net layer, 0 if none */
+    uint32_t  rxPending;
+
+    /* Linear copy of the frame being sent or DMAed */
+    uint8_t  *frameBuffer;
 } LabXEthernet;
 
 /*
@@ -291,6 +300,10 @@ static const MemoryRegionOps mac_regs_ops = {
 #define FIFO_RX_OCCUPANCY_ADDRESS 0x7
 #define FIFO_RX_DATA_ADDRESS      0x8
 #define FIFO_RX_LENGTH_ADDRESS    0x9
+#define FIFO_DMA_TX_ADDR_ADDRESS  0xA
+#define FIFO_DMA_TX_LENGTH_ADDRESS 0xB
+#define FIFO_DMA_RX_ADDR_ADDRESS  0xC
+#define FIFO_DMA_RX_LENGTH_ADDRESS 0xD
 
 static void update_fifo_irq(LabXEthernet *p)
 {
@@ -302,27 +315,140 @@ static void update_fifo_irq(LabXEthernet *p)
     }
 }
 
-static void send_packet(LabXEthernet *p)
+/*
+ * The data FIFOs hold big endian words, the length FIFOs one length per
+ * frame. Frames always occupy whole words.
+ */
+static void fifo_push(uint8_t *fifo, uint32_t size, uint32_t pop,
+                      uint32_t *used, const uint8_t *buf, uint32_t len)
+{
+    uint32_t push = (pop + *used) % size;
+    uint32_t n = MIN(len, size - push);
+
+    memcpy(fifo + push, buf, n);
+    memcpy(fifo, buf + n, len - n);
+    *used += len;
+}
+
+static void fifo_pop(const uint8_t *fifo, uint32_t size, uint32_t *pop,
+                     uint32_t *used, uint8_t *buf, uint32_t len)
 {
-    while (p->txLengthPopIndex != p->txLengthPushIndex) {
-        int i;
-        uint32_t packetBuf[512];
+    uint32_t n = MIN(len, size - *pop);
+
+    memcpy(buf, fifo + *pop, n);
+    memcpy(buf + n, fifo, len - n);
+    *pop = (*pop + len) % size;
+    *used -= len;
+}
 
-        int length = p->txLengthBuffer[p->txLengthPopIndex];
-        p->txLengthPopIndex = (p->txLengthPopIndex + 1) % LENGTH_FIFO_WORDS;
+static bool rx_fifo_fits(LabXEthernet *p, uint32_t bytes)
+{
+    return p->rxLengthUsed < p->lengthFifoDepth &&
+           p->fifoBytes - p->rxUsed >= bytes;
+}
+
+/* Let the net layer retry a held back packet once it fits */
+static void rx_fifo_drained(LabXEthernet *p)
+{
+    if (p->rxPending && rx_fifo_fits(p, p->rxPending)) {
+        p->rxPending = 0;
+        qemu_flush_queued_packets(qemu_get_queue(p->nic));
+    }
+}
 
-        for (i = 0; i < ((length+3)/4); i++) {
-            packetBuf[i] = be32_to_cpu(p->txBuffer[p->txPopIndex]);
-            p->txPopIndex = (p->txPopIndex + 1) % (FIFO_RAM_BYTES/4);
+static void rx_fifo_reset(LabXEthernet *p)
+{
+    p->rxPopIndex = 0;
+    p->rxUsed = 0;
+    p->rxLengthPopIndex = 0;
+    p->rxLengthUsed = 0;
+    rx_fifo_drained(p);
+}
+
+/* Pop the next received frame into frameBuffer, returns its length */
+static uint32_t rx_fifo_pop_frame(LabXEthernet *p)
+{
+    uint32_t length = p->rxLengthBuffer[p->rxLengthPopIndex];
+
+    p->rxLengthPopIndex = (p->rxLengthPopIndex + 1) % p->lengthFifoDepth;
+    p->rxLengthUsed--;
+
+    /*
+     * The guest may already have read part of the data word by word.
+     * Clamp before rounding up, a bogus length would wrap around.
+     */
+    if (length > p->rxUsed) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "labx-ethernet: Rx length %u exceeds the %u bytes "
+                      "left in the fifo\n", length, p->rxUsed);
+        length = p->rxUsed;
+    }
+    fifo_pop(p->rxBuffer, p->fifoBytes, &p->rxPopIndex, &p->rxUsed,
+             p->frameBuffer, MIN(ROUND_UP(length, 4), p->rxUsed));
+    return length;
+}
+
+static void send_packet(LabXEthernet *p)
+{
+    while (p->txLengthUsed) {
+        uint32_t length = p->txLengthBuffer[p->txLengthPopIndex];
+
+        p->txLengthPopIndex = (p->txLengthPopIndex + 1) % p->lengthFifoDepth;
+        p->txLengthUsed--;
+
+        /* The length comes from the guest, clamp it before rounding up.  */
+        if (length > p->txUsed) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "labx-ethernet: Tx length %u exceeds the %u bytes "
+                          "in the fifo\n", length, p->txUsed);
+            length = p->txUsed;
         }
+        fifo_pop(p->txBuffer, p->fifoBytes, &p->txPopIndex, &p->txUsed,
+                 p->frameBuffer, MIN(ROUND_UP(length, 4), p->txUsed));
+
+        qemu_send_packet(qemu_get_queue(p->nic), p->frameBuffer, length);
+    }
+
+    p->fifoRegs[FIFO_INT_STATUS_ADDRESS] |= FIFO_INT_TC;
+    update_fifo_irq(p);
+}
 
-        qemu_send_packet(qemu_get_queue(p->nic), (void *)packetBuf, length);
+static void dma_send_packet(LabXEthernet *p, uint32_t length)
+{
+    if (length > p->fifoBytes) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "labx-ethernet: DMA Tx length %u too large\n", length);
+        p->fifoRegs[FIFO_INT_STATUS_ADDRESS] |= FIFO_INT_TPOE;
+        update_fifo_irq(p);
+        return;
     }
 
+    dma_memory_read(&address_space_memory,
+                    p->fifoRegs[FIFO_DMA_TX_ADDR_ADDRESS],
+                    p->frameBuffer, length);
+    qemu_send_packet(qemu_get_queue(p->nic), p->frameBuffer, length);
+
     p->fifoRegs[FIFO_INT_STATUS_ADDRESS] |= FIFO_INT_TC;
     update_fifo_irq(p);
 }
 
+/* Move the next received frame to the DMA buffer, returns its length */
+static uint32_t dma_receive_packet(LabXEthernet *p)
+{
+    uint32_t length;
+
+    if (!p->rxLengthUsed) {
+        return 0;
+    }
+
+    length = rx_fifo_pop_frame(p);
+    dma_memory_write(&address_space_memory,
+                     p->fifoRegs[FIFO_DMA_RX_ADDR_ADDRESS],
+                     p->frameBuffer, length);
+    rx_fifo_drained(p);
+    return length;
+}
+
 static uint64_t fifo_regs_read(void *opaque, hwaddr addr,
                                unsigned int size)
 {
@@ -338,15 +464,11 @@ static uint64_t fifo_regs_read(void *opaque, hwaddr addr,
         break;
 
     case FIFO_TX_VACANCY_ADDRESS:
-        retval = (p->txPopIndex - p->txPushIndex) - 1;
-        if ((int32_t)retval < 0) {
-            retval += (FIFO_RAM_BYTES/4);
-        }
-
-        if (((p->txLengthPushIndex + 1) % LENGTH_FIFO_WORDS) ==
-            p->txLengthPopIndex) {
+        if (p->txLengthUsed == p->lengthFifoDepth) {
             /* Full length fifo */
             retval = 0;
+        } else {
+            retval = (p->fifoBytes - p->txUsed) / 4;
         }
         break;
 
@@ -357,16 +479,15 @@ static uint64_t fifo_regs_read(void *opaque, hwaddr addr,
         break;
 
     case FIFO_RX_OCCUPANCY_ADDRESS:
-        retval = p->rxPushIndex - p->rxPopIndex;
-        if ((int32_t)retval < 0) {
-            retval += (FIFO_RAM_BYTES/4);
-        }
+        retval = p->rxUsed / 4;
         break;
 
     case FIFO_RX_DATA_ADDRESS:
-        retval = p->rxBuffer[p->rxPopIndex];
-        if (p->rxPopIndex != p->rxPushIndex) {
-            p->rxPopIndex = (p->rxPopIndex+1) % (FIFO_RAM_BYTES/4);
+        if (p->rxUsed) {
+            retval = ldl_be_p(p->rxBuffer + p->rxPopIndex);
+            p->rxPopIndex = (p->rxPopIndex + 4) % p->fifoBytes;
+            p->rxUsed -= 4;
+            rx_fifo_drained(p);
         } else {
             p->fifoRegs[FIFO_INT_STATUS_ADDRESS] |= FIFO_INT_RPURE;
             update_fifo_irq(p);
@@ -374,15 +495,34 @@ static uint64_t fifo_regs_read(void *opaque, hwaddr addr,
         break;
 
     case FIFO_RX_LENGTH_ADDRESS:
-        retval = p->rxLengthBuffer[p->rxLengthPopIndex];
-        if (p->rxLengthPopIndex != p->rxLengthPushIndex) {
-            p->rxLengthPopIndex = (p->rxLengthPopIndex+1) % LENGTH_FIFO_WORDS;
+        if (p->rxLengthUsed) {
+            retval = p->rxLengthBuffer[p->rxLengthPopIndex];
+            p->rxLengthPopIndex = (p->rxLengthPopIndex + 1) %
+                                  p->lengthFifoDepth;
+            p->rxLengthUsed--;
+            rx_fifo_drained(p);
         } else {
             p->fifoRegs[FIFO_INT_STATUS_ADDRESS] |= FIFO_INT_RPURE;
             update_fifo_irq(p);
         }
         break;
 
+    case FIFO_DMA_TX_ADDR_ADDRESS:
+    case FIFO_DMA_RX_ADDR_ADDRESS:
+        if (p->dmaMode) {
+            retval = p->fifoRegs[(addr>>2) & 0x0F];
+        }
+        break;
+
+    case FIFO_DMA_TX_LENGTH_ADDRESS:
+        break;
+
+    case FIFO_DMA_RX_LENGTH_ADDRESS:
+        if (p->dmaMode) {
+            retval = dma_receive_packet(p);
+        }
+        break;
+
     default:
         printf("labx-ethernet: Read of unknown fifo register %"HWADDR_PRIX"\n", addr);
         break;
@@ -416,10 +556,10 @@ static void fifo_regs_write(void *opaque, hwaddr addr,
 
     case FIFO_TX_RESET_ADDRESS:
         if (value == FIFO_RESET_MAGIC) {
-            p->txPushIndex = 0;
             p->txPopIndex = 0;
-            p->txLengthPushIndex = 0;
+            p->txUsed = 0;
             p->txLengthPopIndex = 0;
+            p->txLengthUsed = 0;
         }
         break;
 
@@ -427,40 +567,38 @@ static void fifo_regs_write(void *opaque, hwaddr addr,
         break;
 
     case FIFO_TX_DATA_ADDRESS:
-        if ((((p->txLengthPushIndex + 1) % LENGTH_FIFO_WORDS) ==
-             p->txLengthPopIndex) ||
-            (((p->txPushIndex + 1) % (FIFO_RAM_BYTES/4)) == p->txPopIndex)) {
+        if ((p->txLengthUsed == p->lengthFifoDepth) ||
+            (p->txUsed == p->fifoBytes)) {
             /* Full length fifo or data fifo */
             p->fifoRegs[FIFO_INT_STATUS_ADDRESS] |= FIFO_INT_TPOE;
             update_fifo_irq(p);
         } else {
             /* Push back the data */
-            p->txBuffer[p->txPushIndex] = value;
-            p->txPushIndex = (p->txPushIndex + 1) % (FIFO_RAM_BYTES/4);
+            uint8_t word[4];
+
+            stl_be_p(word, value);
+            fifo_push(p->txBuffer, p->fifoBytes, p->txPopIndex, &p->txUsed,
+                      word, sizeof(word));
         }
         break;
 
     case FIFO_TX_LENGTH_ADDRESS:
-        if (((p->txLengthPushIndex + 1) % LENGTH_FIFO_WORDS) ==
-            p->txLengthPopIndex) {
+        if (p->txLengthUsed == p->lengthFifoDepth) {
             /* Full length fifo */
             p->fifoRegs[FIFO_INT_STATUS_ADDRESS] |= FIFO_INT_TPOE;
             update_fifo_irq(p);
         } else {
             /* Push back the length */
-            p->txLengthBuffer[p->txLengthPushIndex] = value;
-            p->txLengthPushIndex = (p->txLengthPushIndex + 1) %
-                                   LENGTH_FIFO_WORDS;
+            p->txLengthBuffer[(p->txLengthPopIndex + p->txLengthUsed) %
+                              p->lengthFifoDepth] = value;
+            p->txLengthUsed++;
             send_packet(p);
         }
         break;
 
     case FIFO_RX_RESET_ADDRESS:
         if (value == FIFO_RESET_MAGIC) {
-            p->rxPushIndex = 0;
-            p->rxPopIndex = 0;
-            p->rxLengthPushIndex = 0;
-            p->rxLengthPopIndex = 0;
+            rx_fifo_reset(p);
         }
         break;
 
@@ -473,6 +611,22 @@ static void fifo_regs_write(void *opaque, hwaddr addr,
     case FIFO_RX_LENGTH_ADDRESS:
         break;
 
+    case FIFO_DMA_TX_ADDR_ADDRESS:
+    case FIFO_DMA_RX_ADDR_ADDRESS:
+        if (p->dmaMode) {
+            p->fifoRegs[(addr>>2) & 0x0F] = value;
+        }
+        break;
+
+    case FIFO_DMA_TX_LENGTH_ADDRESS:
+        if (p->dmaMode) {
+            dma_send_packet(p, value);
+        }
+        break;
+
+    case FIFO_DMA_RX_LENGTH_ADDRESS:
+        break;
+
     default:
         printf("labx-ethernet: Write of unknown fifo register %"HWADDR_PRIX" = %08X\n",
                addr, value);
@@ -493,36 +647,37 @@ static const MemoryRegionOps fifo_regs_ops = {
 
 static int eth_can_rx(NetClientState *nc)
 {
-    /*LabXEthernet *s = DO_UPCAST(NICState, nc, nc)->opaque; */
+    LabXEthernet *p = qemu_get_nic_opaque(nc);
 
-    return 1;
+    /* Room for at least a minimum sized frame */
+    return !p->rxPending && rx_fifo_fits(p, 64);
 }
 
 static ssize_t eth_rx(NetClientState *nc, const uint8_t *buf, size_t size)
 {
     LabXEthernet *p = qemu_get_nic_opaque(nc);
-    int i;
-    const uint32_t *wbuf = (const uint32_t *)buf;
-    int rxPushIndexStart = p->rxPushIndex;
-
-    for (i = 0; i < ((size+3)/4); i++) {
-        p->rxBuffer[p->rxPushIndex] = cpu_to_be32(wbuf[i]);
-        p->rxPushIndex = (p->rxPushIndex + 1) % (FIFO_RAM_BYTES/4);
-        if (p->rxPushIndex == p->rxPopIndex) {
-            /* Packet didn't fit */
-            p->rxPushIndex = rxPushIndexStart;
-            return -1;
-        }
+    static const uint8_t pad[4];
+    uint32_t padded = ROUND_UP(size, 4);
+
+    if (padded > p->fifoBytes) {
+        /* Never fits, drop it */
+        return size;
     }
 
-    if ((p->rxLengthPushIndex + 1) % LENGTH_FIFO_WORDS == p->rxLengthPopIndex) {
-        /* Length didn't fit */
-        p->rxPushIndex = rxPushIndexStart;
-        return -1;
+    if (!rx_fifo_fits(p, padded)) {
+        /* Hold the packet back until the guest drains the fifo */
+        p->rxPending = padded;
+        return 0;
     }
 
-    p->rxLengthBuffer[p->rxLengthPushIndex] = size;
-    p->rxLengthPushIndex = (p->rxLengthPushIndex + 1) % LENGTH_FIFO_WORDS;
+    fifo_push(p->rxBuffer, p->fifoBytes, p->rxPopIndex, &p->rxUsed,
+              buf, size);
+    fifo_push(p->rxBuffer, p->fifoBytes, p->rxPopIndex, &p->rxUsed,
+              pad, padded - size);
+
+    p->rxLengthBuffer[(p->rxLengthPopIndex + p->rxLengthUsed) %
+                      p->lengthFifoDepth] = size;
+    p->rxLengthUsed++;
 
     p->fifoRegs[FIFO_INT_STATUS_ADDRESS] |= FIFO_INT_RC;
     update_fifo_irq(p);
@@ -550,19 +705,24 @@ static int labx_ethernet_init(SysBusDevice *dev)
     LabXEthernet *p = LABX_ETHERNET(dev);
 
     /* Initialize defaults */
-    p->txBuffer = g_malloc0(FIFO_RAM_BYTES);
-    p->txLengthBuffer = g_malloc0(LENGTH_FIFO_WORDS*4);
-    p->rxBuffer = g_malloc0(FIFO_RAM_BYTES);
-    p->rxLengthBuffer = g_malloc0(LENGTH_FIFO_WORDS*4);
+    p->fifoBytes = MAX(ROUND_UP(p->fifoBytes, 4), 64);
+    p->lengthFifoDepth = MAX(p->lengthFifoDepth, 1);
+
+    p->txBuffer = g_malloc0(p->fifoBytes);
+    p->txLengthBuffer = g_new0(uint32_t, p->lengthFifoDepth);
+    p->rxBuffer = g_malloc0(p->fifoBytes);
+    p->rxLengthBuffer = g_new0(uint32_t, p->lengthFifoDepth);
+    p->frameBuffer = g_malloc0(p->fifoBytes);
 
-    p->txPushIndex = 0;
     p->txPopIndex = 0;
-    p->txLengthPushIndex = 0;
+    p->txUsed = 0;
     p->txLengthPopIndex = 0;
-    p->rxPushIndex = 0;
+    p->txLengthUsed = 0;
     p->rxPopIndex = 0;
-    p->rxLengthPushIndex = 0;
+    p->rxUsed = 0;
     p->rxLengthPopIndex = 0;
+    p->rxLengthUsed = 0;
+    p->rxPending = 0;
 
     /* Set up memory regions */
     memory_region_init_io(&p->mmio_ethernet, OBJECT(p), &ethernet_regs_ops, p,
@@ -595,6 +755,9 @@ static int labx_ethernet_init(SysBusDevice *dev)
 
 static Property labx_ethernet_properties[] = {
     DEFINE_PROP_UINT32("reg", LabXEthernet, baseAddress, 0),
+    DEFINE_PROP_UINT32("fifo-bytes", LabXEthernet, fifoBytes, 2048),
+    DEFINE_PROP_UINT32("length-fifo-depth", LabXEthernet, lengthFifoDepth, 16),
+    DEFINE_PROP_BOOL("dma", LabXEthernet, dmaMode, false),
     DEFINE_NIC_PROPERTIES(LabXEthernet, conf),
     DEFINE_PROP_END_OF_LIST(),
 };
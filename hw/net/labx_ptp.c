@@ -20,8 +20,12 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/timer.h"
+#include "qemu/host-utils.h"
 #include "hw/sysbus.h"
 #include "sysemu/sysemu.h"
+#include "net/net.h"
 
 #define min_bits(i) (32 - clz32((i)))
 #define RAM_INDEX(addr, size) (((addr)>>2)&((1<<min_bits((size)-1))-1))
@@ -30,6 +34,40 @@
 #define PTP_MAX_PACKET_BYTES 256
 #define PTP_RAM_BYTES        (PTP_MAX_PACKETS*PTP_MAX_PACKET_BYTES)
 #define PTP_HOST_RAM_WORDS   (PTP_RAM_BYTES/4)
+#define PTP_BUFFER_WORDS     (PTP_MAX_PACKET_BYTES/4)
+
+/*
+ * Each packet buffer ends with four words of metadata: the frame length
+ * in bytes, written by the driver for Tx and by the hardware for Rx,
+ * and the seconds (high, low) and nanoseconds of the RTC when the frame
+ * went out or came in. Frame data fills the words before, first byte in
+ * the most significant lane.
+ */
+#define PTP_LENGTH_WORD      (PTP_BUFFER_WORDS - 4)
+#define PTP_SECONDS_HIGH_WORD (PTP_BUFFER_WORDS - 3)
+#define PTP_SECONDS_LOW_WORD (PTP_BUFFER_WORDS - 2)
+#define PTP_NANOSECONDS_WORD (PTP_BUFFER_WORDS - 1)
+#define PTP_MAX_FRAME_BYTES  (PTP_LENGTH_WORD * 4)
+
+#define PTP_RX_BUFFER_MASK   (PTP_MAX_PACKETS - 1)
+#define PTP_TX_ENABLE        0x80000000
+#define PTP_TX_BUFFER_MASK   (PTP_MAX_PACKETS - 1)
+
+#define PTP_RX_IRQ           0x00000001
+#define PTP_TX_IRQ           0x00000002
+#define PTP_TIMER_IRQ        0x00000004
+#define PTP_IRQ_MASK         0x00000007
+
+/* The RTC increment is nanoseconds per reference clock tick, with
+ * PTP_RTC_INC_FRAC_BITS fractional bits.
+ */
+#define PTP_RTC_INC_FRAC_BITS 27
+
+/* Shortest timer period, so that a tiny tick count can't hog the host */
+#define PTP_TIMER_MIN_NS     10000
+
+#define ETH_P_PTP            0x88F7
+#define ETH_P_VLAN           0x8100
 
 #define TYPE_LABX_PTP "labx.ptp"
 #define LABX_PTP(obj) \
@@ -43,63 +81,252 @@ typedef struct LabXPTP {
     MemoryRegion  mmio_tx;
     MemoryRegion  mmio_rx;
 
+    NICState *nic;
+    NICConf conf;
+    QEMUTimer *timer;
+
     /* Device Configuration */
     uint32_t baseAddress;
+    uint32_t rtcPeriodNs;
 
     /* Values set by drivers */
+    uint32_t irqMask;
+    uint32_t irqFlags;
+    uint32_t rtcIncrement;
+    uint32_t timerTicks;
+
+    /* The RTC and the free running local clock, as a value in
+     * nanoseconds at a QEMU_CLOCK_VIRTUAL time.
+     */
+    uint64_t rtcBase;
+    int64_t  rtcBaseClock;
+    int64_t  localBaseClock;
+
+    /* Seconds/nanoseconds latched by reading the seconds high registers,
+     * and the time being written to the RTC.
+     */
+    uint64_t rtcLatch;
+    uint64_t localLatch;
+    uint32_t rtcSet[3];
+
+    int64_t  timerDeadline;
 
     /* Tx buffers */
     uint32_t *txRam;
 
     /* Rx buffers */
     uint32_t *rxRam;
+    uint32_t  rxBuffer;
 } LabXPTP;
 
+/*
+ * RTC
+ */
+static uint32_t nominal_increment(LabXPTP *p)
+{
+    return p->rtcPeriodNs << PTP_RTC_INC_FRAC_BITS;
+}
+
+static uint64_t rtc_now(LabXPTP *p)
+{
+    int64_t elapsed = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) -
+                      p->rtcBaseClock;
+
+    /* The increment scales the rate against the nominal clock period */
+    return p->rtcBase + muldiv64(elapsed, p->rtcIncrement,
+                                 nominal_increment(p));
+}
+
+static void rtc_set(LabXPTP *p, uint64_t ns)
+{
+    p->rtcBase = ns;
+    p->rtcBaseClock = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+}
+
+static uint64_t local_now(LabXPTP *p)
+{
+    return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - p->localBaseClock;
+}
+
+static uint32_t time_seconds_high(uint64_t ns)
+{
+    return (ns / NANOSECONDS_PER_SECOND) >> 32;
+}
+
+static uint32_t time_seconds_low(uint64_t ns)
+{
+    return ns / NANOSECONDS_PER_SECOND;
+}
+
+static uint32_t time_nanoseconds(uint64_t ns)
+{
+    return ns % NANOSECONDS_PER_SECOND;
+}
+
+static void timestamp_buffer(LabXPTP *p, uint32_t *buffer)
+{
+    uint64_t now = rtc_now(p);
+
+    buffer[PTP_SECONDS_HIGH_WORD] = time_seconds_high(now);
+    buffer[PTP_SECONDS_LOW_WORD] = time_seconds_low(now);
+    buffer[PTP_NANOSECONDS_WORD] = time_nanoseconds(now);
+}
+
+static void update_irq(LabXPTP *p)
+{
+    qemu_set_irq(p->irq, (p->irqFlags & p->irqMask) != 0);
+}
+
+/*
+ * Timer, ticking in reference clock periods
+ */
+static void timer_rearm(LabXPTP *p)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int64_t period;
+
+    if (!p->timerTicks) {
+        timer_del(p->timer);
+        return;
+    }
+
+    period = MAX((int64_t)p->timerTicks * p->rtcPeriodNs, PTP_TIMER_MIN_NS);
+    p->timerDeadline += period;
+    if (p->timerDeadline <= now) {
+        /* Fell behind, e.g a tiny period. Skip the missed ticks.  */
+        p->timerDeadline = now + period;
+    }
+    timer_mod(p->timer, p->timerDeadline);
+}
+
+static void timer_tick(void *opaque)
+{
+    LabXPTP *p = opaque;
+
+    p->irqFlags |= PTP_TIMER_IRQ;
+    update_irq(p);
+    timer_rearm(p);
+}
+
+/*
+ * Packets
+ */
+static void send_packet(LabXPTP *p, unsigned int index)
+{
+    uint32_t *buffer = &p->txRam[index * PTP_BUFFER_WORDS];
+    uint8_t frame[PTP_MAX_FRAME_BYTES];
+    uint32_t length = buffer[PTP_LENGTH_WORD];
+    int i;
+
+    if (length > PTP_MAX_FRAME_BYTES) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "labx-ptp: Tx length %u too large\n", length);
+        length = PTP_MAX_FRAME_BYTES;
+    }
+
+    for (i = 0; i < DIV_ROUND_UP(length, 4); i++) {
+        stl_be_p(&frame[i * 4], buffer[i]);
+    }
+
+    timestamp_buffer(p, buffer);
+    qemu_send_packet(qemu_get_queue(p->nic), frame, length);
+
+    p->irqFlags |= PTP_TX_IRQ;
+    update_irq(p);
+}
+
+static ssize_t ptp_rx(NetClientState *nc, const uint8_t *buf, size_t size)
+{
+    LabXPTP *p = qemu_get_nic_opaque(nc);
+    uint32_t *buffer = &p->rxRam[p->rxBuffer * PTP_BUFFER_WORDS];
+    uint8_t frame[PTP_MAX_FRAME_BYTES] = { 0 };
+    size_t offset = 12;
+    int i;
+
+    /* Only PTP frames, possibly VLAN tagged, are captured */
+    if (size >= offset + 4 && lduw_be_p(buf + offset) == ETH_P_VLAN) {
+        offset += 4;
+    }
+    if (size < offset + 2 || lduw_be_p(buf + offset) != ETH_P_PTP ||
+        size > PTP_MAX_FRAME_BYTES) {
+        return size;
+    }
+
+    timestamp_buffer(p, buffer);
+    memcpy(frame, buf, size);
+    for (i = 0; i < DIV_ROUND_UP(size, 4); i++) {
+        buffer[i] = ldl_be_p(&frame[i * 4]);
+    }
+    buffer[PTP_LENGTH_WORD] = size;
+
+    /* The hardware moves on regardless, slow drivers lose the oldest */
+    p->rxBuffer = (p->rxBuffer + 1) & PTP_RX_BUFFER_MASK;
+
+    p->irqFlags |= PTP_RX_IRQ;
+    update_irq(p);
+
+    return size;
+}
+
 /*
  * PTP registers
  */
 static uint64_t ptp_regs_read(void *opaque, hwaddr addr,
                               unsigned int size)
 {
-    /*LabXPTP *p = opaque; */
+    LabXPTP *p = opaque;
 
     uint32_t retval = 0;
 
     switch ((addr>>2) & 0x0F) {
     case 0x00: /* rx */
+        retval = p->rxBuffer;
         break;
 
     case 0x01: /* tx */
+        /* Frames go out immediately, never busy */
         break;
 
     case 0x02: /* irq mask */
+        retval = p->irqMask;
         break;
 
     case 0x03: /* irq flags */
+        retval = p->irqFlags;
         break;
 
     case 0x04: /* rtc increment */
+        retval = p->rtcIncrement;
         break;
 
     case 0x05: /* seconds high */
+        p->rtcLatch = rtc_now(p);
+        retval = time_seconds_high(p->rtcLatch);
         break;
 
     case 0x06: /* seconds low */
+        retval = time_seconds_low(p->rtcLatch);
         break;
 
     case 0x07: /* nanoseconds */
+        retval = time_nanoseconds(p->rtcLatch);
         break;
 
     case 0x08: /* timer */
+        retval = p->timerTicks;
         break;
 
     case 0x09: /* local seconds high */
+        p->localLatch = local_now(p);
+        retval = time_seconds_high(p->localLatch);
         break;
 
     case 0x0A: /* local seconds low */
+        retval = time_seconds_low(p->localLatch);
         break;
 
     case 0x0B: /* local nanoseconds */
+        retval = time_nanoseconds(p->localLatch);
         break;
 
     case 0x0F: /* revision */
@@ -117,7 +344,7 @@ static uint64_t ptp_regs_read(void *opaque, hwaddr addr,
 static void ptp_regs_write(void *opaque, hwaddr addr,
                            uint64_t val64, unsigned int size)
 {
-    /*LabXPTP *p = opaque; */
+    LabXPTP *p = opaque;
     uint32_t value = val64;
 
     switch ((addr>>2) & 0x0F) {
@@ -125,27 +352,46 @@ static void ptp_regs_write(void *opaque, hwaddr addr,
         break;
 
     case 0x01: /* tx */
+        if (value & PTP_TX_ENABLE) {
+            send_packet(p, value & PTP_TX_BUFFER_MASK);
+        }
         break;
 
     case 0x02: /* irq mask */
+        p->irqMask = value & PTP_IRQ_MASK;
+        update_irq(p);
         break;
 
     case 0x03: /* irq flags */
+        p->irqFlags &= ~(value & PTP_IRQ_MASK);
+        update_irq(p);
         break;
 
     case 0x04: /* rtc increment */
+        /* Rebase so the new rate only applies from now on */
+        rtc_set(p, rtc_now(p));
+        p->rtcIncrement = value;
         break;
 
     case 0x05: /* seconds high */
+        p->rtcSet[0] = value & 0xFFFF;
         break;
 
     case 0x06: /* seconds low */
+        p->rtcSet[1] = value;
         break;
 
     case 0x07: /* nanoseconds */
+        /* Writing the nanoseconds loads the whole time */
+        p->rtcSet[2] = value % NANOSECONDS_PER_SECOND;
+        rtc_set(p, ((uint64_t)p->rtcSet[0] << 32 | p->rtcSet[1]) *
+                   NANOSECONDS_PER_SECOND + p->rtcSet[2]);
         break;
 
     case 0x08: /* timer */
+        p->timerTicks = value;
+        p->timerDeadline = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        timer_rearm(p);
         break;
 
     case 0x09: /* local seconds high */
@@ -240,6 +486,12 @@ static const MemoryRegionOps rx_ram_ops = {
 };
 
 
+static NetClientInfo net_labx_ptp_info = {
+    .type = NET_CLIENT_DRIVER_NIC,
+    .size = sizeof(NICState),
+    .receive = ptp_rx,
+};
+
 static int labx_ptp_init(SysBusDevice *dev)
 {
     LabXPTP *p = LABX_PTP(dev);
@@ -248,6 +500,12 @@ static int labx_ptp_init(SysBusDevice *dev)
     p->txRam = g_malloc0(PTP_RAM_BYTES);
     p->rxRam = g_malloc0(PTP_RAM_BYTES);
 
+    p->rtcPeriodNs = MAX(MIN(p->rtcPeriodNs, 31), 1);
+    p->rtcIncrement = nominal_increment(p);
+    rtc_set(p, 0);
+    p->localBaseClock = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    p->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, timer_tick, p);
+
     /* Set up memory regions */
     memory_region_init_io(&p->mmio_ptp, OBJECT(p), &ptp_regs_ops, p, "labx.ptp-regs",
                           0x100 * 4);
@@ -266,11 +524,20 @@ static int labx_ptp_init(SysBusDevice *dev)
 
     sysbus_init_irq(dev, &p->irq);
 
+    /* PTP frames are exchanged on a network of their own, the netdev
+     * property is left to the ethernet MAC.
+     */
+    qemu_macaddr_default_if_unset(&p->conf.macaddr);
+    p->nic = qemu_new_nic(&net_labx_ptp_info, &p->conf,
+                          object_get_typename(OBJECT(p)), DEVICE(p)->id, p);
+
     return 0;
 }
 
 static Property labx_ptp_properties[] = {
     DEFINE_PROP_UINT32("reg", LabXPTP, baseAddress, 0),
+    DEFINE_PROP_UINT32("rtc-period-ns", LabXPTP, rtcPeriodNs, 8),
+    DEFINE_PROP_NETDEV("ptp-netdev", LabXPTP, conf.peers),
     DEFINE_PROP_END_OF_LIST(),
 };
 
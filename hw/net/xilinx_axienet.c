@@ -28,6 +28,7 @@
 #include "qemu/log.h"
 #include "net/net.h"
 #include "net/checksum.h"
+#include "qemu/iov.h"
 
 #include "hw/stream.h"
 
@@ -891,14 +892,13 @@ xilinx_axienet_control_stream_push(StreamSlave *obj, uint8_t *buf, size_t len,
 }
 
 static size_t
-xilinx_axienet_data_stream_push(StreamSlave *obj, uint8_t *buf, size_t size,
-                                uint32_t attr)
+xilinx_axienet_data_stream_pushv(StreamSlave *obj, const struct iovec *iov,
+                                 int iovcnt, uint32_t attr)
 {
     XilinxAXIEnetStreamSlave *ds = XILINX_AXI_ENET_DATA_STREAM(obj);
     XilinxAXIEnet *s = ds->enet;
+    size_t size = iov_size(iov, iovcnt);
 
-    /* FIXME. buffer if not EOP. Or add a better scatter-gathering +
-       zero copying flow to the stream if.  */
     if (!stream_attr_has_eop(attr)) {
         hw_error("No EOP.\n");
     }
@@ -918,24 +918,44 @@ xilinx_axienet_data_stream_push(StreamSlave *obj, uint8_t *buf, size_t size,
     if (s->hdr[0] & 1) {
         unsigned int start_off = s->hdr[1] >> 16;
         unsigned int write_off = s->hdr[1] & 0xffff;
+        struct iovec *csum_iov;
         uint32_t tmp_csum;
-        uint16_t csum;
+        uint8_t csum[2];
+        int n;
+
+        if (start_off > size || write_off + 2 > size) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: checksum offsets %u/%u beyond frame of %zu\n",
+                          __func__, start_off, write_off, size);
+            goto send;
+        }
 
-        tmp_csum = net_checksum_add(size - start_off,
-                                    (uint8_t *)buf + start_off);
+        tmp_csum = net_checksum_add_iov(iov, iovcnt, start_off,
+                                        size - start_off, 0);
         /* Accumulate the seed.  */
         tmp_csum += s->hdr[2] & 0xffff;
 
         /* Fold the 32bit partial checksum.  */
-        csum = net_checksum_finish(tmp_csum);
-
-        /* Writeback.  */
-        buf[write_off] = csum >> 8;
-        buf[write_off + 1] = csum & 0xff;
+        stw_be_p(csum, net_checksum_finish(tmp_csum));
+
+        /* The payload may be mapped guest memory, splice the checksum in
+         * rather than writing it back.
+         */
+        csum_iov = g_new(struct iovec, iovcnt + 2);
+        n = iov_copy(csum_iov, iovcnt + 2, iov, iovcnt, 0, write_off);
+        csum_iov[n].iov_base = csum;
+        csum_iov[n].iov_len = sizeof(csum);
+        n++;
+        n += iov_copy(csum_iov + n, iovcnt + 2 - n, iov, iovcnt,
+                      write_off + 2, size - write_off - 2);
+        qemu_sendv_packet(qemu_get_queue(s->nic), csum_iov, n);
+        g_free(csum_iov);
+        goto done;
     }
 
-    qemu_send_packet(qemu_get_queue(s->nic), buf, size);
-
+send:
+    qemu_sendv_packet(qemu_get_queue(s->nic), iov, iovcnt);
+done:
     s->stats.tx_bytes += size;
     s->regs[R_IS] |= IS_TX_COMPLETE;
     enet_update_irq(s);
@@ -943,6 +963,18 @@ xilinx_axienet_data_stream_push(StreamSlave *obj, uint8_t *buf, size_t size,
     return size;
 }
 
+static size_t
+xilinx_axienet_data_stream_push(StreamSlave *obj, uint8_t *buf, size_t size,
+                                uint32_t attr)
+{
+    struct iovec iov = {
+        .iov_base = buf,
+        .iov_len = size,
+    };
+
+    return xilinx_axienet_data_stream_pushv(obj, &iov, 1, attr);
+}
+
 static NetClientInfo net_xilinx_enet_info = {
     .type = NET_CLIENT_DRIVER_NIC,
     .size = sizeof(NICState),
@@ -1041,6 +1073,14 @@ static void xilinx_enet_stream_class_init(ObjectClass *klass, void *data)
     ssc->push = data;
 }
 
+static void xilinx_enet_data_stream_class_init(ObjectClass *klass, void *data)
+{
+    StreamSlaveClass *ssc = STREAM_SLAVE_CLASS(klass);
+
+    ssc->push = xilinx_axienet_data_stream_push;
+    ssc->pushv = xilinx_axienet_data_stream_pushv;
+}
+
 static const TypeInfo xilinx_enet_info = {
     .name          = TYPE_XILINX_AXI_ENET,
     .parent        = TYPE_SYS_BUS_DEVICE,
@@ -1053,8 +1093,7 @@ static const TypeInfo xilinx_enet_data_stream_info = {
     .name          = TYPE_XILINX_AXI_ENET_DATA_STREAM,
     .parent        = TYPE_OBJECT,
     .instance_size = sizeof(struct XilinxAXIEnetStreamSlave),
-    .class_init    = xilinx_enet_stream_class_init,
-    .class_data    = xilinx_axienet_data_stream_push,
+    .class_init    = xilinx_enet_data_stream_class_init,
     .interfaces = (InterfaceInfo[]) {
             { TYPE_STREAM_SLAVE },
             { }
@@ -260,6 +260,17 @@ int qemu_chr_fe_get_msgfd(CharBackend *be);
  */
 int qemu_chr_fe_get_msgfds(CharBackend *be, int *fds, int num);
 
+/**
+ * qemu_chr_fe_get_fd:
+ *
+ * For backends connected through a file descriptor, return it so that
+ * a frontend reading the backend from its own thread can poll it for
+ * hangups. The descriptor is still owned by the backend.
+ *
+ * Returns: -1 if the backend has no such descriptor or is not connected.
+ */
+int qemu_chr_fe_get_fd(CharBackend *be);
+
 /**
  * qemu_chr_fe_set_msgfds:
  *
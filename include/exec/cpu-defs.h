@@ -136,8 +136,11 @@ typedef struct CPUIOTLBEntry {
      *     + the ram_addr_t of the target RAM (if the physical section
      *       number is PHYS_SECTION_NOTDIRTY or PHYS_SECTION_ROM)
      *     + the offset within the target MemoryRegion (otherwise)
+     *
+     * @paddr is the guest physical address of the page, for tracing.
      */
     hwaddr addr;
+    hwaddr paddr;
     MemTxAttrs attrs;
 } CPUIOTLBEntry;
 
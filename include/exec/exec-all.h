@@ -262,6 +262,17 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
                   int mmu_idx, target_ulong size);
 void probe_write(CPUArchState *env, target_ulong addr, int size, int mmu_idx,
                  uintptr_t retaddr);
+/**
+ * tlb_vaddr_to_paddr:
+ * @env: CPUArchState
+ * @addr: guest virtual address
+ * @mmu_idx: MMU index to look up
+ *
+ * Return the guest physical address @addr is mapped to by the TLB of
+ * @mmu_idx, or -1 if the page isn't in the TLB. Must be called from
+ * the vCPU thread.
+ */
+hwaddr tlb_vaddr_to_paddr(CPUArchState *env, target_ulong addr, int mmu_idx);
 #else
 static inline void tlb_init(CPUState *cpu)
 {
@@ -351,9 +362,10 @@ struct TranslationBlock {
 #define CF_USE_ICOUNT  0x00020000
 #define CF_INVALID     0x00040000 /* TB is stale. Set with @jmp_lock held */
 #define CF_PARALLEL    0x00080000 /* Generate code for a parallel context */
+#define CF_ETRACE_MEM  0x00100000 /* Log memory accesses for etrace */
 /* cflags' mask for hashing/comparison */
 #define CF_HASH_MASK   \
-    (CF_COUNT_MASK | CF_LAST_IO | CF_USE_ICOUNT | CF_PARALLEL)
+    (CF_COUNT_MASK | CF_LAST_IO | CF_USE_ICOUNT | CF_PARALLEL | CF_ETRACE_MEM)
 
     /* Per-vCPU dynamic tracing state used to generate this TB */
     uint32_t trace_vcpu_dstate;
@@ -416,7 +428,8 @@ static inline uint32_t tb_cflags(const TranslationBlock *tb)
 static inline uint32_t curr_cflags(void)
 {
     return (parallel_cpus ? CF_PARALLEL : 0)
-         | (use_icount ? CF_USE_ICOUNT : 0);
+         | (use_icount ? CF_USE_ICOUNT : 0)
+         | (current_cpu && current_cpu->etrace_mem ? CF_ETRACE_MEM : 0);
 }
 
 /* TranslationBlock invalidate API */
@@ -12,6 +12,9 @@ static inline void gen_tb_start(TranslationBlock *tb)
     TCGv_i32 count, imm;
 
     tcg_ctx->exitreq_label = gen_new_label();
+    if (tcg_ctx->etrace_mem) {
+        tcg_gen_etrace_mem_tb_start();
+    }
     if (tb_cflags(tb) & CF_USE_ICOUNT) {
         count = tcg_temp_local_new_i32();
     } else {
@@ -32,6 +32,7 @@
 #include "hw/sysbus.h"
 #include "hw/register.h"
 #include "sysemu/dma.h"
+#include "qemu/timer.h"
 
 #define ZDMA_R_MAX (0x204 / 4)
 
@@ -60,10 +61,19 @@ typedef struct XlnxZDMA {
 
     struct {
         uint32_t bus_width;
+        uint32_t bytes_per_ns;
     } cfg;
 
     XlnxZDMAState state;
     bool error;
+    /* The src descriptor has been loaded and is partly transferred.  */
+    bool src_busy;
+
+    /* The channel runs from a BH, or from a timer when throttled.
+       bw_time is the virtual time up to which bandwidth has been used.  */
+    QEMUBH *bh;
+    QEMUTimer *timer;
+    int64_t bw_time;
 
     XlnxZDMADescr dsc_src;
     XlnxZDMADescr dsc_dst;
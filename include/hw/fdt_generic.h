@@ -15,11 +15,6 @@
 /* This is the number of serial ports we have connected */
 extern int fdt_serial_ports;
 
-typedef struct FDTDevOpaque {
-    char *node_path;
-    void *opaque;
-} FDTDevOpaque;
-
 typedef struct FDTIRQConnection {
     DeviceState *dev;
     const char *name;
@@ -35,8 +30,8 @@ typedef struct FDTMachineInfo {
     void *fdt;
     /* irq descriptors for top level int controller */
     qemu_irq *irq_base;
-    /* per-device specific opaques */
-    FDTDevOpaque *dev_opaques;
+    /* per-device specific opaques, keyed by node path */
+    GHashTable *dev_opaques;
 
     /* Base address of the root bus */
     hwaddr sysbus_base;
@@ -45,6 +40,13 @@ typedef struct FDTMachineInfo {
     CoQueue *cq;
     /* list of all IRQ connections */
     FDTIRQConnection *irqs;
+
+    /* machine plan, see fdt_generic_util.c */
+    char *plan_file;
+    GString *plan;
+    int plan_pending;
+    bool plan_replay;
+    bool plan_stale;
 } FDTMachineInfo;
 
 /* create a new FDTMachineInfo. The client is responsible for setting irq_base.
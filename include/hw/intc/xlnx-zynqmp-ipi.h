@@ -38,6 +38,32 @@
 
 #define NUM_IPIS 11
 
+/* Agent numbers, in the order of the outbound TRIG and OBS lines.  */
+enum {
+    XLNX_ZYNQMP_IPI_APU = 0,
+    XLNX_ZYNQMP_IPI_RPU_0,
+    XLNX_ZYNQMP_IPI_RPU_1,
+    XLNX_ZYNQMP_IPI_PMU_0,
+    XLNX_ZYNQMP_IPI_PMU_1,
+    XLNX_ZYNQMP_IPI_PMU_2,
+    XLNX_ZYNQMP_IPI_PMU_3,
+    XLNX_ZYNQMP_IPI_PL_0,
+    XLNX_ZYNQMP_IPI_PL_1,
+    XLNX_ZYNQMP_IPI_PL_2,
+    XLNX_ZYNQMP_IPI_PL_3,
+};
+
+/*
+ * Line numbers used when the signals between two agents are carried by a
+ * GPIO bridge such as remote-port-gpio. Both ends use the same numbering,
+ * TRIG(src, dst) is the trigger from src to dst and OBS(dst, src) is the
+ * ISR bit of dst for src, observed by src.
+ */
+#define XLNX_ZYNQMP_IPI_GPIO_TRIG(src, dst)  ((src) * NUM_IPIS + (dst))
+#define XLNX_ZYNQMP_IPI_GPIO_OBS(dst, src) \
+    (NUM_IPIS * NUM_IPIS + (dst) * NUM_IPIS + (src))
+#define XLNX_ZYNQMP_IPI_NUM_GPIOS            (2 * NUM_IPIS * NUM_IPIS)
+
 typedef struct XlnxZynqMPIPI {
     /* Private */
     SysBusDevice parent_obj;
@@ -53,4 +79,31 @@ typedef struct XlnxZynqMPIPI {
     RegisterInfo regs_info[R_XLNX_ZYNQMP_IPI_MAX];
 } XlnxZynqMPIPI;
 
+/**
+ * xlnx_zynqmp_ipi_connect:
+ * @a: IPI block of agent @a_agent
+ * @a_agent: agent number of @a
+ * @b: IPI block of agent @b_agent
+ * @b_agent: agent number of @b
+ *
+ * Connect two IPI blocks in the same machine, so that triggers raise the
+ * ISR of the other block and its ISR shows up in OBS, in both directions.
+ */
+void xlnx_zynqmp_ipi_connect(XlnxZynqMPIPI *a, int a_agent,
+                             XlnxZynqMPIPI *b, int b_agent);
+
+/**
+ * xlnx_zynqmp_ipi_connect_gpio:
+ * @s: IPI block of agent @agent
+ * @agent: agent number of @s
+ * @peer_agent: agent whose IPI block lives on the other side of @bridge
+ * @bridge: device with XLNX_ZYNQMP_IPI_NUM_GPIOS GPIO inputs and outputs
+ *
+ * Connect @s to an agent modelled elsewhere. The signals from @s go to the
+ * GPIO inputs of @bridge and the GPIO outputs of @bridge come back as the
+ * signals of @peer_agent, numbered as XLNX_ZYNQMP_IPI_GPIO_TRIG/OBS.
+ */
+void xlnx_zynqmp_ipi_connect_gpio(XlnxZynqMPIPI *s, int agent,
+                                  int peer_agent, DeviceState *bridge);
+
 #endif /* XLNX_ZYNQMP_IPI_H */
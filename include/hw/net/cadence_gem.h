@@ -30,6 +30,7 @@
 #include "net/net.h"
 #include "hw/sysbus.h"
 #include "hw/mdio/mdio.h"
+#include "sysemu/iothread.h"
 
 #define CADENCE_GEM_MAXREG        (0x00000800 / 4) /* Last valid GEM address */
 
@@ -40,6 +41,22 @@
 #define MAX_TYPE1_SCREENERS             16
 #define MAX_TYPE2_SCREENERS             16
 
+/* Mapped window of a descriptor ring */
+typedef struct CadenceGEMDescCache {
+    uint8_t *buf;
+    hwaddr addr;
+    bool dirty;
+} CadenceGEMDescCache;
+
+/* Transmit side of a priority queue */
+typedef struct CadenceGEMTxQueue {
+    struct CadenceGEMState *gem;
+    QEMUBH *bh;
+    uint8_t id;
+    /* Waiting for the backend to take a queued frame */
+    bool stalled;
+} CadenceGEMTxQueue;
+
 typedef struct CadenceGEMState {
     /*< private >*/
     SysBusDevice parent_obj;
@@ -58,6 +75,8 @@ typedef struct CadenceGEMState {
     uint8_t num_type1_screeners;
     uint8_t num_type2_screeners;
     uint32_t revision;
+    uint16_t jumbo_max_len;
+    IOThread *iothread;
 
     /* GEM registers backing store */
     uint32_t regs[CADENCE_GEM_MAXREG];
@@ -83,6 +102,17 @@ typedef struct CadenceGEMState {
 
     uint32_t rx_desc[MAX_PRIORITY_QUEUES][DESC_MAX_NUM_WORDS];
 
+    CadenceGEMDescCache rx_desc_cache[MAX_PRIORITY_QUEUES];
+    CadenceGEMDescCache tx_desc_cache[MAX_PRIORITY_QUEUES];
+
+    /* Fragments of the frame being transmitted */
+    struct iovec *tx_iov;
+    bool *tx_mapped;
+    int tx_iovcnt;
+    int tx_iovalloc;
+
+    CadenceGEMTxQueue txq[MAX_PRIORITY_QUEUES];
+
     bool sar_active[4];
     MDIO *mdio;
 } CadenceGEMState;
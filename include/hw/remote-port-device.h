@@ -48,9 +48,33 @@ void rp_restart_sync_timer(RemotePort *s);
 void rp_leave_iothread(RemotePort *s);
 
 ssize_t rp_write(RemotePort *s, const void *buf, size_t count);
+/* Write a packet from multiple buffers without interleaving other writers. */
+ssize_t rp_writev(RemotePort *s, const struct iovec *iov, int iovcnt);
 
 RemotePortDynPkt rp_wait_resp(RemotePort *s);
 
+/*
+ * Tagged transactions. Must be called with the rsp mutex held.
+ *
+ * rp_tag_alloc registers id before the request is written. It blocks
+ * while all tags are in flight. If posted is true, the response is
+ * consumed by the remote-port itself and the caller does not wait for it.
+ *
+ * rp_wait_resp_tag waits for the response to a non-posted tag. The
+ * caller must release the tag with rp_tag_free when done with the
+ * returned packet.
+ *
+ * rp_drain_posted waits until all posted transactions have completed.
+ *
+ * rp_posted_clk returns the peer timestamp of the last retired posted
+ * transaction.
+ */
+void rp_tag_alloc(RemotePort *s, uint32_t id, bool posted);
+RemotePortDynPkt rp_wait_resp_tag(RemotePort *s, uint32_t id);
+void rp_tag_free(RemotePort *s, uint32_t id);
+void rp_drain_posted(RemotePort *s);
+int64_t rp_posted_clk(RemotePort *s);
+
 int64_t rp_normalized_vmclk(RemotePort *s);
 
 struct rp_peer_state *rp_get_peer(RemotePort *s);
@@ -12,7 +12,7 @@
 #define REMOTE_PORT_GPIO(obj) \
         OBJECT_CHECK(RemotePortGPIO, (obj), TYPE_REMOTE_PORT_GPIO)
 
-#define MAX_GPIOS 164
+#define MAX_GPIOS 256
 
 typedef struct RemotePortGPIO {
     /* private */
@@ -29,4 +29,21 @@ typedef struct RemotePortGPIO {
     uint32_t rp_dev;
     struct RemotePort *rp;
 } RemotePortGPIO;
+
+/**
+ * rp_gpio_create:
+ * @parent: Object the adaptor and the GPIO device are added to
+ * @name: Child name of the adaptor, the GPIO device is @name-gpio
+ * @num_gpios: Number of lines in each direction
+ * @errp: returns an error if this function fails
+ *
+ * Create a remote-port adaptor with a single GPIO device on channel 0,
+ * for boards that are not described by a device tree. The adaptor picks
+ * its chardev like the device tree ones, usually from -machine-path, so
+ * both peers must use the same @parent path and @name.
+ *
+ * Returns the GPIO device, or NULL on error.
+ */
+DeviceState *rp_gpio_create(Object *parent, const char *name,
+                            uint32_t num_gpios, Error **errp);
 #endif
@@ -27,6 +27,7 @@
 
 #include <stdbool.h>
 #include <string.h>
+#include <sys/types.h>
 
 /*
  * Remote-Port (RP) is an inter-simulator protocol. It assumes a reliable
@@ -69,7 +70,8 @@ enum rp_cmd {
     RP_CMD_write       = 4,
     RP_CMD_interrupt   = 5,
     RP_CMD_sync        = 6,
-    RP_CMD_max         = 6
+    RP_CMD_shm_setup   = 7,
+    RP_CMD_max         = 7
 };
 
 enum {
@@ -114,8 +116,16 @@ struct rp_capabilities {
 enum {
     CAP_BUSACCESS_EXT_BASE = 1,    /* New header layout. */
     CAP_BUSACCESS_EXT_BYTE_EN = 2, /* Support for Byte Enables.  */
+    CAP_SHM_RING = 3,              /* Shared memory ring transport.  */
+    CAP_BUSACCESS_BURST = 4,       /* Accesses up to RP_MAX_BURST_SIZE.  */
 };
 
+/*
+ * Peers that don't advertise CAP_BUSACCESS_BURST only have to deal with
+ * busaccess payloads of up to 128 bytes.
+ */
+#define RP_MAX_BURST_SIZE (64 * 1024)
+
 struct rp_pkt_hello {
     struct rp_pkt_hdr hdr;
     struct rp_version version;
@@ -129,6 +139,19 @@ enum {
     RP_BUS_ATTR_EXT_BASE   =  (1 << 2),
 };
 
+/* Response status, in the attributes of busaccess responses.  */
+enum {
+    RP_RESP_OK                  =  0x0,
+    RP_RESP_BUS_GENERIC_ERROR   =  0x1,
+    RP_RESP_ADDR_ERROR          =  0x2,
+    RP_RESP_MAX                 =  0xF,
+};
+
+enum {
+    RP_BUS_RESP_SHIFT    =  8,
+    RP_BUS_RESP_MASK     =  (RP_RESP_MAX << RP_BUS_RESP_SHIFT),
+};
+
 struct rp_pkt_busaccess {
     struct rp_pkt_hdr hdr;
     uint64_t timestamp;
@@ -209,6 +232,54 @@ struct rp_pkt_sync {
     uint64_t timestamp;
 } PACKED;
 
+/*
+ * Shared memory ring transport.
+ *
+ * If both peers advertise CAP_SHM_RING, each side allocates the ring it
+ * will receive on and offers it to the peer with an RP_CMD_shm_setup
+ * packet. The packet carries three file descriptors as ancillary data,
+ * so the transport is only usable over UNIX sockets:
+ *   fds[0]  memory holding a struct rp_shm_ring.
+ *   fds[1]  eventfd signalled by the producer when data is available.
+ *   fds[2]  eventfd signalled by the consumer when space is available.
+ *
+ * When a peer has mapped the ring offered to it, it sends an
+ * RP_CMD_shm_setup response over the socket and from then on transmits
+ * everything through the ring. The receiver switches to reading the
+ * ring when it sees that response. The byte stream carried in the ring
+ * is identical to the one on the socket.
+ *
+ * The ring fields are in host byte order, both peers run on the same
+ * host.
+ */
+#define RP_SHM_RING_MAGIC 0x52505348
+
+struct rp_shm_ring {
+    uint32_t magic;
+    /* Size of data in bytes. Must be a power of 2.  */
+    uint32_t size;
+    uint8_t pad0[56];
+
+    /* Free running byte counters.  */
+    uint32_t head;              /* Written by the producer.  */
+    uint8_t pad1[60];
+    uint32_t tail;              /* Written by the consumer.  */
+    uint8_t pad2[60];
+
+    /* Set by a side before it sleeps on its eventfd.  */
+    uint32_t consumer_waiting;
+    uint32_t producer_waiting;
+    uint8_t pad3[56];
+
+    uint8_t data[];
+} PACKED;
+
+struct rp_pkt_shm_setup {
+    struct rp_pkt_hdr hdr;
+    /* Size of the region backing the ring, in bytes.  */
+    uint64_t size;
+} PACKED;
+
 struct rp_pkt {
     union {
         struct rp_pkt_hdr hdr;
@@ -217,6 +288,7 @@ struct rp_pkt {
         struct rp_pkt_busaccess_ext_base busaccess_ext_base;
         struct rp_pkt_interrupt interrupt;
         struct rp_pkt_sync sync;
+        struct rp_pkt_shm_setup shm_setup;
     };
 };
 
@@ -231,6 +303,8 @@ struct rp_peer_state {
     struct {
         bool busaccess_ext_base;
         bool busaccess_ext_byte_en;
+        bool shm_ring;
+        bool busaccess_burst;
     } caps;
 
     /* Used to normalize our clk.  */
@@ -407,6 +481,28 @@ size_t rp_encode_sync_resp(uint32_t id, uint32_t dev,
                            struct rp_pkt_sync *pkt,
                            int64_t clk);
 
+size_t rp_encode_shm_setup(uint32_t id, uint32_t dev,
+                           struct rp_pkt_shm_setup *pkt,
+                           uint64_t size, uint32_t flags);
+
+/*
+ * Initialize a ring in a region of region_size bytes.
+ * Returns false if the region is too small.
+ */
+bool rp_shm_ring_init(struct rp_shm_ring *ring, size_t region_size);
+
+/*
+ * Copy up to len bytes into or out of the ring.
+ * size is the ring size as validated when the ring was set up, the size
+ * field in shared memory is never trusted after that.
+ * Returns the number of bytes copied, possibly 0, or -1 if the peer left
+ * the ring counters in an inconsistent state.
+ */
+ssize_t rp_shm_ring_write(struct rp_shm_ring *ring, uint32_t size,
+                          const void *buf, size_t len);
+ssize_t rp_shm_ring_read(struct rp_shm_ring *ring, uint32_t size,
+                         void *buf, size_t len);
+
 void rp_process_caps(struct rp_peer_state *peer,
                      void *caps, size_t caps_len);
 
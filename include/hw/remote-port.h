@@ -15,10 +15,21 @@
 #include "chardev/char.h"
 #include "chardev/char-fe.h"
 #include "hw/ptimer.h"
+#include "qemu/event_notifier.h"
 
 #define TYPE_REMOTE_PORT "remote-port"
 #define REMOTE_PORT(obj) OBJECT_CHECK(RemotePort, (obj), TYPE_REMOTE_PORT)
 
+/* Max nr of tagged transactions in flight per adaptor.  */
+#define RP_MAX_TAGS 32
+
+enum {
+    RP_TAG_FREE = 0,
+    RP_TAG_PENDING,
+    RP_TAG_POSTED,
+    RP_TAG_DONE,
+};
+
 struct RemotePort {
     DeviceState parent;
 
@@ -39,6 +50,32 @@ struct RemotePort {
     char *chrdev_id;
     struct rp_peer_state peer;
 
+    /* Shared memory ring transport, see remote-port-proto.h.  */
+    struct {
+        bool enable;
+        uint32_t size;
+
+        /* We consume rx and produce into tx.  */
+        struct rp_shm_ring *rx;
+        struct rp_shm_ring *tx;
+        /* Ring sizes as validated at setup, the peer can rewrite them.  */
+        uint32_t rx_ring_size;
+        uint32_t tx_ring_size;
+        int rx_fd;
+        size_t tx_size;
+        EventNotifier rx_data;
+        EventNotifier rx_space;
+        EventNotifier tx_data;
+        EventNotifier tx_space;
+        bool rx_notifiers;
+        bool tx_notifiers;
+
+        /* Owned by the protocol thread.  */
+        bool rx_active;
+        /* Protected by write_mutex.  */
+        bool tx_active;
+    } shm;
+
     struct {
         QEMUBH *bh;
         QEMUBH *bh_resp;
@@ -48,6 +85,24 @@ struct RemotePort {
         bool need_sync;
         struct rp_pkt rsp;
         uint64_t quantum;
+
+        /*
+         * Adaptive quantum. Widened while the link is idle and narrowed
+         * when it is busy, within [quantum_min, quantum_max].
+         */
+        bool adaptive;
+        uint64_t quantum_min;
+        uint64_t quantum_max;
+        /* Packets seen since the last sync.  */
+        unsigned int activity;
+
+        /* Exported as read-only properties.  */
+        struct {
+            uint64_t syncs;
+            uint64_t peer_syncs;
+            uint64_t stall_ns;
+            uint64_t warp_ns;
+        } stats;
     } sync;
 
     QemuMutex rsp_mutex;
@@ -74,6 +129,24 @@ struct RemotePort {
      */
     RemotePortDynPkt rspqueue;
 
+    /*
+     * Tagged transactions. Responses with an id registered here are
+     * routed to their tag instead of rspqueue, so they may complete
+     * in any order. Posted tags are freed by the protocol thread as
+     * soon as the response arrives.
+     * Protected by rsp_mutex.
+     */
+    struct {
+        uint32_t id;
+        uint8_t state;
+        RemotePortDynPkt rsp;
+    } tags[RP_MAX_TAGS];
+    unsigned int posted;
+    /* Peer time of the last retired posted transaction.  */
+    int64_t posted_clk;
+    /* Posted transactions the peer failed, read-only property.  */
+    uint64_t posted_errors;
+
     bool resets[32];
 
     const char *prefix;
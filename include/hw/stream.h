@@ -48,11 +48,26 @@ typedef struct StreamSlaveClass {
      */
     size_t (*push)(StreamSlave *obj, unsigned char *buf, size_t len,
                    uint32_t attr);
+    /**
+     * pushv - optional scatter-gather variant of push. Slaves implementing
+     * it get the data without it being gathered into a linear buffer
+     * first. The buffers may map guest memory and must not be modified.
+     * @obj: Stream slave to push to
+     * @iov: Data to write
+     * @iovcnt: Number of elements in @iov
+     * @attr: Attributes.
+     */
+    size_t (*pushv)(StreamSlave *obj, const struct iovec *iov, int iovcnt,
+                    uint32_t attr);
 } StreamSlaveClass;
 
 size_t
 stream_push(StreamSlave *sink, uint8_t *buf, size_t len, uint32_t attr);
 
+size_t
+stream_pushv(StreamSlave *sink, const struct iovec *iov, int iovcnt,
+             uint32_t attr);
+
 bool
 stream_can_push(StreamSlave *sink, StreamCanPushNotifyFn notify,
                 void *notify_opaque);
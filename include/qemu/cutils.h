@@ -160,6 +160,8 @@ int qemu_strtosz_metric(const char *nptr, char **end, uint64_t *result);
 
 bool buffer_is_zero(const void *buf, size_t len);
 bool test_buffer_is_zero_next_accel(void);
+uint16_t buffer_csum(const void *buf, size_t len);
+bool test_buffer_csum_next_accel(void);
 
 /*
  * Implementation of ULEB128 (http://en.wikipedia.org/wiki/LEB128)
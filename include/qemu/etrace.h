@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include "qemu/thread.h"
 
 struct etrace_entry32 {
     uint32_t duration;
@@ -39,8 +40,16 @@ enum qemu_etrace_flag {
     ETRACE_F_MEM         = (1 << 2),
     ETRACE_F_CPU         = (1 << 3),
     ETRACE_F_GPIO         = (1 << 4),
+    ETRACE_F_MEM_INLINE  = (1 << 5),
+
+    /* Output control, not trace categories.  */
+    ETRACE_F_ASYNC       = (1 << 16),
+    ETRACE_F_ASYNC_DROP  = (1 << 17),
+    ETRACE_F_CHUNKED     = (1 << 18),
 };
 
+#define ETRACE_F_ALL (ETRACE_F_ASYNC - 1)
+
 enum qemu_etrace_event_u64_flag {
     ETRACE_EVU64_F_NONE        = 0,
     ETRACE_EVU64_F_PREV_VAL    = (1 << 0),
@@ -51,19 +60,97 @@ enum etrace_mem_attr {
     MEM_WRITE   = (1 << 0),
 };
 
-struct etracer {
-    const char *filename;
-    FILE *fp;
-    unsigned int arch_bits;
-    uint64_t flags;
+/*
+ * Inline memory access log.
+ *
+ * With ETRACE_F_MEM_INLINE, TCG emits code that appends one of these
+ * per guest load/store to a per-vCPU log (CPUState etrace_mem_ptr).
+ * The log has room for ETRACE_MEMLOG_TB_MAX entries past
+ * etrace_mem_limit. Every instrumented TB checks the limit once on entry
+ * and calls out to drain the log when it's been passed, so accesses
+ * need no checks of their own. Accesses beyond the first
+ * ETRACE_MEMLOG_TB_MAX of a TB are recorded through a helper call.
+ *
+ * An entry is started before the access, with ETRACE_MEMLOG_INFO_PENDING
+ * set, and completed after it. The MMIO path uses the pending entry to
+ * tell accesses that are logged inline from those made by helpers.
+ */
+#define ETRACE_MEMLOG_SIZE (4 * 1024)
+#define ETRACE_MEMLOG_TB_MAX 256
 
-    /* FIXME: Removeme.  */
-    unsigned int current_unit_id;
+#define ETRACE_MEMLOG_INFO_SIZE_MASK 0xff
+#define ETRACE_MEMLOG_INFO_ATTR_SHIFT 8
+#define ETRACE_MEMLOG_INFO_ATTR_MASK 0xff
+#define ETRACE_MEMLOG_INFO_MMU_IDX_SHIFT 16
+#define ETRACE_MEMLOG_INFO_MMU_IDX_MASK 0xff
+#define ETRACE_MEMLOG_INFO_PENDING (1U << 31)
+
+struct etrace_mem_log {
+    uint64_t vaddr;
+    uint64_t value;
+    /* Access size in bytes, etrace_mem_attr and MMU index.  */
+    uint32_t info;
+    uint32_t padd;
+};
+
+/*
+ * Asynchronous output.
+ *
+ * The producer (the tracing vCPU) fills bufs[head % ETRACE_ASYNC_NR_BUFS]
+ * and publishes it by advancing head. A dedicated writer thread drains
+ * buffers from tail and hands them back by advancing tail. head and tail
+ * are only ever written by one side each, so no lock is needed.
+ */
+#define ETRACE_ASYNC_NR_BUFS 8
+#define ETRACE_ASYNC_BUF_SIZE (1 * 1024 * 1024)
+
+struct etrace_async_buf {
+    uint8_t *data;
+    size_t len;
+};
+
+struct etrace_async {
+    bool enabled;
+    /* Drop records instead of blocking when the ring is full.  */
+    bool drop;
+    /* The current record is being dropped.  */
+    bool dropping;
+    bool quit;
+
+    QemuThread thread;
+    QemuSemaphore filled;
+    QemuEvent drained;
+
+    unsigned int head;
+    unsigned int tail;
+    struct etrace_async_buf bufs[ETRACE_ASYNC_NR_BUFS];
+
+    uint64_t dropped_records;
+    uint64_t dropped_bytes;
+};
+
+/*
+ * Per-unit (e.g per vCPU) trace state.
+ *
+ * Each unit caches exec records and buffers other records on its own so
+ * that units running in parallel don't thrash a shared cache. Buffered
+ * records are merged into the output in chunks, each one followed by a
+ * TYPE_BARRIER.
+ */
+#define ETRACE_UNIT_BUF_SIZE (256 * 1024)
+
+struct etrace_unit {
+    /*
+     * Protects exec_cache and rec. Holders may wait for the async writer,
+     * so this is a mutex rather than a spin lock.
+     */
+    QemuMutex lock;
 
-#define EXEC_CACHE_SIZE (16 * 1024)
     uint64_t exec_start;
     bool exec_start_valid;
     int64_t exec_start_time;
+
+#define EXEC_CACHE_SIZE (16 * 1024)
     struct {
         union {
             struct etrace_entry64 t64[EXEC_CACHE_SIZE];
@@ -73,6 +160,60 @@ struct etracer {
         unsigned int pos;
         unsigned int unit_id;
     } exec_cache;
+
+    /* Records not yet merged into the output.  */
+    struct {
+        uint8_t *data;
+        size_t len;
+        size_t size;
+        uint64_t first_time;
+        uint64_t last_time;
+
+        /* Compressed records, for chunked output.  */
+        uint8_t *zdata;
+        size_t zlen;
+        size_t zsize;
+    } rec;
+
+    /* Inline memory access log and the vCPU filling it.  */
+    struct etrace_mem_log *memlog;
+    CPUState *cpu;
+
+    /* Next unit in etracer.unit_list.  */
+    struct etrace_unit *next;
+};
+
+/* Unit ids below this are looked up without taking etracer.lock.  */
+#define ETRACE_MAX_UNITS 64
+
+struct etracer {
+    const char *filename;
+    FILE *fp;
+    unsigned int arch_bits;
+    uint64_t flags;
+
+    /* FIXME: Removeme.  */
+    unsigned int current_unit_id;
+
+    /* Serializes writes to the output.  */
+    QemuMutex lock;
+    /* Bytes written to the output so far.  */
+    uint64_t offset;
+    /* Chunk index, for chunked output.  */
+    GArray *index;
+
+    /* Inline memory tracing filters. NULL/0 means no filtering.  */
+    GArray *mem_pc_ranges;
+    uint64_t mem_masters;
+
+    struct etrace_unit *units[ETRACE_MAX_UNITS];
+    /* Units with higher ids, protected by lock.  */
+    GHashTable *units_high;
+    /* Every unit, newest first. Only ever grows, under lock.  */
+    struct etrace_unit *unit_list;
+    unsigned int nr_units;
+
+    struct etrace_async async;
 };
 
 bool etrace_init(struct etracer *t, const char *filename,
@@ -84,6 +225,8 @@ void etrace_dump_exec(struct etracer *t, unsigned int unit_id,
                       uint64_t start_time, uint32_t duration);
 
 /* Helpers.  */
+bool etrace_exec_start_valid(struct etracer *t, unsigned int unit_id);
+
 void etrace_dump_exec_start(struct etracer *t,
                             unsigned int unit_id,
                             uint64_t start);
@@ -92,6 +235,11 @@ void etrace_dump_exec_end(struct etracer *t,
                           unsigned int unit_id,
                           uint64_t end);
 
+void etrace_set_mem_filter(struct etracer *t, const char *pc_ranges,
+                           const char *masters, Error **errp);
+bool etrace_mem_in_range(struct etracer *t, uint64_t pc);
+void etrace_mem_cpu_init(struct etracer *t, CPUState *cpu);
+
 void etrace_mem_access(struct etracer *t, uint16_t unit_id,
                        uint64_t guest_vaddr, uint64_t guest_paddr,
                        size_t size, uint64_t attr, uint64_t val);
@@ -117,6 +265,8 @@ void etrace_event_u64(struct etracer *t, uint16_t unit_id,
 /* QEMU helpers to simplify integration into qemu.  */
 extern const char *qemu_arg_etrace;
 extern const char *qemu_arg_etrace_flags;
+extern const char *qemu_arg_etrace_mem_pc;
+extern const char *qemu_arg_etrace_mem_masters;
 extern struct etracer qemu_etracer;
 extern bool qemu_etrace_enabled;
 void qemu_etrace_cleanup(void);
@@ -0,0 +1,48 @@
+/*
+ * Arithmetic on polynomials over GF(2)
+ *
+ * Copyright (c) 2018 Biamp Systems
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_GF2X_H
+#define QEMU_GF2X_H
+
+/*
+ * Polynomials are fixed width arrays of @n 64-bit limbs, least significant
+ * limb first: bit i of limb j is the coefficient of x^(64 * j + i).
+ * Results are truncated to the 64 * @n bits of the destination, and the
+ * destination may alias any of the sources.
+ */
+
+/* r = a + b */
+void gf2x_xor(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n);
+
+/* r = a * x^k */
+void gf2x_lshift(uint64_t *r, const uint64_t *a, unsigned int k, size_t n);
+
+/* r += a * b, for a single limb b */
+void gf2x_addmul_1(uint64_t *r, const uint64_t *a, uint64_t b, size_t n);
+
+/* Degree of a, or -1 for the zero polynomial */
+int gf2x_degree(const uint64_t *a, size_t n);
+
+/*
+ * Modular arithmetic as done by a 64 * @n bit shift register with
+ * feedback @m: multiplying by x shifts left, and then adds m whenever
+ * the top bit of the register is set.
+ */
+
+/* r = a * x^k */
+void gf2x_lshift_reduce(uint64_t *r, const uint64_t *a, const uint64_t *m,
+                        unsigned int k, size_t n);
+
+/* r = a * b */
+void gf2x_mulmod(uint64_t *r, const uint64_t *a, const uint64_t *b,
+                 const uint64_t *m, size_t n);
+
+/* Select the next carry-less multiply implementation, for testing */
+bool test_gf2x_next_accel(void);
+
+#endif
@@ -421,6 +421,11 @@ struct CPUState {
 
     bool ignore_memory_transaction_failures;
 
+    /* etrace inline memory access log, see include/qemu/etrace.h.  */
+    bool etrace_mem;
+    uintptr_t etrace_mem_ptr;
+    uintptr_t etrace_mem_limit;
+
     /* Note that this is accessed at the start of every TB via a negative
        offset from AREG0.  Leave this field at the end so as to make the
        (absolute value) offset as small as possible.  This reduces code
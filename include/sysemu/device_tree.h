@@ -195,6 +195,15 @@ typedef struct QEMUDevtreeProp {
 
 /* node queries */
 
+/* qemu_fdt_node_offset: Look up the offset of a node. Canonical node paths
+ * are served from an index of the tree, anything else goes to libfdt.
+ * args:
+ *     fdt: flatend device tree
+ *     node_path: path of the node
+ * return:
+ *     Node offset or a negative libfdt error code.
+ */
+int qemu_fdt_node_offset(void *fdt, const char *node_path);
 char *qemu_fdt_get_node_name(void *fdt, const char *node_path);
 int qemu_fdt_get_node_depth(void *fdt, const char *node_path);
 int qemu_fdt_get_num_children(void *fdt, const char *node_path, int depth);
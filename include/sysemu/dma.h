@@ -166,6 +166,46 @@ static inline void dma_memory_unmap(AddressSpace *as,
                         dir == DMA_DIRECTION_FROM_DEVICE, access_len);
 }
 
+/**
+ * dma_memory_map_direct: Map a range only if it is directly accessible RAM.
+ *
+ * Unlike dma_memory_map() this never hands out a bounce buffer, which
+ * there is only one of and which does not read back what was there before
+ * for writes. Returns NULL unless all of @len bytes are mapped, callers
+ * then fall back to dma_memory_rw().
+ *
+ * @as: #AddressSpace to be accessed
+ * @addr: address within that address space
+ * @len: length of the range
+ * @dir: direction of the accesses that will be made through the mapping
+ */
+static inline void *dma_memory_map_direct(AddressSpace *as, dma_addr_t addr,
+                                          dma_addr_t len, DMADirection dir)
+{
+    bool is_write = dir == DMA_DIRECTION_FROM_DEVICE;
+    MemoryRegion *mr;
+    hwaddr xlat, xlen = len;
+    bool direct;
+    void *p;
+
+    rcu_read_lock();
+    mr = address_space_translate(as, addr, &xlat, &xlen, is_write,
+                                 MEMTXATTRS_UNSPECIFIED);
+    direct = memory_access_is_direct(mr, is_write) && xlen >= len;
+    rcu_read_unlock();
+    if (!direct) {
+        return NULL;
+    }
+
+    xlen = len;
+    p = address_space_map(as, addr, &xlen, is_write, MEMTXATTRS_UNSPECIFIED);
+    if (p && xlen < len) {
+        address_space_unmap(as, p, xlen, is_write, 0);
+        p = NULL;
+    }
+    return p;
+}
+
 #define DEFINE_LDST_DMA(_lname, _sname, _bits, _end) \
     static inline uint##_bits##_t ld##_lname##_##_end##_dma(AddressSpace *as, \
                                                             dma_addr_t addr) \
@@ -17,27 +17,21 @@
 
 #include "qemu/osdep.h"
 #include "qemu-common.h"
+#include "qemu/cutils.h"
 #include "net/checksum.h"
 #include "net/eth.h"
 
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
 {
-    uint32_t sum1 = 0, sum2 = 0;
-    int i;
+    uint16_t sum;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
-    }
-    if (i < len) {
-        sum1 += (uint32_t)buf[i];
+    if (len <= 0) {
+        return 0;
     }
 
-    if (seq & 1) {
-        return sum1 + (sum2 << 8);
-    } else {
-        return sum2 + (sum1 << 8);
-    }
+    /* Data starting at an odd offset has its bytes in swapped lanes.  */
+    sum = buffer_csum(buf, len);
+    return seq & 1 ? bswap16(sum) : sum;
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
@@ -385,7 +385,7 @@ Dump an execution trace to @var{path}.
 ETEXI
 
 DEF("etrace-flags", HAS_ARG, QEMU_OPTION_etrace_flags,
-    "-etrace-flags FLAGS  Execution trace flags\n\texec,translation,mem,cpu\n", QEMU_ARCH_ALL)
+    "-etrace-flags FLAGS  Execution trace flags\n\texec,translation,mem,mem-inline,cpu,async,drop,chunked\n", QEMU_ARCH_ALL)
 STEXI
 @item -etrace-flags
 @findex -etrace-flags
@@ -395,10 +395,46 @@ Execution trace flags.
 exec          Trace instruction execution.
 translation   Trace TB translation with TB contents. (for off-line disassembly)
 mem           Trace memory accesses (Only MMIO at the moment).
+mem-inline    Trace guest loads and stores from code generated inline
+              by TCG. MMIO accesses logged this way are not repeated by
+              mem; accesses made by helpers are still only seen by mem.
 cpu           Trace CPU register state (slow, currently not binary).
+async         Write the trace from a separate thread through a ring of
+              buffers. vCPUs block when the ring is full.
+drop          Like async but drop records instead of blocking when the
+              ring is full. The number of dropped records is reported
+              when the trace is closed.
+chunked       Write records in zlib compressed chunks, each carrying its
+              time range, followed by an index of all chunks at the end
+              of the trace. See scripts/etrace.py for a reader.
 @end example
 ETEXI
 
+DEF("etrace-mem-pc", HAS_ARG, QEMU_OPTION_etrace_mem_pc,
+    "-etrace-mem-pc range1[,...]\n"
+    "                only trace memory accesses by code in these ranges\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -etrace-mem-pc @var{range1}[,...]
+@findex -etrace-mem-pc
+Only trace memory accesses (@option{-etrace-flags mem-inline}) made by
+translation blocks starting in the given ranges. Ranges use the
+@option{-dfilter} syntax. The filter is applied at translation time, so
+code outside of the ranges runs at full speed.
+ETEXI
+
+DEF("etrace-mem-masters", HAS_ARG, QEMU_OPTION_etrace_mem_masters,
+    "-etrace-mem-masters id1[,...]\n"
+    "                only trace memory accesses by these CPU indexes\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -etrace-mem-masters @var{id1}[,...]
+@findex -etrace-mem-masters
+Only trace memory accesses (@option{-etrace-flags mem-inline}) made by the
+CPUs with the given indexes (0 to 63). Code translated for other CPUs is
+not instrumented.
+ETEXI
+
 DEF("mem-path", HAS_ARG, QEMU_OPTION_mempath,
     "-mem-path FILE  provide backing storage for guest RAM\n", QEMU_ARCH_ALL)
 STEXI
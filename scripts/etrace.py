@@ -0,0 +1,252 @@
+#!/usr/bin/env python
+#
+# Reader for QEMU etrace files (-etrace).
+#
+# Copyright (c) 2018 Biamp Systems
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Both plain and chunked (-etrace-flags chunked) traces are supported.
+# Chunked traces carry an index that maps time ranges to file offsets,
+# so that records around a given time can be read without scanning the
+# whole trace. Plain traces are scanned from the start, records that
+# carry a time outside of the requested range are dropped either way.
+#
+# Usage:
+#   etrace.py --index TRACE
+#       List the chunk index.
+#   etrace.py [--start NS] [--end NS] TRACE OUT
+#       Write the records within [NS, NS] to OUT as a plain trace.
+#       Records without a time of their own (TB, barriers) are kept,
+#       unless they are in a chunk that is skipped as a whole.
+
+from __future__ import print_function
+import struct
+import sys
+import zlib
+
+TYPE_EXEC = 1
+TYPE_TB = 2
+TYPE_NOTE = 3
+TYPE_MEM = 4
+TYPE_ARCH = 5
+TYPE_BARRIER = 6
+TYPE_OLD_EVENT_U64 = 7
+TYPE_EVENT_U64 = 8
+TYPE_CHUNK = 9
+TYPE_INDEX = 10
+TYPE_INFO = 0x4554
+
+INFO_F_CHUNKED = 1 << 1
+
+CHUNK_ZLIB = 1
+
+INDEX_MAGIC = 0x58495445
+
+hdr_fmt = '<HHI'
+info_fmt = '<QHH'
+chunk_fmt = '<QQIB3x'
+index_entry_fmt = '<QQQH6x'
+index_trailer_fmt = '<QII'
+
+# Records whose payload starts with their time. Event records carry
+# their flags, unit id and a reserved field first.
+time_fmt = {
+    TYPE_EXEC: '<Q',
+    TYPE_NOTE: '<Q',
+    TYPE_MEM: '<Q',
+    TYPE_EVENT_U64: '<8xQ',
+}
+
+
+class Record(object):
+    '''A raw trace record'''
+    def __init__(self, rtype, unit_id, payload):
+        self.type = rtype
+        self.unit_id = unit_id
+        self.payload = payload
+
+    def pack(self):
+        return struct.pack(hdr_fmt, self.type, self.unit_id,
+                           len(self.payload)) + self.payload
+
+    def time(self):
+        '''The time of the record, None if it has none'''
+        fmt = time_fmt.get(self.type)
+        if fmt is None or len(self.payload) < struct.calcsize(fmt):
+            return None
+        return struct.unpack_from(fmt, self.payload)[0]
+
+    def within(self, start, end):
+        t = self.time()
+        if t is None:
+            return True
+        if start is not None and t < start:
+            return False
+        if end is not None and t > end:
+            return False
+        return True
+
+
+class IndexEntry(object):
+    def __init__(self, start_time, end_time, offset, unit_id):
+        self.start_time = start_time
+        self.end_time = end_time
+        self.offset = offset
+        self.unit_id = unit_id
+
+
+def parse_records(buf):
+    '''Iterate over the records in a buffer'''
+    hlen = struct.calcsize(hdr_fmt)
+    pos = 0
+    while pos + hlen <= len(buf):
+        rtype, unit_id, rlen = struct.unpack_from(hdr_fmt, buf, pos)
+        pos += hlen
+        yield Record(rtype, unit_id, buf[pos:pos + rlen])
+        pos += rlen
+
+
+class EtraceReader(object):
+    def __init__(self, fobj):
+        self.fobj = fobj
+        self.info = self._read_record()
+        if self.info is None or self.info.type != TYPE_INFO:
+            raise ValueError('Not an etrace file')
+        self.attr = struct.unpack_from(info_fmt, self.info.payload)[0]
+        self.arch = self._read_record()
+        self.data_offset = self.fobj.tell()
+        self.index = None
+        if self.attr & INFO_F_CHUNKED:
+            self.index = self._read_index()
+
+    def _read_record(self):
+        hlen = struct.calcsize(hdr_fmt)
+        hdr = self.fobj.read(hlen)
+        if len(hdr) != hlen:
+            return None
+        rtype, unit_id, rlen = struct.unpack(hdr_fmt, hdr)
+        payload = self.fobj.read(rlen)
+        if len(payload) != rlen:
+            return None
+        return Record(rtype, unit_id, payload)
+
+    def _read_index(self):
+        '''Locate the index through the trailer at the end of the file'''
+        tlen = struct.calcsize(index_trailer_fmt)
+        elen = struct.calcsize(index_entry_fmt)
+        self.fobj.seek(-tlen, 2)
+        offset, nr, magic = struct.unpack(index_trailer_fmt,
+                                          self.fobj.read(tlen))
+        if magic != INDEX_MAGIC:
+            # Truncated trace, e.g QEMU was killed.
+            return None
+
+        self.fobj.seek(offset)
+        rec = self._read_record()
+        if rec is None or rec.type != TYPE_INDEX:
+            return None
+        index = []
+        for i in range(nr):
+            index.append(IndexEntry(*struct.unpack_from(index_entry_fmt,
+                                                        rec.payload,
+                                                        i * elen)))
+        return index
+
+    def _expand(self, rec):
+        '''Decompress a chunk record into its records'''
+        start, end, raw_len, comp = struct.unpack_from(chunk_fmt, rec.payload)
+        if comp != CHUNK_ZLIB:
+            raise ValueError('Unknown chunk compression %d' % comp)
+        data = zlib.decompress(rec.payload[struct.calcsize(chunk_fmt):])
+        assert len(data) == raw_len
+        return parse_records(data)
+
+    def _scan(self):
+        self.fobj.seek(self.data_offset)
+        while True:
+            rec = self._read_record()
+            if rec is None or rec.type == TYPE_INDEX:
+                return
+            if rec.type == TYPE_CHUNK:
+                for r in self._expand(rec):
+                    yield r
+            else:
+                yield rec
+
+    def chunks(self, start=None, end=None):
+        '''Index entries of the chunks overlapping [start, end]'''
+        for e in self.index:
+            if start is not None and e.end_time < start:
+                continue
+            if end is not None and e.start_time > end:
+                continue
+            yield e
+
+    def _indexed(self, start, end):
+        for e in self.chunks(start, end):
+            self.fobj.seek(e.offset)
+            for r in self._expand(self._read_record()):
+                yield r
+
+    def records(self, start=None, end=None):
+        '''Iterate over the records within [start, end]. Only the chunks
+           overlapping the range are read when the trace is indexed.'''
+        if self.index is None:
+            src = self._scan()
+        else:
+            src = self._indexed(start, end)
+        for r in src:
+            if r.within(start, end):
+                yield r
+
+
+def main(args):
+    start = None
+    end = None
+    show_index = False
+    files = []
+    while args:
+        a = args.pop(0)
+        if a == '--start':
+            start = int(args.pop(0), 0)
+        elif a == '--end':
+            end = int(args.pop(0), 0)
+        elif a == '--index':
+            show_index = True
+        else:
+            files.append(a)
+
+    if (show_index and len(files) != 1) or (not show_index and
+                                            len(files) != 2):
+        sys.stderr.write('usage: %s [--index] [--start NS] [--end NS] '
+                         'TRACE [OUT]\n' % sys.argv[0])
+        return 1
+
+    with open(files[0], 'rb') as f:
+        reader = EtraceReader(f)
+        if show_index:
+            if reader.index is None:
+                sys.stderr.write('%s has no index\n' % files[0])
+                return 1
+            for e in reader.index:
+                print('unit %d time %d-%d offset %d' % (e.unit_id,
+                                                        e.start_time,
+                                                        e.end_time,
+                                                        e.offset))
+            return 0
+
+        with open(files[1], 'wb') as out:
+            attr, major, minor = struct.unpack_from(info_fmt,
+                                                    reader.info.payload)
+            info = struct.pack(info_fmt, attr & ~INFO_F_CHUNKED, major, minor)
+            out.write(Record(TYPE_INFO, 0, info).pack())
+            out.write(reader.arch.pack())
+            for r in reader.records(start, end):
+                out.write(r.pack())
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
@@ -32,6 +32,7 @@
 
 #ifndef CONFIG_USER_ONLY
 #include "hw/fdt_generic_util.h"
+#include "hw/stream.h"
 #endif
 
 static const struct {
@@ -132,6 +133,99 @@ static void microblaze_set_wakeup(void *opaque, int irq, int level)
         qemu_cpu_kick(cs);
     }
 }
+
+static void microblaze_stream_wakeup(MicroBlazeStream *ms)
+{
+    CPUState *cs = CPU(ms->cpu);
+
+    ms->cpu->env.wakeup |= MB_WAKEUP_STREAM;
+    cs->halted = 0;
+    qemu_cpu_kick(cs);
+}
+
+static bool microblaze_stream_can_push(StreamSlave *obj,
+                                       StreamCanPushNotifyFn notify,
+                                       void *notify_opaque)
+{
+    MicroBlazeStream *ms = MICROBLAZE_STREAM(obj);
+
+    if (ms->rx.wpos - ms->rx.rpos < MB_STREAM_DEPTH) {
+        return true;
+    }
+    ms->notify = notify;
+    ms->notify_opaque = notify_opaque;
+    return false;
+}
+
+static size_t microblaze_stream_push(StreamSlave *obj, uint8_t *buf,
+                                     size_t len, uint32_t attr)
+{
+    MicroBlazeStream *ms = MICROBLAZE_STREAM(obj);
+    size_t pos = 0;
+
+    while (pos < len && ms->rx.wpos - ms->rx.rpos < MB_STREAM_DEPTH) {
+        unsigned int idx = ms->rx.wpos % MB_STREAM_DEPTH;
+        size_t wlen = MIN(len - pos, 4);
+        uint8_t word[4] = { 0 };
+
+        /* Only a trailing word of a packet may be short.  */
+        if (wlen < 4 && !stream_attr_has_eop(attr)) {
+            break;
+        }
+        memcpy(word, buf + pos, wlen);
+        pos += wlen;
+
+        ms->rx.data[idx] = ldl_le_p(word);
+        ms->rx.control[idx] = pos == len && stream_attr_has_eop(attr);
+        ms->rx.wpos++;
+    }
+
+    if (pos && ms->waiting) {
+        ms->waiting = false;
+        microblaze_stream_wakeup(ms);
+    }
+    return pos;
+}
+
+static void microblaze_stream_class_init(ObjectClass *klass, void *data)
+{
+    StreamSlaveClass *ssc = STREAM_SLAVE_CLASS(klass);
+
+    ssc->push = microblaze_stream_push;
+    ssc->can_push = microblaze_stream_can_push;
+}
+
+static void microblaze_init_streams(MicroBlazeCPU *cpu)
+{
+    Object *obj = OBJECT(cpu);
+    unsigned int i;
+
+    for (i = 0; i < MB_NR_STREAMS; i++) {
+        MicroBlazeStream *ms = &cpu->streams[i];
+        char *name;
+
+        name = g_strdup_printf("stream-slave%u", i);
+        object_initialize_child(obj, name, ms, sizeof(*ms),
+                                TYPE_MICROBLAZE_STREAM, &error_abort, NULL);
+        g_free(name);
+        ms->cpu = cpu;
+        ms->id = i;
+
+        name = g_strdup_printf("stream-master%u", i);
+        object_property_add_link(obj, name, TYPE_STREAM_SLAVE,
+                                 (Object **)&ms->tx,
+                                 qdev_prop_allow_set_link_before_realize,
+                                 OBJ_PROP_LINK_STRONG,
+                                 &error_abort);
+        g_free(name);
+    }
+
+    /* Names used by the FDT stream bindings for link 0.  */
+    object_property_add_alias(obj, "axistream-connected", obj,
+                              "stream-master0", &error_abort);
+    object_property_add_alias(obj, "axistream-connected-target", obj,
+                              "stream-slave0", &error_abort);
+}
 #endif
 
 /* CPUClass::reset() */
@@ -140,6 +234,9 @@ static void mb_cpu_reset(CPUState *s)
     MicroBlazeCPU *cpu = MICROBLAZE_CPU(s);
     MicroBlazeCPUClass *mcc = MICROBLAZE_CPU_GET_CLASS(cpu);
     CPUMBState *env = &cpu->env;
+#if !defined(CONFIG_USER_ONLY)
+    int i;
+#endif
 
     mcc->parent_reset(s);
 
@@ -162,6 +259,14 @@ static void mb_cpu_reset(CPUState *s)
     env->mmu.c_mmu_zones = 16;
     env->mmu.c_addr_mask = MAKE_64BIT_MASK(0, cpu->cfg.addr_size);
 
+    for (i = 0; i < MB_NR_STREAMS; i++) {
+        MicroBlazeStream *ms = &cpu->streams[i];
+
+        ms->rx.rpos = ms->rx.wpos = 0;
+        ms->waiting = false;
+        ms->notify = NULL;
+    }
+
     if (cpu->env.memattr_p) {
         env->memattr[0].attrs = *cpu->env.memattr_p;
     }
@@ -273,6 +378,8 @@ static void mb_cpu_initfn(Object *obj)
                              qdev_prop_allow_set_link_before_realize,
                              OBJ_PROP_LINK_STRONG,
                              &error_abort);
+
+    microblaze_init_streams(cpu);
 #endif
 }
 
@@ -389,9 +496,25 @@ static const TypeInfo mb_cpu_type_info = {
 #endif
 };
 
+#ifndef CONFIG_USER_ONLY
+static const TypeInfo microblaze_stream_info = {
+    .name = TYPE_MICROBLAZE_STREAM,
+    .parent = TYPE_OBJECT,
+    .instance_size = sizeof(MicroBlazeStream),
+    .class_init = microblaze_stream_class_init,
+    .interfaces = (InterfaceInfo[]) {
+        { TYPE_STREAM_SLAVE },
+        { }
+    },
+};
+#endif
+
 static void mb_cpu_register_types(void)
 {
     type_register_static(&mb_cpu_type_info);
+#ifndef CONFIG_USER_ONLY
+    type_register_static(&microblaze_stream_info);
+#endif
 }
 
 type_init(mb_cpu_register_types)
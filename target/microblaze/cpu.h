@@ -25,6 +25,10 @@
 
 #define TARGET_LONG_BITS 64
 
+/* MicroBlaze issues loads and stores in order, but stores can sit in the
+   write buffer while later loads go ahead. mbar orders everything.  */
+#define TCG_GUEST_DEFAULT_MO      (TCG_MO_ALL & ~TCG_MO_ST_LD)
+
 #define CPUArchState struct CPUMBState
 
 #include "exec/cpu-defs.h"
@@ -269,6 +273,8 @@ struct CPUMBState {
 #define IFLAGS_TB_MASK  (D_FLAG | IMM_FLAG | DRTI_FLAG | DRTE_FLAG | DRTB_FLAG)
     uint32_t iflags;
     uint32_t wakeup;
+/* wakeup bits 0 and 1 are the wakeup inputs.  */
+#define MB_WAKEUP_STREAM (1 << 2)
 
 #if !defined(CONFIG_USER_ONLY)
     /* Unified MMU.  */
@@ -297,6 +303,39 @@ struct CPUMBState {
  *
  * A MicroBlaze CPU.
  */
+#define TYPE_MICROBLAZE_STREAM "microblaze-stream"
+#define MICROBLAZE_STREAM(obj) \
+    OBJECT_CHECK(MicroBlazeStream, (obj), TYPE_MICROBLAZE_STREAM)
+
+#define MB_NR_STREAMS   16
+/* Depth of the slave FIFOs in words, power of 2.  */
+#define MB_STREAM_DEPTH 16
+
+/* Stream (FSL/AXI-Stream) link number id.  */
+typedef struct MicroBlazeStream {
+    /*< private >*/
+    Object parent_obj;
+
+    /*< public >*/
+    MicroBlazeCPU *cpu;
+    unsigned int id;
+
+    /* Master side, written by put.  */
+    struct StreamSlave *tx;
+
+    /* Slave side, pushed into by our link partner and drained by get.  */
+    struct {
+        uint32_t data[MB_STREAM_DEPTH];
+        bool control[MB_STREAM_DEPTH];
+        unsigned int rpos;
+        unsigned int wpos;
+    } rx;
+    /* Set while the CPU is stalled on a blocking get.  */
+    bool waiting;
+    void (*notify)(void *opaque);
+    void *notify_opaque;
+} MicroBlazeStream;
+
 struct MicroBlazeCPU {
     /*< private >*/
     CPUState parent_obj;
@@ -323,6 +362,8 @@ struct MicroBlazeCPU {
     } cfg;
 
     CPUMBState env;
+
+    MicroBlazeStream streams[MB_NR_STREAMS];
 };
 
 static inline MicroBlazeCPU *mb_env_get_cpu(CPUMBState *env)
@@ -33,5 +33,5 @@ DEF_HELPER_4(mmu_write, void, env, i32, i32, i32)
 DEF_HELPER_5(memalign, void, env, tl, i32, i32, i32)
 DEF_HELPER_2(stackprot, void, env, tl)
 
-DEF_HELPER_2(get, i32, i32, i32)
-DEF_HELPER_3(put, void, i32, i32, i32)
+DEF_HELPER_4(get, i32, env, ptr, i32, i32)
+DEF_HELPER_4(put, void, env, ptr, i32, i32)
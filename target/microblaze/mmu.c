@@ -32,20 +32,71 @@ static unsigned int tlb_decode_size(unsigned int f)
     return sizes[f];
 }
 
+static unsigned int tlb_hash(uint64_t vaddr, unsigned int pagesz)
+{
+    /* Page sizes go in steps of 4x starting at 1K.  */
+    return (vaddr >> (10 + pagesz * 2)) & (TLB_HASH_SIZE - 1);
+}
+
+static void mmu_shadow_remove(struct microblaze_mmu *mmu, unsigned int idx)
+{
+    struct microblaze_mmu_entry *e = &mmu->entries[idx];
+
+    if (!e->valid) {
+        return;
+    }
+
+    mmu->buckets[e->pagesz][tlb_hash(e->epn, e->pagesz)] &= ~(1ULL << idx);
+    if (--mmu->nr_pagesz[e->pagesz] == 0) {
+        mmu->pagesz_used &= ~(1 << e->pagesz);
+    }
+    e->valid = false;
+}
+
+static void mmu_shadow_insert(struct microblaze_mmu *mmu, unsigned int idx)
+{
+    struct microblaze_mmu_entry *e = &mmu->entries[idx];
+    uint64_t t = mmu->rams[RAM_TAG][idx];
+    uint64_t d = mmu->rams[RAM_DATA][idx];
+
+    assert(!e->valid);
+    if (!(t & TLB_VALID)) {
+        return;
+    }
+
+    e->pagesz = (t & TLB_PAGESZ_MASK) >> 7;
+    e->size = tlb_decode_size(e->pagesz);
+    e->mask = ~((uint64_t)e->size - 1);
+    e->epn = t & TLB_EPN_MASK;
+    e->rpn = d & TLB_RPN_MASK;
+    e->zsel = (d & TLB_ZSEL_MASK) >> 4;
+    e->ex = d & TLB_EX;
+    e->wr = d & TLB_WR;
+    e->valid = true;
+
+    mmu->buckets[e->pagesz][tlb_hash(e->epn, e->pagesz)] |= 1ULL << idx;
+    mmu->nr_pagesz[e->pagesz]++;
+    mmu->pagesz_used |= 1 << e->pagesz;
+}
+
 static void mmu_flush_idx(CPUMBState *env, unsigned int idx)
 {
     CPUState *cs = CPU(mb_env_get_cpu(env));
-    struct microblaze_mmu *mmu = &env->mmu;
-    unsigned int tlb_size;
-    uint32_t tlb_tag, end, t;
+    struct microblaze_mmu_entry *e = &env->mmu.entries[idx];
+    uint32_t tlb_tag, end;
 
-    t = mmu->rams[RAM_TAG][idx];
-    if (!(t & TLB_VALID))
+    if (!e->valid)
         return;
 
-    tlb_tag = t & TLB_EPN_MASK;
-    tlb_size = tlb_decode_size((t & TLB_PAGESZ_MASK) >> 7);
-    end = tlb_tag + tlb_size;
+    /* Flushing a big page one QEMU page at a time costs more than
+       starting over.  */
+    if (e->size > 16 * TARGET_PAGE_SIZE) {
+        tlb_flush(cs);
+        return;
+    }
+
+    tlb_tag = e->epn;
+    end = tlb_tag + e->size;
 
     while (tlb_tag < end) {
         tlb_flush_page(cs, tlb_tag);
@@ -79,92 +130,94 @@ unsigned int mmu_translate(struct microblaze_mmu *mmu,
 {
     unsigned int i, hit = 0;
     unsigned int tlb_ex = 0, tlb_wr = 0, tlb_zsel;
-    uint64_t tlb_tag, tlb_rpn, mask;
-    uint32_t tlb_size, t0;
+    unsigned int sizes = mmu->pagesz_used;
+    uint64_t candidates = 0;
+    uint32_t t0;
+
+    /* Gather the entries that may map vaddr, for all page sizes in use.  */
+    while (sizes) {
+        unsigned int sz = ctz32(sizes);
+
+        sizes &= sizes - 1;
+        candidates |= mmu->buckets[sz][tlb_hash(vaddr, sz)];
+    }
 
     lu->err = ERR_MISS;
-    for (i = 0; i < ARRAY_SIZE(mmu->rams[RAM_TAG]); i++) {
-        uint64_t t, d;
+    while (candidates) {
+        struct microblaze_mmu_entry *e;
 
-        /* Lookup and decode.  */
-        t = mmu->rams[RAM_TAG][i];
-        if (t & TLB_VALID) {
-            tlb_size = tlb_decode_size((t & TLB_PAGESZ_MASK) >> 7);
-            if (tlb_size < TARGET_PAGE_SIZE) {
-                qemu_log_mask(LOG_UNIMP, "%d pages not supported\n", tlb_size);
-                abort();
-            }
+        i = ctz64(candidates);
+        candidates &= candidates - 1;
+        e = &mmu->entries[i];
 
-            mask = ~((uint64_t)tlb_size - 1);
-            tlb_tag = t & TLB_EPN_MASK;
-            if ((vaddr & mask) != (tlb_tag & mask)) {
-                continue;
-            }
-            if (mmu->tids[i]
-                && ((mmu->regs[MMU_R_PID] & 0xff) != mmu->tids[i])) {
-                continue;
-            }
+        if (e->size < TARGET_PAGE_SIZE) {
+            qemu_log_mask(LOG_UNIMP, "%d pages not supported\n", e->size);
+            abort();
+        }
 
-            /* Bring in the data part.  */
-            d = mmu->rams[RAM_DATA][i];
-            tlb_ex = d & TLB_EX;
-            tlb_wr = d & TLB_WR;
+        if ((vaddr & e->mask) != (e->epn & e->mask)) {
+            continue;
+        }
+        if (mmu->tids[i]
+            && ((mmu->regs[MMU_R_PID] & 0xff) != mmu->tids[i])) {
+            continue;
+        }
 
-            /* Now let's see if there is a zone that overrides the protbits.  */
-            tlb_zsel = (d >> 4) & 0xf;
-            t0 = mmu->regs[MMU_R_ZPR] >> (30 - (tlb_zsel * 2));
-            t0 &= 0x3;
+        tlb_ex = e->ex;
+        tlb_wr = e->wr;
 
-            if (tlb_zsel > mmu->c_mmu_zones) {
-                qemu_log_mask(LOG_GUEST_ERROR,
-                              "tlb zone select out of range! %d\n", tlb_zsel);
-                t0 = 1; /* Ignore.  */
-            }
+        /* Now let's see if there is a zone that overrides the protbits.  */
+        tlb_zsel = e->zsel;
+        t0 = mmu->regs[MMU_R_ZPR] >> (30 - (tlb_zsel * 2));
+        t0 &= 0x3;
 
-            if (mmu->c_mmu == 1) {
-                t0 = 1; /* Zones are disabled.  */
-            }
+        if (tlb_zsel > mmu->c_mmu_zones) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "tlb zone select out of range! %d\n", tlb_zsel);
+            t0 = 1; /* Ignore.  */
+        }
+
+        if (mmu->c_mmu == 1) {
+            t0 = 1; /* Zones are disabled.  */
+        }
 
-            switch (t0) {
-                case 0:
-                    if (mmu_idx == MMU_USER_IDX)
-                        continue;
-                    break;
-                case 2:
-                    if (mmu_idx != MMU_USER_IDX) {
-                        tlb_ex = 1;
-                        tlb_wr = 1;
-                    }
-                    break;
-                case 3:
+        switch (t0) {
+            case 0:
+                if (mmu_idx == MMU_USER_IDX)
+                    continue;
+                break;
+            case 2:
+                if (mmu_idx != MMU_USER_IDX) {
                     tlb_ex = 1;
                     tlb_wr = 1;
-                    break;
-                default: break;
-            }
-
-            lu->err = ERR_PROT;
-            lu->prot = PAGE_READ;
-            if (tlb_wr)
-                lu->prot |= PAGE_WRITE;
-            else if (rw == 1)
-                goto done;
-            if (tlb_ex)
-                lu->prot |=PAGE_EXEC;
-            else if (rw == 2) {
-                goto done;
-            }
-
-            tlb_rpn = d & TLB_RPN_MASK;
+                }
+                break;
+            case 3:
+                tlb_ex = 1;
+                tlb_wr = 1;
+                break;
+            default: break;
+        }
 
-            lu->vaddr = tlb_tag;
-            lu->paddr = tlb_rpn & mmu->c_addr_mask;
-            lu->size = tlb_size;
-            lu->err = ERR_HIT;
-            lu->idx = i;
-            hit = 1;
+        lu->err = ERR_PROT;
+        lu->prot = PAGE_READ;
+        if (tlb_wr)
+            lu->prot |= PAGE_WRITE;
+        else if (rw == 1)
+            goto done;
+        if (tlb_ex)
+            lu->prot |=PAGE_EXEC;
+        else if (rw == 2) {
             goto done;
         }
+
+        lu->vaddr = e->epn;
+        lu->paddr = e->rpn & mmu->c_addr_mask;
+        lu->size = e->size;
+        lu->err = ERR_HIT;
+        lu->idx = i;
+        hit = 1;
+        goto done;
     }
 done:
     qemu_log_mask(CPU_LOG_MMU,
@@ -199,6 +252,10 @@ uint32_t mmu_read(CPUMBState *env, bool ext, uint32_t rn)
             }
 
             i = env->mmu.regs[MMU_R_TLBX] & 0xff;
+            if (i >= TLB_ENTRIES) {
+                qemu_log_mask(LOG_GUEST_ERROR, "Invalid TLBX %d\n", i);
+                return 0;
+            }
             r = extract64(env->mmu.rams[rn & 1][i], ext * 32, 32);
             if (rn == MMU_R_TLBHI)
                 env->mmu.regs[MMU_R_PID] = env->mmu.tids[i];
@@ -248,16 +305,25 @@ void mmu_write(CPUMBState *env, bool ext, uint32_t rn, uint32_t v)
         case MMU_R_TLBLO:
         case MMU_R_TLBHI:
             i = env->mmu.regs[MMU_R_TLBX] & 0xff;
+            if (i >= TLB_ENTRIES) {
+                qemu_log_mask(LOG_GUEST_ERROR, "Invalid TLBX %d\n", i);
+                return;
+            }
             if (rn == MMU_R_TLBHI) {
                 if (i < 3 && !(v & TLB_VALID) && qemu_loglevel_mask(~0))
                     qemu_log_mask(LOG_GUEST_ERROR,
                              "invalidating index %x at pc=%" PRIx64 "\n",
                              i, env->sregs[SR_PC]);
                 env->mmu.tids[i] = env->mmu.regs[MMU_R_PID] & 0xff;
-                mmu_flush_idx(env, i);
             }
+            /* Drop what was cached from the old contents of the entry,
+               TLBLO changes the RPN and permissions.  Only this CPU's
+               TLB holds them, so the flush completes right here.  */
+            mmu_flush_idx(env, i);
             tmp64 = env->mmu.rams[rn & 1][i];
+            mmu_shadow_remove(&env->mmu, i);
             env->mmu.rams[rn & 1][i] = deposit64(tmp64, ext * 32, 32, v);
+            mmu_shadow_insert(&env->mmu, i);
 
             break;
         case MMU_R_ZPR:
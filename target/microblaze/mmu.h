@@ -60,6 +60,25 @@
 
 #define TLB_ENTRIES    64
 
+/* Nr of hash buckets per page size in the lookup shadow.  */
+#define TLB_HASH_BITS  6
+#define TLB_HASH_SIZE  (1 << TLB_HASH_BITS)
+#define TLB_NR_SIZES   8
+
+/* Decoded copy of a TLB entry.  */
+struct microblaze_mmu_entry
+{
+    uint64_t epn;
+    uint64_t mask;
+    uint64_t rpn;
+    uint32_t size;
+    uint8_t pagesz;
+    uint8_t zsel;
+    bool ex;
+    bool wr;
+    bool valid;
+};
+
 struct microblaze_mmu
 {
     /* Data and tag brams.  */
@@ -69,6 +88,16 @@ struct microblaze_mmu
     /* Control flops.  */
     uint32_t regs[3];
 
+    /*
+     * Lookup shadow of the tag/data rams, updated on every TLB write.
+     * Each bucket is a bitmap of the TLB entries of a given page size
+     * whose page hashes to it, so hits are found in index order.
+     */
+    struct microblaze_mmu_entry entries[TLB_ENTRIES];
+    uint64_t buckets[TLB_NR_SIZES][TLB_HASH_SIZE];
+    uint8_t nr_pagesz[TLB_NR_SIZES];
+    uint8_t pagesz_used;
+
     int c_mmu;
     int c_mmu_tlb_access;
     int c_mmu_zones;
@@ -26,6 +26,10 @@
 #include "exec/cpu_ldst.h"
 #include "fpu/softfloat.h"
 #include "hw/remote-port.h"
+#include "qemu/main-loop.h"
+#if !defined(CONFIG_USER_ONLY)
+#include "hw/stream.h"
+#endif
 
 #define D(x)
 
@@ -48,40 +52,171 @@ void tlb_fill(CPUState *cs, target_ulong addr, int size,
 }
 #endif
 
-void helper_put(uint32_t id, uint32_t ctrl, uint32_t data)
+#if !defined(CONFIG_USER_ONLY)
+static void stream_notify(void *opaque)
+{
+    MicroBlazeStream *ms = opaque;
+    CPUState *cs = CPU(ms->cpu);
+
+    if (ms->waiting) {
+        ms->waiting = false;
+        ms->cpu->env.wakeup |= MB_WAKEUP_STREAM;
+        cs->halted = 0;
+        qemu_cpu_kick(cs);
+    }
+}
+
+/* Stall the CPU on a blocking stream access. The PC still points to the
+ * put/get, so it is re-executed once the link partner wakes us up.
+ */
+static void QEMU_NORETURN stream_stall(CPUMBState *env, MicroBlazeStream *ms,
+                                       bool locked)
+{
+    CPUState *cs = CPU(mb_env_get_cpu(env));
+
+    ms->waiting = true;
+    cs->halted = 1;
+    cs->exception_index = EXCP_HLT;
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+    cpu_loop_exit(cs);
+}
+
+static bool stream_lock(CPUMBState *env)
 {
-    int test = ctrl & STREAM_TEST;
-    int atomic = ctrl & STREAM_ATOMIC;
-    int control = ctrl & STREAM_CONTROL;
-    int nonblock = ctrl & STREAM_NONBLOCK;
-    int exception = ctrl & STREAM_EXCEPTION;
+    bool locked = !qemu_mutex_iothread_locked();
+
+    if (locked) {
+        qemu_mutex_lock_iothread();
+    }
+    env->wakeup &= ~MB_WAKEUP_STREAM;
+    return locked;
+}
 
-    qemu_log_mask(LOG_UNIMP, "Unhandled stream put to stream-id=%d data=%x %s%s%s%s%s\n",
-             id, data,
-             test ? "t" : "",
-             nonblock ? "n" : "",
-             exception ? "e" : "",
-             control ? "c" : "",
-             atomic ? "a" : "");
+static void stream_unlock(bool locked)
+{
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
-uint32_t helper_get(uint32_t id, uint32_t ctrl)
+static void stream_set_carry(CPUMBState *env, bool carry)
+{
+    if (carry) {
+        env->sregs[SR_MSR] |= MSR_C | MSR_CC;
+    } else {
+        env->sregs[SR_MSR] &= ~(MSR_C | MSR_CC);
+    }
+}
+
+void helper_put(CPUMBState *env, void *link, uint32_t ctrl, uint32_t data)
+{
+    MicroBlazeStream *ms = link;
+    bool test = ctrl & STREAM_TEST;
+    bool control = ctrl & STREAM_CONTROL;
+    bool nonblock = ctrl & STREAM_NONBLOCK;
+    uint8_t buf[4];
+    bool locked;
+
+    locked = stream_lock(env);
+    if (!ms->tx) {
+        qemu_log_mask(LOG_UNIMP, "%sput to unconnected stream-id=%u"
+                      " data=%x\n", control ? "c" : "", ms->id, data);
+        if (nonblock) {
+            stream_set_carry(env, false);
+        }
+        stream_unlock(locked);
+        return;
+    }
+
+    if (!stream_can_push(ms->tx, stream_notify, ms)) {
+        if (nonblock) {
+            stream_set_carry(env, true);
+            stream_unlock(locked);
+            return;
+        }
+        stream_stall(env, ms, locked);
+    }
+
+    if (!test) {
+        stl_le_p(buf, data);
+        if (stream_push(ms->tx, buf, sizeof buf,
+                        control ? STREAM_ATTR_EOP : 0) != sizeof buf) {
+            qemu_log_mask(LOG_GUEST_ERROR, "stream-id=%u: short push\n",
+                          ms->id);
+        }
+    }
+    if (nonblock) {
+        stream_set_carry(env, false);
+    }
+    stream_unlock(locked);
+}
+
+uint32_t helper_get(CPUMBState *env, void *link, uint32_t ctrl,
+                    uint32_t old)
+{
+    MicroBlazeStream *ms = link;
+    bool test = ctrl & STREAM_TEST;
+    bool control = ctrl & STREAM_CONTROL;
+    bool nonblock = ctrl & STREAM_NONBLOCK;
+    bool exception = ctrl & STREAM_EXCEPTION;
+    uint32_t data = old;
+    unsigned int idx;
+    bool locked;
+
+    locked = stream_lock(env);
+    if (ms->rx.rpos == ms->rx.wpos) {
+        if (nonblock) {
+            stream_set_carry(env, true);
+            stream_unlock(locked);
+            return old;
+        }
+        stream_stall(env, ms, locked);
+    }
+
+    idx = ms->rx.rpos % MB_STREAM_DEPTH;
+    if (ms->rx.control[idx] != control) {
+        env->sregs[SR_MSR] |= MSR_FSL;
+        if (exception && (env->sregs[SR_MSR] & MSR_EE)
+            && (env->pvr.regs[2] & PVR2_USE_FSL_EXC)) {
+            env->sregs[SR_ESR] = ESR_EC_FSL | (ms->id << ESR_ESS_FSL_OFFSET);
+            stream_unlock(locked);
+            helper_raise_exception(env, EXCP_HW_EXCP);
+        }
+    } else {
+        env->sregs[SR_MSR] &= ~MSR_FSL;
+    }
+
+    if (!test) {
+        data = ms->rx.data[idx];
+        ms->rx.rpos++;
+        if (ms->notify) {
+            StreamCanPushNotifyFn notify = ms->notify;
+
+            ms->notify = NULL;
+            notify(ms->notify_opaque);
+        }
+    }
+    if (nonblock) {
+        stream_set_carry(env, false);
+    }
+    stream_unlock(locked);
+    return data;
+}
+#else
+void helper_put(CPUMBState *env, void *link, uint32_t ctrl, uint32_t data)
 {
-    int test = ctrl & STREAM_TEST;
-    int atomic = ctrl & STREAM_ATOMIC;
-    int control = ctrl & STREAM_CONTROL;
-    int nonblock = ctrl & STREAM_NONBLOCK;
-    int exception = ctrl & STREAM_EXCEPTION;
+    qemu_log_mask(LOG_UNIMP, "Unhandled stream put data=%x\n", data);
+}
 
-    qemu_log_mask(LOG_UNIMP, "Unhandled stream get from stream-id=%d %s%s%s%s%s\n",
-             id,
-             test ? "t" : "",
-             nonblock ? "n" : "",
-             exception ? "e" : "",
-             control ? "c" : "",
-             atomic ? "a" : "");
-    return 0xdead0000 | id;
+uint32_t helper_get(CPUMBState *env, void *link, uint32_t ctrl,
+                    uint32_t old)
+{
+    qemu_log_mask(LOG_UNIMP, "Unhandled stream get\n");
+    return 0xdead0000;
 }
+#endif
 
 void helper_raise_exception(CPUMBState *env, uint32_t index)
 {
@@ -104,7 +239,18 @@ void helper_sleep(CPUMBState *env)
     }
 
 #if !defined(CONFIG_USER_ONLY)
-    qemu_set_irq(cpu->mb_sleep, true);
+    {
+        /* With MTTCG, helpers run without the BQL.  */
+        bool locked = !qemu_mutex_iothread_locked();
+
+        if (locked) {
+            qemu_mutex_lock_iothread();
+        }
+        qemu_set_irq(cpu->mb_sleep, true);
+        if (locked) {
+            qemu_mutex_unlock_iothread();
+        }
+    }
 #endif
     cs->halted = 1;
     cs->exception_index = EXCP_HLT;
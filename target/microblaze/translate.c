@@ -1035,7 +1035,6 @@ static void dec_load(DisasContext *dc)
 static void dec_store(DisasContext *dc)
 {
     TCGv addr;
-    TCGLabel *swx_skip = NULL;
     unsigned int size;
     bool rev = false, ex = false, ea = false;
     int mem_index = cpu_mmu_index(&dc->cpu->env, false);
@@ -1065,13 +1064,14 @@ static void dec_store(DisasContext *dc)
     t_sync_flags(dc);
     /* If we get a fault on a dslot, the jmpstate better be in sync.  */
     sync_jmpstate(dc);
-    /* SWX needs a temp_local.  */
+    /* SWX needs a temp_local, addr is used after the first branch.  */
     addr = ex ? tcg_temp_local_new() : tcg_temp_new();
     compute_ldst_addr(dc, ea, addr);
     /* Extended addressing bypasses the MMU.  */
     mem_index = ea ? MMU_NOMMU_IDX : mem_index;
 
     if (ex) { /* swx */
+        TCGLabel *swx_skip;
         TCGv_i32 tval;
 
         /* swx does not throw unaligned access errors, so force alignment */
@@ -1081,17 +1081,21 @@ static void dec_store(DisasContext *dc)
         swx_skip = gen_new_label();
         tcg_gen_brcond_tl(TCG_COND_NE, env_res_addr, addr, swx_skip);
 
-        /* Compare the value loaded at lwx with current contents of
-           the reserved location.
-           FIXME: This only works for system emulation where we can expect
-           this compare and the following write to be atomic. For user
-           emulation we need to add atomicity between threads.  */
+        /* Store only if the reserved location still holds the value
+           loaded by lwx. The compare and the store must be one atomic
+           operation, other cores may run in parallel.  */
         tval = tcg_temp_new_i32();
-        tcg_gen_qemu_ld_i32(tval, addr, cpu_mmu_index(&dc->cpu->env, false),
-                            MO_TEUL);
+        tcg_gen_atomic_cmpxchg_i32(tval, addr, env_res_val, cpu_R[dc->rd],
+                                   mem_index, mop);
         tcg_gen_brcond_i32(TCG_COND_NE, env_res_val, tval, swx_skip);
         write_carryi(dc, 0);
         tcg_temp_free_i32(tval);
+
+        gen_set_label(swx_skip);
+        /* The reservation is gone whether or not the store was done.  */
+        tcg_gen_movi_tl(env_res_addr, RES_ADDR_NONE);
+        tcg_temp_free(addr);
+        return;
     }
 
     if (rev && size != 4) {
@@ -1139,10 +1143,6 @@ static void dec_store(DisasContext *dc)
                             tcg_const_i32(1), tcg_const_i32(size - 1));
     }
 
-    if (ex) {
-        gen_set_label(swx_skip);
-    }
-
     tcg_temp_free(addr);
 }
 
@@ -1247,6 +1247,7 @@ static void dec_br(DisasContext *dc)
             return;
         }
         LOG_DIS("mbar %d\n", dc->rd);
+        tcg_gen_mb(TCG_MO_ALL | TCG_BAR_SC);
         /* Break the TB.  */
         dc->cpustate_changed = 1;
         return;
@@ -1514,8 +1515,12 @@ static void dec_null(DisasContext *dc)
 /* Insns connected to FSL or AXI stream attached devices.  */
 static void dec_stream(DisasContext *dc)
 {
-    TCGv_i32 t_id, t_ctrl;
+    TCGv_i32 t_ctrl;
+    TCGv_ptr t_link;
     int ctrl;
+    /* Stream links live next to env in MicroBlazeCPU.  */
+    intptr_t base = offsetof(MicroBlazeCPU, streams)
+                    - offsetof(MicroBlazeCPU, env);
 
     LOG_DIS("%s%s imm=%x\n", dc->rd ? "get" : "put",
             dc->type_b ? "" : "d", dc->imm);
@@ -1524,23 +1529,37 @@ static void dec_stream(DisasContext *dc)
         return;
     }
 
-    t_id = tcg_temp_new_i32();
+    /* Blocking accesses stall by re-executing the insn.  */
+    t_sync_flags(dc);
+    sync_jmpstate(dc);
+    tcg_gen_movi_i64(cpu_SR[SR_PC], dc->pc);
+
+    t_link = tcg_temp_new_ptr();
     if (dc->type_b) {
-        tcg_gen_movi_i32(t_id, dc->imm & 0xf);
+        tcg_gen_addi_ptr(t_link, cpu_env,
+                         base + (dc->imm & 0xf) * sizeof(MicroBlazeStream));
         ctrl = dc->imm >> 10;
     } else {
+        TCGv_i32 t_id = tcg_temp_new_i32();
+
         tcg_gen_andi_i32(t_id, cpu_R[dc->rb], 0xf);
+        tcg_gen_muli_i32(t_id, t_id, sizeof(MicroBlazeStream));
+        tcg_gen_ext_i32_ptr(t_link, t_id);
+        tcg_gen_add_ptr(t_link, t_link, cpu_env);
+        tcg_gen_addi_ptr(t_link, t_link, base);
+        tcg_temp_free_i32(t_id);
         ctrl = dc->imm >> 5;
     }
 
     t_ctrl = tcg_const_i32(ctrl);
 
     if (dc->rd == 0) {
-        gen_helper_put(t_id, t_ctrl, cpu_R[dc->ra]);
+        gen_helper_put(cpu_env, t_link, t_ctrl, cpu_R[dc->ra]);
     } else {
-        gen_helper_get(cpu_R[dc->rd], t_id, t_ctrl);
+        gen_helper_get(cpu_R[dc->rd], cpu_env, t_link, t_ctrl,
+                       cpu_R[dc->rd]);
     }
-    tcg_temp_free_i32(t_id);
+    tcg_temp_free_ptr(t_link);
     tcg_temp_free_i32(t_ctrl);
 }
 
@@ -31,6 +31,7 @@
 #include "tcg-mo.h"
 #include "trace-tcg.h"
 #include "trace/mem.h"
+#include "qemu/etrace.h"
 
 /* Reduce the number of ifdefs below.  This assumes that all uses of
    TCGV_HIGH and TCGV_LOW are properly protected by a conditional that
@@ -2699,12 +2700,106 @@ static void tcg_gen_req_mo(TCGBar type)
     }
 }
 
+#define ETRACE_MEM_PTR_OFFSET (-ENV_OFFSET + offsetof(CPUState, etrace_mem_ptr))
+#define ETRACE_MEM_LIMIT_OFFSET \
+    (-ENV_OFFSET + offsetof(CPUState, etrace_mem_limit))
+
+void tcg_gen_etrace_mem_tb_start(void)
+{
+    TCGv_ptr ptr = tcg_temp_new_ptr();
+    TCGv_ptr limit = tcg_temp_new_ptr();
+    TCGLabel *l = gen_new_label();
+
+    tcg_gen_ld_ptr(ptr, cpu_env, ETRACE_MEM_PTR_OFFSET);
+    tcg_gen_ld_ptr(limit, cpu_env, ETRACE_MEM_LIMIT_OFFSET);
+    tcg_gen_brcond_ptr(TCG_COND_LEU, ptr, limit, l);
+    gen_helper_etrace_mem_drain(cpu_env);
+    gen_set_label(l);
+
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_ptr(limit);
+}
+
+static uint32_t etrace_mem_info(TCGMemOp memop, TCGArg idx, bool is_store)
+{
+    return (1 << (memop & MO_SIZE))
+           | ((is_store ? MEM_WRITE : MEM_READ)
+              << ETRACE_MEMLOG_INFO_ATTR_SHIFT)
+           | (idx << ETRACE_MEMLOG_INFO_MMU_IDX_SHIFT);
+}
+
+/*
+ * Start the etrace memory log entry for an access, before it's made:
+ * the slot at etrace_mem_ptr gets the address, marked pending. Returns
+ * the address as a 64-bit temp for gen_etrace_mem_end(). There's no
+ * branch here, the TB entry code has made sure there's room for
+ * ETRACE_MEMLOG_TB_MAX entries.
+ */
+static TCGv_i64 gen_etrace_mem_start(TCGv addr, TCGArg idx, TCGMemOp memop,
+                                     bool is_store)
+{
+    TCGv_i64 vaddr = tcg_temp_new_i64();
+    TCGv_ptr ptr = tcg_temp_new_ptr();
+    TCGv_i32 tinfo = tcg_const_i32(etrace_mem_info(memop, idx, is_store)
+                                   | ETRACE_MEMLOG_INFO_PENDING);
+
+    tcg_gen_extu_tl_i64(vaddr, addr);
+    tcg_gen_ld_ptr(ptr, cpu_env, ETRACE_MEM_PTR_OFFSET);
+    tcg_gen_st_i64(vaddr, ptr, offsetof(struct etrace_mem_log, vaddr));
+    tcg_gen_st_i32(tinfo, ptr, offsetof(struct etrace_mem_log, info));
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_i32(tinfo);
+    return vaddr;
+}
+
+/* Complete the entry once the access is done, and free vaddr.  */
+static void gen_etrace_mem_end(TCGv_i64 vaddr, TCGv_i64 val, TCGArg idx,
+                               TCGMemOp memop, bool is_store)
+{
+    TCGv_i32 tinfo = tcg_const_i32(etrace_mem_info(memop, idx, is_store));
+
+    if (tcg_ctx->etrace_mem_nr < ETRACE_MEMLOG_TB_MAX) {
+        TCGv_ptr ptr = tcg_temp_new_ptr();
+
+        tcg_ctx->etrace_mem_nr++;
+        tcg_gen_ld_ptr(ptr, cpu_env, ETRACE_MEM_PTR_OFFSET);
+        tcg_gen_st_i64(val, ptr, offsetof(struct etrace_mem_log, value));
+        tcg_gen_st_i32(tinfo, ptr, offsetof(struct etrace_mem_log, info));
+        tcg_gen_addi_ptr(ptr, ptr, sizeof(struct etrace_mem_log));
+        tcg_gen_st_ptr(ptr, cpu_env, ETRACE_MEM_PTR_OFFSET);
+        tcg_temp_free_ptr(ptr);
+    } else {
+        gen_helper_etrace_mem(cpu_env, vaddr, val, tinfo);
+    }
+
+    tcg_temp_free_i64(vaddr);
+    tcg_temp_free_i32(tinfo);
+}
+
+static void gen_etrace_mem_end_i32(TCGv_i64 vaddr, TCGv_i32 val, TCGArg idx,
+                                   TCGMemOp memop, bool is_store)
+{
+    TCGv_i64 val64 = tcg_temp_new_i64();
+
+    tcg_gen_extu_i32_i64(val64, val);
+    gen_etrace_mem_end(vaddr, val64, idx, memop, is_store);
+    tcg_temp_free_i64(val64);
+}
+
 void tcg_gen_qemu_ld_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
 {
     tcg_gen_req_mo(TCG_MO_LD_LD | TCG_MO_ST_LD);
     memop = tcg_canonicalize_memop(memop, 0, 0);
     trace_guest_mem_before_tcg(tcg_ctx->cpu, cpu_env,
                                addr, trace_mem_get_info(memop, 0));
+    if (tcg_ctx->etrace_mem) {
+        /* This also keeps a copy of addr, which the load may clobber.  */
+        TCGv_i64 vaddr = gen_etrace_mem_start(addr, idx, memop, false);
+
+        gen_ldst_i32(INDEX_op_qemu_ld_i32, val, addr, memop, idx);
+        gen_etrace_mem_end_i32(vaddr, val, idx, memop, false);
+        return;
+    }
     gen_ldst_i32(INDEX_op_qemu_ld_i32, val, addr, memop, idx);
 }
 
@@ -2714,6 +2809,13 @@ void tcg_gen_qemu_st_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     memop = tcg_canonicalize_memop(memop, 0, 1);
     trace_guest_mem_before_tcg(tcg_ctx->cpu, cpu_env,
                                addr, trace_mem_get_info(memop, 1));
+    if (tcg_ctx->etrace_mem) {
+        TCGv_i64 vaddr = gen_etrace_mem_start(addr, idx, memop, true);
+
+        gen_ldst_i32(INDEX_op_qemu_st_i32, val, addr, memop, idx);
+        gen_etrace_mem_end_i32(vaddr, val, idx, memop, true);
+        return;
+    }
     gen_ldst_i32(INDEX_op_qemu_st_i32, val, addr, memop, idx);
 }
 
@@ -2733,6 +2835,14 @@ void tcg_gen_qemu_ld_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     memop = tcg_canonicalize_memop(memop, 1, 0);
     trace_guest_mem_before_tcg(tcg_ctx->cpu, cpu_env,
                                addr, trace_mem_get_info(memop, 0));
+    if (tcg_ctx->etrace_mem) {
+        /* This also keeps a copy of addr, which the load may clobber.  */
+        TCGv_i64 vaddr = gen_etrace_mem_start(addr, idx, memop, false);
+
+        gen_ldst_i64(INDEX_op_qemu_ld_i64, val, addr, memop, idx);
+        gen_etrace_mem_end(vaddr, val, idx, memop, false);
+        return;
+    }
     gen_ldst_i64(INDEX_op_qemu_ld_i64, val, addr, memop, idx);
 }
 
@@ -2747,6 +2857,13 @@ void tcg_gen_qemu_st_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     memop = tcg_canonicalize_memop(memop, 1, 1);
     trace_guest_mem_before_tcg(tcg_ctx->cpu, cpu_env,
                                addr, trace_mem_get_info(memop, 1));
+    if (tcg_ctx->etrace_mem) {
+        TCGv_i64 vaddr = gen_etrace_mem_start(addr, idx, memop, true);
+
+        gen_ldst_i64(INDEX_op_qemu_st_i64, val, addr, memop, idx);
+        gen_etrace_mem_end(vaddr, val, idx, memop, true);
+        return;
+    }
     gen_ldst_i64(INDEX_op_qemu_st_i64, val, addr, memop, idx);
 }
 
@@ -796,6 +796,12 @@ static inline void tcg_gen_insn_start(target_ulong pc, target_ulong a1,
  */
 void tcg_gen_exit_tb(TranslationBlock *tb, unsigned idx);
 
+/**
+ * tcg_gen_etrace_mem_tb_start() - drain the etrace memory access log if
+ * it may not have room for the accesses of the current TB.
+ */
+void tcg_gen_etrace_mem_tb_start(void);
+
 /**
  * tcg_gen_goto_tb() - output goto_tb TCG operation
  * @idx: Direct jump slot index (0 or 1)
@@ -1210,6 +1216,11 @@ static inline void tcg_gen_ld_ptr(TCGv_ptr r, TCGv_ptr a, intptr_t o)
     glue(tcg_gen_ld_,PTR)((NAT)r, a, o);
 }
 
+static inline void tcg_gen_st_ptr(TCGv_ptr r, TCGv_ptr a, intptr_t o)
+{
+    glue(tcg_gen_st_,PTR)((NAT)r, a, o);
+}
+
 static inline void tcg_gen_discard_ptr(TCGv_ptr a)
 {
     glue(tcg_gen_discard_,PTR)((NAT)a);
@@ -1225,6 +1236,12 @@ static inline void tcg_gen_addi_ptr(TCGv_ptr r, TCGv_ptr a, intptr_t b)
     glue(tcg_gen_addi_,PTR)((NAT)r, (NAT)a, b);
 }
 
+static inline void tcg_gen_brcond_ptr(TCGCond cond, TCGv_ptr a,
+                                      TCGv_ptr b, TCGLabel *label)
+{
+    glue(tcg_gen_brcond_,PTR)(cond, (NAT)a, (NAT)b, label);
+}
+
 static inline void tcg_gen_brcondi_ptr(TCGCond cond, TCGv_ptr a,
                                        intptr_t b, TCGLabel *label)
 {
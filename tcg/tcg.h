@@ -667,6 +667,8 @@ struct TCGContext {
 
     TCGRegSet reserved_regs;
     uint32_t tb_cflags; /* cflags of the current TB */
+    bool etrace_mem; /* Log memory accesses of the current TB */
+    unsigned int etrace_mem_nr; /* Inline logged accesses so far */
     intptr_t current_frame_offset;
     intptr_t frame_start;
     intptr_t frame_end;
@@ -0,0 +1,103 @@
+/*
+ * buffer_csum speed benchmark
+ *
+ * Copyright (c) 2018 Biamp Systems
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Each accelerator is checked against, and timed next to, the byte
+ * serial loop the network models used before.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/cutils.h"
+
+static uint16_t csum_scalar(const uint8_t *buf, size_t len)
+{
+    uint32_t sum1 = 0, sum2 = 0;
+    uint32_t sum;
+    size_t i;
+
+    for (i = 0; i + 1 < len; i += 2) {
+        sum1 += buf[i];
+        sum2 += buf[i + 1];
+    }
+    if (i < len) {
+        sum1 += buf[i];
+    }
+
+    sum = sum2 + (sum1 << 8);
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum;
+}
+
+static uint8_t *make_buffer(size_t len)
+{
+    uint8_t *buf = g_malloc(len + 1);
+    size_t i;
+
+    for (i = 0; i < len + 1; i++) {
+        buf[i] = g_test_rand_int();
+    }
+    return buf;
+}
+
+static double run(uint16_t (*fn)(const void *, size_t),
+                  const uint8_t *buf, size_t len)
+{
+    volatile uint16_t sink;
+    double total = 0.0;
+
+    g_test_timer_start();
+    do {
+        sink = fn(buf, len);
+        total += len;
+    } while (g_test_timer_elapsed() < 1.0);
+    (void)sink;
+
+    return total / MiB / g_test_timer_last();
+}
+
+static uint16_t csum_scalar_fn(const void *buf, size_t len)
+{
+    return csum_scalar(buf, len);
+}
+
+static void test_csum_speed(void)
+{
+    uint8_t *buf = make_buffer(64 * KiB);
+    int accel = 0;
+    size_t i;
+
+    for (i = 64; i <= 64 * KiB; i *= 4) {
+        g_print("scalar:  chunk_size %zu bytes: %.2f MB/sec\n",
+                i, run(csum_scalar_fn, buf, i));
+    }
+
+    /* From the best accelerator down to the integer fallback.  */
+    do {
+        for (i = 64; i <= 64 * KiB; i *= 4) {
+            /* Odd lengths and unaligned starts take the tail paths.  */
+            g_assert_cmpuint(buffer_csum(buf, i), ==, csum_scalar(buf, i));
+            g_assert_cmpuint(buffer_csum(buf + 1, i - 1), ==,
+                             csum_scalar(buf + 1, i - 1));
+
+            g_print("accel %d: chunk_size %zu bytes: %.2f MB/sec\n",
+                    accel, i, run(buffer_csum, buf, i));
+        }
+        accel++;
+    } while (test_buffer_csum_next_accel());
+
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/buffercsum/speed", test_csum_speed);
+
+    return g_test_run();
+}
@@ -0,0 +1,112 @@
+/*
+ * GF(2) polynomial arithmetic speed benchmark
+ *
+ * Copyright (c) 2018 Biamp Systems
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Prints a table of the time the two steps of the IPCores RSA5 4K binary
+ * Montgomery loop take, a mulmod and a 32-bit shift-reduce, at the key
+ * sizes guests commonly program.  There is one row per operation and
+ * carry-less multiply implementation, from the preferred one down to the
+ * table fallback.  Correctness is covered by test-gf2x.
+ */
+#include "qemu/osdep.h"
+#include "qemu/gf2x.h"
+
+/* 4224 bits, the widest operand of the IPCores RSA5 4K.  */
+#define MAX_N 66
+
+/* Minimum wall time of a measurement, in microseconds.  */
+#define MIN_TIME_US 100000
+
+static const size_t widths[] = { 16, 32, 64, MAX_N };
+
+typedef void GF2xStep(uint64_t *a, const uint64_t *b, const uint64_t *m,
+                      size_t n);
+
+/* Both steps feed their result back in, so no two calls are alike.  */
+static void step_mulmod(uint64_t *a, const uint64_t *b, const uint64_t *m,
+                        size_t n)
+{
+    gf2x_mulmod(a, a, b, m, n);
+}
+
+static void step_shift_reduce(uint64_t *a, const uint64_t *b,
+                              const uint64_t *m, size_t n)
+{
+    gf2x_lshift_reduce(a, a, m, 32, n);
+}
+
+static const struct {
+    const char *name;
+    GF2xStep *fn;
+} steps[] = {
+    { "mulmod", step_mulmod },
+    { "shift-reduce", step_shift_reduce },
+};
+
+static void rand_poly(uint64_t *a, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        a[i] = (uint64_t)g_test_rand_int() << 32 | g_test_rand_int();
+    }
+}
+
+/* Nanoseconds per call, doubling the batch until it is long enough.  */
+static double time_step(GF2xStep *fn, size_t n)
+{
+    uint64_t a[MAX_N], b[MAX_N], m[MAX_N];
+    unsigned long iters, i;
+    gint64 t;
+
+    rand_poly(a, n);
+    rand_poly(b, n);
+    rand_poly(m, n);
+    m[n - 1] |= 1ULL << 63;
+
+    for (iters = 16; ; iters *= 2) {
+        t = g_get_monotonic_time();
+        for (i = 0; i < iters; i++) {
+            fn(a, b, m, n);
+        }
+        t = g_get_monotonic_time() - t;
+        if (t >= MIN_TIME_US) {
+            return t * 1000.0 / iters;
+        }
+    }
+}
+
+static void test_gf2x_speed(void)
+{
+    int accel = 0;
+    size_t i, j;
+
+    g_print("\n%-5s %-12s", "accel", "ns per call");
+    for (j = 0; j < ARRAY_SIZE(widths); j++) {
+        g_print(" %6zu bits", widths[j] * 64);
+    }
+    g_print("\n");
+
+    do {
+        for (i = 0; i < ARRAY_SIZE(steps); i++) {
+            g_print("%-5d %-12s", accel, steps[i].name);
+            for (j = 0; j < ARRAY_SIZE(widths); j++) {
+                g_print(" %11.0f", time_step(steps[i].fn, widths[j]));
+            }
+            g_print("\n");
+        }
+        accel++;
+    } while (test_gf2x_next_accel());
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/gf2x/speed", test_gf2x_speed);
+
+    return g_test_run();
+}
@@ -32,6 +32,22 @@ static const uint8_t kernel_pls3adsp1800[] = {
     0xb8, 0x00, 0xff, 0xfc                  /* bri   -4  loop */
 };
 
+/* Print 'T' after each lwx/swx increment that succeeds.  */
+static const uint8_t kernel_pls3adsp1800_swx[] = {
+    0xb0, 0x00, 0x90, 0x00,                 /* imm   0x9000 */
+    0x30, 0xa0, 0x10, 0x00,                 /* addik r5,r0,0x1000 */
+    0xb0, 0x00, 0x84, 0x00,                 /* imm   0x8400 */
+    0x30, 0x60, 0x00, 0x04,                 /* addik r3,r0,4 */
+    0x30, 0x80, 0x00, 0x54,                 /* addik r4,r0,'T' */
+    0xc8, 0xc5, 0x04, 0x00,                 /* lwx   r6,r5,r0 */
+    0x30, 0xc6, 0x00, 0x01,                 /* addik r6,r6,1 */
+    0xd8, 0xc5, 0x04, 0x00,                 /* swx   r6,r5,r0 */
+    0x08, 0xe0, 0x00, 0x00,                 /* addc  r7,r0,r0 */
+    0xbc, 0x27, 0xff, 0xf0,                 /* bnei  r7,-16  retry */
+    0xf0, 0x83, 0x00, 0x00,                 /* sbi   r4,r3,0 */
+    0xb8, 0x00, 0xff, 0xe8                  /* bri   -24  loop */
+};
+
 static const uint8_t kernel_plml605[] = {
     0xe0, 0x83, 0x00, 0xb0,                 /* imm   0x83e0 */
     0x00, 0x10, 0x60, 0x30,                 /* addik r3,r0,0x1000 */
@@ -70,6 +86,7 @@ typedef struct testdef {
     size_t codesize;        /* Size of the kernel or bios data */
     const uint8_t *kernel;  /* Set in case we use our own mini kernel */
     const uint8_t *bios;    /* Set in case we use our own mini bios */
+    const char *name;       /* Test name, if not the machine name */
 } testdef_t;
 
 static testdef_t tests[] = {
@@ -98,6 +115,9 @@ static testdef_t tests[] = {
     { "m68k", "mcf5208evb", "", "TT", sizeof(kernel_mcf5208), kernel_mcf5208 },
     { "microblaze", "petalogix-s3adsp1800", "", "TT",
       sizeof(kernel_pls3adsp1800), kernel_pls3adsp1800 },
+    { "microblaze", "petalogix-s3adsp1800", "-accel tcg,thread=multi", "TT",
+      sizeof(kernel_pls3adsp1800_swx), kernel_pls3adsp1800_swx, NULL,
+      "petalogix-s3adsp1800-swx-mttcg" },
     { "microblazeel", "petalogix-ml605", "", "TT",
       sizeof(kernel_plml605), kernel_plml605 },
     { "moxie", "moxiesim", "", "TT", sizeof(bios_moxiesim), 0, bios_moxiesim },
@@ -199,7 +219,9 @@ int main(int argc, char *argv[])
 
     for (i = 0; tests[i].arch != NULL; i++) {
         if (strcmp(arch, tests[i].arch) == 0) {
-            char *name = g_strdup_printf("boot-serial/%s", tests[i].machine);
+            char *name = g_strdup_printf("boot-serial/%s",
+                                         tests[i].name ? tests[i].name
+                                                       : tests[i].machine);
             qtest_add_data_func(name, &tests[i], test_machine);
             g_free(name);
         }
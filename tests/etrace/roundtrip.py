@@ -0,0 +1,157 @@
+#!/usr/bin/env python
+#
+# Round trip tests for scripts/etrace.py.
+#
+# Copyright (c) 2018 Biamp Systems
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Generates plain and chunked traces the way QEMU lays them out, decodes
+# them and checks that --start/--end select the same records for both.
+
+from __future__ import print_function
+import io
+import os
+import shutil
+import struct
+import sys
+import tempfile
+import zlib
+
+import etrace
+from etrace import *
+
+
+def exec_rec(unit, t, pc):
+    return Record(TYPE_EXEC, unit, struct.pack('<QQQ', t, pc, pc + 4))
+
+
+def mem_rec(unit, t, addr):
+    return Record(TYPE_MEM, unit, struct.pack('<QQQQIB3x', t, addr, addr,
+                                              0x1234, 0, 4))
+
+
+def event_rec(unit, t, val):
+    return Record(TYPE_EVENT_U64, unit,
+                  struct.pack('<IHHQQQHH', 0, unit, 0, t, val, 0, 0, 0))
+
+
+def tb_rec(unit, pc):
+    return Record(TYPE_TB, unit, struct.pack('<QQQII', pc, pc, 0, 4, 0))
+
+
+# Records per unit, in time order within each unit.
+UNITS = [
+    [tb_rec(0, 0x1000), exec_rec(0, 10, 0x1000), mem_rec(0, 12, 0x80),
+     Record(TYPE_BARRIER, 0, b''), exec_rec(0, 20, 0x1004)],
+    [exec_rec(1, 15, 0x2000), event_rec(1, 25, 1), mem_rec(1, 30, 0x90),
+     exec_rec(1, 40, 0x2004)],
+]
+
+
+def header(attr):
+    info = struct.pack(info_fmt, attr, 1, 0)
+    arch = struct.pack('<IBBIBB', 189, 32, 1, 62, 64, 0)
+    return (Record(TYPE_INFO, 0, info).pack() +
+            Record(TYPE_ARCH, 0, arch).pack())
+
+
+def plain_trace():
+    data = header(0)
+    for recs in UNITS:
+        data += b''.join(r.pack() for r in recs)
+    return data
+
+
+def chunked_trace():
+    data = header(INFO_F_CHUNKED)
+    index = b''
+    for unit, recs in enumerate(UNITS):
+        raw = b''.join(r.pack() for r in recs)
+        times = [r.time() for r in recs if r.time() is not None]
+        chunk = struct.pack(chunk_fmt, min(times), max(times), len(raw),
+                            CHUNK_ZLIB) + zlib.compress(raw)
+        index += struct.pack(index_entry_fmt, min(times), max(times),
+                             len(data), unit)
+        data += Record(TYPE_CHUNK, unit, chunk).pack()
+    trailer = struct.pack(index_trailer_fmt, len(data), len(UNITS),
+                          INDEX_MAGIC)
+    data += Record(TYPE_INDEX, 0, index + trailer).pack()
+    return data
+
+
+def overlaps(recs, start, end):
+    times = [r.time() for r in recs if r.time() is not None]
+    return ((start is None or max(times) >= start) and
+            (end is None or min(times) <= end))
+
+
+def expected(start, end, chunked):
+    '''Untimed records go away with the chunk they are in.'''
+    return [r.pack() for recs in UNITS for r in recs
+            if r.within(start, end) and
+            (not chunked or overlaps(recs, start, end))]
+
+
+def decode(data, start, end):
+    reader = EtraceReader(io.BytesIO(data))
+    return [r.pack() for r in reader.records(start, end)]
+
+
+def check(name, got, want):
+    if got != want:
+        print('FAIL: %s: got %d records, expected %d' % (name, len(got),
+                                                         len(want)),
+              file=sys.stderr)
+        return 1
+    return 0
+
+
+# Ranges and the number of records of the plain trace within them.
+RANGES = [(None, None, 9), (12, None, 8), (None, 20, 6), (13, 29, 5),
+          (41, None, 2), (20, 20, 3)]
+
+
+def main():
+    ret = 0
+    plain = plain_trace()
+    chunked = chunked_trace()
+    tmpdir = tempfile.mkdtemp()
+    try:
+        for start, end, nr in RANGES:
+            name = '[%s, %s]' % (start, end)
+            want = expected(start, end, False)
+            if len(want) != nr:
+                print('FAIL: %s selects %d records, expected %d' %
+                      (name, len(want), nr), file=sys.stderr)
+                ret = 1
+            ret |= check('plain ' + name, decode(plain, start, end), want)
+            want = expected(start, end, True)
+            ret |= check('chunked ' + name, decode(chunked, start, end), want)
+
+            # Extract through the command line and read the result back.
+            src = os.path.join(tmpdir, 'in.etrace')
+            out = os.path.join(tmpdir, 'out.etrace')
+            with open(src, 'wb') as f:
+                f.write(chunked)
+            args = [src, out]
+            if start is not None:
+                args += ['--start', str(start)]
+            if end is not None:
+                args += ['--end', str(end)]
+            if etrace.main(args):
+                print('FAIL: etrace.py %s failed' % ' '.join(args),
+                      file=sys.stderr)
+                ret = 1
+                continue
+            with open(out, 'rb') as f:
+                data = f.read()
+            ret |= check('extract ' + name, decode(data, None, None), want)
+    finally:
+        shutil.rmtree(tmpdir)
+    return ret
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,90 @@
+/*
+ * QEMU buffer_csum test
+ *
+ * Copyright (c) 2018 Biamp Systems
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "net/checksum.h"
+
+static uint8_t buffer[4096 + 64];
+
+/* Byte at a time, as net_checksum_add_cont() used to do it.  */
+static uint32_t csum_bytewise(int len, const uint8_t *buf, int seq)
+{
+    uint32_t sum = 0;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if ((i + seq) & 1) {
+            sum += buf[i];
+        } else {
+            sum += buf[i] << 8;
+        }
+    }
+    return sum;
+}
+
+static uint16_t fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum;
+}
+
+static void test_1(void)
+{
+    size_t a, s;
+    int seq;
+
+    /* All zero and all ones.  */
+    memset(buffer, 0, sizeof(buffer));
+    g_assert_cmpuint(buffer_csum(buffer, 4096), ==, 0);
+    memset(buffer, 0xff, sizeof(buffer));
+    g_assert_cmpuint(buffer_csum(buffer, 4096), ==, 0xffff);
+    g_assert_cmpuint(buffer_csum(buffer, 4095), ==,
+                     fold(csum_bytewise(4095, buffer, 0)));
+
+    for (a = 0; a < sizeof(buffer); a++) {
+        buffer[a] = g_test_rand_int();
+    }
+
+    /* Every length up to a few vector blocks, from unaligned starts.  */
+    for (a = 0; a < 64; a++) {
+        for (s = 0; s <= 1100; s++) {
+            g_assert_cmpuint(buffer_csum(buffer + a, s), ==,
+                             fold(csum_bytewise(s, buffer + a, 0)));
+            for (seq = 0; seq < 2; seq++) {
+                g_assert_cmpuint(fold(net_checksum_add_cont(s, buffer + a,
+                                                            seq)), ==,
+                                 fold(csum_bytewise(s, buffer + a, seq)));
+            }
+        }
+    }
+
+    /* Long odd lengths.  */
+    for (s = 4096 - 7; s <= 4096; s++) {
+        g_assert_cmpuint(buffer_csum(buffer + 3, s), ==,
+                         fold(csum_bytewise(s, buffer + 3, 0)));
+    }
+}
+
+static void test_2(void)
+{
+    do {
+        test_1();
+    } while (test_buffer_csum_next_accel());
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/cutils/buffercsum", test_2);
+
+    return g_test_run();
+}
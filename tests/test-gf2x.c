@@ -0,0 +1,214 @@
+/*
+ * GF(2) polynomial arithmetic test
+ *
+ * Copyright (c) 2018 Biamp Systems
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/gf2x.h"
+
+#define MAX_N 4
+
+typedef struct {
+    size_t n;
+    uint64_t m[MAX_N];
+    uint64_t a[MAX_N];
+    uint64_t b[MAX_N];
+    uint64_t ab[MAX_N];     /* a * b */
+    uint64_t a1[MAX_N];     /* a * x */
+    uint64_t a32[MAX_N];    /* a * x^32 */
+    uint64_t a100[MAX_N];   /* a * x^100 */
+} MulmodVector;
+
+/*
+ * Reduced modulo m, with the top bit of m set: these are plain products
+ * in GF(2)[x]/(m).  The last one has no top bit in m, so it exercises
+ * the raw shift register behaviour the RSA core relies on.
+ */
+static const MulmodVector mulmod_vectors[] = {
+    {
+        .n = 1,
+        .m = { 0x800000000000001bULL },
+        .a = { 0x40ebf61fab9e8c69ULL },
+        .b = { 0x0f6a6d2f4c4d5011ULL },
+        .ab = { 0x16442d70d9ab4c30ULL },
+        .a1 = { 0x01d7ec3f573d18c9ULL },
+        .a32 = { 0x2b9e8c6491b99649ULL },
+        .a100 = { 0x37e6380493ed881aULL },
+    }, {
+        .n = 2,
+        .m = { 0x0000000000000087ULL, 0x8000000000000000ULL },
+        .a = { 0x88be89846f376bc2ULL, 0x1e29d1408c687eccULL },
+        .b = { 0x08f25c253c41cc2aULL, 0x6e7190400a842d32ULL },
+        .ab = { 0xd5bd4d8310f48d6eULL, 0x3c16344db0bc5bd5ULL },
+        .a1 = { 0x117d1308de6ed784ULL, 0x3c53a28118d0fd99ULL },
+        .a32 = { 0x6f376bdc9c6b2d07ULL, 0x0c687ecc88be8984ULL },
+        .a100 = { 0x24c3c47c8fafd523ULL, 0x7376bdc9c6b2d0b2ULL },
+    }, {
+        .n = 3,
+        .m = { 0x209ea975887d09dfULL, 0x675cc5fb0716a8efULL,
+               0x80000000002828d6ULL },
+        .a = { 0x6f31cee61064ece2ULL, 0x873759f6a3684e15ULL,
+               0x3abcdcee08b99cf2ULL },
+        .b = { 0xa3917eb0c599302aULL, 0xc417d4d29ab09a71ULL,
+               0x0a1bee8a05d2bba6ULL },
+        .ab = { 0x3ce537b61baad415ULL, 0x7226525299019710ULL,
+                0x529290b6a718210aULL },
+        .a1 = { 0xde639dcc20c9d9c4ULL, 0x0e6eb3ed46d09c2aULL,
+                0x7579b9dc117339e5ULL },
+        .a32 = { 0xd972604241f3db34ULL, 0xf6eaeae1f69690eeULL,
+                 0x08b4952d103dcd2eULL },
+        .a100 = { 0x44c280a8591b6a81ULL, 0xda9b1bb3c8e10193ULL,
+                  0x2596ead2524343b9ULL },
+    }, {
+        .n = 2,
+        .m = { 0x1234567890abcdefULL, 0 },
+        .a = { 0x0000000000000005ULL, 0x4000000000000000ULL },
+        .b = { 0x0000000000000005ULL, 0x4000000000000000ULL },
+        .ab = { 0x1dd72fb3386b4088ULL, 0xe041014404450550ULL },
+        .a1 = { 0x1234567890abcde5ULL, 0x8000000000000000ULL },
+        .a32 = { 0x4855e6f280000000ULL, 0x00000000091a2b3cULL },
+        .a100 = { 0x11fe34cbc927f817ULL, 0x855e6f2810405101ULL },
+    },
+};
+
+static void check_poly(const uint64_t *r, const uint64_t *expect, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        g_assert_cmphex(r[i], ==, expect[i]);
+    }
+}
+
+static void test_mulmod(void)
+{
+    uint64_t r[MAX_N];
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(mulmod_vectors); i++) {
+        const MulmodVector *v = &mulmod_vectors[i];
+
+        gf2x_mulmod(r, v->a, v->b, v->m, v->n);
+        check_poly(r, v->ab, v->n);
+        gf2x_mulmod(r, v->b, v->a, v->m, v->n);
+        check_poly(r, v->ab, v->n);
+
+        /* In place.  */
+        memcpy(r, v->a, sizeof(r));
+        gf2x_mulmod(r, r, v->b, v->m, v->n);
+        check_poly(r, v->ab, v->n);
+    }
+}
+
+static void test_lshift_reduce(void)
+{
+    uint64_t r[MAX_N];
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(mulmod_vectors); i++) {
+        const MulmodVector *v = &mulmod_vectors[i];
+
+        gf2x_lshift_reduce(r, v->a, v->m, 0, v->n);
+        check_poly(r, v->a, v->n);
+        gf2x_lshift_reduce(r, v->a, v->m, 1, v->n);
+        check_poly(r, v->a1, v->n);
+        gf2x_lshift_reduce(r, v->a, v->m, 32, v->n);
+        check_poly(r, v->a32, v->n);
+        gf2x_lshift_reduce(r, v->a, v->m, 100, v->n);
+        check_poly(r, v->a100, v->n);
+
+        /* x^100 is x^32 * x^68.  */
+        memcpy(r, v->a32, sizeof(r));
+        gf2x_lshift_reduce(r, r, v->m, 68, v->n);
+        check_poly(r, v->a100, v->n);
+    }
+}
+
+static void test_degree(void)
+{
+    uint64_t a[MAX_N] = { 0 };
+
+    g_assert_cmpint(gf2x_degree(a, MAX_N), ==, -1);
+    a[0] = 1;
+    g_assert_cmpint(gf2x_degree(a, MAX_N), ==, 0);
+    a[0] = 0x8000000000000001ULL;
+    g_assert_cmpint(gf2x_degree(a, MAX_N), ==, 63);
+    a[1] = 1;
+    g_assert_cmpint(gf2x_degree(a, MAX_N), ==, 64);
+    a[3] = 0x0000000000400000ULL;
+    g_assert_cmpint(gf2x_degree(a, MAX_N), ==, 214);
+    a[3] = 0x8000000000000000ULL;
+    g_assert_cmpint(gf2x_degree(a, MAX_N), ==, 255);
+
+    /* Limbs past n are not looked at.  */
+    g_assert_cmpint(gf2x_degree(a, 2), ==, 64);
+    g_assert_cmpint(gf2x_degree(a, 0), ==, -1);
+}
+
+/* Remainder by long division, as the RSA core's GF_MOD op does it.  */
+static void gf_mod(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n)
+{
+    uint64_t tmp[MAX_N];
+    int rb, bb;
+
+    memcpy(r, a, n * sizeof(*r));
+    bb = gf2x_degree(b, n);
+    for (rb = gf2x_degree(r, n); rb >= bb; rb = gf2x_degree(r, n)) {
+        gf2x_lshift(tmp, b, rb - bb, n);
+        gf2x_xor(r, r, tmp, n);
+    }
+}
+
+static void test_gf_mod(void)
+{
+    static const uint64_t aes_a[MAX_N] = { 0x100 };
+    static const uint64_t aes_b[MAX_N] = { 0x11b };
+    static const uint64_t aes_r[MAX_N] = { 0x1b };
+    static const uint64_t a[MAX_N] = {
+        0x2a2721debfd529d3ULL, 0x33b8813a39ff44bdULL,
+        0x6e134feff1a87271ULL, 0x00000000000000adULL,
+    };
+    static const uint64_t b[MAX_N] = {
+        0x09d802ba968dd8baULL, 0x0000000000000040ULL,
+    };
+    static const uint64_t r_ab[MAX_N] = {
+        0xbdfb271ab730c741ULL, 0x0000000000000004ULL,
+    };
+    uint64_t r[MAX_N];
+
+    /* x^8 mod the AES polynomial.  */
+    gf_mod(r, aes_a, aes_b, MAX_N);
+    check_poly(r, aes_r, MAX_N);
+
+    gf_mod(r, a, b, MAX_N);
+    check_poly(r, r_ab, MAX_N);
+
+    /* Already reduced, and reducing by itself.  */
+    gf_mod(r, r_ab, b, MAX_N);
+    check_poly(r, r_ab, MAX_N);
+    gf_mod(r, b, b, MAX_N);
+    g_assert_cmpint(gf2x_degree(r, MAX_N), ==, -1);
+}
+
+static void test_accel(void)
+{
+    /* Every carry-less multiply implementation the host supports.  */
+    do {
+        test_mulmod();
+        test_lshift_reduce();
+    } while (test_gf2x_next_accel());
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/gf2x/mulmod", test_accel);
+    g_test_add_func("/gf2x/degree", test_degree);
+    g_test_add_func("/gf2x/gf_mod", test_gf_mod);
+
+    return g_test_run();
+}
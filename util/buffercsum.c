@@ -0,0 +1,239 @@
+/*
+ * Ones' complement checksum of a buffer
+ *
+ * Copyright (c) 2018 Biamp Systems
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * The sum is taken over native endian words and byte swapped at the end,
+ * which gives the same result as summing big endian words (RFC 1071).
+ * The vector versions accumulate 16-bit words in 32-bit lanes and widen
+ * them before the lanes can overflow.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/cutils.h"
+#include "qemu/bswap.h"
+
+static uint64_t
+buffer_csum_int(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    uint64_t sum = 0;
+
+    /* A 32-bit word contributes the sum of its two halves.  */
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t w = ldq_he_p(p);
+
+        sum += (w & 0xffffffff) + (w >> 32);
+    }
+    if (len >= 4) {
+        sum += ldl_he_p(p);
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        sum += lduw_he_p(p);
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        /* An odd trailing byte is padded with zero.  */
+        uint8_t t[2] = { *p, 0 };
+
+        sum += lduw_he_p(t);
+    }
+    return sum;
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+/* Do not use push_options pragmas unnecessarily, because clang
+ * does not support them.
+ */
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+#include <emmintrin.h>
+
+static uint64_t
+buffer_csum_sse2(const void *buf, size_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const uint8_t *p = buf;
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        /* Each lane takes two words per block, 32768 blocks fit.  */
+        size_t n = MIN(len / 16, 32768);
+        __m128i acc = zero;
+        uint64_t t[2];
+
+        len -= n * 16;
+        for (; n; n--, p += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+        }
+        acc = _mm_add_epi64(_mm_unpacklo_epi32(acc, zero),
+                            _mm_unpackhi_epi32(acc, zero));
+        _mm_storeu_si128((__m128i *)t, acc);
+        sum += t[0] + t[1];
+    }
+
+    return sum + buffer_csum_int(p, len);
+}
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC pop_options
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static uint64_t
+buffer_csum_avx2(const void *buf, size_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const uint8_t *p = buf;
+    uint64_t sum = 0;
+
+    while (len >= 32) {
+        /* Each lane takes two words per block, 32768 blocks fit.  */
+        size_t n = MIN(len / 32, 32768);
+        __m256i acc = zero;
+        uint64_t t[4];
+
+        len -= n * 32;
+        for (; n; n--, p += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)p);
+
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+        }
+        acc = _mm256_add_epi64(_mm256_unpacklo_epi32(acc, zero),
+                               _mm256_unpackhi_epi32(acc, zero));
+        _mm256_storeu_si256((__m256i *)t, acc);
+        sum += t[0] + t[1] + t[2] + t[3];
+    }
+
+    return sum + buffer_csum_int(p, len);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+/* Note that for test_buffer_csum_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_AVX2    1
+#define CACHE_SSE2    2
+
+/* Make sure that these variables are appropriately initialized when
+ * SSE2 is enabled on the compiler command-line, but the compiler is
+ * too old to support CONFIG_AVX2_OPT.
+ */
+#ifdef CONFIG_AVX2_OPT
+# define INIT_CACHE 0
+# define INIT_ACCEL buffer_csum_int
+#else
+# ifndef __SSE2__
+#  error "ISA selection confusion"
+# endif
+# define INIT_CACHE CACHE_SSE2
+# define INIT_ACCEL buffer_csum_sse2
+#endif
+
+static unsigned cpuid_cache = INIT_CACHE;
+static uint64_t (*csum_accel)(const void *, size_t) = INIT_ACCEL;
+
+static void init_accel(unsigned cache)
+{
+    uint64_t (*fn)(const void *, size_t) = buffer_csum_int;
+    if (cache & CACHE_SSE2) {
+        fn = buffer_csum_sse2;
+    }
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        fn = buffer_csum_avx2;
+    }
+#endif
+    csum_accel = fn;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if (d & bit_SSE2) {
+            cache |= CACHE_SSE2;
+        }
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+bool test_buffer_csum_next_accel(void)
+{
+    /* If no bits set, we just tested buffer_csum_int, and there
+       are no more acceleration options to test.  */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+static uint64_t select_accel_fn(const void *buf, size_t len)
+{
+    if (likely(len >= 64)) {
+        return csum_accel(buf, len);
+    }
+    return buffer_csum_int(buf, len);
+}
+
+#else
+#define select_accel_fn  buffer_csum_int
+bool test_buffer_csum_next_accel(void)
+{
+    return false;
+}
+#endif
+
+/*
+ * Ones' complement sum of a buffer taken as big endian 16-bit words,
+ * folded to 16 bits but not complemented
+ */
+uint16_t buffer_csum(const void *buf, size_t len)
+{
+    uint64_t sum = select_accel_fn(buf, len);
+
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    /* Swapping the folded sum of native words gives the big endian one.  */
+    return be16_to_cpu(sum);
+}
@@ -0,0 +1,281 @@
+/*
+ * Arithmetic on polynomials over GF(2)
+ *
+ * Copyright (c) 2018 Biamp Systems
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Everything is built on gf2x_addmul_1(), a row of 64x64 carry-less
+ * multiplies, which uses PCLMULQDQ when the host has it.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/host-utils.h"
+#include "qemu/gf2x.h"
+
+static void
+addmul_1_int(uint64_t *r, const uint64_t *a, uint64_t b, size_t n)
+{
+    uint64_t tl[16], th[16];
+    uint64_t carry = 0;
+    size_t i;
+    int k;
+
+    /* b times every 4-bit polynomial, as 128-bit values.  */
+    tl[0] = th[0] = 0;
+    for (k = 1; k < 16; k++) {
+        if (k & 1) {
+            tl[k] = tl[k - 1] ^ b;
+            th[k] = th[k - 1];
+        } else {
+            tl[k] = tl[k / 2] << 1;
+            th[k] = th[k / 2] << 1 | tl[k / 2] >> 63;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        uint64_t x = a[i];
+        uint64_t lo = 0, hi = 0;
+
+        for (k = 60; k >= 0; k -= 4) {
+            hi = hi << 4 | lo >> 60;
+            lo <<= 4;
+            lo ^= tl[(x >> k) & 15];
+            hi ^= th[(x >> k) & 15];
+        }
+        r[i] ^= lo ^ carry;
+        carry = hi;
+    }
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(__PCLMUL__)
+/* Do not use push_options pragmas unnecessarily, because clang
+ * does not support them.
+ */
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("sse2,pclmul")
+#endif
+#include <wmmintrin.h>
+
+static void
+addmul_1_pclmul(uint64_t *r, const uint64_t *a, uint64_t b, size_t n)
+{
+    const __m128i vb = _mm_set_epi64x(0, b);
+    uint64_t carry = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        __m128i p = _mm_clmulepi64_si128(_mm_set_epi64x(0, a[i]), vb, 0);
+        uint64_t t[2];
+
+        _mm_storeu_si128((__m128i *)t, p);
+        r[i] ^= t[0] ^ carry;
+        carry = t[1];
+    }
+}
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC pop_options
+#endif
+
+/* Note that for test_gf2x_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_PCLMUL  1
+
+/* Make sure that these variables are appropriately initialized when
+ * PCLMUL is enabled on the compiler command-line, but the compiler is
+ * too old to support CONFIG_AVX2_OPT.
+ */
+#ifdef CONFIG_AVX2_OPT
+# define INIT_CACHE 0
+# define INIT_ACCEL addmul_1_int
+#else
+# define INIT_CACHE CACHE_PCLMUL
+# define INIT_ACCEL addmul_1_pclmul
+#endif
+
+static unsigned cpuid_cache = INIT_CACHE;
+static void (*addmul_1_accel)(uint64_t *, const uint64_t *,
+                              uint64_t, size_t) = INIT_ACCEL;
+
+static void init_accel(unsigned cache)
+{
+    void (*fn)(uint64_t *, const uint64_t *, uint64_t, size_t) = addmul_1_int;
+    if (cache & CACHE_PCLMUL) {
+        fn = addmul_1_pclmul;
+    }
+    addmul_1_accel = fn;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if ((d & bit_SSE2) && (c & bit_PCLMUL)) {
+            cache |= CACHE_PCLMUL;
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+bool test_gf2x_next_accel(void)
+{
+    /* If no bits set, we just tested addmul_1_int, and there
+       are no more acceleration options to test.  */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+#else
+#define addmul_1_accel  addmul_1_int
+bool test_gf2x_next_accel(void)
+{
+    return false;
+}
+#endif
+
+void gf2x_xor(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        r[i] = a[i] ^ b[i];
+    }
+}
+
+void gf2x_lshift(uint64_t *r, const uint64_t *a, unsigned int k, size_t n)
+{
+    size_t w = k / 64;
+    unsigned int s = k % 64;
+    size_t i;
+
+    /* Top down, so that every limb is read before it is overwritten.  */
+    for (i = n; i-- > 0;) {
+        uint64_t v = 0;
+
+        if (i >= w) {
+            v = a[i - w] << s;
+            if (s && i > w) {
+                v |= a[i - w - 1] >> (64 - s);
+            }
+        }
+        r[i] = v;
+    }
+}
+
+void gf2x_addmul_1(uint64_t *r, const uint64_t *a, uint64_t b, size_t n)
+{
+    if (b) {
+        addmul_1_accel(r, a, b, n);
+    }
+}
+
+int gf2x_degree(const uint64_t *a, size_t n)
+{
+    size_t i;
+
+    for (i = n; i-- > 0;) {
+        if (a[i]) {
+            return i * 64 + 63 - clz64(a[i]);
+        }
+    }
+    return -1;
+}
+
+/*
+ * Shift the top limb @h of the register once, and return whether the
+ * feedback was added. The lower limbs only reach the top bit after 63
+ * more shifts, so up to 63 steps can be run on @h alone.
+ */
+static inline bool reduce_step(uint64_t *h, uint64_t mh)
+{
+    *h <<= 1;
+    if (*h >> 63) {
+        *h ^= mh;
+        return true;
+    }
+    return false;
+}
+
+/* In place version of gf2x_lshift_reduce(), t must not alias m.  */
+static void lshift_reduce(uint64_t *t, const uint64_t *m,
+                          unsigned int k, size_t n)
+{
+    while (k) {
+        unsigned int c = MIN(k, 32);
+        uint64_t h = t[n - 1];
+        uint64_t q = 0;
+        unsigned int j;
+
+        /* q collects the feedback of the next c steps, t * x^c is then
+           (t << c) + m * q.  */
+        for (j = 0; j < c; j++) {
+            q = q << 1 | reduce_step(&h, m[n - 1]);
+        }
+        gf2x_lshift(t, t, c, n);
+        gf2x_addmul_1(t, m, q, n);
+        k -= c;
+    }
+}
+
+void gf2x_lshift_reduce(uint64_t *r, const uint64_t *a, const uint64_t *m,
+                        unsigned int k, size_t n)
+{
+    uint64_t *t = g_memdup(a, n * sizeof(*t));
+
+    lshift_reduce(t, m, k, n);
+    memcpy(r, t, n * sizeof(*t));
+    g_free(t);
+}
+
+void gf2x_mulmod(uint64_t *r, const uint64_t *a, const uint64_t *b,
+                 const uint64_t *m, size_t n)
+{
+    uint64_t *t = g_new0(uint64_t, n);
+    int top = gf2x_degree(a, n) / 32;
+    uint64_t qb[32];
+    uint64_t h = b[n - 1];
+    int c, j;
+
+    /* b * x^j is (b << j) + m * qb[j].  */
+    qb[0] = 0;
+    for (j = 1; j < 32; j++) {
+        qb[j] = qb[j - 1] << 1 | reduce_step(&h, m[n - 1]);
+    }
+
+    /* Horner's rule over the 32-bit digits of a, highest first.  */
+    for (c = top; c >= 0; c--) {
+        uint64_t digit = (a[c / 2] >> (32 * (c % 2))) & 0xffffffff;
+        uint64_t q = 0;
+
+        if (c != top) {
+            lshift_reduce(t, m, 32, n);
+        }
+        for (j = 0; j < 32; j++) {
+            if (digit & (1ULL << j)) {
+                q ^= qb[j];
+            }
+        }
+        gf2x_addmul_1(t, b, digit, n);
+        gf2x_addmul_1(t, m, q, n);
+    }
+
+    memcpy(r, t, n * sizeof(*t));
+    g_free(t);
+}
@@ -152,16 +152,22 @@ bool qemu_log_in_addr_range(uint64_t addr)
 
 void qemu_set_dfilter_ranges(const char *filter_spec, Error **errp)
 {
-    gchar **ranges = g_strsplit(filter_spec, ",", 0);
-    int i;
-
     if (debug_regions) {
         g_array_unref(debug_regions);
         debug_regions = NULL;
     }
 
-    debug_regions = g_array_sized_new(FALSE, FALSE,
-                                      sizeof(Range), g_strv_length(ranges));
+    debug_regions = g_array_new(FALSE, FALSE, sizeof(Range));
+    qemu_parse_addr_ranges(debug_regions, filter_spec, errp);
+}
+
+/* Append the comma separated address ranges in filter_spec to ranges.  */
+void qemu_parse_addr_ranges(GArray *ranges_out, const char *filter_spec,
+                            Error **errp)
+{
+    gchar **ranges = g_strsplit(filter_spec, ",", 0);
+    int i;
+
     for (i = 0; ranges[i]; i++) {
         const char *r = ranges[i];
         const char *range_op, *r2, *e;
@@ -216,7 +222,7 @@ void qemu_set_dfilter_ranges(const char *filter_spec, Error **errp)
             goto out;
         }
         range_set_bounds(&range, lob, upb);
-        g_array_append_val(debug_regions, range);
+        g_array_append_val(ranges_out, range);
     }
 out:
     g_strfreev(ranges);
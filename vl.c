@@ -3305,6 +3305,12 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_etrace_flags:
                 qemu_arg_etrace_flags = optarg;
                 break;
+            case QEMU_OPTION_etrace_mem_pc:
+                qemu_arg_etrace_mem_pc = optarg;
+                break;
+            case QEMU_OPTION_etrace_mem_masters:
+                qemu_arg_etrace_mem_masters = optarg;
+                break;
             case QEMU_OPTION_mempath:
                 mem_path = optarg;
                 break;
@@ -4029,6 +4035,8 @@ int main(int argc, char **argv, char **envp)
             perror(qemu_arg_etrace);
             exit(1);
         }
+        etrace_set_mem_filter(&qemu_etracer, qemu_arg_etrace_mem_pc,
+                              qemu_arg_etrace_mem_masters, &error_fatal);
         atexit(qemu_etrace_cleanup);
     }
 